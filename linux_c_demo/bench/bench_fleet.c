@@ -0,0 +1,248 @@
+// Discovery benchmark: runs onvif_discover against sim_fleet and measures
+// time to the first device, time to 95% of the fleet, completeness, CPU
+// time and peak RSS of the discoverer. Without scenario options it runs
+// the built-in suite. -L runs the loss suite instead: completeness on a
+// lossy link against the scan window, with and without Probe repeats.
+// -J prints one JSON object per scenario instead of the table, for
+// regression tracking.
+//
+// Usage: bench_fleet [-J] [-L] [-d DISCOVER] [-S SIM]
+//                    [-n DEVICES -j JITTER_MS -m MATCHES -z BYTES -l LOSS_PCT -w WINDOW_MS -p REPEAT]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+struct scenario {
+    const char *name;
+    int devices;
+    int jitter_ms;
+    int matches;                      // ProbeMatch entries per datagram
+    int size;                         // padded datagram size, 0 for natural
+    int loss_pct;
+    int window_ms;                    // scan deadline, 0 for the jitter window plus 3 s
+    int repeat;                       // Probe repeats, -1 for the discoverer's default
+    int reply_repeat;                 // reply repeats sent by the simulator
+};
+
+struct result {
+    int found;
+    double first_ms;                  // -1 if nothing was found
+    double p95_ms;                    // -1 if 95% was never reached
+    double total_ms;
+    double cpu_ms;
+    long maxrss_kb;
+};
+
+static const struct scenario suite[] = {
+    {"1k",            1000,  500, 1,    0, 0, 0, -1, 0},
+    {"5k",            5000,  500, 1,    0, 0, 0, -1, 0},
+    {"20k",          20000, 1000, 1,    0, 0, 0, -1, 0},
+    {"20k-nvr16",    20000, 1000, 16,   0, 0, 0, -1, 0},
+    {"2k-8kB",        2000,  500, 1, 8192, 0, 0, -1, 0},
+    {"2k-loss5",      2000,  500, 1,    0, 5, 0, -1, 0},
+};
+
+// 10% loss each way, devices repeating their replies once as the spec asks
+static const struct scenario loss_suite[] = {
+    {"w400-r0",       2000,  200, 1,    0, 10,  400, 0, 1},
+    {"w400-r2",       2000,  200, 1,    0, 10,  400, 2, 1},
+    {"w800-r0",       2000,  200, 1,    0, 10,  800, 0, 1},
+    {"w800-r2",       2000,  200, 1,    0, 10,  800, 2, 1},
+    {"w1600-r0",      2000,  200, 1,    0, 10, 1600, 0, 1},
+    {"w1600-r2",      2000,  200, 1,    0, 10, 1600, 2, 1},
+    {"w3200-r0",      2000,  200, 1,    0, 10, 3200, 0, 1},
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// Start the simulator and wait for its "ready" line. Returns its pid.
+static pid_t start_sim(const char *sim, const struct scenario *s) {
+    char n[16], j[16], m[16], z[16], l[16], r[16];
+    int fds[2];
+
+    snprintf(n, sizeof(n), "%d", s->devices);
+    snprintf(j, sizeof(j), "%d", s->jitter_ms);
+    snprintf(m, sizeof(m), "%d", s->matches);
+    snprintf(z, sizeof(z), "%d", s->size);
+    snprintf(l, sizeof(l), "%d", s->loss_pct);
+    snprintf(r, sizeof(r), "%d", s->reply_repeat);
+    if (pipe(fds) < 0) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(sim, sim, "-n", n, "-j", j, "-m", m, "-z", z, "-l", l, "-r", r, (char *)NULL);
+        perror(sim);
+        _exit(127);
+    }
+    close(fds[1]);
+    char line[16];
+    ssize_t got = read(fds[0], line, sizeof(line));
+    close(fds[0]);
+    if (pid < 0 || got <= 0) {
+        if (pid > 0) waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+// Run the discoverer, timestamping "[Device Found]" lines as they arrive
+static int run_discover(const char *discover, const struct scenario *s, struct result *r) {
+    char timeout[16], expect[16], repeat[16];
+    int fds[2];
+    static const char marker[] = "[Device Found]";
+    const size_t mlen = sizeof(marker) - 1;
+    int target = (s->devices * 95 + 99) / 100;
+
+    // Long enough for the whole jitter window plus headroom; -n ends it early
+    snprintf(timeout, sizeof(timeout), "%d", s->window_ms > 0 ? s->window_ms : s->jitter_ms + 3000);
+    snprintf(expect, sizeof(expect), "%d", s->devices);
+    snprintf(repeat, sizeof(repeat), "%d", s->repeat);
+    if (pipe(fds) < 0) return -1;
+
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (s->repeat >= 0) {
+            execl(discover, discover, "-i", "lo", "-t", timeout, "-n", expect, "--repeat", repeat, (char *)NULL);
+        } else {
+            execl(discover, discover, "-i", "lo", "-t", timeout, "-n", expect, (char *)NULL);
+        }
+        perror(discover);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) return -1;
+
+    // Scan the stream for the marker, keeping a tail for split matches
+    char buf[65536 + sizeof(marker)];
+    size_t keep = 0;
+    r->found = 0;
+    r->first_ms = -1;
+    r->p95_ms = -1;
+    for (;;) {
+        ssize_t n = read(fds[0], buf + keep, sizeof(buf) - keep);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        double t = now_ms() - start;
+        size_t len = keep + (size_t)n;
+        const char *p = buf;
+        while ((p = memmem(p, len - (size_t)(p - buf), marker, mlen))) {
+            r->found++;
+            if (r->found == 1) r->first_ms = t;
+            if (r->found == target) r->p95_ms = t;
+            p += mlen;
+        }
+        keep = len < mlen ? len : mlen - 1;
+        memmove(buf, buf + len - keep, keep);
+    }
+    close(fds[0]);
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) return -1;
+    r->total_ms = now_ms() - start;
+    r->cpu_ms = (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+                (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+    r->maxrss_kb = ru.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void print_result(const struct scenario *s, const struct result *r, int json) {
+    double completeness = 100.0 * r->found / s->devices;
+
+    if (json) {
+        printf("{\"scenario\":\"%s\",\"devices\":%d,\"jitter_ms\":%d,\"matches_per_packet\":%d,"
+               "\"packet_size\":%d,\"loss_pct\":%d,\"window_ms\":%d,\"repeat\":%d,\"reply_repeat\":%d,"
+               "\"found\":%d,\"completeness_pct\":%.2f,\"first_ms\":%.1f,\"p95_ms\":%.1f,\"total_ms\":%.1f,"
+               "\"cpu_ms\":%.1f,\"maxrss_kb\":%ld}\n",
+               s->name, s->devices, s->jitter_ms, s->matches, s->size, s->loss_pct, s->window_ms, s->repeat,
+               s->reply_repeat, r->found, completeness, r->first_ms, r->p95_ms, r->total_ms, r->cpu_ms,
+               r->maxrss_kb);
+    } else {
+        printf("%-12s %7d %7d %7.1f%% %9.1f %9.1f %9.1f %9.1f %9ld\n", s->name, s->devices, r->found,
+               completeness, r->first_ms, r->p95_ms, r->total_ms, r->cpu_ms, r->maxrss_kb);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *discover = "./onvif_discover";
+    const char *sim = "./bench/sim_fleet";
+    struct scenario custom = {"custom", 0, 500, 1, 0, 0, 0, -1, 0};
+    int json = 0;
+    int loss = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "JLd:S:n:j:m:z:l:w:p:")) != -1) {
+        switch (opt) {
+        case 'J': json = 1; break;
+        case 'L': loss = 1; break;
+        case 'd': discover = optarg; break;
+        case 'S': sim = optarg; break;
+        case 'n': custom.devices = atoi(optarg); break;
+        case 'j': custom.jitter_ms = atoi(optarg); break;
+        case 'm': custom.matches = atoi(optarg); break;
+        case 'z': custom.size = atoi(optarg); break;
+        case 'l': custom.loss_pct = atoi(optarg); break;
+        case 'w': custom.window_ms = atoi(optarg); break;
+        case 'p': custom.repeat = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-J] [-L] [-d DISCOVER] [-S SIM] [-n DEVICES -j JITTER_MS -m MATCHES "
+                            "-z BYTES -l LOSS_PCT -w WINDOW_MS -p REPEAT]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const struct scenario *list = suite;
+    size_t count = sizeof(suite) / sizeof(suite[0]);
+    if (loss) {
+        list = loss_suite;
+        count = sizeof(loss_suite) / sizeof(loss_suite[0]);
+    }
+    if (custom.devices > 0) {
+        list = &custom;
+        count = 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!json) {
+        printf("%-12s %7s %7s %8s %9s %9s %9s %9s %9s\n", "scenario", "devices", "found", "complete",
+               "first ms", "95% ms", "total ms", "cpu ms", "rss kB");
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct result r;
+        pid_t sim_pid = start_sim(sim, &list[i]);
+        if (sim_pid < 0) {
+            fprintf(stderr, "%s: cannot start %s\n", list[i].name, sim);
+            return 1;
+        }
+        if (run_discover(discover, &list[i], &r) < 0) failures++;
+        kill(sim_pid, SIGTERM);
+        waitpid(sim_pid, NULL, 0);
+        print_result(&list[i], &r, json);
+        if (r.found == 0) {
+            fprintf(stderr, "%s: no device found, is multicast loopback on lo working?\n", list[i].name);
+        }
+    }
+    return failures ? 1 : 0;
+}
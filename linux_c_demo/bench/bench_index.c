@@ -0,0 +1,172 @@
+// Device index benchmark: insert N distinct endpoints, then replay the
+// same matches (the repeated-reply case) and look each endpoint up.
+// Then filter the N devices by 1 to 17 scope predicates,
+// with the compiled trie and with a plain scan of every predicate.
+//
+// Usage: bench_index [-n DEVICES]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "device_index.h"
+#include "wsd_filter.h"
+
+struct sample {
+    char address[64];
+    char xaddrs[64];
+    struct sockaddr_in from;
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// What filtering looked like before the trie: every predicate against
+// every token, prefix plus segment boundary
+static int naive_match(char preds[][64], int count, struct wsd_view scopes) {
+    for (int p = 0; p < count; p++) {
+        struct wsd_view list = scopes, item;
+        size_t plen = strlen(preds[p]);
+        int found = 0;
+        while (!found && wsd_view_next_token(&list, &item)) {
+            found = item.len >= plen && memcmp(item.ptr, preds[p], plen) == 0 &&
+                    (item.len == plen || item.ptr[plen] == '/');
+        }
+        if (!found) return 0;
+    }
+    return 1;
+}
+
+// Devices carry 20 scopes, the 16 profile/ ones shared by all. The
+// predicates ask for count - 1 of those and, last, one location out of
+// ten, so nine devices in ten fail only at the final predicate.
+static void bench_filter(long n, int count) {
+    static char preds[WSD_FILTER_MAX_SCOPES][64];
+    struct wsd_filter f;
+    struct wsd_match m;
+    char scopes[1024];
+    long trie_hits = 0, naive_hits = 0;
+    double trie_ns = 0, naive_ns = 0;
+
+    wsd_filter_init(&f);
+    for (int p = 0; p < count; p++) {
+        if (p == count - 1) snprintf(preds[p], sizeof(preds[p]), "onvif://www.onvif.org/location/Site1");
+        else snprintf(preds[p], sizeof(preds[p]), "onvif://www.onvif.org/profile/p%d", p);
+        wsd_filter_add_scope(&f, preds[p]);
+    }
+
+    memset(&m, 0, sizeof(m));
+    for (long i = 0; i < n; i++) {
+        int len = snprintf(scopes, sizeof(scopes),
+                           "onvif://www.onvif.org/type/video_encoder onvif://www.onvif.org/name/Camera%ld "
+                           "onvif://www.onvif.org/hardware/IPC onvif://www.onvif.org/location/Site%ld/Floor2",
+                           i, i % 10);
+        for (int p = 0; p < 16; p++) {
+            len += snprintf(scopes + len, sizeof(scopes) - (size_t)len, " onvif://www.onvif.org/profile/p%d", p);
+        }
+        m.scopes.ptr = scopes;
+        m.scopes.len = (size_t)len;
+        double t0 = now_ns();
+        trie_hits += wsd_filter_match(&f, &m);
+        double t1 = now_ns();
+        naive_hits += naive_match(preds, count, m.scopes);
+        naive_ns += now_ns() - t1;
+        trie_ns += t1 - t0;
+    }
+    printf("scopes %2d preds    %8.1f ns/dev trie  %8.1f ns/dev scan  %ld/%ld matched\n", count,
+           trie_ns / (double)n, naive_ns / (double)n, trie_hits, naive_hits);
+    wsd_filter_free(&f);
+}
+
+static void make_match(const struct sample *s, struct wsd_match *m) {
+    static const char types[] = "dn:NetworkVideoTransmitter tds:Device";
+    static const char scopes[] = "onvif://www.onvif.org/type/video_encoder onvif://www.onvif.org/name/Camera "
+                                 "onvif://www.onvif.org/hardware/IPC onvif://www.onvif.org/location/Site";
+
+    memset(m, 0, sizeof(*m));
+    m->address.ptr = s->address;
+    m->address.len = strlen(s->address);
+    m->xaddrs.ptr = s->xaddrs;
+    m->xaddrs.len = strlen(s->xaddrs);
+    m->types.ptr = types;
+    m->types.len = sizeof(types) - 1;
+    m->scopes.ptr = scopes;
+    m->scopes.len = sizeof(scopes) - 1;
+    m->metadata_version.ptr = "1";
+    m->metadata_version.len = 1;
+}
+
+int main(int argc, char *argv[]) {
+    long n = 50000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            n = atol(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-n DEVICES]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n <= 0) {
+        fprintf(stderr, "Usage: %s [-n DEVICES]\n", argv[0]);
+        return 1;
+    }
+
+    struct sample *samples = calloc((size_t)n, sizeof(*samples));
+    if (!samples) return 1;
+    srand(1);
+    for (long i = 0; i < n; i++) {
+        struct sample *s = &samples[i];
+        snprintf(s->address, sizeof(s->address), "urn:uuid:%08x-%04x-4%03x-8%03x-%012lx",
+                 (unsigned)rand(), (unsigned)(rand() & 0xFFFF), (unsigned)(rand() & 0xFFF),
+                 (unsigned)(rand() & 0xFFF), (unsigned long)i);
+        s->from.sin_family = AF_INET;
+        s->from.sin_addr.s_addr = htonl(0x0A000000u + (uint32_t)i);
+        snprintf(s->xaddrs, sizeof(s->xaddrs), "http://%s/onvif/device_service", inet_ntoa(s->from.sin_addr));
+    }
+
+    // Start small so the timings include table growth
+    struct device_index idx;
+    if (device_index_init(&idx, 16) < 0) return 1;
+
+    struct wsd_match m;
+    long news = 0, repeats = 0, hits = 0;
+
+    double t0 = now_ns();
+    for (long i = 0; i < n; i++) {
+        make_match(&samples[i], &m);
+        news += device_index_update(&idx, &m, (struct sockaddr *)&samples[i].from, NULL) == DEVICE_NEW;
+    }
+    double t1 = now_ns();
+    for (long i = 0; i < n; i++) {
+        make_match(&samples[i], &m);
+        repeats += device_index_update(&idx, &m, (struct sockaddr *)&samples[i].from, NULL) == DEVICE_UNCHANGED;
+    }
+    double t2 = now_ns();
+    for (long i = 0; i < n; i++) {
+        hits += device_index_find(&idx, samples[i].address, strlen(samples[i].address)) != NULL;
+    }
+    double t3 = now_ns();
+
+    printf("devices            %ld\n", n);
+    printf("insert (new)       %8.1f ns/op  %ld new\n", (t1 - t0) / (double)n, news);
+    printf("update (repeat)    %8.1f ns/op  %ld unchanged\n", (t2 - t1) / (double)n, repeats);
+    printf("lookup             %8.1f ns/op  %ld hits\n", (t3 - t2) / (double)n, hits);
+    printf("slots              %zu (load %.2f)\n", idx.slot_mask + 1, (double)idx.count / (double)(idx.slot_mask + 1));
+    bench_filter(n, 1);
+    bench_filter(n, 4);
+    bench_filter(n, 17);
+
+    device_index_free(&idx);
+    free(samples);
+    return (news == n && repeats == n && hits == n) ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+// Output benchmark: report N device events to /dev/null as the text
+// lines written unbuffered (what a terminal or a line-buffered pipe
+// costs), and through the batched NDJSON and binary writers.
+//
+// Usage: bench_output [-n DEVICES]
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wsd_output.h"
+
+struct sample {
+    char key[64];
+    char xaddrs[64];
+    char addr[16];
+    char scopes[256];
+    struct device device;
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static char types[] = "dn:NetworkVideoTransmitter tds:Device";
+
+static void make_samples(struct sample *samples, long n) {
+    for (long i = 0; i < n; i++) {
+        struct sample *s = &samples[i];
+        snprintf(s->key, sizeof(s->key), "urn:uuid:%08lx-0000-4000-8000-000000000000", (unsigned long)i);
+        snprintf(s->addr, sizeof(s->addr), "10.%ld.%ld.%ld", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        snprintf(s->xaddrs, sizeof(s->xaddrs), "http://%s/onvif/device_service", s->addr);
+        snprintf(s->scopes, sizeof(s->scopes),
+                 "onvif://www.onvif.org/type/video_encoder onvif://www.onvif.org/name/Cam%ld "
+                 "onvif://www.onvif.org/location/rack%ld onvif://www.onvif.org/hardware/Sim",
+                 i, i % 16);
+        memset(&s->device, 0, sizeof(s->device));
+        s->device.key = s->key;
+        s->device.xaddrs = s->xaddrs;
+        s->device.types = types;
+        s->device.scopes = s->scopes;
+        s->device.metadata_version = 1;
+    }
+}
+
+// The text lines the CLI prints per device, scope values found by prefix
+static void print_text(FILE *out, const struct sample *s) {
+    static const char *const scope_labels[][2] = {
+        {"onvif://www.onvif.org/name/", "Name"},
+        {"onvif://www.onvif.org/location/", "Location"},
+        {"onvif://www.onvif.org/hardware/", "Hardware"},
+    };
+    struct wsd_view list = {s->scopes, strlen(s->scopes)}, item;
+
+    fprintf(out, "\n[Device Found] IP: %s\n", s->addr);
+    fprintf(out, "  Interface: eth0\n");
+    fprintf(out, "  Service URL: %s\n", s->xaddrs);
+    while (wsd_view_next_token(&list, &item)) {
+        for (int k = 0; k < 3; k++) {
+            size_t plen = strlen(scope_labels[k][0]);
+            if (item.len < plen || memcmp(item.ptr, scope_labels[k][0], plen) != 0) continue;
+            fprintf(out, "  %s: %.*s\n", scope_labels[k][1], (int)(item.len - plen), item.ptr + plen);
+            break;
+        }
+    }
+}
+
+static double run_structured(int fd, enum wsd_output_format format, const struct sample *samples, long n) {
+    struct wsd_output out;
+
+    if (wsd_output_init(&out, fd, format, WSD_OUTPUT_DEFAULT_BUFFER) < 0) return -1;
+    double t0 = now_ns();
+    for (long i = 0; i < n; i++) {
+        const char *addrs[1] = {samples[i].addr};
+        struct wsd_output_record r = {
+            .event = WSD_EVENT_FOUND,
+            .device = &samples[i].device,
+            .addrs = addrs,
+            .addr_count = 1,
+            .ifname = "eth0",
+            .rtt_ns = 1234567,
+            .ts_ms = 1700000000000 + i,
+        };
+        wsd_output_device(&out, &r);
+    }
+    wsd_output_free(&out);
+    return (now_ns() - t0) / (double)n;
+}
+
+int main(int argc, char *argv[]) {
+    long n = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "Usage: %s [-n DEVICES]\n", argv[0]);
+            return 1;
+        }
+        n = strtol(optarg, NULL, 10);
+    }
+    if (n <= 0) {
+        fprintf(stderr, "Usage: %s [-n DEVICES]\n", argv[0]);
+        return 1;
+    }
+
+    struct sample *samples = calloc((size_t)n, sizeof(*samples));
+    int fd = open("/dev/null", O_WRONLY);
+    FILE *text = fdopen(dup(fd), "w");
+    if (!samples || fd < 0 || !text) {
+        perror("bench_output");
+        return 1;
+    }
+    make_samples(samples, n);
+    setvbuf(text, NULL, _IONBF, 0);
+
+    printf("devices            %ld\n", n);
+    double t0 = now_ns();
+    for (long i = 0; i < n; i++) print_text(text, &samples[i]);
+    printf("text (unbuffered)  %8.1f ns/event\n", (now_ns() - t0) / (double)n);
+    printf("ndjson             %8.1f ns/event\n", run_structured(fd, WSD_OUTPUT_NDJSON, samples, n));
+    printf("binary             %8.1f ns/event\n", run_structured(fd, WSD_OUTPUT_BINARY, samples, n));
+
+    fclose(text);
+    close(fd);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Parser micro-benchmark: the legacy strstr-based extract_xml_tag() path
+// against the single-pass wsd_parse() on recorded ProbeMatches responses,
+// and the wsd_scan_header() pre-scan that rejects a foreign reply.
+//
+// Usage: bench_parser [-n ITERATIONS] FILE...
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wsd_parser.h"
+
+// ---- Legacy implementation, kept verbatim from onvif_discover.c ----
+
+// Simple XML tag extractor (not a full XML parser)
+// Finds content between <tag> and </tag> or <tag ...> and </tag>
+// Returns 1 if found, 0 otherwise. result buffer is filled with content.
+static int extract_xml_tag(const char *xml, const char *tag_name, char *result, size_t result_size) {
+    char start_tag[128];
+    char end_tag[128];
+    
+    // Construct simple start tag <TagName>
+    snprintf(start_tag, sizeof(start_tag), "<%s", tag_name); // Just match <TagName...
+    snprintf(end_tag, sizeof(end_tag), "</%s>", tag_name);
+
+    // Find start
+    const char *start_pos = strstr(xml, start_tag);
+    if (!start_pos) {
+        // Try searching with namespace prefix (naive approach, just search for :TagName)
+        char ns_tag[128];
+        snprintf(ns_tag, sizeof(ns_tag), ":%s", tag_name);
+        start_pos = strstr(xml, ns_tag);
+        if (start_pos) {
+             // Verify it is an opening tag
+             const char *check = start_pos;
+             while (check > xml && *check != '<' && *check != ' ') check--;
+             if (*check == '<') start_pos = check;
+             else start_pos = NULL;
+        }
+    }
+
+    if (!start_pos) return 0;
+
+    // Find the closing bracket of the start tag
+    const char *content_start = strchr(start_pos, '>');
+    if (!content_start) return 0;
+    content_start++; // Skip '>'
+
+    // Find end tag
+    // We need to be careful about matching the correct end tag if possible, 
+    // but for simple extraction we just look for </...:TagName> or </TagName>
+    const char *end_pos = strstr(content_start, end_tag);
+    if (!end_pos) {
+        // Try with namespace
+        char ns_end_tag[128];
+        snprintf(ns_end_tag, sizeof(ns_end_tag), ":%s>", tag_name);
+        end_pos = strstr(content_start, ns_end_tag);
+        // We need to make sure it is </Prefix:TagName>
+        if (end_pos) {
+            const char *check = end_pos;
+            while (check > content_start && *check != '/') check--;
+            if (check > content_start && *(check-1) == '<') end_pos = check - 1;
+            else end_pos = NULL;
+        }
+    }
+
+    if (!end_pos) return 0;
+
+    size_t len = end_pos - content_start;
+    if (len >= result_size) len = result_size - 1;
+    
+    strncpy(result, content_start, len);
+    result[len] = '\0';
+    return 1;
+}
+
+// Helper to decode HTML entities (basic)
+static void decode_html_entities(char *str) {
+    char *p = str;
+    char *w = str;
+    while (*p) {
+        if (strncmp(p, "&lt;", 4) == 0) { *w++ = '<'; p += 4; }
+        else if (strncmp(p, "&gt;", 4) == 0) { *w++ = '>'; p += 4; }
+        else if (strncmp(p, "&amp;", 5) == 0) { *w++ = '&'; p += 5; }
+        else if (strncmp(p, "&quot;", 6) == 0) { *w++ = '"'; p += 6; }
+        else if (strncmp(p, "&apos;", 6) == 0) { *w++ = '\''; p += 6; }
+        else { *w++ = *p++; }
+    }
+    *w = '\0';
+}
+
+// ---- Benchmark ----
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// What the old receive loop did per datagram: the ProbeMatch check and the
+// same five fields wsd_parse() returns, first match only
+static int legacy_packet(const char *buffer) {
+    char address[256], types[512], scopes[2048], xaddrs[1024], mdver[32];
+    int found = 0;
+
+    if (!(strstr(buffer, "ProbeMatch") || strstr(buffer, "d:ProbeMatch") || strstr(buffer, ":ProbeMatch"))) {
+        return 0;
+    }
+    found += extract_xml_tag(buffer, "Address", address, sizeof(address));
+    found += extract_xml_tag(buffer, "Types", types, sizeof(types));
+    found += extract_xml_tag(buffer, "XAddrs", xaddrs, sizeof(xaddrs));
+    found += extract_xml_tag(buffer, "MetadataVersion", mdver, sizeof(mdver));
+    if (extract_xml_tag(buffer, "Scopes", scopes, sizeof(scopes))) {
+        decode_html_entities(scopes);
+        found++;
+    }
+    return found > 0;
+}
+
+static char *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc((size_t)size + 1);
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    data[size] = '\0';
+    fclose(f);
+    *len = (size_t)size;
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 200000;
+    int opt;
+    static struct wsd_message msg;
+    struct wsd_header hdr;
+    volatile int sink = 0;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = atol(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-n ITERATIONS] FILE...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [-n ITERATIONS] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-32s %7s %10s %10s %8s %10s %14s\n", "file", "bytes", "legacy ns", "wsd ns", "speedup", "header ns",
+           "matches l/wsd");
+    for (int i = optind; i < argc; i++) {
+        size_t len;
+        char *data = load_file(argv[i], &len);
+        if (!data) return 1;
+
+        int legacy_matches = legacy_packet(data);
+        int wsd_matches = wsd_parse(data, len, &msg);
+
+        double t0 = now_ns();
+        for (long it = 0; it < iterations; it++) sink += legacy_packet(data);
+        double t1 = now_ns();
+        for (long it = 0; it < iterations; it++) sink += wsd_parse(data, len, &msg);
+        double t2 = now_ns();
+        for (long it = 0; it < iterations; it++) sink += wsd_scan_header(data, len, &hdr);
+        double t3 = now_ns();
+
+        double legacy_ns = (t1 - t0) / (double)iterations;
+        double wsd_ns = (t2 - t1) / (double)iterations;
+        double header_ns = (t3 - t2) / (double)iterations;
+        const char *base = strrchr(argv[i], '/');
+        printf("%-32s %7zu %10.1f %10.1f %7.1fx %10.1f %7d/%d\n", base ? base + 1 : argv[i], len,
+               legacy_ns, wsd_ns, legacy_ns / wsd_ns, header_ns, legacy_matches, wsd_matches);
+        free(data);
+    }
+    (void)sink;
+    return 0;
+}
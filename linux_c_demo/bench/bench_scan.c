@@ -0,0 +1,180 @@
+// Scanner benchmark: throughput of Scopes splitting, entity decoding and
+// whole-datagram parsing with the scalar, SSE2 and AVX2 kernels, against
+// the legacy strtok_r() split over a copy and decode_html_entities().
+//
+// Usage: bench_scan [-n ITERATIONS] [FILE...]
+// FILEs (e.g. bench/corpus/*.xml) are parsed with wsd_parse() per kernel.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wsd_parser.h"
+#include "wsd_scan.h"
+
+#define SCOPE_COUNT 48
+
+// Legacy entity decoder, kept verbatim from onvif_discover.c
+static void decode_html_entities(char *str) {
+    char *p = str;
+    char *w = str;
+    while (*p) {
+        if (strncmp(p, "&lt;", 4) == 0) { *w++ = '<'; p += 4; }
+        else if (strncmp(p, "&gt;", 4) == 0) { *w++ = '>'; p += 4; }
+        else if (strncmp(p, "&amp;", 5) == 0) { *w++ = '&'; p += 5; }
+        else if (strncmp(p, "&quot;", 6) == 0) { *w++ = '"'; p += 6; }
+        else if (strncmp(p, "&apos;", 6) == 0) { *w++ = '\''; p += 6; }
+        else { *w++ = *p++; }
+    }
+    *w = '\0';
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// A camera-sized Scopes list, with "&amp;" in some values if entities is set
+static size_t make_scopes(char *buf, size_t size, int entities) {
+    size_t len = 0;
+    for (int i = 0; i < SCOPE_COUNT && len < size; i++) {
+        int n = snprintf(buf + len, size - len, "%sonvif://www.onvif.org/%s/%s%d", i ? " \n  " : "",
+                         i % 4 == 0 ? "location" : i % 4 == 1 ? "name" : i % 4 == 2 ? "hardware" : "Profile",
+                         entities && i % 3 == 0 ? "Rack&amp;Row" : "Streaming_Video", i);
+        if (n < 0) break;
+        len += (size_t)n;
+    }
+    return len < size ? len : size - 1;
+}
+
+static void report(const char *what, const char *how, size_t bytes, long iterations, double ns) {
+    printf("%-22s %-22s %8.2f GB/s %10.1f ns/op\n", what, how, (double)bytes * (double)iterations / ns,
+           ns / (double)iterations);
+}
+
+static volatile size_t sink;
+
+static void bench_split(const char *scopes, size_t len, long iterations) {
+    static const enum wsd_simd levels[] = {WSD_SIMD_SCALAR, WSD_SIMD_SSE2, WSD_SIMD_AVX2};
+    char *copy = malloc(len + 1);
+    double t0 = now_ns();
+    for (long it = 0; it < iterations; it++) {
+        char *save = NULL;
+        memcpy(copy, scopes, len + 1);
+        for (char *tok = strtok_r(copy, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) sink += 1;
+    }
+    report("split Scopes", "strtok_r (legacy)", len, iterations, now_ns() - t0);
+
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if (wsd_simd_select(levels[l]) != levels[l]) continue;
+        t0 = now_ns();
+        for (long it = 0; it < iterations; it++) {
+            struct wsd_view list = {scopes, len}, tok;
+            while (wsd_view_next_token(&list, &tok)) sink += tok.len;
+        }
+        report("split Scopes", wsd_simd_name(levels[l]), len, iterations, now_ns() - t0);
+    }
+    free(copy);
+}
+
+static void bench_decode(const char *what, const char *text, size_t len, long iterations) {
+    char *copy = malloc(len + 1);
+    double t0 = now_ns();
+    for (long it = 0; it < iterations; it++) {
+        memcpy(copy, text, len + 1);
+        decode_html_entities(copy);
+        sink += (size_t)copy[0];
+    }
+    report(what, "decode_html_entities", len, iterations, now_ns() - t0);
+
+    struct wsd_view v = {text, len};
+    t0 = now_ns();
+    for (long it = 0; it < iterations; it++) sink += wsd_view_decode(v, copy, len + 1);
+    report(what, "wsd_view_decode", len, iterations, now_ns() - t0);
+    free(copy);
+}
+
+static char *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc((size_t)size + 1);
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    data[size] = '\0';
+    fclose(f);
+    *len = (size_t)size;
+    return data;
+}
+
+static int bench_parse(char **files, int count, long iterations) {
+    static const enum wsd_simd levels[] = {WSD_SIMD_SCALAR, WSD_SIMD_SSE2, WSD_SIMD_AVX2};
+    static struct wsd_message msg;
+    struct wsd_header hdr;
+
+    for (int i = 0; i < count; i++) {
+        size_t len;
+        char *data = load_file(files[i], &len);
+        if (!data) return -1;
+        const char *base = strrchr(files[i], '/');
+        base = base ? base + 1 : files[i];
+
+        for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+            if (wsd_simd_select(levels[l]) != levels[l]) continue;
+            char how[64];
+            double t0 = now_ns();
+            for (long it = 0; it < iterations; it++) sink += (size_t)wsd_parse(data, len, &msg);
+            snprintf(how, sizeof(how), "wsd_parse %s", wsd_simd_name(levels[l]));
+            report(base, how, len, iterations, now_ns() - t0);
+            t0 = now_ns();
+            for (long it = 0; it < iterations; it++) sink += (size_t)wsd_scan_header(data, len, &hdr);
+            snprintf(how, sizeof(how), "wsd_scan_header %s", wsd_simd_name(levels[l]));
+            report(base, how, len, iterations, now_ns() - t0);
+        }
+        free(data);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 200000;
+    char plain[4096], entities[4096];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "Usage: %s [-n ITERATIONS] [FILE...]\n", argv[0]);
+            return 1;
+        }
+        iterations = atol(optarg);
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "Usage: %s [-n ITERATIONS] [FILE...]\n", argv[0]);
+        return 1;
+    }
+
+    enum wsd_simd best = wsd_simd_level();
+    size_t plain_len = make_scopes(plain, sizeof(plain), 0);
+    size_t entities_len = make_scopes(entities, sizeof(entities), 1);
+    printf("kernels: %s; Scopes list of %d scopes, %zu bytes\n", wsd_simd_name(best), SCOPE_COUNT, plain_len);
+
+    bench_split(plain, plain_len, iterations);
+    bench_decode("decode, no entities", plain, plain_len, iterations);
+    bench_decode("decode, entities", entities, entities_len, iterations);
+    if (bench_parse(argv + optind, argc - optind, iterations) < 0) return 1;
+    wsd_simd_select(best);
+    return 0;
+}
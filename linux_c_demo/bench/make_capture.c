@@ -0,0 +1,310 @@
+// Deterministic WS-Discovery capture for replay benchmarks and regression
+// runs (onvif_discover -p). Writes what a client on 10.0.0.1 would see
+// after one Probe to a fleet of N devices: the Probe itself, the
+// ProbeMatches (-m per datagram, each sent -r more times with the same
+// MessageID), a Hello from every 10th device, unrelated UDP traffic, and
+// at the end a Bye from every 100th device. Every other frame carries an
+// 802.1Q tag, and datagrams over the 1500 byte MTU are IP fragmented, so
+// the reader's link layer and reassembly paths are exercised too.
+//
+// The replayed inventory should hold N - N/100 devices.
+//
+// Usage: make_capture [-n DEVICES] [-m MATCHES] [-r REPEAT] [-f pcap|pcapng|raw] [-6] [-o FILE]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define WSD_PORT 3702
+#define CLIENT_PORT 49152
+#define MTU 1500
+#define MAX_PACKET 65000
+#define FRAME_NS 10000                // capture timestamps 10 us apart
+
+enum format { PCAP, PCAPNG, RAW };
+
+static enum format format = PCAP;
+static int ipv6 = 0;
+static FILE *out;
+static uint64_t ts_ns = 1700000000ull * 1000000000;
+static uint32_t frames = 0;
+static uint32_t ip_id = 0;
+
+static void put16be(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put32le(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void write_u32(uint32_t v) {
+    unsigned char b[4];
+    put32le(b, v);
+    fwrite(b, 1, 4, out);
+}
+
+static void write_header(void) {
+    if (format == PCAP) {
+        unsigned char h[24] = {0};
+        put32le(h, 0xA1B2C3D4);
+        h[4] = 2;                     // version 2.4
+        h[6] = 4;
+        put32le(h + 16, 65535);
+        put32le(h + 20, 1);           // Ethernet
+        fwrite(h, 1, sizeof(h), out);
+    } else if (format == PCAPNG) {
+        // Section Header, then one Ethernet interface "eth0" in nanoseconds
+        static const unsigned char idb_opts[] = {2, 0, 4, 0, 'e', 't', 'h', '0', 9, 0, 1, 0, 9, 0, 0, 0, 0, 0, 0, 0};
+        write_u32(0x0A0D0D0A);
+        write_u32(28);
+        write_u32(0x1A2B3C4D);
+        write_u32(1);                 // version 1.0
+        write_u32(0xFFFFFFFF);        // section length unknown
+        write_u32(0xFFFFFFFF);
+        write_u32(28);
+        write_u32(1);
+        write_u32(20 + sizeof(idb_opts));
+        write_u32(1);                 // link type, reserved
+        write_u32(65535);
+        fwrite(idb_opts, 1, sizeof(idb_opts), out);
+        write_u32(20 + sizeof(idb_opts));
+    }
+}
+
+static void write_frame(const unsigned char *frame, size_t len) {
+    static const unsigned char zero[4];
+    uint64_t ts = ts_ns;
+
+    ts_ns += FRAME_NS;
+    if (format == PCAP) {
+        write_u32((uint32_t)(ts / 1000000000));
+        write_u32((uint32_t)(ts % 1000000000 / 1000));
+        write_u32((uint32_t)len);
+        write_u32((uint32_t)len);
+        fwrite(frame, 1, len, out);
+    } else {
+        size_t padded = (len + 3) & ~(size_t)3;
+        write_u32(6);
+        write_u32((uint32_t)(32 + padded));
+        write_u32(0);
+        write_u32((uint32_t)(ts >> 32));
+        write_u32((uint32_t)ts);
+        write_u32((uint32_t)len);
+        write_u32((uint32_t)len);
+        fwrite(frame, 1, len, out);
+        fwrite(zero, 1, padded - len, out);
+        write_u32((uint32_t)(32 + padded));
+    }
+}
+
+// Device addresses: 10.1.0.0/16 or 2001:db8::/64, the client is .1 / ::1
+static void address(unsigned char *a, uint32_t host) {
+    if (ipv6) {
+        static const unsigned char prefix[8] = {0x20, 0x01, 0x0d, 0xb8};
+        memcpy(a, prefix, 8);
+        memset(a + 8, 0, 4);
+        a[12] = (unsigned char)(host >> 24);
+        a[13] = (unsigned char)(host >> 16);
+        a[14] = (unsigned char)(host >> 8);
+        a[15] = (unsigned char)host;
+    } else {
+        a[0] = 10;
+        a[1] = (unsigned char)(1 + (host >> 16));
+        a[2] = (unsigned char)(host >> 8);
+        a[3] = (unsigned char)host;
+    }
+}
+
+// One UDP datagram as Ethernet frames, IP fragmented past the MTU
+static void write_udp(uint32_t src_host, uint32_t dst_host, unsigned sport, unsigned dport, const char *data,
+                      size_t len) {
+    static unsigned char udp[MAX_PACKET + 8];
+    static unsigned char frame[MTU + 64];
+
+    if (format == RAW) {
+        if (sport != WSD_PORT && dport != WSD_PORT) return;
+        frames++;
+        write_u32((uint32_t)len);
+        fwrite(data, 1, len, out);
+        return;
+    }
+
+    put16be(udp, sport);
+    put16be(udp + 2, dport);
+    put16be(udp + 4, (unsigned)(len + 8));
+    put16be(udp + 6, 0);
+    memcpy(udp + 8, data, len);
+    size_t total = len + 8;
+    size_t chunk = ipv6 ? (MTU - 48) & ~(size_t)7 : (MTU - 20) & ~(size_t)7;
+    int fragmented = total > (ipv6 ? MTU - 40 : MTU - 20);
+    ip_id++;
+
+    for (size_t off = 0; off < total; off += chunk) {
+        size_t n = fragmented ? (total - off < chunk ? total - off : chunk) : total;
+        int more = off + n < total;
+        size_t l2 = 14;
+
+        memset(frame, 0, 12);
+        frame[6] = 0x02;              // locally administered source MAC, nothing reads them
+        if (frames++ % 2) {
+            put16be(frame + 12, 0x8100);
+            put16be(frame + 14, 100);
+            l2 = 18;
+        }
+        put16be(frame + l2 - 2, ipv6 ? 0x86DD : 0x0800);
+
+        unsigned char *ip = frame + l2;
+        size_t hlen;
+        if (ipv6) {
+            hlen = fragmented ? 48 : 40;
+            memset(ip, 0, hlen);
+            ip[0] = 0x60;
+            put16be(ip + 4, (unsigned)(hlen - 40 + n));
+            ip[6] = fragmented ? 44 : 17;
+            ip[7] = 1;
+            address(ip + 8, src_host);
+            address(ip + 24, dst_host);
+            if (fragmented) {
+                ip[40] = 17;
+                put16be(ip + 42, (unsigned)(off | (more ? 1 : 0)));
+                put16be(ip + 44, ip_id >> 16);
+                put16be(ip + 46, ip_id & 0xFFFF);
+            }
+        } else {
+            hlen = 20;
+            memset(ip, 0, hlen);
+            ip[0] = 0x45;
+            put16be(ip + 2, (unsigned)(hlen + n));
+            put16be(ip + 4, ip_id & 0xFFFF);
+            put16be(ip + 6, (unsigned)((off / 8) | (more ? 0x2000 : 0)));
+            ip[8] = 1;
+            ip[9] = 17;
+            address(ip + 12, src_host);
+            address(ip + 16, dst_host);
+        }
+        memcpy(ip + hlen, udp + off, n);
+        write_frame(frame, l2 + hlen + n);
+        if (!fragmented) break;
+    }
+}
+
+static const char envelope_head[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\" "
+    "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+    "xmlns:wsdd=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "
+    "xmlns:tdn=\"http://www.onvif.org/ver10/network/wsdl\">"
+    "<SOAP-ENV:Header>"
+    "<wsa:MessageID>urn:uuid:0ff11e00-%04x-4000-8000-%012x</wsa:MessageID>%s"
+    "<wsa:To>%s</wsa:To>"
+    "<wsa:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/%s</wsa:Action>"
+    "</SOAP-ENV:Header><SOAP-ENV:Body>";
+
+static const char probe_id[] = "urn:uuid:0ff11e00-ffff-4000-8000-000000000000";
+
+static size_t device_entry(char *buf, const char *element, uint32_t dev) {
+    unsigned char a[16];
+    char host[64];
+
+    address(a, dev + 2);
+    if (ipv6) snprintf(host, sizeof(host), "[2001:db8::%x:%x]", (dev + 2) >> 16, (dev + 2) & 0xFFFF);
+    else snprintf(host, sizeof(host), "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+    return (size_t)sprintf(buf,
+                           "<wsdd:%s><wsa:EndpointReference><wsa:Address>urn:uuid:0ff11e00-0000-4000-8000-%012x"
+                           "</wsa:Address></wsa:EndpointReference>"
+                           "<wsdd:Types>tdn:NetworkVideoTransmitter</wsdd:Types>"
+                           "<wsdd:Scopes>onvif://www.onvif.org/type/video_encoder "
+                           "onvif://www.onvif.org/name/Cam%u onvif://www.onvif.org/hardware/CAP-1 "
+                           "onvif://www.onvif.org/location/rack%u</wsdd:Scopes>"
+                           "<wsdd:XAddrs>http://%s/onvif/device_service</wsdd:XAddrs>"
+                           "<wsdd:MetadataVersion>1</wsdd:MetadataVersion></wsdd:%s>",
+                           element, dev, dev, dev / 100, host, element);
+}
+
+int main(int argc, char *argv[]) {
+    static char buf[MAX_PACKET];
+    static const char multicast[] = "urn:schemas-xmlsoap-org:ws:2005:04:discovery";
+    static const char anonymous[] = "http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous";
+    char relates[128];
+    long devices = 10000;
+    int matches = 1;
+    int repeat = 0;
+    const char *path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:r:f:6o:")) != -1) {
+        switch (opt) {
+        case 'n': devices = strtol(optarg, NULL, 10); break;
+        case 'm': matches = atoi(optarg); break;
+        case 'r': repeat = atoi(optarg); break;
+        case '6': ipv6 = 1; break;
+        case 'o': path = optarg; break;
+        case 'f':
+            if (strcmp(optarg, "pcap") == 0) format = PCAP;
+            else if (strcmp(optarg, "pcapng") == 0) format = PCAPNG;
+            else if (strcmp(optarg, "raw") == 0) format = RAW;
+            else devices = 0;
+            break;
+        default: devices = 0; break;
+        }
+    }
+    if (devices <= 0 || devices > 0xFFFFFF || matches <= 0 || matches > 60 || repeat < 0) {
+        fprintf(stderr, "Usage: %s [-n DEVICES] [-m MATCHES] [-r REPEAT] [-f pcap|pcapng|raw] [-6] [-o FILE]\n",
+                argv[0]);
+        return 1;
+    }
+    out = path ? fopen(path, "wb") : stdout;
+    if (!out) {
+        perror(path);
+        return 1;
+    }
+    write_header();
+
+    // The client's Probe, to the multicast group
+    size_t len = (size_t)sprintf(buf, envelope_head, 0xFFFF, 0, "", multicast, "Probe");
+    len += (size_t)sprintf(buf + len, "<wsdd:Probe><wsdd:Types>tdn:NetworkVideoTransmitter</wsdd:Types></wsdd:Probe>"
+                                      "</SOAP-ENV:Body></SOAP-ENV:Envelope>");
+    write_udp(1, 0xFFFFFF, CLIENT_PORT, WSD_PORT, buf, len);
+
+    snprintf(relates, sizeof(relates), "<wsa:RelatesTo>%s</wsa:RelatesTo>", probe_id);
+    uint32_t serial = 0;
+    for (long first = 0; first < devices; first += matches) {
+        int count = devices - first < matches ? (int)(devices - first) : matches;
+
+        len = (size_t)sprintf(buf, envelope_head, 1, ++serial, relates, anonymous, "ProbeMatches");
+        len += (size_t)sprintf(buf + len, "<wsdd:ProbeMatches>");
+        for (int i = 0; i < count; i++) len += device_entry(buf + len, "ProbeMatch", (uint32_t)(first + i));
+        len += (size_t)sprintf(buf + len, "</wsdd:ProbeMatches></SOAP-ENV:Body></SOAP-ENV:Envelope>");
+        for (int k = 0; k <= repeat; k++) write_udp((uint32_t)first + 2, 1, WSD_PORT, CLIENT_PORT, buf, len);
+
+        for (int i = 0; i < count; i++) {
+            uint32_t dev = (uint32_t)(first + i);
+            if (dev % 10 != 9) continue;
+            len = (size_t)sprintf(buf, envelope_head, 2, ++serial, "", multicast, "Hello");
+            len += device_entry(buf + len, "Hello", dev);
+            len += (size_t)sprintf(buf + len, "</SOAP-ENV:Body></SOAP-ENV:Envelope>");
+            write_udp(dev + 2, 0xFFFFFF, WSD_PORT, WSD_PORT, buf, len);
+        }
+        if (serial % 8 == 0) write_udp(1, 0xFFFFFE, 5353, 5353, "mdns", 4);
+    }
+
+    for (uint32_t dev = 99; dev < devices; dev += 100) {
+        len = (size_t)sprintf(buf, envelope_head, 3, ++serial, "", multicast, "Bye");
+        len += (size_t)sprintf(buf + len,
+                               "<wsdd:Bye><wsa:EndpointReference><wsa:Address>urn:uuid:0ff11e00-0000-4000-8000-%012x"
+                               "</wsa:Address></wsa:EndpointReference></wsdd:Bye></SOAP-ENV:Body></SOAP-ENV:Envelope>",
+                               dev);
+        write_udp(dev + 2, 0xFFFFFF, WSD_PORT, WSD_PORT, buf, len);
+    }
+
+    if (out != stdout) fclose(out);
+    else fflush(out);
+    fprintf(stderr, "%ld devices, %u frames; the replayed inventory should hold %ld\n", devices, frames,
+            devices - devices / 100);
+    return 0;
+}
@@ -0,0 +1,408 @@
+// Simulated camera fleet: answers every WS-Discovery Probe on behalf of N
+// virtual devices living on consecutive loopback addresses (127.1.0.1 and
+// up, all local on Linux). Replies are spread over a random delay, can
+// carry several ProbeMatch entries per datagram, be padded to a given size
+// and be repeated like SOAP-over-UDP unicast replies (-r).
+//
+// -l drops the given share of datagrams in both directions: a device
+// misses the Probe, or its reply (each copy) gets lost. Like a real
+// device, each one answers a Probe MessageID only once, so a repeated
+// Probe reaches exactly the devices that missed the earlier copies.
+//
+// Probe Types, Scopes and MatchBy are honoured per datagram: it is sent
+// if any of its devices matches.
+//
+// -6 also joins [FF02::C]:3702 on the given interface. Probes heard there
+// are answered over IPv6 from the interface's own link-local address, so
+// the devices are dual-stack but share one IPv6 address.
+//
+// Usage: sim_fleet [-n DEVICES] [-j JITTER_MS] [-m MATCHES] [-z BYTES] [-l LOSS_PCT] [-r REPEAT] [-i IFADDR]
+//                  [-6 IFNAME]
+//
+// Prints "ready" on stdout once it listens, then runs until killed.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "wsd_parser.h"
+#include "wsd_filter.h"
+
+#define WSD_PORT 3702
+#define FIRST_DEVICE 0x7F010001u      // 127.1.0.1
+#define MAX_PACKET 65000
+#define SEND_BATCH 64
+#define MAX_PROBES 64
+#define UDP_MIN_DELAY_MS 50           // SOAP-over-UDP retransmission delays
+#define UDP_MAX_DELAY_MS 250
+#define UDP_UPPER_DELAY_MS 500
+
+struct reply {
+    int64_t due;                      // monotonic ns
+    uint32_t first;                   // first device of the datagram
+    int probe;                        // index into the probe table
+};
+
+// A Probe MessageID and which datagrams already answered it
+struct probe {
+    struct sockaddr_storage from;
+    socklen_t from_len;
+    int sock;                         // the socket it came in on, replies leave through it
+    char message_id[128];
+    unsigned serial;                  // goes into the reply MessageIDs
+    uint8_t *heard;                   // bitmap over the reply datagrams
+    struct wsd_filter filter;         // the Probe's Types and Scopes
+};
+
+static int device_count = 1000;
+static int jitter_ms = 500;
+static int matches_per_packet = 1;
+static int packet_size = 0;
+static int loss_pct = 0;
+static int reply_repeat = 0;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_reply(const void *a, const void *b) {
+    const struct reply *x = a, *y = b;
+    return (x->due > y->due) - (x->due < y->due);
+}
+
+// One ProbeMatches for devices first..first+count-1. Its MessageID only
+// depends on the Probe and the devices, so repeats carry the same one.
+static size_t build_reply(char *buf, const struct probe *probe, uint32_t first, int count) {
+    static const char head[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\" "
+        "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+        "xmlns:wsdd=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "
+        "xmlns:tdn=\"http://www.onvif.org/ver10/network/wsdl\">"
+        "<SOAP-ENV:Header>"
+        "<wsa:MessageID>urn:uuid:5ca1ab1e-%04x-4000-8000-%012x</wsa:MessageID>"
+        "<wsa:RelatesTo>%s</wsa:RelatesTo>"
+        "<wsa:To>http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous</wsa:To>"
+        "<wsa:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/ProbeMatches</wsa:Action>"
+        "</SOAP-ENV:Header><SOAP-ENV:Body><wsdd:ProbeMatches>";
+    static const char match[] =
+        "<wsdd:ProbeMatch>"
+        "<wsa:EndpointReference><wsa:Address>urn:uuid:5ca1ab1e-0000-4000-8000-%012x</wsa:Address>"
+        "</wsa:EndpointReference>"
+        "<wsdd:Types>tdn:NetworkVideoTransmitter</wsdd:Types>"
+        "<wsdd:Scopes>onvif://www.onvif.org/type/video_encoder onvif://www.onvif.org/name/SimCam%u "
+        "onvif://www.onvif.org/hardware/SIM-1 onvif://www.onvif.org/location/rack%u%s</wsdd:Scopes>"
+        "<wsdd:XAddrs>http://%s/onvif/device_service</wsdd:XAddrs>"
+        "<wsdd:MetadataVersion>1</wsdd:MetadataVersion>"
+        "</wsdd:ProbeMatch>";
+    static const char tail[] = "</wsdd:ProbeMatches></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+    static char pad[MAX_PACKET];
+    size_t len = (size_t)sprintf(buf, head, probe->serial & 0xFFFF, first, probe->message_id);
+
+    // Pad the Scopes of every match so the datagram reaches packet_size
+    size_t pad_len = 0;
+    if (packet_size > 0) {
+        size_t plain = len + sizeof(tail) + (size_t)count * 600;
+        if ((size_t)packet_size > plain) pad_len = ((size_t)packet_size - plain) / (size_t)count;
+        if (pad_len > MAX_PACKET / (size_t)count - 700) pad_len = MAX_PACKET / (size_t)count - 700;
+    }
+    memcpy(pad, " onvif://www.onvif.org/extension/", 33);
+    memset(pad + 33, 'x', pad_len > 33 ? pad_len - 33 : 0);
+    pad[pad_len > 33 ? pad_len : 0] = '\0';
+
+    for (int i = 0; i < count; i++) {
+        uint32_t dev = first + (uint32_t)i;
+        struct in_addr a;
+        a.s_addr = htonl(FIRST_DEVICE + dev);
+        len += (size_t)sprintf(buf + len, match, dev, dev, dev / 100, pad, inet_ntoa(a));
+    }
+    memcpy(buf + len, tail, sizeof(tail));
+    return len + sizeof(tail) - 1;
+}
+
+// Send every reply that is due, IPv4 ones sourced from the first device's
+// address. A batch goes out through one socket, so it ends where the
+// socket changes.
+static void send_due(struct reply *q, size_t *head, size_t len, const struct probe *probes) {
+    static char bufs[SEND_BATCH][MAX_PACKET + 1];
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iov[SEND_BATCH];
+    char control[SEND_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];
+    int64_t now = now_ns();
+
+    while (*head < len && q[*head].due <= now) {
+        int n = 0;
+        int sock = probes[q[*head].probe].sock;
+        while (*head < len && q[*head].due <= now && n < SEND_BATCH && probes[q[*head].probe].sock == sock) {
+            const struct reply *r = &q[(*head)++];
+            int count = matches_per_packet;
+            if (r->first + (uint32_t)count > (uint32_t)device_count) count = device_count - (int)r->first;
+            if (loss_pct > 0 && rand() % 100 < loss_pct) continue;
+
+            iov[n].iov_base = bufs[n];
+            iov[n].iov_len = build_reply(bufs[n], &probes[r->probe], r->first, count);
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            msgs[n].msg_hdr.msg_name = (void *)&probes[r->probe].from;
+            msgs[n].msg_hdr.msg_namelen = probes[r->probe].from_len;
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            if (probes[r->probe].from.ss_family != AF_INET) {
+                n++;
+                continue;
+            }
+            msgs[n].msg_hdr.msg_control = control[n];
+            msgs[n].msg_hdr.msg_controllen = sizeof(control[n]);
+
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&msgs[n].msg_hdr);
+            cm->cmsg_level = IPPROTO_IP;
+            cm->cmsg_type = IP_PKTINFO;
+            cm->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+            struct in_pktinfo *pi = (struct in_pktinfo *)CMSG_DATA(cm);
+            memset(pi, 0, sizeof(*pi));
+            pi->ipi_spec_dst.s_addr = htonl(FIRST_DEVICE + r->first);
+            n++;
+        }
+        for (int done = 0; done < n;) {
+            int sent = sendmmsg(sock, msgs + done, (unsigned int)(n - done), 0);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                perror("sendmmsg");
+                break;
+            }
+            done += sent;
+        }
+    }
+}
+
+static int find_probe(const struct probe *probes, struct wsd_view message_id) {
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].message_id[0] && wsd_view_eq(message_id, probes[i].message_id)) return i;
+    }
+    return -1;
+}
+
+// Return 1 if one of the devices of datagram i matches the Probe
+static int datagram_matches(const struct probe *p, size_t i) {
+    char scopes[256];
+    static const char types[] = "tdn:NetworkVideoTransmitter";
+    struct wsd_match m;
+
+    if (!wsd_filter_active(&p->filter)) return 1;
+    memset(&m, 0, sizeof(m));
+    m.types.ptr = types;
+    m.types.len = sizeof(types) - 1;
+    for (int k = 0; k < matches_per_packet; k++) {
+        uint32_t dev = (uint32_t)(i * (size_t)matches_per_packet) + (uint32_t)k;
+        if (dev >= (uint32_t)device_count) break;
+        int len = snprintf(scopes, sizeof(scopes),
+                           "onvif://www.onvif.org/type/video_encoder onvif://www.onvif.org/name/SimCam%u "
+                           "onvif://www.onvif.org/hardware/SIM-1 onvif://www.onvif.org/location/rack%u",
+                           dev, dev / 100);
+        m.scopes.ptr = scopes;
+        m.scopes.len = (size_t)len;
+        if (wsd_filter_match(&p->filter, &m)) return 1;
+    }
+    return 0;
+}
+
+// Queue the reply, and its repeats, of every datagram that has not
+// answered this Probe yet, matches it and does not miss it.
+// Returns the entries added.
+static size_t schedule(struct reply *out, struct probe *p, int slot, size_t packets) {
+    int64_t now = now_ns();
+    size_t n = 0;
+
+    for (size_t i = 0; i < packets; i++) {
+        if (p->heard[i / 8] & (1u << (i % 8))) continue;
+        if (!datagram_matches(p, i)) continue;
+        if (loss_pct > 0 && rand() % 100 < loss_pct) continue;
+        p->heard[i / 8] |= (uint8_t)(1u << (i % 8));
+
+        int64_t due = now + (jitter_ms ? (int64_t)(rand() % (jitter_ms * 1000)) * 1000 : 0);
+        int delay_ms = UDP_MIN_DELAY_MS + rand() % (UDP_MAX_DELAY_MS - UDP_MIN_DELAY_MS + 1);
+        for (int copy = 0; copy <= reply_repeat; copy++) {
+            out[n].due = due;
+            out[n].first = (uint32_t)(i * (size_t)matches_per_packet);
+            out[n].probe = slot;
+            n++;
+            due += (int64_t)delay_ms * 1000000;
+            delay_ms = delay_ms * 2 > UDP_UPPER_DELAY_MS ? UDP_UPPER_DELAY_MS : delay_ms * 2;
+        }
+    }
+    return n;
+}
+
+// IPv6 socket on the WS-Discovery port, joined to FF02::C on ifname
+static int open_socket6(const char *ifname) {
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    int on = 1;
+    struct sockaddr_in6 local;
+    struct ipv6_mreq mreq;
+
+    if (sock < 0) {
+        perror("socket(AF_INET6)");
+        return -1;
+    }
+    memset(&local, 0, sizeof(local));
+    local.sin6_family = AF_INET6;
+    local.sin6_addr = in6addr_any;
+    local.sin6_port = htons(WSD_PORT);
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind(AF_INET6)");
+        close(sock);
+        return -1;
+    }
+    inet_pton(AF_INET6, "ff02::c", &mreq.ipv6mr_multiaddr);
+    mreq.ipv6mr_interface = if_nametoindex(ifname);
+    if (mreq.ipv6mr_interface == 0 ||
+        setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
+        perror("setsockopt(IPV6_JOIN_GROUP)");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int main(int argc, char *argv[]) {
+    const char *ifaddr = "127.0.0.1";
+    const char *ifname6 = NULL;
+    unsigned ifindex6 = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:j:m:z:l:r:i:6:")) != -1) {
+        switch (opt) {
+        case 'n': device_count = atoi(optarg); break;
+        case 'j': jitter_ms = atoi(optarg); break;
+        case 'm': matches_per_packet = atoi(optarg); break;
+        case 'z': packet_size = atoi(optarg); break;
+        case 'l': loss_pct = atoi(optarg); break;
+        case 'r': reply_repeat = atoi(optarg); break;
+        case 'i': ifaddr = optarg; break;
+        case '6': ifname6 = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n DEVICES] [-j JITTER_MS] [-m MATCHES] [-z BYTES] [-l LOSS_PCT] "
+                            "[-r REPEAT] [-i IFADDR] [-6 IFNAME]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (device_count <= 0 || device_count > 65000 || matches_per_packet <= 0 || matches_per_packet > 64 ||
+        jitter_ms < 0 || loss_pct < 0 || loss_pct > 100 || reply_repeat < 0 || reply_repeat > 4) {
+        fprintf(stderr, "Invalid simulator parameters\n");
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(WSD_PORT);
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = inet_addr("239.255.255.250");
+    mreq.imr_interface.s_addr = inet_addr(ifaddr);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        perror("setsockopt(IP_ADD_MEMBERSHIP)");
+        return 1;
+    }
+    int sndbuf = 8 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf));
+
+    struct pollfd pfds[2] = {{sock, POLLIN, 0}, {-1, POLLIN, 0}};
+    if (ifname6) {
+        ifindex6 = if_nametoindex(ifname6);
+        pfds[1].fd = open_socket6(ifname6);
+        if (pfds[1].fd < 0) return 1;
+        setsockopt(pfds[1].fd, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf));
+    }
+
+    size_t packets = (size_t)((device_count + matches_per_packet - 1) / matches_per_packet);
+    size_t copies = 1 + (size_t)reply_repeat;
+    size_t cap = packets * copies * 4;
+    struct reply *queue = malloc(cap * sizeof(*queue));
+    static struct probe probes[MAX_PROBES];
+    int probe_count = 0;
+    size_t head = 0, len = 0;
+    static char buf[MAX_PACKET + 1];
+    if (!queue) return 1;
+    for (int i = 0; i < MAX_PROBES; i++) {
+        probes[i].heard = malloc(packets / 8 + 1);
+        if (!probes[i].heard) return 1;
+        probes[i].message_id[0] = '\0';
+        wsd_filter_init(&probes[i].filter);
+    }
+
+    unsigned serial = 0;
+    srand((unsigned)getpid());
+    printf("ready\n");
+    fflush(stdout);
+
+    for (;;) {
+        int timeout = -1;
+        if (head < len) {
+            int64_t wait = (queue[head].due - now_ns()) / 1000000;
+            timeout = wait > 0 ? (int)wait : 0;
+        }
+        if (poll(pfds, ifname6 ? 2 : 1, timeout) <= 0) {
+            send_due(queue, &head, len, probes);
+            continue;
+        }
+        for (int f = 0; f < 2; f++) {
+            if (!(pfds[f].revents & POLLIN)) continue;
+            struct sockaddr_storage from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = recvfrom(pfds[f].fd, buf, MAX_PACKET, 0, (struct sockaddr *)&from, &from_len);
+            struct wsd_message msg;
+            // The group membership is not per interface: in one network
+            // namespace the discoverer's own joins loop its Probes back to
+            // us on its side of the link too. Answer the copy from ours only.
+            if (from.ss_family == AF_INET6 && ((struct sockaddr_in6 *)&from)->sin6_scope_id != ifindex6) continue;
+            if (n > 0 && wsd_parse(buf, (size_t)n, &msg) >= 0 && msg.type == WSD_MSG_PROBE) {
+                // Compact the queue, then schedule the replies of every
+                // datagram that hears this Probe for the first time
+                memmove(queue, queue + head, (len - head) * sizeof(*queue));
+                len -= head;
+                head = 0;
+                int slot = find_probe(probes, msg.message_id);
+                if (slot < 0) {
+                    slot = probe_count;
+                    probe_count = (probe_count + 1) % MAX_PROBES;
+                    struct probe *p = &probes[slot];
+                    p->from = from;
+                    p->from_len = from_len;
+                    p->sock = pfds[f].fd;
+                    p->serial = serial++;
+                    wsd_view_copy(msg.message_id, p->message_id, sizeof(p->message_id));
+                    memset(p->heard, 0, packets / 8 + 1);
+                    // A Probe it cannot evaluate is answered by every device
+                    if (msg.match_count == 0 || wsd_filter_compile_probe(&p->filter, &msg.matches[0]) < 0) {
+                        wsd_filter_free(&p->filter);
+                    }
+                }
+                if (len + packets * copies <= cap) {
+                    len += schedule(queue + len, &probes[slot], slot, packets);
+                    qsort(queue, len, sizeof(*queue), cmp_reply);
+                }
+            }
+        }
+        send_due(queue, &head, len, probes);
+    }
+}
@@ -0,0 +1,242 @@
+#include "device_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#define CACHE_MAGIC 0x43564E4Fu      // "ONVC" read as a little-endian word
+
+struct cache_header {
+    uint32_t magic;                   // also catches a byte order mismatch
+    uint32_t version;
+    uint32_t record_size;             // sizeof(struct cache_record)
+    uint32_t count;
+    uint64_t strings_size;
+    int64_t saved_at;                 // wall clock, ms since the epoch
+};
+
+// Strings are offsets into the string area and NUL-terminated there
+struct cache_string {
+    uint32_t off;
+    uint32_t len;
+};
+
+struct cache_addr {
+    uint32_t family;                  // 4 or 6
+    unsigned char bytes[16];
+};
+
+struct cache_record {
+    struct cache_string key;          // EndpointReference as received
+    struct cache_string xaddrs;
+    struct cache_string types;
+    struct cache_string scopes;
+    struct cache_string info;         // raw struct device_info, len 0 if absent
+    uint32_t metadata_version;
+    uint32_t addr_count;
+    int64_t last_seen;                // wall clock, ms since the epoch
+    struct cache_addr addrs[DEVICE_MAX_ADDRS];
+};
+
+static int64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Return the string, or NULL if it points outside the string area
+static const char *cache_str(const char *strings, uint64_t size, struct cache_string s) {
+    if ((uint64_t)s.off + s.len >= size) return NULL;
+    if (strings[s.off + s.len] != '\0') return NULL;
+    return strings + s.off;
+}
+
+static int load_record(struct device_index *idx, const struct cache_record *r, const char *strings,
+                       uint64_t strings_size, int64_t last_seen) {
+    const char *key = cache_str(strings, strings_size, r->key);
+    const char *xaddrs = cache_str(strings, strings_size, r->xaddrs);
+    const char *types = cache_str(strings, strings_size, r->types);
+    const char *scopes = cache_str(strings, strings_size, r->scopes);
+    if (!key || !xaddrs || !types || !scopes || r->key.len == 0 || r->addr_count > DEVICE_MAX_ADDRS) return -1;
+    if (r->info.len && (r->info.len != sizeof(struct device_info) ||
+                        (uint64_t)r->info.off + r->info.len > strings_size)) {
+        return -1;
+    }
+
+    struct device *d = device_index_insert(idx, key, r->key.len);
+    if (!d) return -1;
+    char *x = strdup(xaddrs), *t = strdup(types), *s = strdup(scopes);
+    struct device_info *info = r->info.len ? malloc(sizeof(*info)) : NULL;
+    if (!x || !t || !s || (r->info.len && !info)) {
+        free(x);
+        free(t);
+        free(s);
+        free(info);
+        return -1;
+    }
+    free(d->xaddrs);
+    free(d->types);
+    free(d->scopes);
+    free(d->info);
+    d->xaddrs = x;
+    d->types = t;
+    d->scopes = s;
+    d->info = info;
+    if (info) memcpy(info, strings + r->info.off, sizeof(*info));
+
+    d->metadata_version = r->metadata_version;
+    d->last_seen = last_seen;
+    d->addr_count = 0;
+    for (uint32_t i = 0; i < r->addr_count; i++) {
+        if (r->addrs[i].family != 4 && r->addrs[i].family != 6) continue;
+        d->addrs[d->addr_count].family = r->addrs[i].family == 4 ? AF_INET : AF_INET6;
+        memcpy(d->addrs[d->addr_count].bytes, r->addrs[i].bytes, 16);
+        d->addrs[d->addr_count].scope_id = 0;   // interface indexes do not outlive the run
+        d->addr_count++;
+    }
+    return 0;
+}
+
+int device_cache_load(const char *path, struct device_index *idx, int64_t now_ms, int64_t max_age_ms) {
+    struct stat st;
+    int loaded = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct cache_header)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const struct cache_header *h = (const void *)map;
+    uint64_t table = (uint64_t)h->count * sizeof(struct cache_record);
+    if (h->magic != CACHE_MAGIC || h->version != DEVICE_CACHE_VERSION ||
+        h->record_size != sizeof(struct cache_record) || h->strings_size > size ||
+        sizeof(*h) + table + h->strings_size != size) {
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    const struct cache_record *records = (const void *)(map + sizeof(*h));
+    const char *strings = map + sizeof(*h) + table;
+    int64_t now_wall = wall_ms();
+    for (uint32_t i = 0; i < h->count; i++) {
+        int64_t age = now_wall - records[i].last_seen;
+        if (age < 0) age = 0;
+        if (max_age_ms > 0 && age > max_age_ms) continue;
+        if (load_record(idx, &records[i], strings, h->strings_size, now_ms - age) == 0) loaded++;
+    }
+
+    munmap((void *)map, size);
+    return loaded;
+}
+
+// Append s (and its NUL) to the string area
+static struct cache_string put_str(char *strings, uint64_t *used, const char *s) {
+    struct cache_string out;
+    size_t len = strlen(s);
+    out.off = (uint32_t)*used;
+    out.len = (uint32_t)len;
+    memcpy(strings + *used, s, len + 1);
+    *used += len + 1;
+    return out;
+}
+
+// Size, map and fill the already open file fd
+static int write_cache(int fd, const struct device_index *idx, int64_t now_ms) {
+    uint64_t strings_size = 0;
+
+    for (size_t i = 0; i < idx->count; i++) {
+        const struct device *d = &idx->records[i];
+        strings_size += strlen(d->address) + strlen(d->xaddrs) + strlen(d->types) + strlen(d->scopes) + 4;
+        if (d->info) strings_size += sizeof(*d->info);
+    }
+    if (strings_size > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    size_t size = sizeof(struct cache_header) + idx->count * sizeof(struct cache_record) + strings_size;
+
+    if (ftruncate(fd, (off_t)size) < 0) return -1;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    struct cache_header *h = (void *)map;
+    struct cache_record *records = (void *)(map + sizeof(*h));
+    char *strings = map + sizeof(*h) + idx->count * sizeof(struct cache_record);
+    int64_t now_wall = wall_ms();
+    uint64_t used = 0;
+
+    for (size_t i = 0; i < idx->count; i++) {
+        const struct device *d = &idx->records[i];
+        struct cache_record *r = &records[i];
+
+        memset(r, 0, sizeof(*r));
+        r->key = put_str(strings, &used, d->address);
+        r->xaddrs = put_str(strings, &used, d->xaddrs);
+        r->types = put_str(strings, &used, d->types);
+        r->scopes = put_str(strings, &used, d->scopes);
+        if (d->info) {
+            r->info.off = (uint32_t)used;
+            r->info.len = sizeof(*d->info);
+            memcpy(strings + used, d->info, sizeof(*d->info));
+            used += sizeof(*d->info);
+        }
+        r->metadata_version = d->metadata_version;
+        r->last_seen = now_wall - (now_ms - d->last_seen);
+        for (int k = 0; k < d->addr_count; k++) {
+            r->addrs[r->addr_count].family = d->addrs[k].family == AF_INET ? 4 : 6;
+            memcpy(r->addrs[r->addr_count].bytes, d->addrs[k].bytes, 16);
+            r->addr_count++;
+        }
+    }
+
+    h->magic = CACHE_MAGIC;
+    h->version = DEVICE_CACHE_VERSION;
+    h->record_size = sizeof(struct cache_record);
+    h->count = (uint32_t)idx->count;
+    h->strings_size = strings_size;
+    h->saved_at = now_wall;
+
+    if (munmap(map, size) < 0) return -1;
+    return fsync(fd);
+}
+
+int device_cache_save(const char *path, const struct device_index *idx, int64_t now_ms) {
+    char tmp[4096];
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    int ret = write_cache(fd, idx, now_ms);
+    int err = errno;
+    if (close(fd) < 0 && ret == 0) {
+        ret = -1;
+        err = errno;
+    }
+    if (ret == 0 && rename(tmp, path) < 0) {
+        ret = -1;
+        err = errno;
+    }
+    if (ret < 0) {
+        unlink(tmp);
+        errno = err;
+    }
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef DEVICE_CACHE_H
+#define DEVICE_CACHE_H
+
+#include <stdint.h>
+
+#include "device_index.h"
+
+// Persistent device inventory.
+// The file is a header, a table of fixed-size records and a string area,
+// in native byte order. It is read through mmap() and written to a
+// temporary file that is renamed over the old one, so readers never see
+// a half-written cache. last_seen is stored on the wall clock and mapped
+// back onto the monotonic clock when loading.
+
+#define DEVICE_CACHE_VERSION 2
+
+// Load the cache into idx, skipping devices not seen for max_age_ms.
+// Returns the number of devices loaded, 0 if the file does not exist,
+// or -1 if it cannot be read or has another format version.
+int device_cache_load(const char *path, struct device_index *idx, int64_t now_ms, int64_t max_age_ms);
+
+// Write idx to path. now_ms is the current monotonic time.
+// Returns 0 on success, -1 on error (errno is set).
+int device_cache_save(const char *path, const struct device_index *idx, int64_t now_ms);
+
+#endif
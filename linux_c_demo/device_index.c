@@ -0,0 +1,440 @@
+#include "device_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsd_filter.h"
+#include "wsd_hash.h"
+
+#ifdef _MSC_VER
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+#define KEY_MAX 256
+
+// Strip "urn:" and "uuid:" and lowercase, so "urn:uuid:ABC" and "uuid:abc"
+// name the same endpoint. Returns the key length.
+static size_t normalize_key(const char *s, size_t len, char *out) {
+    if (len >= 4 && strncasecmp(s, "urn:", 4) == 0) {
+        s += 4;
+        len -= 4;
+    }
+    if (len >= 5 && strncasecmp(s, "uuid:", 5) == 0) {
+        s += 5;
+        len -= 5;
+    }
+    if (len >= KEY_MAX) len = KEY_MAX - 1;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        out[i] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// Folded to the 32 bits a slot has room for
+static uint32_t hash_key(const char *key, size_t len) {
+    uint64_t h = wsd_hash(key, len);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+int device_index_init(struct device_index *idx, size_t expected) {
+    memset(idx, 0, sizeof(*idx));
+    size_t nslots = wsd_hash_slots(expected);
+    idx->slots = calloc(nslots, sizeof(*idx->slots));
+    if (!idx->slots) return -1;
+    idx->slot_mask = nslots - 1;
+    return 0;
+}
+
+void device_index_free(struct device_index *idx) {
+    for (size_t i = 0; i < idx->count; i++) {
+        free(idx->records[i].key);
+        free(idx->records[i].address);
+        free(idx->records[i].xaddrs);
+        free(idx->records[i].types);
+        free(idx->records[i].scopes);
+        free(idx->records[i].info);
+    }
+    free(idx->records);
+    free(idx->slots);
+    memset(idx, 0, sizeof(*idx));
+}
+
+// Find the slot holding key, or the empty slot where it would go
+static size_t probe_slot(const struct device_index *idx, const char *key, size_t len, uint32_t hash) {
+    size_t i = hash & idx->slot_mask;
+    for (;;) {
+        uint64_t slot = idx->slots[i];
+        if (slot == 0) return i;
+        if ((uint32_t)(slot >> 32) == hash) {
+            const struct device *d = &idx->records[(uint32_t)slot - 1];
+            if (strncmp(d->key, key, len) == 0 && d->key[len] == '\0') return i;
+        }
+        i = (i + 1) & idx->slot_mask;
+    }
+}
+
+static int grow_slots(struct device_index *idx) {
+    size_t nslots = (idx->slot_mask + 1) * 2;
+    uint64_t *slots = calloc(nslots, sizeof(*slots));
+    if (!slots) return -1;
+
+    for (size_t i = 0; i <= idx->slot_mask; i++) {
+        uint64_t slot = idx->slots[i];
+        if (slot == 0) continue;
+        size_t j = (uint32_t)(slot >> 32) & (nslots - 1);
+        while (slots[j]) j = (j + 1) & (nslots - 1);
+        slots[j] = slot;
+    }
+    free(idx->slots);
+    idx->slots = slots;
+    idx->slot_mask = nslots - 1;
+    return 0;
+}
+
+// Make room for one more record in the record array and the slot table.
+// *slot is updated if the table had to grow.
+static int make_room(struct device_index *idx, const char *key, size_t len, uint32_t hash, size_t *slot) {
+    if (idx->count == idx->capacity) {
+        size_t cap = idx->capacity ? idx->capacity * 2 : 64;
+        struct device *records = realloc(idx->records, cap * sizeof(*records));
+        if (!records) return -1;
+        idx->records = records;
+        idx->capacity = cap;
+    }
+    if ((idx->count + 1) * 2 > idx->slot_mask + 1) {
+        if (grow_slots(idx) < 0) return -1;
+        *slot = probe_slot(idx, key, len, hash);
+    }
+    return 0;
+}
+
+static char *view_dup_decoded(struct wsd_view v) {
+    char *s = malloc(v.len + 1);
+    if (s) wsd_view_decode(v, s, v.len + 1);
+    return s;
+}
+
+// Return 1 if the view, entity-decoded, equals s. Most lists have no
+// entities and compare in place.
+static int same_decoded(struct wsd_view v, const char *s) {
+    size_t len = strlen(s);
+
+    if (v.len == 0 || !memchr(v.ptr, '&', v.len)) return v.len == len && (len == 0 || memcmp(v.ptr, s, len) == 0);
+    char *decoded = view_dup_decoded(v);
+    int same = decoded && strcmp(decoded, s) == 0;
+    free(decoded);
+    return same;
+}
+
+static uint32_t parse_version(struct wsd_view v) {
+    uint32_t n = 0;
+    for (size_t i = 0; i < v.len && v.ptr[i] >= '0' && v.ptr[i] <= '9'; i++) {
+        n = n * 10 + (uint32_t)(v.ptr[i] - '0');
+    }
+    return n;
+}
+
+// Add the reply's sender to the device's addresses. A full set ages out
+// the address of the same family heard least recently, so a dual-stack
+// device keeps both families. Returns 1 if the set changed.
+static int merge_addr(struct device *d, const struct sockaddr *from) {
+    struct device_addr a;
+    memset(&a, 0, sizeof(a));
+
+    if (!from) return 0;
+    a.family = from->sa_family;
+    if (from->sa_family == AF_INET) {
+        memcpy(a.bytes, &((const struct sockaddr_in *)from)->sin_addr, 4);
+    } else if (from->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)from;
+        memcpy(a.bytes, &sin6->sin6_addr, 16);
+        // The same fe80:: address can exist on several links
+        if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) a.scope_id = sin6->sin6_scope_id;
+    } else {
+        return 0;
+    }
+
+    uint32_t latest = 0;
+    int stalest = -1;
+    for (int i = 0; i < d->addr_count; i++) {
+        if (d->addrs[i].heard > latest) latest = d->addrs[i].heard;
+    }
+    a.heard = latest + 1;
+    for (int i = 0; i < d->addr_count; i++) {
+        if (d->addrs[i].family == a.family && memcmp(d->addrs[i].bytes, a.bytes, 16) == 0 &&
+            d->addrs[i].scope_id == a.scope_id) {
+            d->addrs[i].heard = a.heard;
+            return 0;
+        }
+        if (d->addrs[i].family == a.family && (stalest < 0 || d->addrs[i].heard < d->addrs[stalest].heard)) {
+            stalest = i;
+        }
+    }
+    if (d->addr_count < DEVICE_MAX_ADDRS) {
+        d->addrs[d->addr_count++] = a;
+    } else {
+        d->addrs[stalest < 0 ? 0 : stalest] = a;
+    }
+    return 1;
+}
+
+// Return 1 if the space separated list contains item
+static int list_contains(const char *list, struct wsd_view item) {
+    struct wsd_view rest = { list, strlen(list) };
+    struct wsd_view tok;
+    while (wsd_view_next_token(&rest, &tok)) {
+        if (tok.len == item.len && memcmp(tok.ptr, item.ptr, item.len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Append the XAddrs we have not seen yet, dropping the oldest beyond
+// DEVICE_MAX_ADDRS. Returns 1 if any were added, -1 on allocation failure.
+static int merge_xaddrs(struct device *d, struct wsd_view xaddrs) {
+    char decoded[2048];
+    struct wsd_view rest, tok;
+    int added = 0;
+
+    rest.len = wsd_view_decode(xaddrs, decoded, sizeof(decoded));
+    rest.ptr = decoded;
+    while (wsd_view_next_token(&rest, &tok)) {
+        if (list_contains(d->xaddrs, tok)) continue;
+
+        size_t old = strlen(d->xaddrs);
+        char *grown = realloc(d->xaddrs, old + tok.len + 2);
+        if (!grown) return -1;
+        d->xaddrs = grown;
+        if (old) grown[old++] = ' ';
+        memcpy(grown + old, tok.ptr, tok.len);
+        grown[old + tok.len] = '\0';
+        added = 1;
+    }
+    if (!added) return 0;
+
+    struct wsd_view list = { d->xaddrs, strlen(d->xaddrs) };
+    int count = 0;
+    while (wsd_view_next_token(&list, &tok)) count++;
+    list.ptr = d->xaddrs;
+    list.len = strlen(d->xaddrs);
+    for (; count > DEVICE_MAX_ADDRS && wsd_view_next_token(&list, &tok); count--) {
+    }
+    if (list.ptr != d->xaddrs) {
+        while (list.len && list.ptr[0] == ' ') {
+            list.ptr++;
+            list.len--;
+        }
+        memmove(d->xaddrs, list.ptr, list.len + 1);
+    }
+    return 1;
+}
+
+int device_index_update(struct device_index *idx, const struct wsd_match *m,
+                        const struct sockaddr *from, struct device **out) {
+    char key[KEY_MAX];
+
+    // Devices without an EndpointReference are keyed by their XAddrs
+    struct wsd_view id = m->address.len ? m->address : m->xaddrs;
+    size_t len = normalize_key(id.ptr ? id.ptr : "", id.len, key);
+    uint32_t hash = hash_key(key, len);
+    size_t slot = probe_slot(idx, key, len, hash);
+    uint32_t version = parse_version(m->metadata_version);
+    struct device *d;
+
+    if (idx->slots[slot]) {
+        d = &idx->records[(uint32_t)idx->slots[slot] - 1];
+        if (out) *out = d;
+
+        // A reply older than what we have (delayed, or repeated from
+        // before an update) must not roll the record back
+        d->changes = 0;
+        if (version < d->metadata_version) return DEVICE_UNCHANGED;
+
+        // Keys compare case-insensitively; answer with the latest spelling
+        if (!same_decoded(id, d->address)) {
+            char *address = view_dup_decoded(id);
+            if (!address) return -1;
+            free(d->address);
+            d->address = address;
+        }
+
+        // Devices are supposed to bump MetadataVersion with their Types
+        // and Scopes, not all of them do
+        if (version > d->metadata_version) d->changes |= DEVICE_CHANGED_VERSION;
+        if (!same_decoded(m->types, d->types)) d->changes |= DEVICE_CHANGED_TYPES;
+        if (!same_decoded(m->scopes, d->scopes)) d->changes |= DEVICE_CHANGED_SCOPES;
+        if (d->changes) {
+            char *types = view_dup_decoded(m->types);
+            char *scopes = view_dup_decoded(m->scopes);
+            if (!types || !scopes) {
+                free(types);
+                free(scopes);
+                return -1;
+            }
+            free(d->types);
+            free(d->scopes);
+            d->types = types;
+            d->scopes = scopes;
+            d->metadata_version = version;
+        }
+
+        if (merge_addr(d, from)) d->changes |= DEVICE_CHANGED_ADDRS;
+        int xmerged = merge_xaddrs(d, m->xaddrs);
+        if (xmerged < 0) return -1;
+        if (xmerged) d->changes |= DEVICE_CHANGED_XADDRS;
+        if (d->changes & DEVICE_CHANGED_VERSION) return DEVICE_UPDATED;
+        return d->changes ? DEVICE_MERGED : DEVICE_UNCHANGED;
+    }
+
+    // New endpoint
+    if (make_room(idx, key, len, hash, &slot) < 0) return -1;
+    d = &idx->records[idx->count];
+    memset(d, 0, sizeof(*d));
+    d->key = malloc(len + 1);
+    d->address = view_dup_decoded(id);
+    d->xaddrs = calloc(1, 1);
+    d->types = view_dup_decoded(m->types);
+    d->scopes = view_dup_decoded(m->scopes);
+    if (!d->key || !d->address || !d->xaddrs || !d->types || !d->scopes || merge_xaddrs(d, m->xaddrs) < 0) {
+        free(d->key);
+        free(d->address);
+        free(d->xaddrs);
+        free(d->types);
+        free(d->scopes);
+        return -1;
+    }
+    memcpy(d->key, key, len + 1);
+    d->hash = hash;
+    d->metadata_version = version;
+    merge_addr(d, from);
+
+    idx->slots[slot] = ((uint64_t)hash << 32) | (uint32_t)(idx->count + 1);
+    idx->count++;
+    if (out) *out = d;
+    return DEVICE_NEW;
+}
+
+struct device *device_index_insert(struct device_index *idx, const char *endpoint, size_t len) {
+    char key[KEY_MAX];
+    size_t klen = normalize_key(endpoint, len, key);
+    uint32_t hash = hash_key(key, klen);
+    size_t slot = probe_slot(idx, key, klen, hash);
+
+    if (idx->slots[slot]) return &idx->records[(uint32_t)idx->slots[slot] - 1];
+    if (make_room(idx, key, klen, hash, &slot) < 0) return NULL;
+
+    struct device *d = &idx->records[idx->count];
+    memset(d, 0, sizeof(*d));
+    d->key = malloc(klen + 1);
+    d->address = strndup(endpoint, len);
+    d->xaddrs = calloc(1, 1);
+    d->types = calloc(1, 1);
+    d->scopes = calloc(1, 1);
+    if (!d->key || !d->address || !d->xaddrs || !d->types || !d->scopes) {
+        free(d->key);
+        free(d->address);
+        free(d->xaddrs);
+        free(d->types);
+        free(d->scopes);
+        return NULL;
+    }
+    memcpy(d->key, key, klen + 1);
+    d->hash = hash;
+
+    idx->slots[slot] = ((uint64_t)hash << 32) | (uint32_t)(idx->count + 1);
+    idx->count++;
+    return d;
+}
+
+struct device *device_index_find(const struct device_index *idx, const char *endpoint, size_t len) {
+    char key[KEY_MAX];
+    size_t klen = normalize_key(endpoint, len, key);
+    uint32_t hash = hash_key(key, klen);
+    size_t slot = probe_slot(idx, key, klen, hash);
+
+    if (!idx->slots[slot]) return NULL;
+    return &idx->records[(uint32_t)idx->slots[slot] - 1];
+}
+
+// Find the slot that points at record i
+static size_t slot_of_record(const struct device_index *idx, size_t i) {
+    size_t s = idx->records[i].hash & idx->slot_mask;
+    while ((uint32_t)idx->slots[s] != (uint32_t)(i + 1)) s = (s + 1) & idx->slot_mask;
+    return s;
+}
+
+void device_index_remove_at(struct device_index *idx, size_t i) {
+    size_t hole = slot_of_record(idx, i);
+    size_t last = idx->count - 1;
+
+    // Backward-shift deletion keeps every probe chain unbroken
+    idx->slots[hole] = 0;
+    for (size_t j = (hole + 1) & idx->slot_mask; idx->slots[j]; j = (j + 1) & idx->slot_mask) {
+        size_t home = (uint32_t)(idx->slots[j] >> 32) & idx->slot_mask;
+        int movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+        if (movable) {
+            idx->slots[hole] = idx->slots[j];
+            idx->slots[j] = 0;
+            hole = j;
+        }
+    }
+
+    struct device *d = &idx->records[i];
+    free(d->key);
+    free(d->address);
+    free(d->xaddrs);
+    free(d->types);
+    free(d->scopes);
+    free(d->info);
+
+    // Keep the record array dense
+    if (i != last) {
+        size_t s = slot_of_record(idx, last);
+        idx->records[i] = idx->records[last];
+        idx->slots[s] = (idx->slots[s] & 0xFFFFFFFF00000000ULL) | (uint32_t)(i + 1);
+    }
+    idx->count--;
+}
+
+int device_index_remove(struct device_index *idx, const char *endpoint, size_t len) {
+    struct device *d = device_index_find(idx, endpoint, len);
+    if (!d) return 0;
+    device_index_remove_at(idx, (size_t)(d - idx->records));
+    return 1;
+}
+
+int device_index_merge(struct device_index *idx, const struct wsd_message *msg, const struct wsd_filter *filter,
+                       const struct sockaddr *from, device_merge_cb cb, void *user) {
+    int new_devices = 0;
+
+    if (msg->type != WSD_MSG_PROBE_MATCHES && msg->type != WSD_MSG_HELLO && msg->type != WSD_MSG_BYE) return 0;
+
+    for (int i = 0; i < msg->match_count; i++) {
+        const struct wsd_match *m = &msg->matches[i];
+        struct device *d;
+
+        if (msg->type == WSD_MSG_BYE) {
+            d = device_index_find(idx, m->address.ptr, m->address.len);
+            if (d) {
+                cb(user, DEVICE_LEFT, d);
+                device_index_remove_at(idx, (size_t)(d - idx->records));
+            }
+            continue;
+        }
+
+        // Devices are free to ignore the Probe's Types and Scopes, and
+        // Hellos come unasked
+        if (filter && !wsd_filter_match(filter, m)) {
+            cb(user, DEVICE_FILTERED, NULL);
+            continue;
+        }
+
+        int change = device_index_update(idx, m, from, &d);
+        if (change == DEVICE_NEW) new_devices++;
+        cb(user, change, change < 0 ? NULL : d);
+    }
+    return new_devices;
+}
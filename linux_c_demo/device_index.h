@@ -0,0 +1,123 @@
+#ifndef DEVICE_INDEX_H
+#define DEVICE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wsd_parser.h"
+#include "wsd_socket.h"
+
+// In-memory device index keyed by the WS-Addressing EndpointReference.
+// Open addressing with linear probing over a power-of-two slot array;
+// records live in a dense array so they can be walked in arrival order.
+// Repeated replies for the same endpoint are merged into one record, so
+// callers only see a device again when it is new or its MetadataVersion
+// rose; replies with an older one are ignored. Sender addresses and XAddrs
+// are merged across replies, up to DEVICE_MAX_ADDRS each. Each update also
+// records which fields it changed, for callers that report smaller changes.
+
+#define DEVICE_MAX_ADDRS 8
+
+// A sender address, IPv4 or IPv6
+struct device_addr {
+    int family;
+    unsigned char bytes[16];
+    uint32_t scope_id;                // link-local IPv6: the interface index, else 0
+    uint32_t heard;                   // device_index_update() order, for ageing out
+};
+
+// Filled in by the optional HTTP enrichment stage (GetDeviceInformation,
+// then GetCapabilities for the service XAddrs, empty if not offered)
+struct device_info {
+    char manufacturer[64];
+    char model[64];
+    char firmware[64];
+    char serial[64];
+    char hardware_id[64];
+    char media_xaddr[128];
+    char events_xaddr[128];
+    char ptz_xaddr[128];
+    char imaging_xaddr[128];
+};
+
+struct device {
+    char *key;                        // normalized EndpointReference
+    char *address;                    // EndpointReference as the device sent it, entity-decoded
+    char *xaddrs;                     // merged XAddrs, space separated, at most DEVICE_MAX_ADDRS
+    char *types;                      // from the latest MetadataVersion
+    char *scopes;                     // entity-decoded, latest MetadataVersion
+    uint32_t metadata_version;
+    uint32_t hash;                    // hash of key, used by the index
+    int64_t last_seen;                // maintained by the caller (monotonic ms)
+    int64_t expires;                  // maintained by the caller (monotonic ms), 0 if never
+    unsigned int changes;             // DEVICE_CHANGED_* bits of the last update
+    int addr_count;
+    struct device_addr addrs[DEVICE_MAX_ADDRS];  // merged sender addresses
+    struct device_info *info;         // NULL until enriched
+};
+
+enum device_change {
+    DEVICE_UNCHANGED = 0,
+    DEVICE_NEW,                       // first time this endpoint is seen
+    DEVICE_UPDATED,                   // MetadataVersion rose
+    DEVICE_MERGED,                    // same MetadataVersion, something else changed
+    DEVICE_LEFT,                      // device_index_merge(): Bye, removed after the callback
+    DEVICE_FILTERED                   // device_index_merge(): rejected by the filter
+};
+
+// What an update changed, in device.changes
+enum device_changed {
+    DEVICE_CHANGED_VERSION = 1 << 0,  // MetadataVersion
+    DEVICE_CHANGED_TYPES = 1 << 1,
+    DEVICE_CHANGED_SCOPES = 1 << 2,
+    DEVICE_CHANGED_ADDRS = 1 << 3,    // a sender address added (or aged out for it)
+    DEVICE_CHANGED_XADDRS = 1 << 4    // an XAddr added (or aged out for it)
+};
+
+struct wsd_filter;
+
+struct device_index {
+    uint64_t *slots;                  // hash in the high 32 bits, record index + 1 below
+    size_t slot_mask;
+    struct device *records;
+    size_t count;
+    size_t capacity;
+};
+
+// Size the table for about `expected` devices (it grows as needed).
+// Returns 0 on success, -1 on allocation failure.
+int device_index_init(struct device_index *idx, size_t expected);
+void device_index_free(struct device_index *idx);
+
+// Merge one parsed match received from `from` (may be NULL).
+// Returns a device_change value, or -1 on allocation failure. *out, when
+// not NULL, points to the record; it stays valid until the next update.
+int device_index_update(struct device_index *idx, const struct wsd_match *m,
+                        const struct sockaddr *from, struct device **out);
+
+// Called by device_index_merge() for each match: change is a device_change
+// value, or -1 on allocation failure. d is NULL for DEVICE_FILTERED and -1.
+typedef void (*device_merge_cb)(void *user, int change, struct device *d);
+
+// Merge every match of a parsed ProbeMatches or Hello, skipping those that
+// fail filter (may be NULL), and drop the devices of a Bye. Other messages
+// are ignored. Returns the number of new devices.
+int device_index_merge(struct device_index *idx, const struct wsd_message *msg, const struct wsd_filter *filter,
+                       const struct sockaddr *from, device_merge_cb cb, void *user);
+
+// Find or add the record for an EndpointReference. A new record has empty
+// strings and no addresses for the caller to fill in (e.g. from a cache).
+// Returns NULL on allocation failure.
+struct device *device_index_insert(struct device_index *idx, const char *endpoint, size_t len);
+
+// Look up a device by EndpointReference. Returns NULL if unknown.
+struct device *device_index_find(const struct device_index *idx, const char *endpoint, size_t len);
+
+// Remove the record at position i of idx->records. The last record is
+// moved into its place, so walk the array backwards when removing in a loop.
+void device_index_remove_at(struct device_index *idx, size_t i);
+
+// Remove a device by EndpointReference. Returns 1 if it was known.
+int device_index_remove(struct device_index *idx, const char *endpoint, size_t len);
+
+#endif
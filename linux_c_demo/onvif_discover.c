@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,242 +10,2090 @@
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <getopt.h>
+
+#include "wsd_parser.h"
+#include "wsd_rx.h"
+#include "device_index.h"
+#include "wsd_probe.h"
+#include "wsd_sweep.h"
+#include "wsd_enrich.h"
+#include "device_cache.h"
+#include "wsd_metrics.h"
+#include "wsd_dedup.h"
+#include "wsd_correlate.h"
+#include "wsd_filter.h"
+#include "wsd_output.h"
+#include "wsd_pcap.h"
+#include "wsd_proxy.h"
+#include "wsd_pipeline.h"
+#include "wsd_monitor.h"
+#include "wsd_socket.h"
 
 #define MULTICAST_IP "239.255.255.250"
+#define MULTICAST_IP6 "ff02::c"      // link-local scope, sent per interface
 #define MULTICAST_PORT 3702
 #define RCV_TIMEOUT_SEC 5
-#define MAX_BUF_SIZE 4096
-
-// Generate a random UUID-like string
-void generate_uuid(char *buffer, size_t size) {
-    srand(time(NULL));
-    snprintf(buffer, size, "urn:uuid:%04x%04x-%04x-%04x-%04x-%04x%04x%04x",
-             rand() & 0xFFFF, rand() & 0xFFFF,
-             rand() & 0xFFFF,
-             ((rand() & 0x0FFF) | 0x4000),
-             ((rand() & 0x3FFF) | 0x8000),
-             rand() & 0xFFFF, rand() & 0xFFFF, rand() & 0xFFFF);
-}
-
-// Simple XML tag extractor (not a full XML parser)
-// Finds content between <tag> and </tag> or <tag ...> and </tag>
-// Returns 1 if found, 0 otherwise. result buffer is filled with content.
-int extract_xml_tag(const char *xml, const char *tag_name, char *result, size_t result_size) {
-    char start_tag[128];
-    char end_tag[128];
-    
-    // Construct simple start tag <TagName>
-    snprintf(start_tag, sizeof(start_tag), "<%s", tag_name); // Just match <TagName...
-    snprintf(end_tag, sizeof(end_tag), "</%s>", tag_name);
-
-    // Find start
-    const char *start_pos = strstr(xml, start_tag);
-    if (!start_pos) {
-        // Try searching with namespace prefix (naive approach, just search for :TagName)
-        char ns_tag[128];
-        snprintf(ns_tag, sizeof(ns_tag), ":%s", tag_name);
-        start_pos = strstr(xml, ns_tag);
-        if (start_pos) {
-             // Verify it is an opening tag
-             const char *check = start_pos;
-             while (check > xml && *check != '<' && *check != ' ') check--;
-             if (*check == '<') start_pos = check;
-             else start_pos = NULL;
-        }
-    }
-
-    if (!start_pos) return 0;
-
-    // Find the closing bracket of the start tag
-    const char *content_start = strchr(start_pos, '>');
-    if (!content_start) return 0;
-    content_start++; // Skip '>'
-
-    // Find end tag
-    // We need to be careful about matching the correct end tag if possible, 
-    // but for simple extraction we just look for </...:TagName> or </TagName>
-    const char *end_pos = strstr(content_start, end_tag);
-    if (!end_pos) {
-        // Try with namespace
-        char ns_end_tag[128];
-        snprintf(ns_end_tag, sizeof(ns_end_tag), ":%s>", tag_name);
-        end_pos = strstr(content_start, ns_end_tag);
-        // We need to make sure it is </Prefix:TagName>
-        if (end_pos) {
-            const char *check = end_pos;
-            while (check > content_start && *check != '/') check--;
-            if (check > content_start && *(check-1) == '<') end_pos = check - 1;
-            else end_pos = NULL;
-        }
-    }
-
-    if (!end_pos) return 0;
-
-    size_t len = end_pos - content_start;
-    if (len >= result_size) len = result_size - 1;
-    
-    strncpy(result, content_start, len);
-    result[len] = '\0';
+#define RECONCILE_MS 300000  // listen mode: reconciling Probe interval
+#define TIMER_TAG UINT32_MAX  // epoll tag of the scan timerfd
+#define LISTEN_TAG (UINT32_MAX - 1)  // epoll tag of the Hello/Bye socket
+#define LISTEN6_TAG (UINT32_MAX - 2)  // epoll tag of the IPv6 Hello/Bye socket
+#define PIPELINE_TAG (UINT32_MAX - 3)  // epoll tag of the parser workers' eventfd
+#define ENRICH_TAG_BASE 0x40000000u  // epoll tags of the enrichment connections
+#define SWEEP_RATE 2000       // unicast sweep: probes per second
+#define SWEEP_INFLIGHT 512    // unicast sweep: hosts awaiting a reply
+#define SWEEP_RETRIES 2       // unicast sweep: extra attempts per host
+#define SWEEP_WAIT_MS 500     // unicast sweep: reply wait per attempt
+#define CACHE_MAX_AGE_MS (24LL * 3600 * 1000)  // cached devices older than this are dropped
+#define METRICS_INTERVAL_MS 10000  // metrics file rewrite interval
+#define MONITOR_COALESCE_MS 500    // monitor mode: Probes due this close together go out as one
+#define MAX_BUF_SIZE 4096  // outgoing Probe
+#define MAX_INTERFACES 64
+#define MAX_REPLAY_FILES 64
+#define ADDR_TEXT_SIZE (INET6_ADDRSTRLEN + IF_NAMESIZE)  // address and "%zone"
+#define MAX_EVENTS 256     // epoll events handled per wake-up
+
+// One probe socket per outgoing interface and address family. name is
+// empty for the default-route socket bound to INADDR_ANY.
+struct probe_iface {
+    char name[IF_NAMESIZE];
+    int family;                       // AF_INET or AF_INET6
+    unsigned int index;               // interface index, the IPv6 scope ID
+    struct in_addr addr;              // IPv4: the interface address
+    struct in6_addr addr6;            // IPv6: the link-local address
+    int sock;
+    uint32_t rx_drops;  // kernel receive queue drops (SO_RXQ_OVFL)
+    int interval_ms;                  // monitor mode: Probe interval
+    int64_t next_probe;               // monitor mode: next Probe due, monotonic ms
+    int skip;                         // left out of the current Probe and its repeats
+};
+
+// Long-only options
+enum {
+    OPT_RATE = 256,
+    OPT_INFLIGHT,
+    OPT_RETRIES,
+    OPT_WAIT,
+    OPT_USER,
+    OPT_PASSWORD,
+    OPT_ENRICH_CONNS,
+    OPT_ENRICH_TIMEOUT,
+    OPT_METRICS,
+    OPT_REPEAT,
+    OPT_MATCH_BY,
+    OPT_FORMAT,
+    OPT_PROXY,
+    OPT_WORKERS,
+    OPT_MONITOR,
+    OPT_INTERVAL,
+    OPT_MAX_MISSED
+};
+
+// Set from signal handlers, checked by the event loops
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+static void on_signal(int sig) {
+    if (sig == SIGUSR1) dump_requested = 1;
+    else stop_requested = 1;
+}
+
+// State shared by the scan and listen modes
+struct discover_ctx {
+    struct probe_iface ifs[MAX_INTERFACES];
+    int if_count;
+    int use_if;                       // interfaces were picked explicitly
+    int epfd;
+    int tfd;
+    int listen_sock;                  // joined to the multicast group, or -1
+    uint32_t listen_drops;
+    int listen6_sock;                 // joined to FF02::C, or -1
+    uint32_t listen6_drops;
+    struct wsd_rx rx;
+    struct wsd_pipeline *pipeline;    // receive thread and parser workers, or NULL
+    struct device_index devices;
+    struct wsd_sweep *sweep;          // unicast sweep in progress, or NULL
+    struct wsd_enrich *enrich;        // GetDeviceInformation pool, or NULL
+    const char *cache_path;           // persistent inventory, or NULL
+    struct wsd_metrics metrics;
+    const char *metrics_path;         // metrics export, "-" for stdout, or NULL
+    int64_t metrics_due;              // next periodic export, monotonic ms
+    int64_t probe_sent_ns;            // last multicast Probe, 0 before the first
+    int probe_repeat;                 // retransmissions of each multicast Probe
+    struct wsd_repeat repeat;         // schedule of the current Probe's repeats
+    struct wsd_dedup seen_ids;        // MessageIDs of recent replies
+    struct wsd_correlator outstanding;  // MessageIDs of our Probes still taking replies
+    int probe_ttl_ms;                 // how long a Probe takes replies
+    struct wsd_filter filter;         // Types/Scopes asked for and checked on every match
+    int filter_active;
+    struct wsd_output output;         // NDJSON/binary events, buf is NULL for text
+    int replay;                       // reading captures: replies to any Probe count
+    int64_t capture_ts_ms;            // capture time of the datagram being replayed, or 0
+    struct wsd_proxy *proxy;          // Discovery Proxy answering from the index, or NULL
+    struct wsd_monitor *monitor;      // monitor mode schedule, or NULL
+    struct sockaddr_in multicast_addr;
+    struct sockaddr_in6 multicast6_addr;  // scope ID filled in per interface
+    // Each family gets its own MessageID, so a dual-stack device that drops
+    // repeated MessageIDs still answers on both
+    char probe[MAX_BUF_SIZE];
+    size_t probe_len;
+    char probe6[MAX_BUF_SIZE];
+    size_t probe6_len;                // 0 without IPv6 interfaces
+};
+
+// Print the value of a scope if it starts with prefix
+static int print_scope(struct wsd_view scope, const char *prefix, const char *label) {
+    char value[512];
+
+    if (!wsd_view_has_prefix(scope, prefix)) return 0;
+    scope.ptr += strlen(prefix);
+    scope.len -= strlen(prefix);
+    wsd_view_copy(scope, value, sizeof(value));
+    printf("  %s: %s\n", label, value);
     return 1;
 }
 
-// Helper to decode HTML entities (basic)
-void decode_html_entities(char *str) {
-    char *p = str;
-    char *w = str;
-    while (*p) {
-        if (strncmp(p, "&lt;", 4) == 0) { *w++ = '<'; p += 4; }
-        else if (strncmp(p, "&gt;", 4) == 0) { *w++ = '>'; p += 4; }
-        else if (strncmp(p, "&amp;", 5) == 0) { *w++ = '&'; p += 5; }
-        else if (strncmp(p, "&quot;", 6) == 0) { *w++ = '"'; p += 6; }
-        else if (strncmp(p, "&apos;", 6) == 0) { *w++ = '\''; p += 6; }
-        else { *w++ = *p++; }
+// Numeric address, link-local IPv6 with its "%ifname" zone
+static void format_addr(const struct device_addr *a, char *out, size_t size) {
+    char ifname[IF_NAMESIZE];
+
+    if (!inet_ntop(a->family, a->bytes, out, (socklen_t)size)) {
+        snprintf(out, size, "?");
+        return;
+    }
+    if (a->scope_id && if_indextoname(a->scope_id, ifname)) {
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%%%s", ifname);
     }
-    *w = '\0';
 }
 
-int main() {
-    int sock;
-    struct sockaddr_in multicast_addr, local_addr;
-    char buffer[MAX_BUF_SIZE];
-    char uuid[64];
-    
-    // 1. Create UDP socket
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
+// Service XAddrs from GetCapabilities, those the device offers
+static void print_services(const struct device_info *info) {
+    if (info->media_xaddr[0]) printf("  Media: %s\n", info->media_xaddr);
+    if (info->events_xaddr[0]) printf("  Events: %s\n", info->events_xaddr);
+    if (info->ptz_xaddr[0]) printf("  PTZ: %s\n", info->ptz_xaddr);
+    if (info->imaging_xaddr[0]) printf("  Imaging: %s\n", info->imaging_xaddr);
+}
+
+// Print a device record, label is "Device Found", "Device Left"...
+static void print_device(const char *label, const struct device *d, const char *ifname) {
+    struct wsd_view list, item;
+
+    printf("\n[%s] IP:", label);
+    for (int i = 0; i < d->addr_count; i++) {
+        char ip[ADDR_TEXT_SIZE];
+        format_addr(&d->addrs[i], ip, sizeof(ip));
+        printf("%s %s", i ? "," : "", ip);
+    }
+    printf("\n");
+    if (ifname && ifname[0]) {
+        printf("  Interface: %s\n", ifname);
+    }
+
+    if (d->xaddrs[0]) {
+        printf("  Service URL: %s\n", d->xaddrs);
+    }
+
+    // Walk the Scopes list in place, only the printed values are copied
+    list.ptr = d->scopes;
+    list.len = strlen(d->scopes);
+    while (wsd_view_next_token(&list, &item)) {
+        if (print_scope(item, "onvif://www.onvif.org/name/", "Name")) continue;
+        if (print_scope(item, "onvif://www.onvif.org/location/", "Location")) continue;
+        print_scope(item, "onvif://www.onvif.org/hardware/", "Hardware");
+    }
+
+    if (d->info) {
+        printf("  Manufacturer: %s\n", d->info->manufacturer);
+        printf("  Model: %s\n", d->info->model);
+        printf("  Firmware: %s\n", d->info->firmware);
+        printf("  Serial: %s\n", d->info->serial);
+        print_services(d->info);
+    }
+}
+
+// Encode a device event on the machine-readable output
+static void output_device(struct discover_ctx *ctx, enum wsd_output_event event, const struct device *d,
+                          const char *ifname, int64_t rtt_ns, const char *error) {
+    char text[DEVICE_MAX_ADDRS][ADDR_TEXT_SIZE];
+    const char *addrs[DEVICE_MAX_ADDRS];
+    struct timespec ts;
+
+    for (int i = 0; i < d->addr_count; i++) {
+        format_addr(&d->addrs[i], text[i], sizeof(text[i]));
+        addrs[i] = text[i];
+    }
+    // Replayed events carry the time they were captured
+    int64_t ts_ms = ctx->capture_ts_ms;
+    if (!ts_ms) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+    struct wsd_output_record r = {
+        .event = event,
+        .device = d,
+        .addrs = addrs,
+        .addr_count = d->addr_count,
+        .ifname = ifname,
+        .rtt_ns = rtt_ns,
+        .ts_ms = ts_ms,
+        .error = error,
+    };
+    wsd_output_device(&ctx->output, &r);
+}
+
+// Report a device event: the text lines, or a record on the
+// machine-readable output. rtt_ns < 0 when unknown.
+static void report_device(struct discover_ctx *ctx, enum wsd_output_event event, const char *label,
+                          const struct device *d, const char *ifname, int64_t rtt_ns) {
+    if (ctx->output.buf) output_device(ctx, event, d, ifname, rtt_ns, NULL);
+    else print_device(label, d, ifname);
+}
+
+// Write out what the last wakeup printed or encoded
+static void flush_output(struct discover_ctx *ctx) {
+    fflush(stdout);
+    if (ctx->output.buf) wsd_output_flush(&ctx->output);
+}
+
+// Milliseconds on the monotonic clock
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Nanoseconds on the monotonic clock, for the latency histograms
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Arm the one-shot timerfd to fire at the absolute monotonic time at_ms
+static void arm_timer(int tfd, int64_t at_ms) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = at_ms / 1000;
+    its.it_value.tv_nsec = (at_ms % 1000) * 1000000;
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) perror("timerfd_settime");
+}
+
+// Return 1 if a RelatesTo answers one of our Probes, multicast or sweep
+static int is_ours(const struct discover_ctx *ctx, struct wsd_view relates_to, int64_t now_ms) {
+    // A capture holds other clients' Probes, or none at all
+    if (ctx->replay) return 1;
+    if (wsd_correlator_match(&ctx->outstanding, relates_to.ptr, relates_to.len, now_ms)) return 1;
+    return ctx->sweep && wsd_sweep_owns(ctx->sweep, relates_to);
+}
+
+// The header alone rejects the chatter: other clients' Probes, replies
+// to Probes we did not send, and repeats of messages already handled.
+// Returns 1 if the message is worth parsing.
+static int wanted(struct discover_ctx *ctx, const struct wsd_header *hdr, int64_t now_ms) {
+    if (wsd_view_has_suffix(hdr->action, "/Probe") || wsd_view_has_suffix(hdr->action, "/Resolve")) {
+        ctx->metrics.ignored++;
+        return 0;
+    }
+    if (hdr->relates_to.len > 0 && !is_ours(ctx, hdr->relates_to, now_ms)) {
+        ctx->metrics.uncorrelated++;
+        return 0;
+    }
+    if (hdr->message_id.len > 0 && wsd_dedup_check(&ctx->seen_ids, hdr->message_id.ptr, hdr->message_id.len)) {
+        ctx->metrics.repeats++;
+        return 0;
+    }
+    return 1;
+}
+
+// Monitor mode: the Probe interval of the interface a reply came in on.
+// Hellos arrive on the listen socket and get the default.
+static int iface_interval(const struct discover_ctx *ctx, const char *ifname) {
+    for (int i = 0; ifname && ifname[0] && i < ctx->if_count; i++) {
+        if (strcmp(ctx->ifs[i].name, ifname) == 0) return ctx->ifs[i].interval_ms;
+    }
+    return ctx->monitor->interval_ms;
+}
+
+// The datagram being merged, for on_merge()
+struct merge_state {
+    struct discover_ctx *ctx;
+    const struct wsd_message *msg;
+    const char *ifname;
+    int64_t now_ns;                   // when the datagram arrived
+};
+
+// Enrichment result: attach it to the device, which may have left meanwhile
+static void on_device_info(void *user, const char *key, const struct device_info *info, const char *error) {
+    struct discover_ctx *ctx = user;
+    struct device *d = device_index_find(&ctx->devices, key, strlen(key));
+    char ip[ADDR_TEXT_SIZE] = "?";
+
+    if (!d) return;
+    if (ctx->output.buf) {
+        if (info) {
+            if (!d->info) d->info = malloc(sizeof(*d->info));
+            if (d->info) *d->info = *info;
+        }
+        output_device(ctx, WSD_EVENT_INFO, d, NULL, -1, info ? NULL : error);
+        return;
+    }
+    if (d->addr_count > 0) format_addr(&d->addrs[0], ip, sizeof(ip));
+    if (!info) {
+        printf("\n[Device Info] IP: %s\n  Error: %s\n", ip, error);
+        return;
+    }
+
+    if (!d->info) d->info = malloc(sizeof(*d->info));
+    if (!d->info) return;
+    *d->info = *info;
+    printf("\n[Device Info] IP: %s\n", ip);
+    printf("  Manufacturer: %s\n", info->manufacturer);
+    printf("  Model: %s\n", info->model);
+    printf("  Firmware: %s\n", info->firmware);
+    printf("  Serial: %s\n", info->serial);
+    if (info->hardware_id[0]) printf("  Hardware ID: %s\n", info->hardware_id);
+    print_services(info);
+}
+
+// Print a device that is new, changed its MetadataVersion or left, and
+// keep the metrics, enrichment and monitor deadlines up to date
+static void on_merge(void *user, int change, struct device *d) {
+    struct merge_state *st = user;
+    struct discover_ctx *ctx = st->ctx;
+
+    if (change == DEVICE_LEFT) {
+        report_device(ctx, WSD_EVENT_LEFT, "Device Left", d, NULL, -1);
+        ctx->metrics.devices_left++;
+        return;
+    }
+    if (change == DEVICE_FILTERED) {
+        ctx->metrics.filtered++;
+        return;
+    }
+    if (change < 0) {
+        fprintf(stderr, "Out of memory for the device index\n");
+        return;
+    }
+
+    // The first reply of a device to the current multicast Probe gives its RTT
+    int64_t prev_seen = d->last_seen;
+    int64_t rtt_ns = -1;
+    d->last_seen = st->now_ns / 1000000;
+    if (st->msg->type == WSD_MSG_PROBE_MATCHES && !ctx->sweep && ctx->probe_sent_ns &&
+        (change == DEVICE_NEW || prev_seen < ctx->probe_sent_ns / 1000000)) {
+        rtt_ns = st->now_ns - ctx->probe_sent_ns;
+        wsd_histogram_observe(&ctx->metrics.probe_rtt, (uint64_t)rtt_ns);
+    }
+    if (change == DEVICE_UNCHANGED) ctx->metrics.duplicates++;
+    int enrich = WSD_ENRICH_NO_XADDR;
+    if (ctx->enrich && (change == DEVICE_NEW || change == DEVICE_UPDATED)) {
+        enrich = wsd_enrich_submit(ctx->enrich, d->key, d->xaddrs, d->last_seen);
+    }
+    if (change == DEVICE_NEW) {
+        report_device(ctx, WSD_EVENT_FOUND, "Device Found", d, st->ifname, rtt_ns);
+        ctx->metrics.devices_found++;
+    } else if (change == DEVICE_UPDATED) {
+        report_device(ctx, WSD_EVENT_UPDATED, "Device Updated", d, st->ifname, rtt_ns);
+        ctx->metrics.devices_updated++;
+    } else if (change == DEVICE_MERGED && ctx->monitor) {
+        // Smaller changes are news only to a monitor
+        if (d->changes & (DEVICE_CHANGED_TYPES | DEVICE_CHANGED_SCOPES)) {
+            report_device(ctx, WSD_EVENT_SCOPES, "Device Scopes Changed", d, st->ifname, rtt_ns);
+            ctx->metrics.scope_changes++;
+        }
+        if (d->changes & (DEVICE_CHANGED_ADDRS | DEVICE_CHANGED_XADDRS)) {
+            report_device(ctx, WSD_EVENT_ADDRESS, "Device Address Changed", d, st->ifname, rtt_ns);
+            ctx->metrics.address_changes++;
+        }
+    }
+    // Enrichment speaks IPv4 only; say so rather than leave the device bare
+    if (enrich == WSD_ENRICH_IPV6_ONLY) on_device_info(ctx, d->key, NULL, "not enriched: IPv6 XAddrs only");
+    if (ctx->monitor) {
+        d->expires = d->last_seen + (int64_t)ctx->monitor->max_missed * iface_interval(ctx, st->ifname);
+    }
+}
+
+// Merge a parsed ProbeMatches, Hello or Bye into the device index, the
+// same way the library does. now_ns is when the datagram arrived.
+// Returns the number of new devices.
+static int merge_message(struct discover_ctx *ctx, const struct wsd_message *msg, int parsed,
+                         const struct sockaddr *from, const char *ifname, int64_t now_ns) {
+    struct merge_state st = {ctx, msg, ifname, now_ns};
+
+    // Truncated datagrams still report the matches that were complete
+    if (parsed < 0) ctx->metrics.parse_errors++;
+    if (msg->type != WSD_MSG_PROBE_MATCHES && msg->type != WSD_MSG_HELLO && msg->type != WSD_MSG_BYE) {
+        if (parsed >= 0) ctx->metrics.ignored++;
+        return 0;
+    }
+    if (ctx->sweep && msg->type == WSD_MSG_PROBE_MATCHES) wsd_sweep_on_reply(ctx->sweep, msg->relates_to);
+    return device_index_merge(&ctx->devices, msg, ctx->filter_active ? &ctx->filter : NULL, from, on_merge, &st);
+}
+
+// Check, parse and merge one datagram on the event loop.
+// Returns the number of new devices.
+static int handle_response(struct discover_ctx *ctx, const char *buffer, size_t len,
+                           const struct sockaddr *from, const char *ifname) {
+    struct wsd_message msg;
+    struct wsd_header hdr;
+
+    int64_t parse_start = monotonic_ns();
+    if (wsd_scan_header(buffer, len, &hdr) == 0 && !wanted(ctx, &hdr, parse_start / 1000000)) return 0;
+
+    int parsed = wsd_parse(buffer, len, &msg);
+    int64_t now_ns = monotonic_ns();
+    wsd_histogram_observe(&ctx->metrics.parse_time, (uint64_t)(now_ns - parse_start));
+    return merge_message(ctx, &msg, parsed, from, ifname, now_ns);
+}
+
+// The library's probe socket, bound to the interface address when
+// interfaces were picked and to INADDR_ANY on the default route otherwise.
+// Returns the socket or -1 on error.
+static int open_probe_socket(const struct discover_ctx *ctx, const struct probe_iface *pif) {
+    int sock = wsd_socket_open_udp4(ctx->use_if ? &pif->addr : NULL);
+    if (sock < 0) perror("probe socket");
+    return sock;
+}
+
+// IPv6 counterpart of open_probe_socket(): an ephemeral port, multicast
+// leaving through interface index. Returns the socket or -1 on error.
+static int open_probe_socket6(unsigned int index) {
+    struct sockaddr_in6 local_addr;
+    int on = 1;
+
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
     if (sock < 0) {
-        perror("socket");
-        return 1;
+        perror("socket(AF_INET6)");
+        return -1;
     }
 
-    // 2. Set reuse address
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin6_family = AF_INET6;
+    local_addr.sin6_addr = in6addr_any;
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) < 0 ||
+        bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        perror("bind(AF_INET6)");
+        close(sock);
+        return -1;
+    }
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index)) < 0) {
+        perror("setsockopt(IPV6_MULTICAST_IF)");
+        close(sock);
+        return -1;
+    }
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl(O_NONBLOCK)");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Return 1 if name is in the list of interfaces given on the command line
+static int name_in_list(const char *name, char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Fill ifs with the interfaces of the given family to probe, one entry per
+// interface name (for IPv6, the ones with a link-local address).
+// With an explicit list only those interfaces are used (loopback allowed),
+// otherwise every multicast-capable, non-loopback interface that is up.
+// Returns the number of entries, or -1 on error.
+static int enumerate_interfaces(struct probe_iface *ifs, int max, char **only, int only_count, int family) {
+    struct ifaddrs *ifap, *ifa;
+    int count = 0;
+
+    if (getifaddrs(&ifap) < 0) {
+        perror("getifaddrs");
+        return -1;
+    }
+
+    for (ifa = ifap; ifa && count < max; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family) continue;
+        if (!(ifa->ifa_flags & IFF_UP)) continue;
+        // FF02::C is link-local: it goes out of, and is answered to, the link-local address
+        if (family == AF_INET6 &&
+            !IN6_IS_ADDR_LINKLOCAL(&((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr)) {
+            continue;
+        }
+
+        if (only_count > 0) {
+            if (!name_in_list(ifa->ifa_name, only, only_count)) continue;
+        } else if ((ifa->ifa_flags & IFF_LOOPBACK) || !(ifa->ifa_flags & IFF_MULTICAST)) {
+            continue;
+        }
+
+        // Keep the first address of each interface
+        int seen = 0;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(ifs[i].name, ifa->ifa_name) == 0) seen = 1;
+        }
+        if (seen) continue;
+
+        memset(&ifs[count], 0, sizeof(ifs[count]));
+        snprintf(ifs[count].name, sizeof(ifs[count].name), "%s", ifa->ifa_name);
+        ifs[count].family = family;
+        ifs[count].index = if_nametoindex(ifa->ifa_name);
+        if (family == AF_INET) ifs[count].addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+        else ifs[count].addr6 = ((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+        ifs[count].sock = -1;
+        count++;
+    }
+
+    freeifaddrs(ifap);
+    return count;
+}
+
+// Open the socket that receives Hello/Bye: bound to the WS-Discovery port
+// and joined to the multicast group on every selected interface.
+// Returns the socket or -1 on error.
+static int open_listen_socket(const struct discover_ctx *ctx) {
+    struct sockaddr_in local_addr;
     int reuse = 1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // Other WS-Discovery listeners on this host may hold the port too
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse)) < 0) {
         perror("setsockopt(SO_REUSEADDR)");
         close(sock);
-        return 1;
+        return -1;
     }
 
-    // 3. Bind to local port (optional, but good for receiving responses)
-    // We bind to ANY and let OS pick a port, or we can bind to 0
     memset(&local_addr, 0, sizeof(local_addr));
     local_addr.sin_family = AF_INET;
     local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    local_addr.sin_port = htons(0); // Random port
-
+    local_addr.sin_port = htons(MULTICAST_PORT);
     if (bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
         perror("bind");
         close(sock);
-        return 1;
+        return -1;
+    }
+
+    int joined = 0;
+    for (int i = 0; i < ctx->if_count; i++) {
+        struct ip_mreq mreq;
+        if (ctx->ifs[i].family != AF_INET) continue;
+        mreq.imr_multiaddr.s_addr = inet_addr(MULTICAST_IP);
+        mreq.imr_interface = ctx->ifs[i].addr;
+        if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            perror("setsockopt(IP_ADD_MEMBERSHIP)");
+            continue;
+        }
+        joined++;
+    }
+    if (joined == 0) {
+        close(sock);
+        return -1;
+    }
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl(O_NONBLOCK)");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Same for IPv6: port 3702, joined to FF02::C on every IPv6 interface
+static int open_listen_socket6(const struct discover_ctx *ctx) {
+    struct sockaddr_in6 local_addr;
+    int on = 1;
+
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket(AF_INET6)");
+        return -1;
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) < 0) {
+        perror("setsockopt(AF_INET6)");
+        close(sock);
+        return -1;
+    }
+
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin6_family = AF_INET6;
+    local_addr.sin6_addr = in6addr_any;
+    local_addr.sin6_port = htons(MULTICAST_PORT);
+    if (bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        perror("bind(AF_INET6)");
+        close(sock);
+        return -1;
+    }
+
+    int joined = 0;
+    for (int i = 0; i < ctx->if_count; i++) {
+        struct ipv6_mreq mreq;
+        if (ctx->ifs[i].family != AF_INET6) continue;
+        mreq.ipv6mr_multiaddr = ctx->multicast6_addr.sin6_addr;
+        mreq.ipv6mr_interface = ctx->ifs[i].index;
+        if (setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
+            perror("setsockopt(IPV6_JOIN_GROUP)");
+            continue;
+        }
+        joined++;
+    }
+    if (joined == 0) {
+        close(sock);
+        return -1;
     }
 
-    // 4. Set Receive Timeout
-    struct timeval tv;
-    tv.tv_sec = 1; // 1 second timeout for select loop
-    tv.tv_usec = 0;
-    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        perror("setsockopt(SO_RCVTIMEO)");
-    }
-
-    // 5. Prepare Multicast Address
-    memset(&multicast_addr, 0, sizeof(multicast_addr));
-    multicast_addr.sin_family = AF_INET;
-    multicast_addr.sin_addr.s_addr = inet_addr(MULTICAST_IP);
-    multicast_addr.sin_port = htons(MULTICAST_PORT);
-
-    // 6. Build Probe Message
-    generate_uuid(uuid, sizeof(uuid));
-    const char *probe_template = 
-        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
-        "<e:Envelope xmlns:e=\"http://www.w3.org/2003/05/soap-envelope\" "
-        "xmlns:w=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
-        "xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "
-        "xmlns:dn=\"http://www.onvif.org/ver10/network/wsdl\">"
-        "<e:Header>"
-        "<w:MessageID>%s</w:MessageID>"
-        "<w:To>urn:schemas-xmlsoap-org:ws:2005:04:discovery</w:To>"
-        "<w:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/Probe</w:Action>"
-        "</e:Header>"
-        "<e:Body>"
-        "<d:Probe>"
-        "<d:Types>dn:NetworkVideoTransmitter</d:Types>"
-        "</d:Probe>"
-        "</e:Body>"
-        "</e:Envelope>";
-
-    snprintf(buffer, sizeof(buffer), probe_template, uuid);
-
-    // 7. Send Probe
-    printf("Sending ONVIF Probe to %s:%d...\n", MULTICAST_IP, MULTICAST_PORT);
-    if (sendto(sock, buffer, strlen(buffer), 0, (struct sockaddr *)&multicast_addr, sizeof(multicast_addr)) < 0) {
-        perror("sendto");
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl(O_NONBLOCK)");
         close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int watch_fd(int epfd, int fd, uint32_t tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+// With parser workers the receive thread reads the sockets, not the event loop
+static int watch_socket(struct discover_ctx *ctx, int sock, uint32_t tag) {
+    if (!ctx->pipeline) return watch_fd(ctx->epfd, sock, tag);
+    if (wsd_pipeline_add_socket(ctx->pipeline, sock, tag) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+// Create the probe sockets, epoll set and timer. The interfaces must
+// already be filled in. Returns 0 on success, -1 on error.
+static int ctx_open(struct discover_ctx *ctx, int batch, int rcvbuf, int listen) {
+    ctx->epfd = -1;
+    ctx->tfd = -1;
+    ctx->listen_sock = -1;
+    ctx->listen_drops = 0;
+    ctx->listen6_sock = -1;
+    ctx->listen6_drops = 0;
+    wsd_metrics_init(&ctx->metrics);
+    for (int i = 0; i < ctx->if_count; i++) {
+        ctx->ifs[i].sock = -1;
+        ctx->ifs[i].rx_drops = 0;
+    }
+
+    // With a pipeline the receive thread has receive slots of its own
+    if (!ctx->pipeline && wsd_rx_init(&ctx->rx, batch) < 0) {
+        fprintf(stderr, "Out of memory for %d receive slots\n", batch);
+        return -1;
+    }
+    if (device_index_init(&ctx->devices, 256) < 0) {
+        fprintf(stderr, "Out of memory for the device index\n");
+        return -1;
+    }
+    if (wsd_dedup_init(&ctx->seen_ids, WSD_DEDUP_DEFAULT_CAPACITY) < 0 ||
+        wsd_correlator_init(&ctx->outstanding, 8) < 0) {
+        fprintf(stderr, "Out of memory for the MessageID sets\n");
+        return -1;
+    }
+    ctx->repeat.due = -1;
+
+    ctx->epfd = epoll_create1(0);
+    if (ctx->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    memset(&ctx->multicast_addr, 0, sizeof(ctx->multicast_addr));
+    ctx->multicast_addr.sin_family = AF_INET;
+    ctx->multicast_addr.sin_addr.s_addr = inet_addr(MULTICAST_IP);
+    ctx->multicast_addr.sin_port = htons(MULTICAST_PORT);
+    memset(&ctx->multicast6_addr, 0, sizeof(ctx->multicast6_addr));
+    ctx->multicast6_addr.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, MULTICAST_IP6, &ctx->multicast6_addr.sin6_addr);
+    ctx->multicast6_addr.sin6_port = htons(MULTICAST_PORT);
+
+    // One probe socket per interface and family, tagged with its index
+    int have4 = 0, have6 = 0;
+    for (int i = 0; i < ctx->if_count; i++) {
+        if (ctx->ifs[i].family == AF_INET6) {
+            ctx->ifs[i].sock = open_probe_socket6(ctx->ifs[i].index);
+            have6 = 1;
+        } else {
+            ctx->ifs[i].sock = open_probe_socket(ctx, &ctx->ifs[i]);
+            have4 = 1;
+        }
+        if (ctx->ifs[i].sock < 0) return -1;
+        wsd_rx_setup_socket(ctx->ifs[i].sock, rcvbuf);
+        if (watch_socket(ctx, ctx->ifs[i].sock, (uint32_t)i) < 0) return -1;
+    }
+
+    if (listen && have4) {
+        ctx->listen_sock = open_listen_socket(ctx);
+        if (ctx->listen_sock < 0) return -1;
+        wsd_rx_setup_socket(ctx->listen_sock, rcvbuf);
+        if (ctx->proxy && wsd_rx_want_destination(ctx->listen_sock, AF_INET) < 0) {
+            perror("setsockopt(IP_PKTINFO)");
+            return -1;
+        }
+        if (watch_socket(ctx, ctx->listen_sock, LISTEN_TAG) < 0) return -1;
+    }
+    if (listen && have6) {
+        ctx->listen6_sock = open_listen_socket6(ctx);
+        if (ctx->listen6_sock < 0) return -1;
+        wsd_rx_setup_socket(ctx->listen6_sock, rcvbuf);
+        if (ctx->proxy && wsd_rx_want_destination(ctx->listen6_sock, AF_INET6) < 0) {
+            perror("setsockopt(IPV6_RECVPKTINFO)");
+            return -1;
+        }
+        if (watch_socket(ctx, ctx->listen6_sock, LISTEN6_TAG) < 0) return -1;
+    }
+
+    ctx->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ctx->tfd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    if (watch_fd(ctx->epfd, ctx->tfd, TIMER_TAG) < 0) return -1;
+
+    if (ctx->pipeline) {
+        if (watch_fd(ctx->epfd, wsd_pipeline_fd(ctx->pipeline), PIPELINE_TAG) < 0) return -1;
+        if (wsd_pipeline_start(ctx->pipeline) < 0) {
+            fprintf(stderr, "Cannot start the receive and parser threads\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void ctx_close(struct discover_ctx *ctx) {
+    // The receive thread goes before the sockets it reads
+    if (ctx->pipeline) wsd_pipeline_free(ctx->pipeline);
+    for (int i = 0; i < ctx->if_count; i++) {
+        if (ctx->ifs[i].sock >= 0) close(ctx->ifs[i].sock);
+    }
+    if (ctx->listen_sock >= 0) close(ctx->listen_sock);
+    if (ctx->listen6_sock >= 0) close(ctx->listen6_sock);
+    if (ctx->tfd >= 0) close(ctx->tfd);
+    if (ctx->epfd >= 0) close(ctx->epfd);
+    wsd_rx_free(&ctx->rx);
+    device_index_free(&ctx->devices);
+    wsd_dedup_free(&ctx->seen_ids);
+    wsd_correlator_free(&ctx->outstanding);
+    wsd_filter_free(&ctx->filter);
+    if (ctx->output.buf) wsd_output_free(&ctx->output);
+}
+
+// Send the current Probe on every interface back to back. IPv6 goes to
+// FF02::C scoped to the interface.
+// Returns the number of interfaces it went out on.
+static int send_to_all(struct discover_ctx *ctx, int verbose) {
+    int sent = 0;
+
+    for (int i = 0; i < ctx->if_count; i++) {
+        struct probe_iface *pif = &ctx->ifs[i];
+        const struct sockaddr *dest = (const struct sockaddr *)&ctx->multicast_addr;
+        socklen_t dest_len = sizeof(ctx->multicast_addr);
+        struct sockaddr_in6 dest6;
+
+        if (pif->skip) continue;
+        if (pif->family == AF_INET6) {
+            dest6 = ctx->multicast6_addr;
+            dest6.sin6_scope_id = pif->index;
+            dest = (const struct sockaddr *)&dest6;
+            dest_len = sizeof(dest6);
+            if (verbose) {
+                printf("Sending ONVIF Probe to [%s]:%d via %s...\n", MULTICAST_IP6, MULTICAST_PORT, pif->name);
+            }
+        } else if (verbose && pif->name[0]) {
+            printf("Sending ONVIF Probe to %s:%d via %s (%s)...\n", MULTICAST_IP, MULTICAST_PORT,
+                   pif->name, inet_ntoa(pif->addr));
+        } else if (verbose) {
+            printf("Sending ONVIF Probe to %s:%d...\n", MULTICAST_IP, MULTICAST_PORT);
+        }
+        const char *probe = pif->family == AF_INET6 ? ctx->probe6 : ctx->probe;
+        size_t probe_len = pif->family == AF_INET6 ? ctx->probe6_len : ctx->probe_len;
+        if (sendto(pif->sock, probe, probe_len, 0, dest, dest_len) < 0) {
+            perror("sendto");
+            continue;
+        }
+        ctx->metrics.probes_sent++;
+        sent++;
+    }
+    return sent;
+}
+
+// Build a Probe with a fresh MessageID, send it and schedule its repeats.
+// Returns the number of interfaces it went out on.
+static int send_probe(struct discover_ctx *ctx, int verbose) {
+    char uuid[WSD_MESSAGE_ID_SIZE], uuid6[WSD_MESSAGE_ID_SIZE];
+    int have6 = 0;
+
+    for (int i = 0; i < ctx->if_count; i++) {
+        if (ctx->ifs[i].family == AF_INET6) have6 = 1;
+    }
+    if (wsd_generate_uuid(uuid, sizeof(uuid)) < 0 || (have6 && wsd_generate_uuid(uuid6, sizeof(uuid6)) < 0)) {
+        perror("getrandom");
+        return 0;
+    }
+    ctx->probe_len = wsd_build_probe(ctx->probe, sizeof(ctx->probe), uuid, &ctx->filter);
+    ctx->probe6_len = have6 ? wsd_build_probe(ctx->probe6, sizeof(ctx->probe6), uuid6, &ctx->filter) : 0;
+    if (ctx->probe_len == 0 || (have6 && ctx->probe6_len == 0)) {
+        fprintf(stderr, "Probe too large for the given Types and Scopes\n");
+        return 0;
+    }
+    ctx->probe_sent_ns = monotonic_ns();
+    int64_t now = ctx->probe_sent_ns / 1000000;
+    // Parser workers read the correlator too
+    if (ctx->pipeline) wsd_pipeline_lock(ctx->pipeline);
+    int added = wsd_correlator_add(&ctx->outstanding, uuid, strlen(uuid), now + ctx->probe_ttl_ms, now) == 0 &&
+                (!have6 || wsd_correlator_add(&ctx->outstanding, uuid6, strlen(uuid6), now + ctx->probe_ttl_ms,
+                                              now) == 0);
+    if (ctx->pipeline) wsd_pipeline_unlock(ctx->pipeline);
+    if (!added) {
+        fprintf(stderr, "Out of memory for the MessageID sets\n");
+        return 0;
+    }
+    wsd_repeat_start(&ctx->repeat, ctx->probe_repeat, now);
+    return send_to_all(ctx, verbose);
+}
+
+// Where a Discovery Proxy on this interface takes unicast requests
+static void proxy_xaddr(const struct probe_iface *pif, char *out, size_t size) {
+    char host[INET6_ADDRSTRLEN];
+
+    if (pif->family == AF_INET6) {
+        inet_ntop(AF_INET6, &pif->addr6, host, sizeof(host));
+        snprintf(out, size, "soap.udp://[%s%%25%s]:%d", host, pif->name, MULTICAST_PORT);
+    } else {
+        inet_ntop(AF_INET, &pif->addr, host, sizeof(host));
+        snprintf(out, size, "soap.udp://%s:%d", host, MULTICAST_PORT);
+    }
+}
+
+// Multicast the proxy's Hello (or Bye) on every interface
+static void proxy_announce(struct discover_ctx *ctx, int hello) {
+    char msg[MAX_BUF_SIZE], xaddr[WSD_PROXY_XADDR_SIZE];
+    struct wsd_view none = {NULL, 0};
+
+    for (int i = 0; i < ctx->if_count; i++) {
+        struct probe_iface *pif = &ctx->ifs[i];
+        const struct sockaddr *dest = (const struct sockaddr *)&ctx->multicast_addr;
+        socklen_t dest_len = sizeof(ctx->multicast_addr);
+        struct sockaddr_in6 dest6;
+
+        if (pif->family == AF_INET6) {
+            dest6 = ctx->multicast6_addr;
+            dest6.sin6_scope_id = pif->index;
+            dest = (const struct sockaddr *)&dest6;
+            dest_len = sizeof(dest6);
+        }
+        proxy_xaddr(pif, xaddr, sizeof(xaddr));
+        size_t len = hello ? wsd_proxy_hello(ctx->proxy, msg, sizeof(msg), xaddr, none)
+                           : wsd_proxy_bye(ctx->proxy, msg, sizeof(msg));
+        if (len == 0) continue;
+        // It comes back on the listen socket: not a device to track
+        wsd_dedup_check(&ctx->seen_ids, ctx->proxy->message_id, strlen(ctx->proxy->message_id));
+        if (sendto(pif->sock, msg, len, 0, dest, dest_len) < 0) perror("sendto");
+    }
+}
+
+static socklen_t sockaddr_len(const struct sockaddr_storage *ss) {
+    return ss->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+// Discovery Proxy: a multicast Probe or Resolve gets a Hello pointing the
+// client to the proxy, a unicast one is answered from the device index.
+// Returns 1 if the datagram was a request, 0 to handle it as a reply.
+static int proxy_request(struct discover_ctx *ctx, int sock, const struct wsd_rx_packet *pkt) {
+    const struct sockaddr *from = (const struct sockaddr *)&pkt->from;
+    char msg[WSD_PROXY_DATAGRAM_SIZE];
+    struct wsd_message req;
+    struct wsd_header hdr;
+
+    int64_t start_ns = monotonic_ns();
+    if (wsd_scan_header(pkt->data, pkt->len, &hdr) < 0) return 0;
+    int resolve = wsd_view_has_suffix(hdr.action, "/Resolve");
+    if (!resolve && !wsd_view_has_suffix(hdr.action, "/Probe")) return 0;
+
+    // Our own reconciling Probes loop back, and requests are repeated
+    if (wsd_correlator_match(&ctx->outstanding, hdr.message_id.ptr, hdr.message_id.len, start_ns / 1000000)) {
+        ctx->metrics.ignored++;
+        return 1;
+    }
+    if (hdr.message_id.len > 0 && wsd_dedup_check(&ctx->seen_ids, hdr.message_id.ptr, hdr.message_id.len)) {
+        ctx->metrics.repeats++;
         return 1;
     }
 
-    // 8. Receive Loop
-    printf("Listening for responses (Timeout: %d seconds)...\n", RCV_TIMEOUT_SEC);
-    time_t start_time = time(NULL);
-    
-    while (time(NULL) - start_time < RCV_TIMEOUT_SEC) {
-        struct sockaddr_in sender_addr;
-        socklen_t sender_len = sizeof(sender_addr);
-        
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(sock, &fds);
-        
-        struct timeval select_tv;
-        select_tv.tv_sec = 1;
-        select_tv.tv_usec = 0;
-        
-        int ret = select(sock + 1, &fds, NULL, NULL, &select_tv);
-        
-        if (ret > 0) {
-            int n = recvfrom(sock, buffer, MAX_BUF_SIZE - 1, 0, (struct sockaddr *)&sender_addr, &sender_len);
-            if (n > 0) {
-                buffer[n] = '\0';
-                
-                // Basic check if it's a ProbeMatch
-                if (strstr(buffer, "ProbeMatch") || strstr(buffer, "d:ProbeMatch") || strstr(buffer, ":ProbeMatch")) {
-                    char xaddrs[1024] = {0};
-                    char scopes[2048] = {0};
-                    char sender_ip[INET_ADDRSTRLEN];
-                    
-                    inet_ntop(AF_INET, &(sender_addr.sin_addr), sender_ip, INET_ADDRSTRLEN);
-                    
-                    printf("\n[Device Found] IP: %s\n", sender_ip);
-                    
-                    if (extract_xml_tag(buffer, "XAddrs", xaddrs, sizeof(xaddrs))) {
-                        printf("  Service URL: %s\n", xaddrs);
-                    }
-                    
-                    if (extract_xml_tag(buffer, "Scopes", scopes, sizeof(scopes))) {
-                        decode_html_entities(scopes);
-                        // Try to find Name in Scopes
-                        char *token;
-                        char *saveptr;
-                        
-                        // Note: strtok modifies the string, so we work on a copy if needed, 
-                        // but here we just want to print info
-                        token = strtok_r(scopes, " \t\r\n", &saveptr);
-                        while (token) {
-                            if (strstr(token, "onvif://www.onvif.org/name/")) {
-                                printf("  Name: %s\n", token + strlen("onvif://www.onvif.org/name/"));
-                            } else if (strstr(token, "onvif://www.onvif.org/location/")) {
-                                printf("  Location: %s\n", token + strlen("onvif://www.onvif.org/location/"));
-                            } else if (strstr(token, "onvif://www.onvif.org/hardware/")) {
-                                printf("  Hardware: %s\n", token + strlen("onvif://www.onvif.org/hardware/"));
-                            }
-                            token = strtok_r(NULL, " \t\r\n", &saveptr);
-                        }
-                    }
-                }
+    int multicast = 1;
+    if (pkt->to.ss_family == AF_INET) {
+        multicast = IN_MULTICAST(ntohl(((const struct sockaddr_in *)&pkt->to)->sin_addr.s_addr));
+    } else if (pkt->to.ss_family == AF_INET6) {
+        multicast = IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)&pkt->to)->sin6_addr);
+    }
+    if (multicast) {
+        char xaddr[WSD_PROXY_XADDR_SIZE];
+        const struct probe_iface *pif = NULL;
+        for (int i = 0; i < ctx->if_count && !pif; i++) {
+            if (ctx->ifs[i].family == pkt->to.ss_family && ctx->ifs[i].index == pkt->ifindex) pif = &ctx->ifs[i];
+        }
+        if (!pif) return 1;
+        proxy_xaddr(pif, xaddr, sizeof(xaddr));
+        size_t len = wsd_proxy_hello(ctx->proxy, msg, sizeof(msg), xaddr, hdr.message_id);
+        if (len > 0 && !wsd_proxy_admit(ctx->proxy, from, start_ns / 1000000)) {
+            ctx->metrics.proxy_limited++;
+        } else if (len > 0 && sendto(sock, msg, len, 0, from, sockaddr_len(&pkt->from)) >= 0) {
+            ctx->metrics.proxy_suppressed++;
+        }
+        return 1;
+    }
+
+    // An empty Probe may come without a body entry at all
+    int parsed = wsd_parse(pkt->data, pkt->len, &req);
+    if (parsed < 0) {
+        ctx->metrics.parse_errors++;
+        return 1;
+    }
+    struct wsd_match none;
+    const struct wsd_match *body = req.match_count > 0 ? &req.matches[0] : &none;
+    memset(&none, 0, sizeof(none));
+    ctx->metrics.proxy_requests++;
+
+    if (resolve) {
+        struct device *d = device_index_find(&ctx->devices, body->address.ptr, body->address.len);
+        size_t len = d ? wsd_proxy_resolve_matches(ctx->proxy, msg, sizeof(msg), hdr.message_id, d) : 0;
+        if (len > 0 && !wsd_proxy_admit(ctx->proxy, from, start_ns / 1000000)) {
+            ctx->metrics.proxy_limited++;
+        } else if (len > 0 && sendto(sock, msg, len, 0, from, sockaddr_len(&pkt->from)) >= 0) {
+            ctx->metrics.proxy_matches++;
+        }
+    } else if (wsd_proxy_begin_probe(ctx->proxy, body) == 0) {
+        // Large inventories take several datagrams; only the first may be
+        // empty. The answer stops where the source's budget runs out.
+        size_t next = 0;
+        int datagrams = 0;
+        do {
+            int matches;
+            size_t len = wsd_proxy_probe_matches(ctx->proxy, msg, sizeof(msg), hdr.message_id, &ctx->devices,
+                                                 &next, &matches);
+            if (len == 0) break;
+            if (matches == 0 && datagrams > 0) continue;
+            if (datagrams == WSD_PROXY_MAX_DATAGRAMS || !wsd_proxy_admit(ctx->proxy, from, start_ns / 1000000)) {
+                ctx->metrics.proxy_limited++;
+                break;
+            }
+            if (sendto(sock, msg, len, 0, from, sockaddr_len(&pkt->from)) < 0) {
+                perror("sendto");
+                break;
             }
+            ctx->metrics.proxy_matches += (uint64_t)matches;
+            datagrams++;
+        } while (next < ctx->devices.count);
+    }
+    wsd_histogram_observe(&ctx->metrics.proxy_answer, (uint64_t)(monotonic_ns() - start_ns));
+    return 1;
+}
+
+// Drain a readable socket a batch at a time, it is non-blocking.
+// Returns the number of new devices.
+static int drain_socket(struct discover_ctx *ctx, int sock, uint32_t *drops, const char *ifname) {
+    int found = 0;
+
+    for (;;) {
+        int n = wsd_rx_recv(&ctx->rx, sock, drops);
+        if (n < 0) {
+            perror("recvmmsg");
+            break;
+        }
+        if (n == 0) break;
+
+        for (int k = 0; k < n; k++) {
+            const struct wsd_rx_packet *pkt = &ctx->rx.packets[k];
+
+            ctx->metrics.packets++;
+            ctx->metrics.bytes += pkt->len;
+            if (pkt->truncated) ctx->metrics.truncated++;
+            if (pkt->len == 0) continue;
+            // Requests for the proxy come in on port 3702
+            if (ctx->proxy && (sock == ctx->listen_sock || sock == ctx->listen6_sock) &&
+                proxy_request(ctx, sock, pkt)) {
+                continue;
+            }
+            found += handle_response(ctx, pkt->data, pkt->len, (const struct sockaddr *)&pkt->from, ifname);
+        }
+        if (n < ctx->rx.slots) break;
+    }
+    return found;
+}
+
+// One datagram back from the parser workers: the same checks and merge as
+// drain_socket(), with the header and body already parsed. Returns the
+// number of new devices.
+static int handle_item(struct discover_ctx *ctx, const struct wsd_pipeline_item *item) {
+    const struct wsd_rx_packet *pkt = &item->pkt;
+    const char *ifname = "";
+    uint32_t *drops;
+    int sock;
+
+    if (item->tag == LISTEN_TAG) {
+        sock = ctx->listen_sock;
+        drops = &ctx->listen_drops;
+    } else if (item->tag == LISTEN6_TAG) {
+        sock = ctx->listen6_sock;
+        drops = &ctx->listen6_drops;
+    } else {
+        sock = ctx->ifs[item->tag].sock;
+        drops = &ctx->ifs[item->tag].rx_drops;
+        ifname = ctx->ifs[item->tag].name;
+    }
+    // Datagrams of one socket may come back through different workers
+    if (item->drops > *drops) *drops = item->drops;
+
+    ctx->metrics.packets++;
+    ctx->metrics.bytes += pkt->len;
+    if (pkt->truncated) ctx->metrics.truncated++;
+    if (pkt->len == 0) return 0;
+    if (ctx->proxy && (item->tag == LISTEN_TAG || item->tag == LISTEN6_TAG) && proxy_request(ctx, sock, pkt)) {
+        return 0;
+    }
+    // Rejected by the worker on the header alone, before the parse
+    if (item->parsed == WSD_PIPELINE_UNCORRELATED) {
+        ctx->metrics.uncorrelated++;
+        return 0;
+    }
+    if (item->parsed == WSD_PIPELINE_REPEAT) {
+        ctx->metrics.repeats++;
+        return 0;
+    }
+    if (item->header_ok && !wanted(ctx, &item->hdr, item->rx_ns / 1000000)) return 0;
+    wsd_histogram_observe(&ctx->metrics.parse_time, (uint64_t)item->parse_ns);
+    return merge_message(ctx, &item->msg, item->parsed, (const struct sockaddr *)&pkt->from, ifname, item->rx_ns);
+}
+
+// Handle everything the parser workers have finished.
+// Returns the number of new devices.
+static int drain_pipeline(struct discover_ctx *ctx) {
+    struct wsd_pipeline_item *item;
+    int found = 0;
+
+    wsd_pipeline_wakeup(ctx->pipeline);
+    while ((item = wsd_pipeline_next(ctx->pipeline)) != NULL) {
+        found += handle_item(ctx, item);
+        wsd_histogram_observe(&ctx->metrics.pipeline_latency, (uint64_t)(monotonic_ns() - item->rx_ns));
+        wsd_pipeline_release(ctx->pipeline, item);
+    }
+    return found;
+}
+
+// Dispatch one epoll event. Returns the number of new devices, or -1 when
+// the timer fired.
+static int handle_event(struct discover_ctx *ctx, const struct epoll_event *ev) {
+    uint32_t tag = ev->data.u32;
+
+    if (tag == TIMER_TAG) {
+        uint64_t expirations;
+        if (read(ctx->tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("read(timerfd)");
+        return -1;
+    }
+    if (tag == LISTEN_TAG) {
+        return drain_socket(ctx, ctx->listen_sock, &ctx->listen_drops, "");
+    }
+    if (tag == LISTEN6_TAG) {
+        return drain_socket(ctx, ctx->listen6_sock, &ctx->listen6_drops, "");
+    }
+    if (tag == PIPELINE_TAG) {
+        return drain_pipeline(ctx);
+    }
+    if (tag >= ENRICH_TAG_BASE) {
+        if (ctx->enrich) wsd_enrich_on_event(ctx->enrich, tag, ev->events, monotonic_ms());
+        return 0;
+    }
+    struct probe_iface *pif = &ctx->ifs[tag];
+    return drain_socket(ctx, pif->sock, &pif->rx_drops, pif->name);
+}
+
+static int is_json_path(const char *path) {
+    size_t len = strlen(path);
+    return len >= 5 && strcmp(path + len - 5, ".json") == 0;
+}
+
+// Export the metrics: a ".json" path gets a JSON snapshot, anything else the
+// Prometheus text format. Files are replaced through a rename so a scraper
+// (e.g. the node_exporter textfile collector) never sees half a file.
+static void write_metrics(struct discover_ctx *ctx) {
+    struct wsd_metrics *m = &ctx->metrics;
+    char tmp[4096];
+
+    if (!ctx->metrics_path) return;
+    m->queue_drops = ctx->listen_drops + ctx->listen6_drops;
+    for (int i = 0; i < ctx->if_count; i++) m->queue_drops += ctx->ifs[i].rx_drops;
+    m->devices = ctx->devices.count;
+    if (ctx->pipeline) {
+        m->pipeline_stalls = atomic_load(&ctx->pipeline->stalls);
+        m->pipeline_drops = atomic_load(&ctx->pipeline->dropped);
+    }
+
+    if (strcmp(ctx->metrics_path, "-") == 0) {
+        wsd_metrics_write_prometheus(m, stdout);
+        fflush(stdout);
+        return;
+    }
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", ctx->metrics_path) >= (int)sizeof(tmp)) {
+        fprintf(stderr, "Metrics path too long: %s\n", ctx->metrics_path);
+        return;
+    }
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write metrics %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    int ret = is_json_path(ctx->metrics_path) ? wsd_metrics_write_json(m, f) : wsd_metrics_write_prometheus(m, f);
+    if (fclose(f) != 0) ret = -1;
+    if (ret < 0 || rename(tmp, ctx->metrics_path) < 0) {
+        fprintf(stderr, "Cannot write metrics %s: %s\n", ctx->metrics_path, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+// Time left until the absolute monotonic time at_ms, as an epoll timeout
+static int ms_until(int64_t at_ms) {
+    int64_t left = at_ms - monotonic_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+// epoll_wait() that also wakes up for the Probe repeats, the enrichment
+// deadlines and the periodic metrics export
+static int wait_events(struct discover_ctx *ctx, struct epoll_event *events, int max) {
+    int timeout = -1;
+
+    if (ctx->repeat.due >= 0) timeout = ms_until(ctx->repeat.due);
+
+    if (ctx->enrich) {
+        int64_t next = wsd_enrich_next_deadline(ctx->enrich);
+        if (next >= 0 && (timeout < 0 || ms_until(next) < timeout)) timeout = ms_until(next);
+    }
+    int periodic = ctx->metrics_path && strcmp(ctx->metrics_path, "-") != 0;
+    if (periodic) {
+        int left = ms_until(ctx->metrics_due);
+        if (timeout < 0 || left < timeout) timeout = left;
+    }
+    int nev = epoll_wait(ctx->epfd, events, max, timeout);
+    if (wsd_repeat_due(&ctx->repeat, monotonic_ms())) send_to_all(ctx, 0);
+    if (ctx->enrich) wsd_enrich_expire(ctx->enrich, monotonic_ms());
+    if (periodic && monotonic_ms() >= ctx->metrics_due) {
+        write_metrics(ctx);
+        ctx->metrics_due = monotonic_ms() + METRICS_INTERVAL_MS;
+    }
+    return nev;
+}
+
+// Let the outstanding GetDeviceInformation requests finish once
+// discovery itself is over
+static void finish_enrichment(struct discover_ctx *ctx) {
+    if (!ctx->enrich) return;
+    if (wsd_enrich_busy(ctx->enrich)) {
+        printf("Waiting for device information (%d running, %zu queued)...\n", ctx->enrich->active,
+               ctx->enrich->queue_len);
+    }
+    while (wsd_enrich_busy(ctx->enrich) && !stop_requested) {
+        struct epoll_event events[MAX_EVENTS];
+
+        int nev = wait_events(ctx, events, MAX_EVENTS);
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
         }
+        for (int e = 0; e < nev; e++) handle_event(ctx, &events[e]);
     }
+    printf("Device information: %llu of %llu device(s) enriched, %llu failed.\n",
+           (unsigned long long)ctx->enrich->succeeded, (unsigned long long)ctx->enrich->submitted,
+           (unsigned long long)ctx->enrich->failed);
+}
 
-    printf("\nDiscovery finished.\n");
-    close(sock);
+static void print_rx_stats(const struct discover_ctx *ctx) {
+    unsigned long drops = ctx->listen_drops + ctx->listen6_drops;
+    for (int i = 0; i < ctx->if_count; i++) drops += ctx->ifs[i].rx_drops;
+    if (drops || ctx->metrics.truncated) {
+        printf("Receive queue drops: %lu, truncated replies: %llu\n", drops,
+               (unsigned long long)ctx->metrics.truncated);
+    }
+}
+
+// Report and drop the devices not heard from since since_ms
+static void drop_silent(struct discover_ctx *ctx, int64_t since_ms) {
+    for (size_t i = ctx->devices.count; i-- > 0;) {
+        struct device *d = &ctx->devices.records[i];
+        if (d->last_seen >= since_ms) continue;
+        report_device(ctx, WSD_EVENT_LOST, "Device Lost", d, NULL, -1);
+        ctx->metrics.devices_left++;
+        device_index_remove_at(&ctx->devices, i);
+    }
+}
+
+// One probe, one receive window. Ends at the deadline, after quiet_ms
+// without a new device, or once `expect` devices answered. Cached devices
+// that stay silent until the deadline are dropped.
+static int run_scan(struct discover_ctx *ctx, int timeout_ms, int quiet_ms, int expect) {
+    int found = 0;
+    int64_t probe_ms = monotonic_ms();
+
+    ctx->probe_ttl_ms = timeout_ms;
+    if (send_probe(ctx, 1) == 0) return 1;
+
+    if (quiet_ms > 0) {
+        printf("Listening for responses (Timeout: %d ms, quiet period: %d ms)...\n", timeout_ms, quiet_ms);
+    } else {
+        printf("Listening for responses (Timeout: %d ms)...\n", timeout_ms);
+    }
+
+    // The scan ends when the timer fires: at the deadline, or earlier
+    // once the quiet period passes without a new device
+    int64_t start_ms = monotonic_ms();
+    int64_t deadline_ms = start_ms + timeout_ms;
+    int64_t expiry_ms = deadline_ms;
+    if (quiet_ms > 0 && start_ms + quiet_ms < expiry_ms) expiry_ms = start_ms + quiet_ms;
+    arm_timer(ctx->tfd, expiry_ms);
+
+    int done = 0;
+    while (!done && !stop_requested) {
+        struct epoll_event events[MAX_EVENTS];
+        int found_before = found;
+
+        int nev = wait_events(ctx, events, MAX_EVENTS);
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int e = 0; e < nev; e++) {
+            int n = handle_event(ctx, &events[e]);
+            if (n < 0) {
+                if (monotonic_ms() >= expiry_ms) done = 1;
+            } else {
+                found += n;
+            }
+        }
+
+        if (expect > 0 && found >= expect) break;
+
+        // A new device restarts the quiet period
+        if (found > found_before && quiet_ms > 0) {
+            int64_t quiet_end = monotonic_ms() + quiet_ms;
+            expiry_ms = quiet_end < deadline_ms ? quiet_end : deadline_ms;
+            arm_timer(ctx->tfd, expiry_ms);
+        }
+        // One write per wake-up keeps piped output timely without a flush per line
+        flush_output(ctx);
+    }
+    // Only a full window proves silence: --expect, -q and signals end it early
+    if (done && monotonic_ms() >= deadline_ms) {
+        drop_silent(ctx, probe_ms);
+        flush_output(ctx);
+    }
+
+    printf("\nDiscovery finished in %lld ms, %zu device(s).\n", (long long)(monotonic_ms() - start_ms),
+           ctx->devices.count);
+    print_rx_stats(ctx);
+    finish_enrichment(ctx);
     return 0;
 }
+
+// Unicast Probe to every host of the sweep ranges, paced and retried by
+// the sweep engine. Ends once every target answered or ran out of retries.
+static int run_sweep(struct discover_ctx *ctx, struct wsd_sweep *sw, double rate, int inflight, int retries,
+                     int wait_ms) {
+    int64_t start_ms = monotonic_ms();
+
+    if (wsd_sweep_start(sw, rate, inflight, retries, wait_ms, start_ms) < 0) {
+        fprintf(stderr, "Nothing to sweep or out of memory\n");
+        return 1;
+    }
+    ctx->sweep = sw;
+    printf("Sweeping %llu host(s) at %.0f probes/s, %d in flight, %d retries...\n",
+           (unsigned long long)sw->total, rate, inflight, retries);
+
+    int64_t wake = wsd_sweep_tick(sw, ctx->ifs[0].sock, start_ms);
+    while (wake >= 0 && !stop_requested) {
+        struct epoll_event events[MAX_EVENTS];
+
+        arm_timer(ctx->tfd, wake);
+        int nev = wait_events(ctx, events, MAX_EVENTS);
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int e = 0; e < nev; e++) handle_event(ctx, &events[e]);
+        flush_output(ctx);
+
+        // Replies free in-flight slots, so run the pacer after every wake-up
+        wake = wsd_sweep_tick(sw, ctx->ifs[0].sock, monotonic_ms());
+    }
+
+    printf("\nSweep finished in %lld ms: %llu probe(s) sent (%llu retries), %llu of %llu host(s) answered, "
+           "%zu device(s).\n",
+           (long long)(monotonic_ms() - start_ms), (unsigned long long)sw->sent,
+           (unsigned long long)sw->retried, (unsigned long long)sw->replies, (unsigned long long)sw->total,
+           ctx->devices.count);
+    print_rx_stats(ctx);
+    ctx->metrics.probes_sent += sw->sent;
+    ctx->sweep = NULL;
+    wsd_sweep_free(sw);
+    finish_enrichment(ctx);
+    return 0;
+}
+
+// Start from the inventory of the previous run, reported right away
+static void load_cache(struct discover_ctx *ctx) {
+    int n = device_cache_load(ctx->cache_path, &ctx->devices, monotonic_ms(), CACHE_MAX_AGE_MS);
+    if (n < 0) {
+        fprintf(stderr, "Ignoring cache %s: unreadable or another format version\n", ctx->cache_path);
+        return;
+    }
+    for (size_t i = 0; i < ctx->devices.count; i++) {
+        report_device(ctx, WSD_EVENT_CACHED, "Device Cached", &ctx->devices.records[i], NULL, -1);
+    }
+    if (n > 0) printf("\nLoaded %d cached device(s) from %s, refreshing...\n", n, ctx->cache_path);
+    flush_output(ctx);
+}
+
+static void save_cache(const struct discover_ctx *ctx) {
+    if (!ctx->cache_path) return;
+    if (device_cache_save(ctx->cache_path, &ctx->devices, monotonic_ms()) < 0) {
+        fprintf(stderr, "Cannot write cache %s: %s\n", ctx->cache_path, strerror(errno));
+    }
+}
+
+static void print_inventory(struct discover_ctx *ctx) {
+    printf("\n=== Inventory: %zu device(s) ===\n", ctx->devices.count);
+    for (size_t i = 0; i < ctx->devices.count; i++) {
+        report_device(ctx, WSD_EVENT_INVENTORY, "Device", &ctx->devices.records[i], NULL, -1);
+    }
+    flush_output(ctx);
+}
+
+// Feed captured datagrams through the same parse, dedup and index path
+// as live replies, as fast as the files can be read.
+// Returns 0, or 1 if a file could not be read to the end.
+static int run_replay(struct discover_ctx *ctx, char **files, int count) {
+    int ret = 0;
+    uint64_t datagrams = 0;
+    int64_t start_ns = monotonic_ns();
+
+    for (int f = 0; f < count && !stop_requested; f++) {
+        struct wsd_pcap cap;
+        struct wsd_pcap_packet pkt;
+        int r = 0;
+
+        if (wsd_pcap_open(&cap, files[f]) < 0) {
+            perror(files[f]);
+            ret = 1;
+            continue;
+        }
+        uint64_t before = ctx->metrics.packets;
+        while (!stop_requested && (r = wsd_pcap_next(&cap, &pkt)) > 0) {
+            ctx->metrics.packets++;
+            ctx->metrics.bytes += pkt.len;
+            if (pkt.truncated) ctx->metrics.truncated++;
+            if (pkt.len == 0) continue;
+            ctx->capture_ts_ms = pkt.ts_ns / 1000000;
+            const struct sockaddr *from = pkt.from.ss_family == AF_UNSPEC ? NULL : (const struct sockaddr *)&pkt.from;
+            handle_response(ctx, pkt.data, pkt.len, from, pkt.ifname);
+        }
+        if (r < 0) {
+            fprintf(stderr, "%s: malformed or truncated capture, stopped after %llu records\n", files[f],
+                    (unsigned long long)cap.records);
+            ret = 1;
+        }
+        datagrams += ctx->metrics.packets - before;
+        printf("%s: %llu records, %llu WS-Discovery datagrams, %llu skipped", files[f],
+               (unsigned long long)cap.records, (unsigned long long)(ctx->metrics.packets - before),
+               (unsigned long long)cap.skipped);
+        if (cap.fragments) {
+            printf(", %llu IP fragments (%llu datagrams incomplete)", (unsigned long long)cap.fragments,
+                   (unsigned long long)cap.incomplete);
+        }
+        printf("\n");
+        wsd_pcap_close(&cap);
+        flush_output(ctx);
+    }
+    ctx->capture_ts_ms = 0;
+
+    double elapsed_ms = (double)(monotonic_ns() - start_ns) / 1e6;
+    printf("\nReplay finished in %.0f ms, %zu device(s) from %llu datagrams (%.0f datagrams/s)\n", elapsed_ms,
+           ctx->devices.count, (unsigned long long)datagrams,
+           elapsed_ms > 0 ? (double)datagrams * 1000 / elapsed_ms : 0.0);
+    print_rx_stats(ctx);
+    return ret;
+}
+
+// Long-running mode: learn devices from Hello/Bye as they happen and run a
+// reconciling Probe every reconcile_ms. Devices that neither announce
+// themselves nor answer a reconciling Probe within window_ms are dropped.
+static int run_listen(struct discover_ctx *ctx, int reconcile_ms, int window_ms) {
+    printf("Listening for Hello/Bye on %s:%d%s (reconciling Probe every %d ms)...\n", MULTICAST_IP,
+           MULTICAST_PORT, ctx->listen6_sock >= 0 ? " and [" MULTICAST_IP6 "]:3702" : "", reconcile_ms);
+
+    if (ctx->proxy) {
+        printf("Discovery Proxy %s answering unicast Probe/Resolve on port %d\n", ctx->proxy->endpoint,
+               MULTICAST_PORT);
+        proxy_announce(ctx, 1);
+    }
+
+    int64_t probe_ms = monotonic_ms();
+    int in_window = 1;
+    ctx->probe_ttl_ms = window_ms;
+    send_probe(ctx, 0);
+    arm_timer(ctx->tfd, probe_ms + window_ms);
+    flush_output(ctx);
+
+    while (!stop_requested) {
+        struct epoll_event events[MAX_EVENTS];
+
+        int nev = wait_events(ctx, events, MAX_EVENTS);
+        if (nev < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+
+        for (int e = 0; e < nev; e++) {
+            if (handle_event(ctx, &events[e]) >= 0) continue;
+
+            if (in_window) {
+                // Reconciliation window closed: sweep devices that went silent
+                drop_silent(ctx, probe_ms);
+                in_window = 0;
+                arm_timer(ctx->tfd, probe_ms + reconcile_ms);
+                save_cache(ctx);
+            } else {
+                probe_ms = monotonic_ms();
+                send_probe(ctx, 0);
+                in_window = 1;
+                arm_timer(ctx->tfd, probe_ms + window_ms);
+            }
+        }
+
+        if (dump_requested) {
+            dump_requested = 0;
+            print_inventory(ctx);
+            write_metrics(ctx);
+        }
+        flush_output(ctx);
+    }
+
+    if (ctx->proxy) proxy_announce(ctx, 0);
+    print_inventory(ctx);
+    print_rx_stats(ctx);
+    return 0;
+}
+
+// Monitor mode: Probe the interfaces whose turn has come, along with those
+// due within MONITOR_COALESCE_MS, so neighbouring schedules share one Probe
+// and its repeats. Returns when the next one is due.
+static int64_t probe_due(struct discover_ctx *ctx, int64_t now_ms) {
+    int64_t next = -1;
+    int due = 0;
+
+    for (int i = 0; i < ctx->if_count; i++) {
+        struct probe_iface *pif = &ctx->ifs[i];
+        pif->skip = pif->next_probe > now_ms + MONITOR_COALESCE_MS;
+        if (!pif->skip) {
+            pif->next_probe = now_ms + pif->interval_ms;
+            due = 1;
+        }
+        if (next < 0 || pif->next_probe < next) next = pif->next_probe;
+    }
+    if (due) send_probe(ctx, 0);
+    return next;
+}
+
+// Monitor mode: drop the devices whose time is up. One pass over the dense
+// record array per Probe round, next to that round's replies.
+static void age_out(struct discover_ctx *ctx, int64_t now_ms) {
+    for (size_t i = ctx->devices.count; i-- > 0;) {
+        struct device *d = &ctx->devices.records[i];
+        if (!d->expires || d->expires > now_ms) continue;
+        report_device(ctx, WSD_EVENT_LOST, "Device Lost", d, NULL, -1);
+        ctx->metrics.devices_left++;
+        device_index_remove_at(&ctx->devices, i);
+    }
+}
+
+// Every event that changed the inventory so far
+static uint64_t change_count(const struct discover_ctx *ctx) {
+    const struct wsd_metrics *m = &ctx->metrics;
+    return m->devices_found + m->devices_updated + m->devices_left + m->address_changes + m->scope_changes;
+}
+
+// Resident monitoring: each interface is probed on its own schedule,
+// devices that miss max_missed of their cycles are aged out, and only
+// changes are reported, so a steady fleet produces no output at all.
+// Hello/Bye are tracked in between as in listen mode.
+static int run_monitor(struct discover_ctx *ctx, int window_ms) {
+    const struct wsd_monitor *mon = ctx->monitor;
+    int64_t now = monotonic_ms();
+
+    printf("Monitoring %d interface(s), devices are lost after %d missed Probe(s):\n", ctx->if_count,
+           mon->max_missed);
+    for (int i = 0; i < ctx->if_count; i++) {
+        struct probe_iface *pif = &ctx->ifs[i];
+        pif->interval_ms = wsd_monitor_interval(mon, pif->name, pif->family == AF_INET ? &pif->addr : NULL);
+        pif->next_probe = now;
+        printf("  %s (%s): Probe every %d ms\n", pif->name, pif->family == AF_INET6 ? "IPv6" : "IPv4",
+               pif->interval_ms);
+    }
+    // Cached devices get a default cycle allowance to answer
+    for (size_t i = 0; i < ctx->devices.count; i++) {
+        struct device *d = &ctx->devices.records[i];
+        if (!d->expires) d->expires = now + (int64_t)mon->max_missed * mon->interval_ms;
+    }
+    if (ctx->proxy) {
+        printf("Discovery Proxy %s answering unicast Probe/Resolve on port %d\n", ctx->proxy->endpoint,
+               MULTICAST_PORT);
+        proxy_announce(ctx, 1);
+    }
+
+    ctx->probe_ttl_ms = window_ms;
+    arm_timer(ctx->tfd, probe_due(ctx, now));
+    flush_output(ctx);
+    uint64_t saved = change_count(ctx);
+
+    while (!stop_requested) {
+        struct epoll_event events[MAX_EVENTS];
+
+        int nev = wait_events(ctx, events, MAX_EVENTS);
+        if (nev < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+
+        for (int e = 0; e < nev; e++) {
+            if (handle_event(ctx, &events[e]) >= 0) continue;
+
+            now = monotonic_ms();
+            age_out(ctx, now);
+            arm_timer(ctx->tfd, probe_due(ctx, now));
+            // The cache is only rewritten when something changed
+            if (change_count(ctx) != saved) {
+                save_cache(ctx);
+                saved = change_count(ctx);
+            }
+        }
+
+        if (dump_requested) {
+            dump_requested = 0;
+            print_inventory(ctx);
+            write_metrics(ctx);
+        }
+        flush_output(ctx);
+    }
+
+    if (ctx->proxy) proxy_announce(ctx, 0);
+    print_inventory(ctx);
+    print_rx_stats(ctx);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-a] [-i IFNAME]... [-b N] [-r BYTES] [-t MS] [-q MS] [-n COUNT] [--repeat N] [-6]\n"
+            "       %s -l [--proxy] [-a] [-i IFNAME]... [-R MS] [-t MS] [-6]\n"
+            "       %s -s CIDR[,CIDR...] [--rate N] [--inflight N] [--retries N] [--wait MS]\n"
+            "       %s -p FILE [-p FILE]...\n"
+            "  any mode: [-T TYPES] [-S SCOPE]... [--match-by RULE] [--format FMT] [-c FILE] [-e [--user NAME --password PASS] [--enrich-conns N] [--enrich-timeout MS]] [--metrics FILE]\n"
+            "  -a, --all-interfaces   probe on every multicast-capable IPv4 interface\n"
+            "  -i, --interface NAME   probe on NAME (may be repeated, implies -a)\n"
+            "  -6, --ipv6             also probe [FF02::C]:3702 on every IPv6 interface (or those of -i)\n"
+            "  -b, --batch N          datagrams drained per recvmmsg() call (default %d)\n"
+            "  -r, --rcvbuf BYTES     socket receive buffer size (default %d)\n"
+            "      --workers N        receive on a thread of its own and parse on N worker threads\n"
+            "                         (default 0: receive and parse on the event loop)\n"
+            "  -t, --timeout MS       scan deadline in milliseconds (default %d)\n"
+            "  -q, --quiet MS         stop once no new device has replied for MS\n"
+            "  -n, --expect COUNT     stop as soon as COUNT devices have replied\n"
+            "  -l, --listen           keep running, track devices from Hello/Bye announcements\n"
+            "                         (SIGUSR1 prints the inventory, SIGINT stops)\n"
+            "      --proxy            listen mode as a WS-Discovery Discovery Proxy: announce it, redirect\n"
+            "                         multicast Probes to it and answer unicast Probe/Resolve from the\n"
+            "                         inventory (implies -l -a)\n"
+            "  -R, --reconcile MS     interval of the reconciling Probe in listen mode (default %d)\n"
+            "      --monitor MS       resident monitoring: Probe every interface every MS and report only\n"
+            "                         changes (found, updated, address, scopes, left, lost) (implies -l -a)\n"
+            "      --interval T=MS    monitor: Probe interface or IPv4 subnet T every MS instead\n"
+            "                         (may be repeated, the first match wins)\n"
+            "      --max-missed N     monitor: lose devices after N Probes without a reply (default %d)\n"
+            "  -s, --sweep CIDR       send unicast Probes to every host of CIDR (may be repeated)\n"
+            "      --rate N           sweep: probes per second (default %d)\n"
+            "      --inflight N       sweep: hosts awaiting a reply at once (default %d)\n"
+            "      --retries N        sweep: extra attempts per silent host (default %d)\n"
+            "      --wait MS          sweep: reply wait per attempt (default %d)\n"
+            "  -c, --cache FILE       start from the inventory saved in FILE and save it back\n"
+            "  -p, --replay FILE      read WS-Discovery traffic from a pcap or pcapng capture, or from\n"
+            "                         u32-length-prefixed payloads, instead of the network (\"-\" for stdin)\n"
+            "  -e, --enrich           fetch model, firmware and serial with GetDeviceInformation\n"
+            "      --user NAME        enrich: WS-Security user name\n"
+            "      --password PASS    enrich: WS-Security password\n"
+            "      --enrich-conns N   enrich: concurrent HTTP connections (default %d)\n"
+            "      --enrich-timeout MS  enrich: deadline per device (default %d)\n"
+            "      --repeat N         retransmit each multicast Probe N times (default %d)\n"
+            "  -T, --types LIST       Probe for these types, comma separated: NVT, NVD, NVS, NVA, Device,\n"
+            "                         or dn:/tds: QNames (default NVT)\n"
+            "  -S, --scope URI        Probe for devices with a scope matching URI (may be repeated;\n"
+            "                         \"location/x\" stands for onvif://www.onvif.org/location/x)\n"
+            "      --match-by RULE    scope matching: rfc3986 (default, by path segment) or strcmp\n"
+            "      --metrics FILE     export counters and latency histograms to FILE every %d s and at\n"
+            "                         exit (and on SIGUSR1 in listen mode); Prometheus text format,\n"
+            "                         or JSON if FILE ends in .json; \"-\" writes them to stdout at exit\n"
+            "      --format FMT       device events on stdout as text (default), ndjson (one JSON\n"
+            "                         object per line) or binary (length-prefixed records); with\n"
+            "                         ndjson or binary, everything else goes to stderr\n",
+            prog, prog, prog, prog, WSD_RX_DEFAULT_SLOTS, WSD_RX_DEFAULT_RCVBUF, RCV_TIMEOUT_SEC * 1000,
+            RECONCILE_MS, WSD_MONITOR_DEFAULT_MISSED, SWEEP_RATE, SWEEP_INFLIGHT, SWEEP_RETRIES, SWEEP_WAIT_MS, WSD_ENRICH_DEFAULT_CONNS,
+            WSD_ENRICH_DEFAULT_TIMEOUT_MS, WSD_MULTICAST_UDP_REPEAT, METRICS_INTERVAL_MS / 1000);
+}
+
+int main(int argc, char *argv[]) {
+    static struct discover_ctx ctx;
+    static struct wsd_sweep sweep;
+    static struct wsd_enrich enrich;
+    static struct wsd_proxy proxy;
+    static struct wsd_monitor monitor;
+    static struct wsd_pipeline pipeline;
+    char *only[MAX_INTERFACES];
+    int only_count = 0;
+    char *replay[MAX_REPLAY_FILES];
+    int replay_count = 0;
+    int ret_code = 0;
+    int batch = WSD_RX_DEFAULT_SLOTS;
+    int rcvbuf = WSD_RX_DEFAULT_RCVBUF;
+    int timeout_ms = RCV_TIMEOUT_SEC * 1000;
+    int quiet_ms = 0;
+    int expect = 0;
+    int listen = 0;
+    int reconcile_ms = RECONCILE_MS;
+    int sweep_rate = SWEEP_RATE;
+    int sweep_inflight = SWEEP_INFLIGHT;
+    int sweep_retries = SWEEP_RETRIES;
+    int sweep_wait_ms = SWEEP_WAIT_MS;
+    int enrich_on = 0;
+    const char *enrich_user = NULL;
+    const char *enrich_password = NULL;
+    int enrich_conns = WSD_ENRICH_DEFAULT_CONNS;
+    int enrich_timeout_ms = WSD_ENRICH_DEFAULT_TIMEOUT_MS;
+    int ipv6 = 0;
+    int format = WSD_OUTPUT_TEXT;
+    int proxy_on = 0;
+    int workers = 0;
+    int monitor_on = 0;
+
+    static const struct option long_opts[] = {
+        {"all-interfaces", no_argument, NULL, 'a'},
+        {"interface", required_argument, NULL, 'i'},
+        {"batch", required_argument, NULL, 'b'},
+        {"rcvbuf", required_argument, NULL, 'r'},
+        {"timeout", required_argument, NULL, 't'},
+        {"quiet", required_argument, NULL, 'q'},
+        {"expect", required_argument, NULL, 'n'},
+        {"listen", no_argument, NULL, 'l'},
+        {"reconcile", required_argument, NULL, 'R'},
+        {"sweep", required_argument, NULL, 's'},
+        {"rate", required_argument, NULL, OPT_RATE},
+        {"inflight", required_argument, NULL, OPT_INFLIGHT},
+        {"retries", required_argument, NULL, OPT_RETRIES},
+        {"wait", required_argument, NULL, OPT_WAIT},
+        {"cache", required_argument, NULL, 'c'},
+        {"replay", required_argument, NULL, 'p'},
+        {"enrich", no_argument, NULL, 'e'},
+        {"user", required_argument, NULL, OPT_USER},
+        {"password", required_argument, NULL, OPT_PASSWORD},
+        {"enrich-conns", required_argument, NULL, OPT_ENRICH_CONNS},
+        {"enrich-timeout", required_argument, NULL, OPT_ENRICH_TIMEOUT},
+        {"metrics", required_argument, NULL, OPT_METRICS},
+        {"repeat", required_argument, NULL, OPT_REPEAT},
+        {"types", required_argument, NULL, 'T'},
+        {"scope", required_argument, NULL, 'S'},
+        {"match-by", required_argument, NULL, OPT_MATCH_BY},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"proxy", no_argument, NULL, OPT_PROXY},
+        {"workers", required_argument, NULL, OPT_WORKERS},
+        {"monitor", required_argument, NULL, OPT_MONITOR},
+        {"interval", required_argument, NULL, OPT_INTERVAL},
+        {"max-missed", required_argument, NULL, OPT_MAX_MISSED},
+        {"ipv6", no_argument, NULL, '6'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    wsd_monitor_init(&monitor, 0, WSD_MONITOR_DEFAULT_MISSED);
+    int opt;
+    ctx.probe_repeat = WSD_MULTICAST_UDP_REPEAT;
+    while ((opt = getopt_long(argc, argv, "ai:b:r:t:q:n:lR:s:c:p:e6T:S:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            ctx.use_if = 1;
+            break;
+        case 'i':
+            if (only_count < MAX_INTERFACES) only[only_count++] = optarg;
+            ctx.use_if = 1;
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            if (batch <= 0 || batch > 1024) {
+                fprintf(stderr, "Invalid batch size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            rcvbuf = atoi(optarg);
+            if (rcvbuf <= 0) {
+                fprintf(stderr, "Invalid receive buffer size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            timeout_ms = atoi(optarg);
+            if (timeout_ms <= 0) {
+                fprintf(stderr, "Invalid timeout: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            quiet_ms = atoi(optarg);
+            if (quiet_ms < 0) {
+                fprintf(stderr, "Invalid quiet period: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            expect = atoi(optarg);
+            if (expect < 0) {
+                fprintf(stderr, "Invalid device count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            listen = 1;
+            break;
+        case 'R':
+            reconcile_ms = atoi(optarg);
+            if (reconcile_ms <= 0) {
+                fprintf(stderr, "Invalid reconcile interval: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's': {
+            char *save = NULL;
+            for (char *spec = strtok_r(optarg, ",", &save); spec; spec = strtok_r(NULL, ",", &save)) {
+                if (wsd_sweep_add_cidr(&sweep, spec) < 0) {
+                    fprintf(stderr, "Invalid or too many sweep ranges: %s\n", spec);
+                    return 1;
+                }
+            }
+            break;
+        }
+        case OPT_RATE:
+            sweep_rate = atoi(optarg);
+            if (sweep_rate <= 0) {
+                fprintf(stderr, "Invalid rate: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_INFLIGHT:
+            sweep_inflight = atoi(optarg);
+            if (sweep_inflight <= 0) {
+                fprintf(stderr, "Invalid in-flight limit: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_RETRIES:
+            sweep_retries = atoi(optarg);
+            if (sweep_retries < 0) {
+                fprintf(stderr, "Invalid retry count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_WAIT:
+            sweep_wait_ms = atoi(optarg);
+            if (sweep_wait_ms <= 0) {
+                fprintf(stderr, "Invalid wait: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            ctx.cache_path = optarg;
+            break;
+        case 'p':
+            if (replay_count >= MAX_REPLAY_FILES) {
+                fprintf(stderr, "Too many capture files (max %d)\n", MAX_REPLAY_FILES);
+                return 1;
+            }
+            replay[replay_count++] = optarg;
+            break;
+        case 'e':
+            enrich_on = 1;
+            break;
+        case OPT_USER:
+            enrich_user = optarg;
+            break;
+        case OPT_PASSWORD:
+            enrich_password = optarg;
+            break;
+        case OPT_ENRICH_CONNS:
+            enrich_conns = atoi(optarg);
+            if (enrich_conns <= 0 || enrich_conns > 4096) {
+                fprintf(stderr, "Invalid connection count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_ENRICH_TIMEOUT:
+            enrich_timeout_ms = atoi(optarg);
+            if (enrich_timeout_ms <= 0) {
+                fprintf(stderr, "Invalid enrichment timeout: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_METRICS:
+            ctx.metrics_path = optarg;
+            break;
+        case OPT_REPEAT:
+            ctx.probe_repeat = atoi(optarg);
+            if (ctx.probe_repeat < 0 || ctx.probe_repeat > 16) {
+                fprintf(stderr, "Invalid repeat count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case '6':
+            ipv6 = 1;
+            break;
+        case 'T': {
+            char *save = NULL;
+            for (char *name = strtok_r(optarg, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+                if (wsd_filter_add_type(&ctx.filter, name) < 0) {
+                    fprintf(stderr, "Unknown or too many types: %s\n", name);
+                    return 1;
+                }
+            }
+            break;
+        }
+        case 'S':
+            if (wsd_filter_add_scope(&ctx.filter, optarg) < 0) {
+                fprintf(stderr, "Invalid or too many scopes: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_MATCH_BY:
+            if (wsd_filter_set_match_by(&ctx.filter, optarg) < 0) {
+                fprintf(stderr, "Unsupported MatchBy rule: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_FORMAT:
+            format = wsd_output_parse_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "Unknown output format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_PROXY:
+            // Hellos and suppression answers carry an interface address
+            proxy_on = 1;
+            listen = 1;
+            ctx.use_if = 1;
+            break;
+        case OPT_MONITOR:
+            // Schedules are per interface
+            monitor.interval_ms = atoi(optarg);
+            if (monitor.interval_ms <= 0) {
+                fprintf(stderr, "Invalid monitor interval: %s\n", optarg);
+                return 1;
+            }
+            monitor_on = 1;
+            listen = 1;
+            ctx.use_if = 1;
+            break;
+        case OPT_INTERVAL:
+            if (wsd_monitor_add_rule(&monitor, optarg) < 0) {
+                fprintf(stderr, "Invalid interval (IFNAME=MS or CIDR=MS): %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_MAX_MISSED:
+            monitor.max_missed = atoi(optarg);
+            if (monitor.max_missed <= 0) {
+                fprintf(stderr, "Invalid missed Probe count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_WORKERS:
+            workers = atoi(optarg);
+            if (workers < 0 || workers > WSD_PIPELINE_MAX_WORKERS) {
+                fprintf(stderr, "Invalid worker count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    ctx.filter_active = wsd_filter_active(&ctx.filter);
+    sweep.filter = &ctx.filter;
+
+    // Sweeps are unicast IPv4 only
+    if (ipv6 && sweep.range_count > 0) {
+        fprintf(stderr, "--ipv6 cannot be combined with --sweep\n");
+        return 1;
+    }
+
+    if (monitor.rule_count > 0 && !monitor_on) {
+        fprintf(stderr, "--interval needs --monitor\n");
+        return 1;
+    }
+    if (monitor_on && sweep.range_count > 0) {
+        fprintf(stderr, "--monitor cannot be combined with --sweep\n");
+        return 1;
+    }
+
+    // The proxy answers from what it hears, a sweep never listens
+    if (proxy_on && sweep.range_count > 0) {
+        fprintf(stderr, "--proxy cannot be combined with --sweep\n");
+        return 1;
+    }
+
+    // Replays have no network to listen to, sweep or enrich from
+    if (replay_count > 0 && (listen || sweep.range_count > 0 || enrich_on)) {
+        fprintf(stderr, "--replay cannot be combined with --listen, --sweep or --enrich\n");
+        return 1;
+    }
+
+    // Structured output keeps the original stdout to itself; progress
+    // lines, summaries and "--metrics -" move over to stderr
+    if (format != WSD_OUTPUT_TEXT) {
+        int fd = dup(STDOUT_FILENO);
+        if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            perror("dup");
+            return 1;
+        }
+        if (wsd_output_init(&ctx.output, fd, (enum wsd_output_format)format, WSD_OUTPUT_DEFAULT_BUFFER) < 0) {
+            fprintf(stderr, "Out of memory for the output buffer\n");
+            return 1;
+        }
+    }
+
+    // 1. Pick the interfaces to probe on. IPv6 always needs them, FF02::C
+    // is link-local and has no default route to follow. A replay opens no sockets.
+    if (replay_count > 0) {
+        ctx.if_count = 0;
+        ctx.replay = 1;
+    } else if (ctx.use_if) {
+        ctx.if_count = enumerate_interfaces(ctx.ifs, MAX_INTERFACES, only, only_count, AF_INET);
+        if (ctx.if_count < 0) return 1;
+    } else {
+        memset(&ctx.ifs[0], 0, sizeof(ctx.ifs[0]));
+        ctx.ifs[0].family = AF_INET;
+        ctx.ifs[0].addr.s_addr = htonl(INADDR_ANY);
+        ctx.if_count = 1;
+    }
+    if (ipv6) {
+        int count6 = enumerate_interfaces(ctx.ifs + ctx.if_count, MAX_INTERFACES - ctx.if_count, only,
+                                          only_count, AF_INET6);
+        if (count6 < 0) return 1;
+        ctx.if_count += count6;
+    }
+    if (ctx.if_count == 0 && !ctx.replay) {
+        fprintf(stderr, "No usable interfaces found\n");
+        return 1;
+    }
+
+    if (monitor_on) ctx.monitor = &monitor;
+    if (proxy_on) {
+        if (wsd_proxy_init(&proxy) < 0) {
+            perror("getrandom");
+            return 1;
+        }
+        ctx.proxy = &proxy;
+    }
+
+    // 2. Receive thread and parser workers; a replay is read on the event loop
+    if (workers > 0 && !ctx.replay) {
+        if (wsd_pipeline_init(&pipeline, workers, WSD_PIPELINE_DEFAULT_DEPTH, batch) < 0) {
+            fprintf(stderr, "Cannot set up %d parser workers\n", workers);
+            return 1;
+        }
+        ctx.pipeline = &pipeline;
+        // Sweep replies relate to IDs of the sweep's own
+        if (sweep.range_count == 0) wsd_pipeline_set_correlator(&pipeline, &ctx.outstanding);
+    }
+
+    // 3. Sockets, epoll set and timer
+    if (ctx_open(&ctx, batch, rcvbuf, listen) < 0) {
+        ctx_close(&ctx);
+        return 1;
+    }
+
+    if (enrich_on) {
+        if (wsd_enrich_init(&enrich, ctx.epfd, ENRICH_TAG_BASE, enrich_conns, enrich_timeout_ms, enrich_user,
+                            enrich_password, on_device_info, &ctx) < 0) {
+            fprintf(stderr, "Out of memory for %d enrichment connections\n", enrich_conns);
+            ctx_close(&ctx);
+            return 1;
+        }
+        ctx.enrich = &enrich;
+    }
+
+    if (ctx.cache_path) load_cache(&ctx);
+    ctx.metrics_due = monotonic_ms() + METRICS_INTERVAL_MS;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    // 4. Probe and collect replies, once or continuously
+    if (ctx.replay) {
+        ret_code = run_replay(&ctx, replay, replay_count);
+    } else if (sweep.range_count > 0) {
+        ret_code = run_sweep(&ctx, &sweep, sweep_rate, sweep_inflight, sweep_retries, sweep_wait_ms);
+    } else if (ctx.monitor) {
+        ret_code = run_monitor(&ctx, timeout_ms);
+    } else if (listen) {
+        ret_code = run_listen(&ctx, reconcile_ms, timeout_ms);
+    } else {
+        ret_code = run_scan(&ctx, timeout_ms, quiet_ms, expect);
+    }
+
+    save_cache(&ctx);
+    write_metrics(&ctx);
+    if (ctx.enrich) wsd_enrich_free(ctx.enrich);
+    if (ctx.proxy) wsd_proxy_free(ctx.proxy);
+    ctx_close(&ctx);
+    return ret_code;
+}
@@ -0,0 +1,244 @@
+#include "onvif_discovery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsd_parser.h"
+#include "device_index.h"
+#include "wsd_probe.h"
+#include "wsd_filter.h"
+
+#define MULTICAST_IP "239.255.255.250"
+#define MULTICAST_PORT 3702
+#define RECV_BUF_SIZE 65536           // largest UDP payload
+#define PROBE_BUF_SIZE 4096
+
+struct onvif_discovery {
+    struct onvif_discovery_config cfg;
+    wsd_socket_t sock;
+    struct sockaddr_in multicast_addr;
+    struct device_index devices;
+    struct wsd_filter filter;         // pushed into the Probe and checked on every match
+    int64_t deadline;
+    struct wsd_repeat repeat;
+    char probe_id[WSD_MESSAGE_ID_SIZE];  // MessageID of the current Probe
+    char probe[PROBE_BUF_SIZE];
+    size_t probe_len;
+    char *buf;
+    struct wsd_message msg;
+};
+
+// Add each item of a list separated by spaces or commas to the filter.
+// Returns 0 on success, -1 if an item was rejected.
+static int add_items(struct wsd_filter *f, const char *list, int (*add)(struct wsd_filter *, const char *)) {
+    char item[512];
+
+    while (list && *list) {
+        size_t len = strcspn(list, " ,\t\r\n");
+        if (len >= sizeof(item)) return -1;
+        if (len > 0) {
+            memcpy(item, list, len);
+            item[len] = '\0';
+            if (add(f, item) < 0) return -1;
+        }
+        list += len;
+        if (*list) list++;
+    }
+    return 0;
+}
+
+struct onvif_discovery *onvif_discovery_create(const struct onvif_discovery_config *cfg) {
+    struct in_addr if_addr;
+
+    struct onvif_discovery *d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->cfg = *cfg;
+    if (d->cfg.timeout_ms <= 0) d->cfg.timeout_ms = ONVIF_DISCOVERY_DEFAULT_TIMEOUT_MS;
+    if (d->cfg.probe_repeat == 0) d->cfg.probe_repeat = WSD_MULTICAST_UDP_REPEAT;
+    d->repeat.due = -1;
+    d->sock = WSD_INVALID_SOCKET;
+    d->buf = malloc(RECV_BUF_SIZE);
+    if (!d->buf || device_index_init(&d->devices, 64) < 0) {
+        onvif_discovery_destroy(d);
+        return NULL;
+    }
+    if (add_items(&d->filter, cfg->types, wsd_filter_add_type) < 0 ||
+        add_items(&d->filter, cfg->scopes, wsd_filter_add_scope) < 0 ||
+        (cfg->match_by && wsd_filter_set_match_by(&d->filter, cfg->match_by) < 0)) {
+        onvif_discovery_destroy(d);
+        return NULL;
+    }
+
+    if (cfg->interface_addr && inet_pton(AF_INET, cfg->interface_addr, &if_addr) != 1) {
+        onvif_discovery_destroy(d);
+        return NULL;
+    }
+    d->sock = wsd_socket_open_udp4(cfg->interface_addr ? &if_addr : NULL);
+    if (d->sock == WSD_INVALID_SOCKET) {
+        onvif_discovery_destroy(d);
+        return NULL;
+    }
+
+    memset(&d->multicast_addr, 0, sizeof(d->multicast_addr));
+    d->multicast_addr.sin_family = AF_INET;
+    d->multicast_addr.sin_addr.s_addr = inet_addr(MULTICAST_IP);
+    d->multicast_addr.sin_port = htons(MULTICAST_PORT);
+    return d;
+}
+
+void onvif_discovery_destroy(struct onvif_discovery *d) {
+    if (!d) return;
+    if (d->sock != WSD_INVALID_SOCKET) wsd_socket_close(d->sock);
+    device_index_free(&d->devices);
+    wsd_filter_free(&d->filter);
+    free(d->buf);
+    free(d);
+}
+
+static int send_probe(struct onvif_discovery *d) {
+    return sendto(d->sock, d->probe, (int)d->probe_len, 0, (struct sockaddr *)&d->multicast_addr,
+                  sizeof(d->multicast_addr)) < 0 ? -1 : 0;
+}
+
+int onvif_discovery_start(struct onvif_discovery *d) {
+    if (wsd_generate_uuid(d->probe_id, sizeof(d->probe_id)) < 0) return -1;
+    d->probe_len = wsd_build_probe(d->probe, sizeof(d->probe), d->probe_id, &d->filter);
+    if (d->probe_len == 0 || send_probe(d) < 0) return -1;
+    int64_t now = wsd_monotonic_ms();
+    d->deadline = now + d->cfg.timeout_ms;
+    wsd_repeat_start(&d->repeat, d->cfg.probe_repeat > 0 ? d->cfg.probe_repeat : 0, now);
+    return 0;
+}
+
+wsd_socket_t onvif_discovery_socket(const struct onvif_discovery *d) {
+    return d->sock;
+}
+
+// Copy the value of the first scope starting with prefix
+static void scope_value(const char *scopes, const char *prefix, char *out, size_t size) {
+    struct wsd_view list = {scopes, strlen(scopes)};
+    struct wsd_view item;
+    size_t plen = strlen(prefix);
+
+    out[0] = '\0';
+    while (wsd_view_next_token(&list, &item)) {
+        if (!wsd_view_has_prefix(item, prefix)) continue;
+        item.ptr += plen;
+        item.len -= plen;
+        wsd_view_copy(item, out, size);
+        return;
+    }
+}
+
+static void report(struct onvif_discovery *d, enum onvif_device_event event, const struct device *rec,
+                   const struct sockaddr *from) {
+    struct onvif_device dev;
+
+    if (!d->cfg.on_device) return;
+    dev.event = event;
+    dev.endpoint = rec->key;
+    dev.xaddrs = rec->xaddrs;
+    dev.types = rec->types;
+    dev.scopes = rec->scopes;
+    dev.metadata_version = rec->metadata_version;
+    dev.address[0] = '\0';
+    if (from && from->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)from)->sin_addr, dev.address, sizeof(dev.address));
+    } else if (from && from->sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)from)->sin6_addr, dev.address, sizeof(dev.address));
+    }
+    scope_value(rec->scopes, "onvif://www.onvif.org/name/", dev.name, sizeof(dev.name));
+    scope_value(rec->scopes, "onvif://www.onvif.org/location/", dev.location, sizeof(dev.location));
+    scope_value(rec->scopes, "onvif://www.onvif.org/hardware/", dev.hardware, sizeof(dev.hardware));
+    d->cfg.on_device(d->cfg.user, &dev);
+}
+
+struct feed_state {
+    struct onvif_discovery *d;
+    const struct sockaddr *from;
+};
+
+static void on_merge(void *user, int change, struct device *rec) {
+    struct feed_state *st = user;
+
+    if (change == DEVICE_LEFT) {
+        report(st->d, ONVIF_DEVICE_LEFT, rec, st->from);
+        return;
+    }
+    if (!rec) return;
+    rec->last_seen = wsd_monotonic_ms();
+    if (change == DEVICE_NEW) {
+        report(st->d, ONVIF_DEVICE_FOUND, rec, st->from);
+    } else if (change == DEVICE_UPDATED) {
+        report(st->d, ONVIF_DEVICE_UPDATED, rec, st->from);
+    }
+}
+
+int onvif_discovery_feed(struct onvif_discovery *d, const char *buf, size_t len, const struct sockaddr *from) {
+    struct feed_state st = {d, from};
+    struct wsd_header hdr;
+
+    // Replies to someone else's Probe are dropped on their header alone
+    if (wsd_scan_header(buf, len, &hdr) == 0 && hdr.relates_to.len > 0 && !wsd_view_eq(hdr.relates_to, d->probe_id)) {
+        return 0;
+    }
+
+    // Truncated datagrams still report the matches that were complete
+    wsd_parse(buf, len, &d->msg);
+    return device_index_merge(&d->devices, &d->msg, &d->filter, from, on_merge, &st);
+}
+
+int onvif_discovery_process(struct onvif_discovery *d) {
+    int found = 0;
+
+    // A lost repeat is no worse than a lost Probe, so send errors are ignored
+    if (wsd_repeat_due(&d->repeat, wsd_monotonic_ms())) send_probe(d);
+
+    for (;;) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+
+        int n = (int)recvfrom(d->sock, d->buf, RECV_BUF_SIZE, 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            if (wsd_socket_would_block()) break;
+#ifdef _WIN32
+            // ICMP port unreachable from an earlier send, not fatal for UDP
+            if (wsd_socket_error() == WSAECONNRESET) continue;
+#endif
+            return -1;
+        }
+        if (n == 0) continue;
+        found += onvif_discovery_feed(d, d->buf, (size_t)n, (struct sockaddr *)&from);
+    }
+    return found;
+}
+
+int onvif_discovery_timeout_ms(const struct onvif_discovery *d) {
+    int64_t left = d->deadline - wsd_monotonic_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+int onvif_discovery_next_ms(const struct onvif_discovery *d) {
+    int left = onvif_discovery_timeout_ms(d);
+    if (d->repeat.due >= 0) {
+        int64_t until = d->repeat.due - wsd_monotonic_ms();
+        if (until < left) left = until > 0 ? (int)until : 0;
+    }
+    return left;
+}
+
+size_t onvif_discovery_count(const struct onvif_discovery *d) {
+    return d->devices.count;
+}
+
+int onvif_discovery_run(struct onvif_discovery *d) {
+    if (onvif_discovery_start(d) < 0) return -1;
+
+    while (onvif_discovery_timeout_ms(d) > 0) {
+        int ready = wsd_socket_wait_readable(d->sock, onvif_discovery_next_ms(d));
+        if (ready < 0) return -1;
+        if (onvif_discovery_process(d) < 0) return -1;
+    }
+    return (int)d->devices.count;
+}
@@ -0,0 +1,101 @@
+#ifndef ONVIF_DISCOVERY_H
+#define ONVIF_DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wsd_socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libonvifdiscover: ONVIF WS-Discovery as an embeddable, non-blocking library.
+// A scan owns one UDP socket. Start it, wait for the socket in whatever
+// event loop the application already has (select, poll, epoll...), call
+// onvif_discovery_process() whenever it is readable or
+// onvif_discovery_next_ms() has passed, and stop once
+// onvif_discovery_timeout_ms() reaches 0. Every device that is found,
+// changes its metadata or says Bye is reported through a callback with
+// its parsed fields, merged by EndpointReference. Datagrams the
+// application receives itself can be handed to onvif_discovery_feed().
+
+#define ONVIF_DISCOVERY_DEFAULT_TIMEOUT_MS 5000
+
+enum onvif_device_event {
+    ONVIF_DEVICE_FOUND = 1,
+    ONVIF_DEVICE_UPDATED,             // MetadataVersion changed
+    ONVIF_DEVICE_LEFT                 // Bye received
+};
+
+// Only valid during the callback
+struct onvif_device {
+    enum onvif_device_event event;
+    const char *endpoint;             // normalized EndpointReference
+    const char *xaddrs;               // service URLs, space separated
+    const char *types;
+    const char *scopes;               // entity-decoded, space separated
+    uint32_t metadata_version;
+    char address[46];                 // sender IP of this message
+    char name[128];                   // onvif://www.onvif.org/name/, "" if absent
+    char location[128];               // onvif://www.onvif.org/location/
+    char hardware[128];               // onvif://www.onvif.org/hardware/
+};
+
+typedef void (*onvif_device_cb)(void *user, const struct onvif_device *dev);
+
+struct onvif_discovery_config {
+    const char *interface_addr;       // IPv4 address to probe from, NULL for the default route
+    int timeout_ms;                   // scan length, 0 for the default
+    int probe_repeat;                 // Probe retransmissions, 0 for the default (2), < 0 for none
+    const char *types;                // e.g. "NVT Device" or "dn:NetworkVideoTransmitter", NULL for NVT
+    const char *scopes;               // space separated scope URIs to match, NULL for any
+    const char *match_by;             // "rfc3986" (NULL) or "strcmp"
+    onvif_device_cb on_device;
+    void *user;
+};
+
+struct onvif_discovery;
+
+// Open the socket. The caller must have called wsd_socket_startup().
+// Returns NULL on error.
+struct onvif_discovery *onvif_discovery_create(const struct onvif_discovery_config *cfg);
+void onvif_discovery_destroy(struct onvif_discovery *d);
+
+// Send a Probe and start the scan window. Can be called again to rescan;
+// devices already reported are only reported again if they change.
+// Returns 0 on success, -1 on error.
+int onvif_discovery_start(struct onvif_discovery *d);
+
+// The socket to wait on for readability
+wsd_socket_t onvif_discovery_socket(const struct onvif_discovery *d);
+
+// Read every pending datagram without blocking, and send a Probe repeat
+// if one is due. Returns the number of new devices, or -1 on a socket error.
+int onvif_discovery_process(struct onvif_discovery *d);
+
+// Handle one datagram received by the caller; from may be NULL. Replies
+// whose RelatesTo is not the current Probe are ignored.
+// Returns the number of new devices.
+int onvif_discovery_feed(struct onvif_discovery *d, const char *buf, size_t len, const struct sockaddr *from);
+
+// Milliseconds left in the scan window, 0 once it is over
+int onvif_discovery_timeout_ms(const struct onvif_discovery *d);
+
+// How long to wait for the socket before calling onvif_discovery_process()
+// anyway, so the Probe repeats go out on time. Never more than
+// onvif_discovery_timeout_ms().
+int onvif_discovery_next_ms(const struct onvif_discovery *d);
+
+// Number of devices currently known
+size_t onvif_discovery_count(const struct onvif_discovery *d);
+
+// Blocking convenience: start and process until the window closes.
+// Returns the number of devices known at the end, or -1 on error.
+int onvif_discovery_run(struct onvif_discovery *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
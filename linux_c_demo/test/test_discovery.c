@@ -0,0 +1,401 @@
+// libonvifdiscover tests: canned ProbeMatches, Hello and Bye messages fed
+// to a scan, directly and over the loopback interface, checked against
+// the callbacks they produce.
+//
+// Usage: test_discovery
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "device_index.h"
+#include "onvif_discovery.h"
+#include "wsd_parser.h"
+
+#define MULTICAST_IP "239.255.255.250"
+#define MULTICAST_PORT 3702
+#define MAX_EVENTS 16
+#define CAM_XADDR "http://192.0.2.10/onvif/device_service"
+
+static int failures;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+// What the callback saw, copied out since the strings are only valid during it
+struct event {
+    enum onvif_device_event event;
+    char endpoint[128];
+    char xaddrs[256];
+    char address[46];
+    char name[128];
+    char location[128];
+    char hardware[128];
+    uint32_t metadata_version;
+};
+
+struct recorder {
+    struct event events[MAX_EVENTS];
+    int count;
+};
+
+static void on_device(void *user, const struct onvif_device *dev) {
+    struct recorder *r = user;
+    if (r->count == MAX_EVENTS) return;
+    struct event *e = &r->events[r->count++];
+    e->event = dev->event;
+    snprintf(e->endpoint, sizeof(e->endpoint), "%s", dev->endpoint);
+    snprintf(e->xaddrs, sizeof(e->xaddrs), "%s", dev->xaddrs);
+    snprintf(e->address, sizeof(e->address), "%s", dev->address);
+    snprintf(e->name, sizeof(e->name), "%s", dev->name);
+    snprintf(e->location, sizeof(e->location), "%s", dev->location);
+    snprintf(e->hardware, sizeof(e->hardware), "%s", dev->hardware);
+    e->metadata_version = dev->metadata_version;
+}
+
+static const char envelope[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+    "xmlns:a=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+    "xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "
+    "xmlns:dn=\"http://www.onvif.org/ver10/network/wsdl\">"
+    "<s:Header>"
+    "<a:MessageID>urn:uuid:%08x-0000-4000-8000-000000000000</a:MessageID>"
+    "%s"
+    "<a:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/%s</a:Action>"
+    "</s:Header>"
+    "<s:Body>%s</s:Body></s:Envelope>";
+
+static const char match[] =
+    "<a:EndpointReference><a:Address>%s</a:Address></a:EndpointReference>"
+    "<d:Types>dn:NetworkVideoTransmitter</d:Types>"
+    "<d:Scopes>onvif://www.onvif.org/name/%s onvif://www.onvif.org/location/%s "
+    "onvif://www.onvif.org/hardware/X100</d:Scopes>"
+    "<d:XAddrs>%s</d:XAddrs>"
+    "<d:MetadataVersion>%u</d:MetadataVersion>";
+
+// A ProbeMatches answering relates_to (NULL for none), or a Hello or Bye
+static size_t build(char *out, size_t size, const char *action, const char *relates_to, const char *endpoint,
+                    const char *name, const char *location, const char *xaddrs, unsigned version) {
+    static unsigned serial;
+    char rel[128] = "";
+    char body[1024];
+    char fields[768];
+
+    if (relates_to) snprintf(rel, sizeof(rel), "<a:RelatesTo>%s</a:RelatesTo>", relates_to);
+    snprintf(fields, sizeof(fields), match, endpoint, name, location, xaddrs, version);
+    if (strcmp(action, "ProbeMatches") == 0) {
+        snprintf(body, sizeof(body), "<d:ProbeMatches><d:ProbeMatch>%s</d:ProbeMatch></d:ProbeMatches>", fields);
+    } else if (strcmp(action, "Bye") == 0) {
+        snprintf(body, sizeof(body),
+                 "<d:Bye><a:EndpointReference><a:Address>%s</a:Address></a:EndpointReference></d:Bye>", endpoint);
+    } else {
+        snprintf(body, sizeof(body), "<d:%s>%s</d:%s>", action, fields, action);
+    }
+    return (size_t)snprintf(out, size, envelope, ++serial, rel, action, body);
+}
+
+static struct sockaddr_in sender(const char *ip) {
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(MULTICAST_PORT);
+    inet_pton(AF_INET, ip, &sin.sin_addr);
+    return sin;
+}
+
+// A socket in the discovery group on the loopback interface, to read the
+// Probe a scan sends. Returns -1 if the sandbox has no multicast on lo.
+static int open_group_socket(void) {
+    struct sockaddr_in addr = sender("0.0.0.0");
+    struct ip_mreq mreq;
+    struct timeval tv = {2, 0};
+    int on = 1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+    mreq.imr_multiaddr.s_addr = inet_addr(MULTICAST_IP);
+    mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Start a scan from the loopback interface and read back its Probe's
+// MessageID, which every ProbeMatches has to relate to
+static int start_scan(struct onvif_discovery *d, int group, char *probe_id, size_t size) {
+    char buf[4096];
+    struct wsd_header hdr;
+
+    if (onvif_discovery_start(d) < 0) return -1;
+    for (;;) {
+        ssize_t n = recv(group, buf, sizeof(buf), 0);
+        if (n <= 0) return -1;
+        if (wsd_scan_header(buf, (size_t)n, &hdr) < 0 || !wsd_view_has_suffix(hdr.action, "/Probe")) continue;
+        wsd_view_copy(hdr.message_id, probe_id, size);
+        return 0;
+    }
+}
+
+static void test_probe_matches(int group) {
+    struct recorder rec = {0};
+    struct onvif_discovery_config cfg = {0};
+    char probe_id[128];
+    char msg[4096];
+    size_t len;
+
+    cfg.interface_addr = "127.0.0.1";
+    cfg.timeout_ms = 1000;
+    cfg.probe_repeat = -1;
+    cfg.on_device = on_device;
+    cfg.user = &rec;
+    struct onvif_discovery *d = onvif_discovery_create(&cfg);
+    CHECK(d != NULL);
+    if (!d) return;
+    CHECK(start_scan(d, group, probe_id, sizeof(probe_id)) == 0);
+    struct sockaddr_in from = sender("192.0.2.10");
+    const struct sockaddr *sa = (const struct sockaddr *)&from;
+
+    // A reply to the Probe: reported once, with the scopes picked apart
+    len = build(msg, sizeof(msg), "ProbeMatches", probe_id, "urn:uuid:AAAA-1", "Cam%20One", "Dock", CAM_XADDR, 1);
+    CHECK(onvif_discovery_feed(d, msg, len, sa) == 1);
+    CHECK(rec.count == 1);
+    CHECK(rec.events[0].event == ONVIF_DEVICE_FOUND);
+    CHECK(strcmp(rec.events[0].endpoint, "aaaa-1") == 0);
+    CHECK(strcmp(rec.events[0].address, "192.0.2.10") == 0);
+    CHECK(strcmp(rec.events[0].xaddrs, CAM_XADDR) == 0);
+    CHECK(strcmp(rec.events[0].name, "Cam%20One") == 0);
+    CHECK(strcmp(rec.events[0].location, "Dock") == 0);
+    CHECK(strcmp(rec.events[0].hardware, "X100") == 0);
+    CHECK(rec.events[0].metadata_version == 1);
+
+    // The same reply again, or one to somebody else's Probe, is not news
+    len = build(msg, sizeof(msg), "ProbeMatches", probe_id, "urn:uuid:AAAA-1", "Cam%20One", "Dock", CAM_XADDR, 1);
+    CHECK(onvif_discovery_feed(d, msg, len, sa) == 0);
+    len = build(msg, sizeof(msg), "ProbeMatches", "urn:uuid:00000000-0000-4000-8000-00000000dead", "urn:uuid:BBBB-2",
+                "Other", "Dock", "http://192.0.2.11/", 1);
+    CHECK(onvif_discovery_feed(d, msg, len, sa) == 0);
+    CHECK(rec.count == 1);
+    CHECK(onvif_discovery_count(d) == 1);
+
+    // A new MetadataVersion is an update, and the EndpointReference is
+    // matched whatever its spelling
+    len = build(msg, sizeof(msg), "ProbeMatches", probe_id, "uuid:aaaa-1", "Cam%20One", "Yard", CAM_XADDR, 2);
+    CHECK(onvif_discovery_feed(d, msg, len, sa) == 0);
+    CHECK(rec.count == 2);
+    CHECK(rec.events[1].event == ONVIF_DEVICE_UPDATED);
+    CHECK(strcmp(rec.events[1].location, "Yard") == 0);
+    CHECK(rec.events[1].metadata_version == 2);
+
+    // A late reply with an older MetadataVersion is stale, not news
+    len = build(msg, sizeof(msg), "ProbeMatches", probe_id, "urn:uuid:AAAA-1", "Cam%20One", "Dock", CAM_XADDR, 1);
+    CHECK(onvif_discovery_feed(d, msg, len, sa) == 0);
+    CHECK(rec.count == 2);
+
+    // A Hello needs no Probe, a Bye drops the device
+    len = build(msg, sizeof(msg), "Hello", NULL, "urn:uuid:CCCC-3", "Door", "Gate", "http://192.0.2.12/", 1);
+    CHECK(onvif_discovery_feed(d, msg, len, NULL) == 1);
+    CHECK(onvif_discovery_count(d) == 2);
+    len = build(msg, sizeof(msg), "Bye", NULL, "urn:uuid:AAAA-1", "", "", "", 0);
+    CHECK(onvif_discovery_feed(d, msg, len, sa) == 0);
+    CHECK(rec.count == 4);
+    CHECK(rec.events[2].event == ONVIF_DEVICE_FOUND && strcmp(rec.events[2].name, "Door") == 0);
+    CHECK(rec.events[3].event == ONVIF_DEVICE_LEFT && strcmp(rec.events[3].endpoint, "aaaa-1") == 0);
+    CHECK(onvif_discovery_count(d) == 1);
+
+    // Something that is not SOAP at all
+    CHECK(onvif_discovery_feed(d, "garbage", 7, sa) == 0);
+    CHECK(rec.count == 4);
+    onvif_discovery_destroy(d);
+}
+
+static void test_scope_filter(int group) {
+    struct recorder rec = {0};
+    struct onvif_discovery_config cfg = {0};
+    char probe_id[128];
+    char msg[4096];
+    size_t len;
+
+    cfg.interface_addr = "127.0.0.1";
+    cfg.timeout_ms = 1000;
+    cfg.probe_repeat = -1;
+    cfg.scopes = "onvif://www.onvif.org/location/Dock";
+    cfg.on_device = on_device;
+    cfg.user = &rec;
+    struct onvif_discovery *d = onvif_discovery_create(&cfg);
+    CHECK(d != NULL);
+    if (!d) return;
+    CHECK(start_scan(d, group, probe_id, sizeof(probe_id)) == 0);
+
+    // Devices are free to ignore the Probe's Scopes; the library is not
+    len = build(msg, sizeof(msg), "ProbeMatches", probe_id, "urn:uuid:DDDD-4", "A", "Yard", "http://192.0.2.20/", 1);
+    CHECK(onvif_discovery_feed(d, msg, len, NULL) == 0);
+    len = build(msg, sizeof(msg), "ProbeMatches", probe_id, "urn:uuid:EEEE-5", "B", "Dock/Bay3",
+                "http://192.0.2.21/", 1);
+    CHECK(onvif_discovery_feed(d, msg, len, NULL) == 1);
+    CHECK(rec.count == 1 && strcmp(rec.events[0].endpoint, "eeee-5") == 0);
+    onvif_discovery_destroy(d);
+}
+
+// Numeric character references come out as UTF-8; ones that name no
+// character are left alone
+static void test_entities(void) {
+    struct recorder rec = {0};
+    struct onvif_discovery_config cfg = {0};
+    char msg[4096];
+
+    cfg.on_device = on_device;
+    cfg.user = &rec;
+    struct onvif_discovery *d = onvif_discovery_create(&cfg);
+    CHECK(d != NULL);
+    if (!d) return;
+    size_t len = build(msg, sizeof(msg), "Hello", NULL, "urn:uuid:1111-6", "Caf&#233;&#x1F4F7;&#8364;",
+                       "A&#xD800;&#1114112;&amp;&#x41;", "http://192.0.2.30/", 1);
+    CHECK(onvif_discovery_feed(d, msg, len, NULL) == 1);
+    CHECK(rec.count == 1);
+    CHECK(strcmp(rec.events[0].name, "Caf\xC3\xA9\xF0\x9F\x93\xB7\xE2\x82\xAC") == 0);
+    CHECK(strcmp(rec.events[0].location, "A&#xD800;&#1114112;&A") == 0);
+    onvif_discovery_destroy(d);
+}
+
+static struct wsd_view view(const char *s) {
+    struct wsd_view v = {s, strlen(s)};
+    return v;
+}
+
+// A dual-stack device answering over IPv4 and IPv6 in turn keeps both
+// addresses and both XAddrs; once both are known a reply is not a change
+static void test_address_merge(void) {
+    struct device_index idx;
+    struct wsd_match v4, v6;
+    struct sockaddr_in from4 = sender("192.0.2.30");
+    struct sockaddr_in6 from6;
+    struct device *d = NULL;
+
+    memset(&v4, 0, sizeof(v4));
+    v4.address = view("urn:uuid:EEEE-5");
+    v4.types = view("dn:NetworkVideoTransmitter");
+    v4.xaddrs = view("http://192.0.2.30/onvif/device_service");
+    v4.metadata_version = view("1");
+    v6 = v4;
+    v6.xaddrs = view("http://[2001:db8::30]/onvif/device_service");
+    memset(&from6, 0, sizeof(from6));
+    from6.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::30", &from6.sin6_addr);
+
+    CHECK(device_index_init(&idx, 4) == 0);
+    CHECK(device_index_update(&idx, &v4, (struct sockaddr *)&from4, &d) == DEVICE_NEW);
+    CHECK(device_index_update(&idx, &v6, (struct sockaddr *)&from6, &d) == DEVICE_MERGED);
+    CHECK(d->changes == (DEVICE_CHANGED_ADDRS | DEVICE_CHANGED_XADDRS));
+    for (int i = 0; i < 4; i++) {
+        CHECK(device_index_update(&idx, &v4, (struct sockaddr *)&from4, &d) == DEVICE_UNCHANGED);
+        CHECK(device_index_update(&idx, &v6, (struct sockaddr *)&from6, &d) == DEVICE_UNCHANGED);
+    }
+    CHECK(d->addr_count == 2 && d->addrs[0].family == AF_INET && d->addrs[1].family == AF_INET6);
+    CHECK(strcmp(d->xaddrs, "http://192.0.2.30/onvif/device_service "
+                            "http://[2001:db8::30]/onvif/device_service") == 0);
+
+    // A full set makes room by ageing out the stalest IPv4 address
+    for (int i = 0; i < DEVICE_MAX_ADDRS; i++) {
+        char ip[16];
+        snprintf(ip, sizeof(ip), "192.0.2.%d", 40 + i);
+        struct sockaddr_in other = sender(ip);
+        CHECK(device_index_update(&idx, &v4, (struct sockaddr *)&other, &d) == DEVICE_MERGED);
+    }
+    CHECK(d->addr_count == DEVICE_MAX_ADDRS);
+    int v6_kept = 0;
+    for (int i = 0; i < d->addr_count; i++) v6_kept += d->addrs[i].family == AF_INET6;
+    CHECK(v6_kept == 1);
+
+    // So does a full XAddr list, oldest first
+    v4.xaddrs = view("http://a/ http://b/ http://c/ http://d/ http://e/ http://f/ http://g/ http://h/");
+    CHECK(device_index_update(&idx, &v4, (struct sockaddr *)&from4, &d) == DEVICE_MERGED);
+    CHECK(strcmp(d->xaddrs, "http://a/ http://b/ http://c/ http://d/ http://e/ http://f/ http://g/ "
+                            "http://h/") == 0);
+    device_index_free(&idx);
+}
+
+// Replies sent to the scan's socket, picked up by onvif_discovery_process()
+static void test_socket(int group) {
+    struct recorder rec = {0};
+    struct onvif_discovery_config cfg = {0};
+    struct sockaddr_in to;
+    socklen_t to_len = sizeof(to);
+    char probe_id[128];
+    char msg[4096];
+
+    cfg.interface_addr = "127.0.0.1";
+    cfg.timeout_ms = 300;
+    cfg.probe_repeat = -1;
+    cfg.on_device = on_device;
+    cfg.user = &rec;
+    struct onvif_discovery *d = onvif_discovery_create(&cfg);
+    CHECK(d != NULL);
+    if (!d) return;
+    CHECK(start_scan(d, group, probe_id, sizeof(probe_id)) == 0);
+    CHECK(getsockname(onvif_discovery_socket(d), (struct sockaddr *)&to, &to_len) == 0);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    for (int i = 0; i < 3; i++) {
+        char endpoint[64], xaddr[64];
+        snprintf(endpoint, sizeof(endpoint), "urn:uuid:FFFF-%d", i);
+        snprintf(xaddr, sizeof(xaddr), "http://127.0.0.1:%d/onvif/device_service", 8000 + i);
+        size_t len = build(msg, sizeof(msg), "ProbeMatches", probe_id, endpoint, "N", "L", xaddr, 1);
+        CHECK(sendto(sock, msg, len, 0, (struct sockaddr *)&to, sizeof(to)) == (ssize_t)len);
+    }
+    close(sock);
+
+    // The blocking loop reads them all and then the window closes
+    int found = 0;
+    while (onvif_discovery_timeout_ms(d) > 0) {
+        usleep(20000);
+        int n = onvif_discovery_process(d);
+        CHECK(n >= 0);
+        if (n > 0) found += n;
+    }
+    CHECK(found == 3);
+    CHECK(rec.count == 3);
+    for (int i = 0; i < rec.count; i++) {
+        CHECK(rec.events[i].event == ONVIF_DEVICE_FOUND && strcmp(rec.events[i].address, "127.0.0.1") == 0);
+    }
+    onvif_discovery_destroy(d);
+}
+
+int main(void) {
+    if (wsd_socket_startup() < 0) return 1;
+    int group = open_group_socket();
+    if (group < 0) {
+        perror("multicast on lo");
+        return 1;
+    }
+
+    test_probe_matches(group);
+    test_scope_filter(group);
+    test_entities();
+    test_address_merge();
+    test_socket(group);
+
+    close(group);
+    wsd_socket_cleanup();
+    if (failures) {
+        fprintf(stderr, "test_discovery: %d failed\n", failures);
+        return 1;
+    }
+    printf("test_discovery: ok\n");
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Enrichment test: a stub ONVIF device service on 127.0.0.1 answers each
+// GetDeviceInformation according to its path, with the response framed
+// by Content-Length, chunked or by closing the connection, with a 401,
+// a SOAP Fault or a chunk size past the end of the response. Responses
+// are written in pieces so the client sees partial reads. The devices
+// that answer then get a GetCapabilities, which one of them faults.
+// wsd_enrich runs against it on its own epoll set and each device's
+// result is checked, along with the service XAddrs, the escaping of the
+// WS-Security user name in the request and the refusal of IPv6 XAddrs.
+//
+// Usage: test_enrich
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "wsd_enrich.h"
+
+#define TAG_BASE 0x40000000u
+#define USER "ad<min>&\"x\""
+#define USER_XML "ad&lt;min&gt;&amp;&quot;x&quot;"
+
+static int failures;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+static const char info_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+    "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\"><s:Body>"
+    "<tds:GetDeviceInformationResponse>"
+    "<tds:Manufacturer>Acme &amp; Sons</tds:Manufacturer>"
+    "<tds:Model>Cam-9</tds:Model>"
+    "<tds:FirmwareVersion>4.2.1</tds:FirmwareVersion>"
+    "<tds:SerialNumber>SN0042</tds:SerialNumber>"
+    "<tds:HardwareId>HW7</tds:HardwareId>"
+    "</tds:GetDeviceInformationResponse>"
+    "</s:Body></s:Envelope>";
+
+static const char capabilities_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+    "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\" "
+    "xmlns:tt=\"http://www.onvif.org/ver10/schema\"><s:Body>"
+    "<tds:GetCapabilitiesResponse><tds:Capabilities>"
+    "<tt:Analytics><tt:XAddr>http://127.0.0.1/onvif/analytics</tt:XAddr></tt:Analytics>"
+    "<tt:Device><tt:XAddr>http://127.0.0.1/onvif/device_service</tt:XAddr>"
+    "<tt:Network><tt:IPFilter>false</tt:IPFilter></tt:Network></tt:Device>"
+    "<tt:Events><tt:XAddr>http://127.0.0.1/onvif/events?a=1&amp;b=2</tt:XAddr></tt:Events>"
+    "<tt:Imaging></tt:Imaging>"
+    "<tt:Media><tt:XAddr>http://127.0.0.1/onvif/media</tt:XAddr>"
+    "<tt:StreamingCapabilities><tt:RTPMulticast>false</tt:RTPMulticast></tt:StreamingCapabilities>"
+    "</tt:Media>"
+    "</tds:Capabilities></tds:GetCapabilitiesResponse>"
+    "</s:Body></s:Envelope>";
+
+static const char fault_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\"><s:Body>"
+    "<s:Fault><s:Code><s:Value>s:Sender</s:Value></s:Code>"
+    "<s:Reason><s:Text xml:lang=\"en\">Sender not authorized</s:Text></s:Reason>"
+    "</s:Fault></s:Body></s:Envelope>";
+
+// One stub endpoint: its path and what the client should report
+struct endpoint {
+    const char *path;
+    const char *error;                // NULL when GetDeviceInformation succeeds
+};
+
+static const struct endpoint endpoints[] = {
+    {"/length", NULL},
+    {"/chunked", NULL},
+    {"/close", NULL},
+    {"/unauthorized", "HTTP 401 (credentials required)"},
+    {"/fault", "HTTP 500: Sender not authorized"},
+    {"/badchunk", "malformed chunked encoding"},
+};
+
+#define ENDPOINT_COUNT (int)(sizeof(endpoints) / sizeof(endpoints[0]))
+
+struct server {
+    int listen_fd;
+    int port;
+    int expected;                     // connections to serve
+    int requests;
+    int escaped_user;                 // requests carrying USER_XML as the Username
+};
+
+struct result {
+    int done;
+    int ok;
+    char error[256];
+    struct device_info info;
+};
+
+static void send_piece(int fd, const char *s, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, s, len, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        s += n;
+        len -= (size_t)n;
+    }
+    usleep(5000);
+}
+
+static void send_str(int fd, const char *s) {
+    send_piece(fd, s, strlen(s));
+}
+
+// Read one request: headers, then Content-Length bytes of body
+static int read_request(int fd, char *buf, size_t size) {
+    size_t len = 0;
+
+    for (;;) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 2000) <= 0) return -1;
+        ssize_t n = recv(fd, buf + len, size - 1 - len, 0);
+        if (n <= 0) return -1;
+        len += (size_t)n;
+        buf[len] = '\0';
+        char *hdr_end = strstr(buf, "\r\n\r\n");
+        const char *cl = strcasestr(buf, "Content-Length:");
+        if (hdr_end && cl && len >= (size_t)(hdr_end + 4 - buf) + strtoul(cl + 15, NULL, 10)) return (int)len;
+        if (len == size - 1) return -1;
+    }
+}
+
+// GetCapabilities: /close faults it, the others answer it
+static void respond_capabilities(int fd, const char *path) {
+    char head[256];
+    int fault = strcmp(path, "/close") == 0;
+    const char *body = fault ? fault_body : capabilities_body;
+
+    snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: application/soap+xml\r\n"
+             "Content-Length: %zu\r\n\r\n", fault ? "500 Internal Server Error" : "200 OK", strlen(body));
+    send_str(fd, head);
+    send_str(fd, body);
+}
+
+static void respond(int fd, const char *path) {
+    char head[256];
+    size_t half = sizeof(info_body) / 2;
+
+    if (strcmp(path, "/length") == 0) {
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/soap+xml\r\n"
+                 "Content-Length: %zu\r\n\r\n", sizeof(info_body) - 1);
+        send_str(fd, head);
+        send_piece(fd, info_body, half);
+        send_str(fd, info_body + half);
+    } else if (strcmp(path, "/chunked") == 0) {
+        send_str(fd, "HTTP/1.1 200 OK\r\nContent-Type: application/soap+xml\r\nTransfer-Encoding: chunked\r\n\r\n");
+        snprintf(head, sizeof(head), "%zx\r\n", half);
+        send_str(fd, head);
+        send_piece(fd, info_body, half);
+        snprintf(head, sizeof(head), "\r\n%zx;ext=1\r\n", sizeof(info_body) - 1 - half);
+        send_str(fd, head);
+        send_str(fd, info_body + half);
+        send_str(fd, "\r\n0\r\n\r\n");
+    } else if (strcmp(path, "/close") == 0) {
+        send_str(fd, "HTTP/1.0 200 OK\r\nContent-Type: application/soap+xml\r\n\r\n");
+        send_piece(fd, info_body, half);
+        send_str(fd, info_body + half);
+    } else if (strcmp(path, "/unauthorized") == 0) {
+        send_str(fd, "HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Digest realm=\"onvif\"\r\n"
+                 "Content-Length: 0\r\n\r\n");
+    } else if (strcmp(path, "/fault") == 0) {
+        snprintf(head, sizeof(head), "HTTP/1.1 500 Internal Server Error\r\nContent-Type: application/soap+xml\r\n"
+                 "Content-Length: %zu\r\n\r\n", sizeof(fault_body) - 1);
+        send_str(fd, head);
+        send_str(fd, fault_body);
+    } else if (strcmp(path, "/badchunk") == 0) {
+        // size + 2 wraps around if the size is not checked against the data
+        send_str(fd, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+        send_str(fd, "fffffffffffffffe\r\n<s:Envelope/>\r\n");
+        usleep(50000);
+    }
+}
+
+static void *server_main(void *arg) {
+    struct server *s = arg;
+    char req[8192], path[64];
+
+    for (int i = 0; i < s->expected; i++) {
+        struct pollfd pfd = {s->listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 5000) <= 0) break;
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0) break;
+        if (read_request(fd, req, sizeof(req)) > 0 && sscanf(req, "POST %63s HTTP/1.1", path) == 1) {
+            s->requests++;
+            if (strstr(req, "<Username>" USER_XML "</Username>")) s->escaped_user++;
+            if (strstr(req, "<tds:GetCapabilities>")) respond_capabilities(fd, path);
+            else respond(fd, path);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static void on_info(void *user, const char *key, const struct device_info *info, const char *error) {
+    struct result *results = user;
+    int i = atoi(key);
+
+    if (i < 0 || i >= ENDPOINT_COUNT) return;
+    results[i].done++;
+    results[i].ok = info != NULL;
+    if (info) results[i].info = *info;
+    if (error) snprintf(results[i].error, sizeof(results[i].error), "%s", error);
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int main(void) {
+    static struct wsd_enrich eng;
+    struct result results[ENDPOINT_COUNT];
+    struct server srv = {0};
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+
+    memset(results, 0, sizeof(results));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    srv.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv.listen_fd < 0 || bind(srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(srv.listen_fd, ENDPOINT_COUNT) < 0 ||
+        getsockname(srv.listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("stub server");
+        return 1;
+    }
+    srv.port = ntohs(addr.sin_port);
+    for (int i = 0; i < ENDPOINT_COUNT; i++) srv.expected += endpoints[i].error ? 1 : 2;
+    if (pthread_create(&thread, NULL, server_main, &srv) != 0) return 1;
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0 || wsd_enrich_init(&eng, epfd, TAG_BASE, 2, 3000, USER, "secret", on_info, results) < 0) {
+        perror("wsd_enrich_init");
+        return 1;
+    }
+
+    // Keys are the endpoint numbers; the first XAddr that is not http:// is skipped
+    for (int i = 0; i < ENDPOINT_COUNT; i++) {
+        char key[16], xaddrs[160];
+        snprintf(key, sizeof(key), "%d", i);
+        snprintf(xaddrs, sizeof(xaddrs), "https://127.0.0.1/onvif http://127.0.0.1:%d%s", srv.port,
+                 endpoints[i].path);
+        CHECK(wsd_enrich_submit(&eng, key, xaddrs, now_ms()) == 0);
+    }
+    CHECK(wsd_enrich_submit(&eng, "x", "http://camera.local/onvif/device_service", now_ms()) ==
+          WSD_ENRICH_NO_XADDR);
+    CHECK(wsd_enrich_submit(&eng, "x", "https://127.0.0.1/onvif http://[fe80::1%25eth0]/onvif/device_service",
+                            now_ms()) == WSD_ENRICH_IPV6_ONLY);
+
+    int64_t give_up = now_ms() + 10000;
+    while (wsd_enrich_busy(&eng) && now_ms() < give_up) {
+        struct epoll_event events[8];
+        int64_t next = wsd_enrich_next_deadline(&eng);
+        int wait = next < 0 ? 100 : (int)(next - now_ms());
+        int n = epoll_wait(epfd, events, 8, wait < 0 ? 0 : wait > 100 ? 100 : wait);
+        for (int e = 0; e < n; e++) wsd_enrich_on_event(&eng, events[e].data.u32, events[e].events, now_ms());
+        wsd_enrich_expire(&eng, now_ms());
+    }
+    pthread_join(thread, NULL);
+
+    for (int i = 0; i < ENDPOINT_COUNT; i++) {
+        const struct result *r = &results[i];
+        CHECK(r->done == 1);
+        if (endpoints[i].error) {
+            if (r->ok || strcmp(r->error, endpoints[i].error) != 0) {
+                fprintf(stderr, "%s: expected \"%s\", got \"%s\"\n", endpoints[i].path, endpoints[i].error,
+                        r->ok ? "success" : r->error);
+                failures++;
+            }
+            continue;
+        }
+        if (!r->ok) {
+            fprintf(stderr, "%s: %s\n", endpoints[i].path, r->error);
+            failures++;
+            continue;
+        }
+        CHECK(strcmp(r->info.manufacturer, "Acme & Sons") == 0);
+        CHECK(strcmp(r->info.model, "Cam-9") == 0);
+        CHECK(strcmp(r->info.firmware, "4.2.1") == 0);
+        CHECK(strcmp(r->info.serial, "SN0042") == 0);
+        CHECK(strcmp(r->info.hardware_id, "HW7") == 0);
+
+        // The faulted GetCapabilities leaves the service XAddrs empty
+        if (strcmp(endpoints[i].path, "/close") == 0) {
+            CHECK(r->info.media_xaddr[0] == '\0' && r->info.events_xaddr[0] == '\0');
+            continue;
+        }
+        CHECK(strcmp(r->info.media_xaddr, "http://127.0.0.1/onvif/media") == 0);
+        CHECK(strcmp(r->info.events_xaddr, "http://127.0.0.1/onvif/events?a=1&b=2") == 0);
+        CHECK(r->info.ptz_xaddr[0] == '\0');
+        CHECK(r->info.imaging_xaddr[0] == '\0');
+    }
+    CHECK(srv.requests == srv.expected);
+    CHECK(srv.escaped_user == srv.expected);
+    CHECK(eng.succeeded == 3 && eng.failed == 3);
+
+    wsd_enrich_free(&eng);
+    close(epfd);
+    close(srv.listen_fd);
+    if (failures) {
+        fprintf(stderr, "test_enrich: %d failed\n", failures);
+        return 1;
+    }
+    printf("test_enrich: ok\n");
+    return 0;
+}
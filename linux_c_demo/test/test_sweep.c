@@ -0,0 +1,274 @@
+// Unicast sweep test: one responder socket per loopback alias of a range
+// (127.1.0.1 and up, all local on Linux), each answering only the Probes
+// sent to its own address, from that address. Every SILENT_EVERY-th host
+// has no socket. The sweep must close every ordinal exactly once: a reply
+// from the right address for each responder, a give-up for each silent
+// host. Prints the sweep's throughput.
+//
+// Usage: test_sweep [-b PREFIX_LEN] [-r RATE]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "wsd_parser.h"
+#include "wsd_rx.h"
+#include "wsd_sweep.h"
+
+#define WSD_PORT 3702
+#define SILENT_EVERY 16
+#define STOP_TAG UINT32_MAX
+
+static const char reply_template[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+    "xmlns:a=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+    "xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "
+    "xmlns:dn=\"http://www.onvif.org/ver10/network/wsdl\">"
+    "<s:Header>"
+    "<a:MessageID>urn:uuid:7e57c0de-0000-4000-8000-%012x</a:MessageID>"
+    "<a:RelatesTo>%.*s</a:RelatesTo>"
+    "<a:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/ProbeMatches</a:Action>"
+    "</s:Header><s:Body><d:ProbeMatches><d:ProbeMatch>"
+    "<a:EndpointReference><a:Address>urn:uuid:7e57d0de-0000-4000-8000-%012x</a:Address></a:EndpointReference>"
+    "<d:Types>dn:NetworkVideoTransmitter</d:Types>"
+    "<d:Scopes>onvif://www.onvif.org/name/host%u</d:Scopes>"
+    "<d:XAddrs>http://%s/onvif/device_service</d:XAddrs>"
+    "<d:MetadataVersion>1</d:MetadataVersion>"
+    "</d:ProbeMatch></d:ProbeMatches></s:Body></s:Envelope>";
+
+struct responder {
+    uint32_t first;                   // address of host 0, host byte order
+    uint32_t count;
+    int *socks;                       // per host, -1 for a silent one
+    int epfd;
+    int stop_fd;
+    unsigned long answered;
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int is_silent(uint32_t host) {
+    return host % SILENT_EVERY == SILENT_EVERY - 1;
+}
+
+static int open_host_socket(uint32_t addr) {
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(addr);
+    sin.sin_port = htons(WSD_PORT);
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) return -1;
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int responder_open(struct responder *r, uint32_t first, uint32_t count) {
+    struct epoll_event ev;
+
+    r->first = first;
+    r->count = count;
+    r->socks = malloc(count * sizeof(*r->socks));
+    r->epfd = epoll_create1(0);
+    r->stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (!r->socks || r->epfd < 0 || r->stop_fd < 0) return -1;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = STOP_TAG;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->stop_fd, &ev) < 0) return -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        r->socks[i] = -1;
+        if (is_silent(i)) continue;
+        r->socks[i] = open_host_socket(first + i);
+        ev.data.u32 = i;
+        if (r->socks[i] < 0 || epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->socks[i], &ev) < 0) {
+            char ip[INET_ADDRSTRLEN];
+            struct in_addr a = {htonl(first + i)};
+            fprintf(stderr, "Cannot listen on %s:%d: %s\n", inet_ntop(AF_INET, &a, ip, sizeof(ip)), WSD_PORT,
+                    strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void responder_close(struct responder *r) {
+    for (uint32_t i = 0; r->socks && i < r->count; i++) {
+        if (r->socks[i] >= 0) close(r->socks[i]);
+    }
+    free(r->socks);
+    if (r->epfd >= 0) close(r->epfd);
+    if (r->stop_fd >= 0) close(r->stop_fd);
+}
+
+// Answer every Probe on host i's socket
+static void answer(struct responder *r, uint32_t i) {
+    char buf[4096], reply[2048], ip[INET_ADDRSTRLEN];
+    struct sockaddr_in from;
+    struct wsd_header hdr;
+    struct in_addr self = {htonl(r->first + i)};
+
+    inet_ntop(AF_INET, &self, ip, sizeof(ip));
+    for (;;) {
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(r->socks[i], buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0) return;
+        if (wsd_scan_header(buf, (size_t)n, &hdr) < 0 || !wsd_view_has_suffix(hdr.action, "/Probe")) continue;
+        int len = snprintf(reply, sizeof(reply), reply_template, (unsigned)r->answered, (int)hdr.message_id.len,
+                           hdr.message_id.ptr, i, i, ip);
+        if (sendto(r->socks[i], reply, (size_t)len, 0, (struct sockaddr *)&from, from_len) == len) r->answered++;
+    }
+}
+
+static void *responder_main(void *arg) {
+    struct responder *r = arg;
+    struct epoll_event events[64];
+
+    for (;;) {
+        int n = epoll_wait(r->epfd, events, 64, -1);
+        if (n < 0 && errno != EINTR) break;
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.u32 == STOP_TAG) return NULL;
+            answer(r, events[e].data.u32);
+        }
+    }
+    return NULL;
+}
+
+// Read the replies pending on sock and close their ordinals. A reply must
+// come from the address its ordinal was probed at.
+static void drain(struct wsd_sweep *sw, int sock, uint8_t *replied, int *misrouted) {
+    char buf[4096];
+    struct sockaddr_in from;
+    struct wsd_header hdr;
+
+    for (;;) {
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0) return;
+        if (wsd_scan_header(buf, (size_t)n, &hdr) < 0) continue;
+        int64_t ordinal = wsd_sweep_on_reply(sw, hdr.relates_to);
+        if (ordinal < 0) continue;
+        if (ntohl(from.sin_addr.s_addr) != sw->ranges[0].first + (uint32_t)ordinal) (*misrouted)++;
+        replied[ordinal / 8] |= (uint8_t)(1u << (ordinal % 8));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int prefix = 22;
+    double rate = 20000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:r:")) != -1) {
+        switch (opt) {
+        case 'b': prefix = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-b PREFIX_LEN] [-r RATE]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (prefix < 16 || prefix > 30 || rate <= 0) {
+        fprintf(stderr, "PREFIX_LEN must be 16 to 30, RATE positive\n");
+        return 2;
+    }
+
+    // One socket per host
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    static struct wsd_sweep sw;
+    char spec[32];
+    snprintf(spec, sizeof(spec), "127.1.0.0/%d", prefix);
+    if (wsd_sweep_add_cidr(&sw, spec) < 0) return 2;
+    uint32_t hosts = sw.ranges[0].last - sw.ranges[0].first + 1;
+
+    struct responder r = {.epfd = -1, .stop_fd = -1};
+    pthread_t thread;
+    if (responder_open(&r, sw.ranges[0].first, hosts) < 0 || pthread_create(&thread, NULL, responder_main, &r) != 0) {
+        responder_close(&r);
+        return 1;
+    }
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    uint8_t *replied = calloc((hosts + 7) / 8, 1);
+    int64_t start = now_ms();
+    if (sock < 0 || bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0 || !replied ||
+        wsd_sweep_start(&sw, rate, 512, 2, 200, start) < 0) {
+        perror("sweep");
+        return 1;
+    }
+    // Sized like the tool's sockets: a full window of replies has to fit
+    wsd_rx_setup_socket(sock, WSD_RX_DEFAULT_RCVBUF);
+
+    int misrouted = 0;
+    int64_t wake = wsd_sweep_tick(&sw, sock, start);
+    while (wake >= 0) {
+        struct pollfd pfd = {sock, POLLIN, 0};
+        int64_t wait = wake - now_ms();
+        poll(&pfd, 1, wait > 0 ? (int)(wait < 1000 ? wait : 1000) : 0);
+        drain(&sw, sock, replied, &misrouted);
+        wake = wsd_sweep_tick(&sw, sock, now_ms());
+    }
+    int64_t elapsed = now_ms() - start;
+
+    uint64_t one = 1;
+    if (write(r.stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    pthread_join(thread, NULL);
+
+    // Every responder answered, every silent host was given up on
+    uint32_t missing = 0, unexpected = 0, silent = 0;
+    for (uint32_t i = 0; i < hosts; i++) {
+        int got = (replied[i / 8] >> (i % 8)) & 1;
+        if (is_silent(i)) {
+            silent++;
+            if (got) unexpected++;
+        } else if (!got) {
+            missing++;
+        }
+    }
+    printf("test_sweep: %u hosts, %llu replies, %llu given up, %llu probes (%llu retries) in %lld ms, %.0f probes/s\n",
+           hosts, (unsigned long long)sw.replies, (unsigned long long)sw.given_up, (unsigned long long)sw.sent,
+           (unsigned long long)sw.retried, (long long)elapsed, elapsed ? (double)sw.sent * 1000.0 / (double)elapsed : 0);
+
+    int ok = missing == 0 && unexpected == 0 && misrouted == 0 && sw.given_up == silent &&
+             sw.replies == hosts - silent && sw.next == hosts;
+    if (!ok) {
+        fprintf(stderr, "test_sweep: %u missing, %u unexpected, %d from the wrong address, %llu given up of %u silent\n",
+                missing, unexpected, misrouted, (unsigned long long)sw.given_up, silent);
+    }
+    wsd_sweep_free(&sw);
+    free(replied);
+    close(sock);
+    responder_close(&r);
+    return ok ? 0 : 1;
+}
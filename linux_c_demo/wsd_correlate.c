@@ -0,0 +1,73 @@
+#include "wsd_correlate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsd_hash.h"
+
+int wsd_correlator_init(struct wsd_correlator *c, size_t expected) {
+    size_t n = wsd_hash_slots(expected);
+
+    memset(c, 0, sizeof(*c));
+    c->hashes = calloc(n, sizeof(*c->hashes));
+    c->expires = calloc(n, sizeof(*c->expires));
+    if (!c->hashes || !c->expires) {
+        wsd_correlator_free(c);
+        return -1;
+    }
+    c->mask = n - 1;
+    return 0;
+}
+
+void wsd_correlator_free(struct wsd_correlator *c) {
+    free(c->hashes);
+    free(c->expires);
+    memset(c, 0, sizeof(*c));
+}
+
+// Reinsert the live entries into a table sized for them
+static int rebuild(struct wsd_correlator *c, int64_t now_ms) {
+    size_t live = 0;
+    for (size_t i = 0; i <= c->mask; i++) {
+        if (c->hashes[i] && c->expires[i] > now_ms) live++;
+    }
+
+    size_t n = wsd_hash_slots(live + 1);
+    uint64_t *hashes = calloc(n, sizeof(*hashes));
+    int64_t *expires = calloc(n, sizeof(*expires));
+    if (!hashes || !expires) {
+        free(hashes);
+        free(expires);
+        return -1;
+    }
+
+    for (size_t i = 0; i <= c->mask; i++) {
+        if (!c->hashes[i] || c->expires[i] <= now_ms) continue;
+        size_t slot = wsd_hash_find(hashes, n - 1, c->hashes[i]);
+        hashes[slot] = c->hashes[i];
+        expires[slot] = c->expires[i];
+    }
+    free(c->hashes);
+    free(c->expires);
+    c->hashes = hashes;
+    c->expires = expires;
+    c->mask = n - 1;
+    c->count = live;
+    return 0;
+}
+
+int wsd_correlator_add(struct wsd_correlator *c, const char *id, size_t len, int64_t expires_ms, int64_t now_ms) {
+    uint64_t h = wsd_hash(id, len);
+
+    if ((c->count + 1) * 2 > c->mask + 1 && rebuild(c, now_ms) < 0) return -1;
+    size_t slot = wsd_hash_find(c->hashes, c->mask, h);
+    if (!c->hashes[slot]) c->count++;
+    c->hashes[slot] = h;
+    c->expires[slot] = expires_ms;
+    return 0;
+}
+
+int wsd_correlator_match(const struct wsd_correlator *c, const char *id, size_t len, int64_t now_ms) {
+    size_t slot = wsd_hash_find(c->hashes, c->mask, wsd_hash(id, len));
+    return c->hashes[slot] && c->expires[slot] > now_ms;
+}
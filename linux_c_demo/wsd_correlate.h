@@ -0,0 +1,31 @@
+#ifndef WSD_CORRELATE_H
+#define WSD_CORRELATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MessageIDs of our own outstanding Probes, so replies can be matched on
+// RelatesTo in O(1) and everything answering someone else's Probe dropped.
+// IDs are kept as 64-bit FNV-1a hashes in an open-addressing set (see
+// wsd_hash.h), with an expiry time per slot beside it. Expired entries are
+// only swept out when the table fills up, by rebuilding it.
+
+struct wsd_correlator {
+    uint64_t *hashes;                 // 0 marks an empty slot
+    int64_t *expires;                 // monotonic ms, per slot
+    size_t mask;                      // slot count - 1
+    size_t count;                     // occupied slots, expired ones included
+};
+
+// Returns 0 on success, -1 on allocation failure
+int wsd_correlator_init(struct wsd_correlator *c, size_t expected);
+void wsd_correlator_free(struct wsd_correlator *c);
+
+// Accept replies to id until expires_ms.
+// Returns 0 on success, -1 on allocation failure.
+int wsd_correlator_add(struct wsd_correlator *c, const char *id, size_t len, int64_t expires_ms, int64_t now_ms);
+
+// Return 1 if id is an outstanding MessageID at now_ms
+int wsd_correlator_match(const struct wsd_correlator *c, const char *id, size_t len, int64_t now_ms);
+
+#endif
@@ -0,0 +1,49 @@
+#include "wsd_dedup.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsd_hash.h"
+
+int wsd_dedup_init(struct wsd_dedup *d, size_t capacity) {
+    memset(d, 0, sizeof(*d));
+    if (capacity == 0) capacity = WSD_DEDUP_DEFAULT_CAPACITY;
+    size_t n = wsd_hash_slots(capacity);
+    d->sets[0] = calloc(n, sizeof(uint64_t));
+    d->sets[1] = calloc(n, sizeof(uint64_t));
+    if (!d->sets[0] || !d->sets[1]) {
+        wsd_dedup_free(d);
+        return -1;
+    }
+    d->mask = n - 1;
+    d->capacity = capacity;
+    return 0;
+}
+
+void wsd_dedup_free(struct wsd_dedup *d) {
+    free(d->sets[0]);
+    free(d->sets[1]);
+    memset(d, 0, sizeof(*d));
+}
+
+int wsd_dedup_check(struct wsd_dedup *d, const char *id, size_t len) {
+    uint64_t h = wsd_hash(id, len);
+    uint64_t *cur = d->sets[d->current];
+    uint64_t *old = d->sets[!d->current];
+
+    size_t slot = wsd_hash_find(cur, d->mask, h);
+    if (cur[slot]) return 1;
+    if (old[wsd_hash_find(old, d->mask, h)]) return 1;
+
+    if (d->used == d->capacity) {
+        // Retire the older generation and start filling it again
+        memset(old, 0, (d->mask + 1) * sizeof(uint64_t));
+        d->current = !d->current;
+        d->used = 0;
+        cur = old;
+        slot = wsd_hash_find(cur, d->mask, h);
+    }
+    cur[slot] = h;
+    d->used++;
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef WSD_DEDUP_H
+#define WSD_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Recently seen MessageIDs, so the repeats of a SOAP-over-UDP message can
+// be dropped before they are parsed and merged. IDs are kept as 64-bit
+// FNV-1a hashes in two generations of open-addressing sets: new IDs go
+// into the current one, and once it holds `capacity` IDs the older
+// generation is cleared and the two swap. Lookups check both, so at least
+// the last `capacity` IDs are always remembered, with no per-entry expiry.
+
+#define WSD_DEDUP_DEFAULT_CAPACITY 65536
+
+struct wsd_dedup {
+    uint64_t *sets[2];                // 0 marks an empty slot
+    size_t mask;                      // slots per set - 1
+    size_t capacity;                  // IDs per generation
+    size_t used;                      // IDs in the current generation
+    int current;
+};
+
+// Returns 0 on success, -1 on allocation failure
+int wsd_dedup_init(struct wsd_dedup *d, size_t capacity);
+void wsd_dedup_free(struct wsd_dedup *d);
+
+// Return 1 if id was seen recently; otherwise remember it and return 0
+int wsd_dedup_check(struct wsd_dedup *d, const char *id, size_t len);
+
+#endif
@@ -0,0 +1,694 @@
+#define _GNU_SOURCE
+#include "wsd_enrich.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+
+#define ENRICH_PATH "/onvif/device_service"  // when the XAddr has no path
+#define ENRICH_REQUEST_SIZE 4096
+
+enum {
+    ENRICH_CONNECTING,
+    ENRICH_SENDING,
+    ENRICH_RECEIVING
+};
+
+// Requests sent to each device, in order
+enum {
+    ENRICH_DEVICE_INFO,
+    ENRICH_CAPABILITIES
+};
+
+// --- WS-Security UsernameToken (PasswordDigest) ---------------------------
+
+struct sha1_ctx {
+    uint32_t h[5];
+    uint64_t len;
+    unsigned char block[64];
+    size_t used;
+};
+
+static uint32_t rol32(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+static void sha1_block(struct sha1_ctx *c, const unsigned char *p) {
+    uint32_t w[80];
+    uint32_t a = c->h[0], b = c->h[1], d = c->h[3], e = c->h[4], cc = c->h[2];
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & cc) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ cc ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & cc) | (b & d) | (cc & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ cc ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = cc;
+        cc = rol32(b, 30);
+        b = a;
+        a = t;
+    }
+    c->h[0] += a;
+    c->h[1] += b;
+    c->h[2] += cc;
+    c->h[3] += d;
+    c->h[4] += e;
+}
+
+static void sha1_init(struct sha1_ctx *c) {
+    static const uint32_t h0[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    memcpy(c->h, h0, sizeof(h0));
+    c->len = 0;
+    c->used = 0;
+}
+
+static void sha1_update(struct sha1_ctx *c, const void *data, size_t len) {
+    const unsigned char *p = data;
+    c->len += len;
+    while (len--) {
+        c->block[c->used++] = *p++;
+        if (c->used == 64) {
+            sha1_block(c, c->block);
+            c->used = 0;
+        }
+    }
+}
+
+static void sha1_final(struct sha1_ctx *c, unsigned char out[20]) {
+    uint64_t bits = c->len * 8;
+    unsigned char pad = 0x80;
+
+    sha1_update(c, &pad, 1);
+    pad = 0;
+    while (c->used != 56) sha1_update(c, &pad, 1);
+    for (int i = 7; i >= 0; i--) {
+        unsigned char b = (unsigned char)(bits >> (i * 8));
+        sha1_update(c, &b, 1);
+    }
+    for (int i = 0; i < 5; i++) {
+        out[i * 4] = (unsigned char)(c->h[i] >> 24);
+        out[i * 4 + 1] = (unsigned char)(c->h[i] >> 16);
+        out[i * 4 + 2] = (unsigned char)(c->h[i] >> 8);
+        out[i * 4 + 3] = (unsigned char)c->h[i];
+    }
+}
+
+static void base64_encode(const unsigned char *in, size_t len, char *out) {
+    static const char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+
+    for (; i + 2 < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+        *out++ = tbl[v >> 18];
+        *out++ = tbl[(v >> 12) & 63];
+        *out++ = tbl[(v >> 6) & 63];
+        *out++ = tbl[v & 63];
+    }
+    if (i < len) {
+        uint32_t v = (uint32_t)in[i] << 16 | (i + 1 < len ? (uint32_t)in[i + 1] << 8 : 0);
+        *out++ = tbl[v >> 18];
+        *out++ = tbl[(v >> 12) & 63];
+        *out++ = i + 1 < len ? tbl[(v >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+    *out = '\0';
+}
+
+// Security header for user/password, digest = Base64(SHA1(nonce + created + password))
+static int build_security(const char *user, const char *password, char *out, size_t size) {
+    unsigned char nonce[16], digest[20];
+    char nonce64[32], digest64[32], created[32], user_xml[256];
+    struct sha1_ctx sha;
+    struct tm tm;
+
+    // The user name goes into the XML as text, the password only into the digest
+    if (wsd_xml_escape(user, user_xml, sizeof(user_xml)) < 0) return -1;
+    if (getrandom(nonce, sizeof(nonce), 0) != (ssize_t)sizeof(nonce)) return -1;
+    time_t now = time(NULL);
+    gmtime_r(&now, &tm);
+    strftime(created, sizeof(created), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    sha1_init(&sha);
+    sha1_update(&sha, nonce, sizeof(nonce));
+    sha1_update(&sha, created, strlen(created));
+    sha1_update(&sha, password, strlen(password));
+    sha1_final(&sha, digest);
+    base64_encode(nonce, sizeof(nonce), nonce64);
+    base64_encode(digest, sizeof(digest), digest64);
+
+    int n = snprintf(out, size,
+        "<s:Header>"
+        "<Security s:mustUnderstand=\"1\" "
+        "xmlns=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-wssecurity-secext-1.0.xsd\">"
+        "<UsernameToken>"
+        "<Username>%s</Username>"
+        "<Password Type=\"http://docs.oasis-open.org/wss/2004/01/"
+        "oasis-200401-wss-username-token-profile-1.0#PasswordDigest\">%s</Password>"
+        "<Nonce EncodingType=\"http://docs.oasis-open.org/wss/2004/01/"
+        "oasis-200401-wss-soap-message-security-1.0#Base64Binary\">%s</Nonce>"
+        "<Created xmlns=\"http://docs.oasis-open.org/wss/2004/01/"
+        "oasis-200401-wss-wssecurity-utility-1.0.xsd\">%s</Created>"
+        "</UsernameToken>"
+        "</Security>"
+        "</s:Header>",
+        user_xml, digest64, nonce64, created);
+    return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+// --- HTTP -----------------------------------------------------------------
+
+static int build_request(const struct wsd_enrich *eng, const struct wsd_enrich_job *job, int step, char *out,
+                         size_t size) {
+    static const char *const actions[] = {"GetDeviceInformation", "GetCapabilities"};
+    static const char *const requests[] = {
+        "<tds:GetDeviceInformation/>",
+        "<tds:GetCapabilities><tds:Category>All</tds:Category></tds:GetCapabilities>"};
+    char header[1536] = "";
+    char body[2048];
+
+    if (eng->user && build_security(eng->user, eng->password ? eng->password : "", header, sizeof(header)) < 0) {
+        return -1;
+    }
+    int body_len = snprintf(body, sizeof(body),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" "
+        "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\">"
+        "%s"
+        "<s:Body>%s</s:Body>"
+        "</s:Envelope>",
+        header, requests[step]);
+    if (body_len < 0 || (size_t)body_len >= sizeof(body)) return -1;
+
+    int n = snprintf(out, size,
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Content-Type: application/soap+xml; charset=utf-8; "
+        "action=\"http://www.onvif.org/ver10/device/wsdl/%s\"\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "%s",
+        job->path, job->host, actions[step], body_len, body);
+    return n < 0 || (size_t)n >= size ? -1 : n;
+}
+
+// Find a header in the header block, name without the colon.
+// Returns its trimmed value, or an empty view if absent.
+static struct wsd_view header_value(const char *hdr, size_t len, const char *name) {
+    struct wsd_view v = {NULL, 0};
+    size_t nlen = strlen(name);
+    const char *end = hdr + len;
+    const char *line = memchr(hdr, '\n', len);  // skip the status line
+
+    while (line && line + 1 < end) {
+        line++;
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) eol = end;
+        if ((size_t)(eol - line) > nlen && line[nlen] == ':' && strncasecmp(line, name, nlen) == 0) {
+            const char *p = line + nlen + 1;
+            const char *q = eol;
+            while (p < q && (*p == ' ' || *p == '\t')) p++;
+            while (q > p && (q[-1] == '\r' || q[-1] == ' ' || q[-1] == '\t')) q--;
+            v.ptr = p;
+            v.len = (size_t)(q - p);
+            return v;
+        }
+        line = eol < end ? eol : NULL;
+    }
+    return v;
+}
+
+// Walk a chunked body. With decode set the chunks are joined in place.
+// Returns 1 once the last chunk is in, 0 if more data is needed, -1 if
+// the framing is broken. *out_len receives the decoded length.
+static int dechunk(char *body, size_t len, int decode, size_t *out_len) {
+    size_t r = 0, w = 0;
+
+    for (;;) {
+        char *eol = memchr(body + r, '\n', len - r);
+        if (!eol) return 0;
+        char *endp;
+        errno = 0;
+        unsigned long size = strtoul(body + r, &endp, 16);
+        if (endp == body + r || errno == ERANGE) return -1;
+        r = (size_t)(eol - body) + 1;
+        if (size == 0) break;
+        // A device cannot send more than fits in the response buffer
+        if (size > WSD_ENRICH_MAX_RESPONSE - w) return -1;
+        if (size > len - r || len - r - size < 2) return 0;
+        if (decode) memmove(body + w, body + r, size);
+        w += size;
+        r += size;
+        if (body[r] == '\r') r++;
+        if (body[r] != '\n') return -1;
+        r++;
+    }
+    *out_len = w;
+    return 1;
+}
+
+// --- Connection pool ------------------------------------------------------
+
+static void free_job(struct wsd_enrich_job *job) {
+    free(job->key);
+    job->key = NULL;
+}
+
+static void finish(struct wsd_enrich *eng, struct wsd_enrich_conn *c, const struct device_info *info,
+                   const char *error) {
+    // A failed GetCapabilities still leaves the device information
+    if (!info && c->step == ENRICH_CAPABILITIES) {
+        info = &c->info;
+        error = NULL;
+    }
+    if (info) eng->succeeded++;
+    else eng->failed++;
+    eng->cb(eng->cb_user, c->job.key, info, error);
+
+    if (c->fd >= 0) close(c->fd);  // also drops it from the epoll set
+    c->fd = -1;
+    free(c->out);
+    free(c->in);
+    c->out = c->in = NULL;
+    free_job(&c->job);
+    eng->active--;
+}
+
+static void fail_errno(struct wsd_enrich *eng, struct wsd_enrich_conn *c, const char *what, int err) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s: %s", what, strerror(err));
+    finish(eng, c, NULL, msg);
+}
+
+// Open a connection for the current step and queue its request
+static void connect_step(struct wsd_enrich *eng, struct wsd_enrich_conn *c) {
+    c->sent = 0;
+    c->in_len = 0;
+    c->in_cap = 0;
+    c->in = NULL;
+    c->out = malloc(ENRICH_REQUEST_SIZE);
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        fail_errno(eng, c, "socket", errno);
+        return;
+    }
+    int n = c->out ? build_request(eng, &c->job, c->step, c->out, ENRICH_REQUEST_SIZE) : -1;
+    if (n < 0) {
+        finish(eng, c, NULL, "cannot build request");
+        return;
+    }
+    c->out_len = (size_t)n;
+
+    if (connect(c->fd, (struct sockaddr *)&c->job.addr, sizeof(c->job.addr)) == 0) {
+        c->state = ENRICH_SENDING;
+    } else if (errno == EINPROGRESS) {
+        c->state = ENRICH_CONNECTING;
+    } else {
+        fail_errno(eng, c, "connect", errno);
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.u32 = eng->tag_base + (uint32_t)(c - eng->conns);
+    if (epoll_ctl(eng->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) fail_errno(eng, c, "epoll_ctl", errno);
+}
+
+// Copy the XAddr that opens each service section of a GetCapabilitiesResponse
+static void copy_services(struct device_info *info, const char *body, size_t len) {
+    static const char *const sections[] = {"Media", "Events", "PTZ", "Imaging"};
+    static const char *const xaddr[] = {"XAddr"};
+    char *const dst[] = {info->media_xaddr, info->events_xaddr, info->ptz_xaddr, info->imaging_xaddr};
+    const char *end = body + len;
+
+    for (int i = 0; i < 4; i++) {
+        struct wsd_view section, v;
+        if (wsd_extract_leaves(body, len, &sections[i], 1, &section) == 0) continue;
+        if (wsd_extract_leaves(section.ptr, (size_t)(end - section.ptr), xaddr, 1, &v) == 0) continue;
+        // An XAddr past a closing tag belongs to a later section
+        if (memmem(section.ptr, (size_t)(v.ptr - section.ptr), "</", 2)) continue;
+        wsd_view_decode(v, dst[i], sizeof(info->media_xaddr));
+    }
+}
+
+// Copy the GetDeviceInformationResponse fields and go on to GetCapabilities,
+// or report a fault
+static void complete(struct wsd_enrich *eng, struct wsd_enrich_conn *c, int status, const char *body,
+                     size_t len) {
+    static const char *const names[] = {"Manufacturer", "Model", "FirmwareVersion", "SerialNumber",
+                                        "HardwareId", "Text"};
+    struct wsd_view v[6];
+    char msg[256];
+
+    if (c->step == ENRICH_CAPABILITIES) {
+        if (status == 200) copy_services(&c->info, body, len);
+        finish(eng, c, &c->info, NULL);
+        return;
+    }
+
+    int found = wsd_extract_leaves(body, len, names, 6, v);
+    if (status == 200 && found > 0 && (v[0].ptr || v[1].ptr)) {
+        struct device_info *info = &c->info;
+        memset(info, 0, sizeof(*info));
+        wsd_view_decode(v[0], info->manufacturer, sizeof(info->manufacturer));
+        wsd_view_decode(v[1], info->model, sizeof(info->model));
+        wsd_view_decode(v[2], info->firmware, sizeof(info->firmware));
+        wsd_view_decode(v[3], info->serial, sizeof(info->serial));
+        wsd_view_decode(v[4], info->hardware_id, sizeof(info->hardware_id));
+
+        // The request asked for Connection: close, so the next one needs a new connection
+        close(c->fd);
+        free(c->out);
+        free(c->in);
+        c->out = c->in = NULL;
+        c->step = ENRICH_CAPABILITIES;
+        connect_step(eng, c);
+        return;
+    }
+
+    // SOAP faults carry their reason in Fault/Reason/Text
+    char reason[160] = "";
+    if (v[5].ptr) wsd_view_decode(v[5], reason, sizeof(reason));
+    if (status == 200) {
+        snprintf(msg, sizeof(msg), "no GetDeviceInformationResponse%s%s", reason[0] ? ": " : "", reason);
+    } else {
+        snprintf(msg, sizeof(msg), "HTTP %d%s%s%s", status, status == 401 ? " (credentials required)" : "",
+                 reason[0] ? ": " : "", reason);
+    }
+    finish(eng, c, NULL, msg);
+}
+
+// Check whether the whole response is in; eof is set once the peer closed
+static void check_response(struct wsd_enrich *eng, struct wsd_enrich_conn *c, int eof) {
+    char *hdr_end = memmem(c->in, c->in_len, "\r\n\r\n", 4);
+    if (!hdr_end) {
+        if (eof || c->in_len >= WSD_ENRICH_MAX_RESPONSE) finish(eng, c, NULL, "malformed HTTP response");
+        return;
+    }
+
+    int status = 0;
+    if (sscanf(c->in, "HTTP/%*d.%*d %d", &status) != 1) {
+        finish(eng, c, NULL, "malformed HTTP response");
+        return;
+    }
+    size_t hdr_len = (size_t)(hdr_end - c->in) + 4;
+    char *body = c->in + hdr_len;
+    size_t body_len = c->in_len - hdr_len;
+
+    struct wsd_view te = header_value(c->in, hdr_len, "Transfer-Encoding");
+    struct wsd_view cl = header_value(c->in, hdr_len, "Content-Length");
+    int done;
+    if (te.len >= 7 && strncasecmp(te.ptr, "chunked", 7) == 0) {
+        size_t decoded;
+        done = dechunk(body, body_len, 0, &decoded);
+        if (done < 0) {
+            finish(eng, c, NULL, "malformed chunked encoding");
+            return;
+        }
+        if (done) {
+            dechunk(body, body_len, 1, &decoded);
+            body_len = decoded;
+        }
+    } else if (cl.ptr) {
+        size_t want = (size_t)strtoul(cl.ptr, NULL, 10);
+        done = body_len >= want;
+        if (done) body_len = want;
+    } else {
+        done = eof;
+    }
+
+    if (done) complete(eng, c, status, body, body_len);
+    else if (eof) finish(eng, c, NULL, "connection closed mid-response");
+    else if (c->in_len >= WSD_ENRICH_MAX_RESPONSE) finish(eng, c, NULL, "response too large");
+}
+
+// Both requests share the one deadline
+static void start_job(struct wsd_enrich *eng, struct wsd_enrich_conn *c, struct wsd_enrich_job *job,
+                      int64_t now_ms) {
+    c->job = *job;
+    c->step = ENRICH_DEVICE_INFO;
+    c->deadline = now_ms + eng->timeout_ms;
+    eng->active++;
+    connect_step(eng, c);
+}
+
+// Start queued jobs while connection slots are free
+static void pump(struct wsd_enrich *eng, int64_t now_ms) {
+    for (int i = 0; i < eng->max_conns && eng->queue_len; i++) {
+        if (eng->conns[i].fd >= 0) continue;
+        struct wsd_enrich_job job = eng->queue[eng->queue_head];
+        eng->queue_head = (eng->queue_head + 1) % eng->queue_cap;
+        eng->queue_len--;
+        start_job(eng, &eng->conns[i], &job, now_ms);
+    }
+}
+
+int wsd_enrich_init(struct wsd_enrich *eng, int epfd, uint32_t tag_base, int max_conns, int timeout_ms,
+                    const char *user, const char *password, wsd_enrich_cb cb, void *cb_user) {
+    memset(eng, 0, sizeof(*eng));
+    eng->epfd = epfd;
+    eng->tag_base = tag_base;
+    eng->max_conns = max_conns > 0 ? max_conns : WSD_ENRICH_DEFAULT_CONNS;
+    eng->timeout_ms = timeout_ms > 0 ? timeout_ms : WSD_ENRICH_DEFAULT_TIMEOUT_MS;
+    eng->user = user;
+    eng->password = password;
+    eng->cb = cb;
+    eng->cb_user = cb_user;
+
+    eng->conns = calloc((size_t)eng->max_conns, sizeof(*eng->conns));
+    eng->queue_cap = 64;
+    eng->queue = malloc(eng->queue_cap * sizeof(*eng->queue));
+    if (!eng->conns || !eng->queue) {
+        wsd_enrich_free(eng);
+        return -1;
+    }
+    for (int i = 0; i < eng->max_conns; i++) eng->conns[i].fd = -1;
+    return 0;
+}
+
+void wsd_enrich_free(struct wsd_enrich *eng) {
+    if (eng->conns) {
+        for (int i = 0; i < eng->max_conns; i++) {
+            struct wsd_enrich_conn *c = &eng->conns[i];
+            if (c->fd < 0) continue;
+            close(c->fd);
+            free(c->out);
+            free(c->in);
+            free_job(&c->job);
+        }
+    }
+    for (size_t i = 0; i < eng->queue_len; i++) free_job(&eng->queue[(eng->queue_head + i) % eng->queue_cap]);
+    free(eng->conns);
+    free(eng->queue);
+    eng->conns = NULL;
+    eng->queue = NULL;
+    eng->queue_len = 0;
+    eng->active = 0;
+}
+
+// Parse "http://a.b.c.d[:port][/path]" into job. Returns 0 on success,
+// WSD_ENRICH_IPV6_ONLY for an "http://[v6]" XAddr, -1 for anything else.
+static int parse_xaddr(struct wsd_view x, struct wsd_enrich_job *job) {
+    char host[32];
+    const char *scheme = "http://";
+
+    if (!wsd_view_has_prefix(x, scheme)) return -1;
+    const char *p = x.ptr + strlen(scheme);
+    if (p < x.ptr + x.len && *p == '[') return WSD_ENRICH_IPV6_ONLY;
+    const char *end = x.ptr + x.len;
+    const char *slash = memchr(p, '/', (size_t)(end - p));
+    const char *host_end = slash ? slash : end;
+    if (host_end == p || (size_t)(host_end - p) >= sizeof(host)) return -1;
+    memcpy(host, p, (size_t)(host_end - p));
+    host[host_end - p] = '\0';
+
+    int port = 80;
+    char *colon = strchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = atoi(colon + 1);
+        if (port <= 0 || port > 65535) return -1;
+    }
+
+    memset(&job->addr, 0, sizeof(job->addr));
+    job->addr.sin_family = AF_INET;
+    job->addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, host, &job->addr.sin_addr) != 1) return -1;
+
+    if (port == 80) snprintf(job->host, sizeof(job->host), "%s", host);
+    else snprintf(job->host, sizeof(job->host), "%s:%d", host, port);
+    if (slash) {
+        struct wsd_view path = {slash, (size_t)(end - slash)};
+        wsd_view_copy(path, job->path, sizeof(job->path));
+    } else {
+        snprintf(job->path, sizeof(job->path), "%s", ENRICH_PATH);
+    }
+    return 0;
+}
+
+int wsd_enrich_submit(struct wsd_enrich *eng, const char *key, const char *xaddrs, int64_t now_ms) {
+    struct wsd_view list = {xaddrs, xaddrs ? strlen(xaddrs) : 0};
+    struct wsd_view item;
+    struct wsd_enrich_job job;
+    int usable = 0, ipv6 = 0;
+
+    while (wsd_view_next_token(&list, &item)) {
+        int r = parse_xaddr(item, &job);
+        if (r == 0) {
+            usable = 1;
+            break;
+        }
+        if (r == WSD_ENRICH_IPV6_ONLY) ipv6 = 1;
+    }
+    if (!usable) return ipv6 ? WSD_ENRICH_IPV6_ONLY : WSD_ENRICH_NO_XADDR;
+
+    if (eng->queue_len == eng->queue_cap) {
+        size_t cap = eng->queue_cap * 2;
+        struct wsd_enrich_job *q = malloc(cap * sizeof(*q));
+        if (!q) return WSD_ENRICH_NO_XADDR;
+        for (size_t i = 0; i < eng->queue_len; i++) q[i] = eng->queue[(eng->queue_head + i) % eng->queue_cap];
+        free(eng->queue);
+        eng->queue = q;
+        eng->queue_cap = cap;
+        eng->queue_head = 0;
+    }
+    job.key = strdup(key);
+    if (!job.key) return WSD_ENRICH_NO_XADDR;
+    eng->queue[(eng->queue_head + eng->queue_len) % eng->queue_cap] = job;
+    eng->queue_len++;
+    eng->submitted++;
+
+    pump(eng, now_ms);
+    return 0;
+}
+
+static void on_writable(struct wsd_enrich *eng, struct wsd_enrich_conn *c) {
+    if (c->state == ENRICH_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+        if (err) {
+            fail_errno(eng, c, "connect", err);
+            return;
+        }
+        c->state = ENRICH_SENDING;
+    }
+
+    while (c->sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->sent, c->out_len - c->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fail_errno(eng, c, "send", errno);
+            return;
+        }
+        c->sent += (size_t)n;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = eng->tag_base + (uint32_t)(c - eng->conns);
+    if (epoll_ctl(eng->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+        fail_errno(eng, c, "epoll_ctl", errno);
+        return;
+    }
+    c->state = ENRICH_RECEIVING;
+}
+
+static void on_readable(struct wsd_enrich *eng, struct wsd_enrich_conn *c) {
+    for (;;) {
+        if (c->in_cap - c->in_len < 1024) {
+            size_t cap = c->in_cap ? c->in_cap * 2 : 4096;
+            if (cap > WSD_ENRICH_MAX_RESPONSE + 1) cap = WSD_ENRICH_MAX_RESPONSE + 1;
+            if (cap - c->in_len <= 1) {
+                finish(eng, c, NULL, "response too large");
+                return;
+            }
+            char *in = realloc(c->in, cap);
+            if (!in) {
+                finish(eng, c, NULL, "out of memory");
+                return;
+            }
+            c->in = in;
+            c->in_cap = cap;
+        }
+
+        // Keep one byte for the NUL that sscanf() relies on
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len - 1, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            fail_errno(eng, c, "recv", errno);
+            return;
+        }
+        c->in_len += (size_t)n;
+        c->in[c->in_len] = '\0';
+        if (n == 0) {
+            check_response(eng, c, 1);
+            return;
+        }
+    }
+    check_response(eng, c, 0);
+}
+
+void wsd_enrich_on_event(struct wsd_enrich *eng, uint32_t tag, uint32_t events, int64_t now_ms) {
+    uint32_t slot = tag - eng->tag_base;
+    if (slot >= (uint32_t)eng->max_conns) return;
+    struct wsd_enrich_conn *c = &eng->conns[slot];
+    if (c->fd < 0) return;
+
+    if (c->state == ENRICH_RECEIVING) {
+        on_readable(eng, c);
+    } else if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        on_writable(eng, c);
+    }
+    pump(eng, now_ms);
+}
+
+void wsd_enrich_expire(struct wsd_enrich *eng, int64_t now_ms) {
+    for (int i = 0; i < eng->max_conns; i++) {
+        struct wsd_enrich_conn *c = &eng->conns[i];
+        if (c->fd >= 0 && c->deadline <= now_ms) finish(eng, c, NULL, "timed out");
+    }
+    pump(eng, now_ms);
+}
+
+int64_t wsd_enrich_next_deadline(const struct wsd_enrich *eng) {
+    int64_t next = -1;
+    for (int i = 0; i < eng->max_conns; i++) {
+        const struct wsd_enrich_conn *c = &eng->conns[i];
+        if (c->fd >= 0 && (next < 0 || c->deadline < next)) next = c->deadline;
+    }
+    return next;
+}
+
+int wsd_enrich_busy(const struct wsd_enrich *eng) {
+    return eng->active > 0 || eng->queue_len > 0;
+}
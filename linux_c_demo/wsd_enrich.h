@@ -0,0 +1,103 @@
+#ifndef WSD_ENRICH_H
+#define WSD_ENRICH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "device_index.h"
+
+// Device enrichment over HTTP SOAP.
+// Each discovered device gets a GetDeviceInformation POST on its first
+// http:// XAddr with an IPv4 host, then a GetCapabilities POST for its
+// Media, Events, PTZ and Imaging service XAddrs. GetCapabilities is best
+// effort: a device that fails it is still reported with its information,
+// and the service XAddrs left empty. Connections are non-blocking and driven by the caller's
+// epoll set: every connection slot is registered with tag_base + slot,
+// and the caller hands those events to wsd_enrich_on_event(). At most
+// max_conns requests run at once, the rest wait in a FIFO queue, and each
+// device fails once its two requests have run for timeout_ms.
+
+#define WSD_ENRICH_DEFAULT_CONNS 32
+#define WSD_ENRICH_DEFAULT_TIMEOUT_MS 3000
+#define WSD_ENRICH_MAX_RESPONSE 65536
+
+// wsd_enrich_submit() results besides 0
+#define WSD_ENRICH_NO_XADDR (-1)          // no usable XAddr, or no memory
+#define WSD_ENRICH_IPV6_ONLY (-2)         // the http:// XAddrs all have IPv6 hosts
+
+// Called once per submitted device: info on success, error otherwise
+typedef void (*wsd_enrich_cb)(void *user, const char *key, const struct device_info *info, const char *error);
+
+// A queued request
+struct wsd_enrich_job {
+    char *key;
+    struct sockaddr_in addr;
+    char host[64];                    // Host header, "a.b.c.d:port"
+    char path[256];
+};
+
+struct wsd_enrich_conn {
+    int fd;                           // -1 when the slot is free
+    int state;
+    int step;                         // GetDeviceInformation, then GetCapabilities
+    struct wsd_enrich_job job;
+    struct device_info info;          // kept from the first step
+    int64_t deadline;
+    char *out;                        // request, then response
+    size_t out_len;
+    size_t sent;
+    char *in;
+    size_t in_len;
+    size_t in_cap;
+};
+
+struct wsd_enrich {
+    int epfd;
+    uint32_t tag_base;
+    int max_conns;
+    int timeout_ms;
+    const char *user;                 // WS-Security UsernameToken, or NULL
+    const char *password;
+    wsd_enrich_cb cb;
+    void *cb_user;
+
+    struct wsd_enrich_conn *conns;
+    int active;
+
+    // Waiting jobs: FIFO ring
+    struct wsd_enrich_job *queue;
+    size_t queue_cap;
+    size_t queue_head;
+    size_t queue_len;
+
+    // Statistics
+    uint64_t submitted;
+    uint64_t succeeded;
+    uint64_t failed;
+};
+
+// Returns 0 on success, -1 on allocation failure
+int wsd_enrich_init(struct wsd_enrich *eng, int epfd, uint32_t tag_base, int max_conns, int timeout_ms,
+                    const char *user, const char *password, wsd_enrich_cb cb, void *cb_user);
+void wsd_enrich_free(struct wsd_enrich *eng);
+
+// Queue the enrichment of the device with the given key.
+// Uses the first http:// XAddr whose host is an IPv4 literal; IPv6 hosts
+// are not supported. Returns 0 if queued, WSD_ENRICH_IPV6_ONLY if the
+// device only has IPv6 http:// XAddrs, WSD_ENRICH_NO_XADDR otherwise.
+int wsd_enrich_submit(struct wsd_enrich *eng, const char *key, const char *xaddrs, int64_t now_ms);
+
+// Handle an epoll event whose tag is tag_base + slot
+void wsd_enrich_on_event(struct wsd_enrich *eng, uint32_t tag, uint32_t events, int64_t now_ms);
+
+// Fail requests past their deadline and start queued ones
+void wsd_enrich_expire(struct wsd_enrich *eng, int64_t now_ms);
+
+// Earliest request deadline (monotonic ms), or -1 if idle
+int64_t wsd_enrich_next_deadline(const struct wsd_enrich *eng);
+
+// Return 1 while requests are queued or running
+int wsd_enrich_busy(const struct wsd_enrich *eng);
+
+#endif
@@ -0,0 +1,351 @@
+#include "wsd_filter.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ONVIF_SCOPE_BASE "onvif://www.onvif.org/"
+#define MATCH_BY_RFC3986 "http://schemas.xmlsoap.org/ws/2005/04/discovery/rfc3986"
+#define MATCH_BY_STRCMP "http://schemas.xmlsoap.org/ws/2005/04/discovery/strcmp0"
+#define MAX_SCOPE_LEN 512
+
+static const struct {
+    const char *alias;
+    const char *qname;
+} type_aliases[] = {
+    {"NVT", "dn:NetworkVideoTransmitter"},
+    {"NVD", "dn:NetworkVideoDisplay"},
+    {"NVS", "dn:NetworkVideoStorage"},
+    {"NVA", "dn:NetworkVideoAnalytics"},
+    {"Device", "tds:Device"},
+};
+
+void wsd_filter_init(struct wsd_filter *f) {
+    memset(f, 0, sizeof(*f));
+}
+
+void wsd_filter_free(struct wsd_filter *f) {
+    free(f->nodes);
+    free(f->labels);
+    wsd_filter_init(f);
+}
+
+int wsd_filter_add_type(struct wsd_filter *f, const char *name) {
+    const char *qname = NULL;
+
+    for (size_t i = 0; i < sizeof(type_aliases) / sizeof(type_aliases[0]); i++) {
+        if (strcmp(name, type_aliases[i].alias) == 0) qname = type_aliases[i].qname;
+    }
+    // Only the prefixes the Probe declares
+    if (!qname && (strncmp(name, "dn:", 3) == 0 || strncmp(name, "tds:", 4) == 0)) qname = name;
+    if (!qname || f->type_count == WSD_FILTER_MAX_TYPES || strlen(qname) >= sizeof(f->types[0])) return -1;
+    for (const char *p = strchr(qname, ':') + 1; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_' && *p != '-' && *p != '.') return -1;
+    }
+    snprintf(f->types[f->type_count++], sizeof(f->types[0]), "%s", qname);
+    return 0;
+}
+
+// Length of "scheme://authority", the part compared without case; 0 if none
+static size_t authority_len(const char *s, size_t len) {
+    for (size_t i = 0; i + 2 < len; i++) {
+        if (s[i] == '/' || s[i] == '?' || s[i] == '#') return 0;
+        if (s[i] == ':') {
+            if (s[i + 1] != '/' || s[i + 2] != '/') return 0;
+            for (size_t j = i + 3; j < len; j++) {
+                if (s[j] == '/') return j;
+            }
+            return len;
+        }
+    }
+    return 0;
+}
+
+// Child of node whose edge label starts with c, or -1
+static int32_t trie_child(const struct wsd_filter *f, int32_t node, char c) {
+    for (int32_t i = f->nodes[node].child; i >= 0; i = f->nodes[i].sibling) {
+        if (f->labels[f->nodes[i].label] == c) return i;
+    }
+    return -1;
+}
+
+// Add a node under parent; label is its edge. Returns its index or -1.
+static int32_t trie_add_node(struct wsd_filter *f, int32_t parent, uint32_t label, uint32_t label_len) {
+    if (f->node_count == f->node_cap) {
+        size_t cap = f->node_cap ? f->node_cap * 2 : 64;
+        struct wsd_scope_node *nodes = realloc(f->nodes, cap * sizeof(*nodes));
+        if (!nodes) return -1;
+        f->nodes = nodes;
+        f->node_cap = cap;
+    }
+    int32_t i = (int32_t)f->node_count++;
+    f->nodes[i].child = -1;
+    f->nodes[i].sibling = parent >= 0 ? f->nodes[parent].child : -1;
+    f->nodes[i].label = label;
+    f->nodes[i].label_len = label_len;
+    f->nodes[i].past_authority = 0;
+    f->nodes[i].accept = 0;
+    if (parent >= 0) f->nodes[parent].child = i;
+    return i;
+}
+
+// Append s to the label pool. Returns its offset, or -1.
+static int64_t add_label(struct wsd_filter *f, const char *s, size_t len) {
+    if (f->labels_len + len > f->labels_cap) {
+        size_t cap = f->labels_cap ? f->labels_cap : 1024;
+        while (cap < f->labels_len + len) cap *= 2;
+        char *labels = realloc(f->labels, cap);
+        if (!labels) return -1;
+        f->labels = labels;
+        f->labels_cap = cap;
+    }
+    memcpy(f->labels + f->labels_len, s, len);
+    f->labels_len += len;
+    return (int64_t)(f->labels_len - len);
+}
+
+// Insert s, whose scheme and authority end at auth, and return the node
+// where it ends, or -1
+static int32_t trie_insert(struct wsd_filter *f, const char *s, size_t len, size_t auth) {
+    int32_t node = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        int32_t child = trie_child(f, node, s[i]);
+        if (child < 0) {
+            int64_t label = add_label(f, s + i, len - i);
+            if (label < 0) return -1;
+            child = trie_add_node(f, node, (uint32_t)label, (uint32_t)(len - i));
+            if (child >= 0) f->nodes[child].past_authority = auth == 0 || len > auth;
+            return child;
+        }
+        struct wsd_scope_node *c = &f->nodes[child];
+        uint32_t k = 0;
+        while (k < c->label_len && i + k < len && f->labels[c->label + k] == s[i + k]) k++;
+        if (k < c->label_len) {
+            // Split the edge: the tail keeps the children and accept bits
+            int32_t tail = trie_add_node(f, -1, 0, 0);
+            if (tail < 0) return -1;
+            c = &f->nodes[child];
+            f->nodes[tail].child = c->child;
+            f->nodes[tail].label = c->label + k;
+            f->nodes[tail].label_len = c->label_len - k;
+            f->nodes[tail].accept = c->accept;
+            f->nodes[tail].past_authority = c->past_authority;
+            c->child = tail;
+            c->label_len = k;
+            c->accept = 0;
+            c->past_authority = auth == 0 || i + k > auth;
+        }
+        node = child;
+        i += k;
+    }
+    return node;
+}
+
+// Append s to the Probe's Scopes text, XML-escaped
+static int append_escaped(struct wsd_filter *f, const char *s) {
+    char *out = f->scopes + f->scopes_len;
+    size_t room = sizeof(f->scopes) - f->scopes_len;
+    size_t w = 0;
+
+    if (f->scopes_len > 0) {
+        if (room < 2) return -1;
+        out[w++] = ' ';
+    }
+    int n = wsd_xml_escape(s, out + w, room - w);
+    if (n < 0) {
+        out[0] = '\0';
+        return -1;
+    }
+    f->scopes_len += w + (size_t)n;
+    return 0;
+}
+
+int wsd_filter_add_scope(struct wsd_filter *f, const char *uri) {
+    char scope[MAX_SCOPE_LEN];
+    int n;
+
+    if (f->scope_count == WSD_FILTER_MAX_SCOPES || !*uri) return -1;
+    for (const char *p = uri; *p; p++) {
+        if (isspace((unsigned char)*p)) return -1;
+    }
+    n = strchr(uri, ':') ? snprintf(scope, sizeof(scope), "%s", uri)
+                         : snprintf(scope, sizeof(scope), ONVIF_SCOPE_BASE "%s", uri);
+    if (n < 0 || (size_t)n >= sizeof(scope)) return -1;
+
+    // Scheme and authority are case-insensitive, a trailing slash adds no segment
+    size_t len = (size_t)n;
+    size_t auth = authority_len(scope, len);
+    for (size_t i = 0; i < auth; i++) scope[i] = (char)tolower((unsigned char)scope[i]);
+    if (len > auth && scope[len - 1] == '/') scope[--len] = '\0';
+
+    if (!f->nodes && trie_add_node(f, -1, 0, 0) < 0) return -1;
+    if (append_escaped(f, scope) < 0) return -1;
+
+    // "scheme://authority/" gets a node of its own, so a walk that fails
+    // further down still knows it got past the authority
+    if (auth > 0 && len > auth && trie_insert(f, scope, auth + 1, auth) < 0) return -1;
+    int32_t node = trie_insert(f, scope, len, auth);
+    if (node < 0) return -1;
+    f->nodes[node].accept |= 1ULL << f->scope_count++;
+    return 0;
+}
+
+int wsd_filter_set_match_by(struct wsd_filter *f, const char *name) {
+    if (strcmp(name, "rfc3986") == 0 || strcmp(name, MATCH_BY_RFC3986) == 0) {
+        f->match_by = WSD_MATCH_RFC3986;
+    } else if (strcmp(name, "strcmp") == 0 || strcmp(name, MATCH_BY_STRCMP) == 0) {
+        f->match_by = WSD_MATCH_STRCMP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int wsd_filter_compile_probe(struct wsd_filter *f, const struct wsd_match *probe) {
+    struct wsd_view list, item;
+    char text[MAX_SCOPE_LEN];
+
+    wsd_filter_free(f);
+    if (probe->match_by.len > 0) {
+        wsd_view_decode(probe->match_by, text, sizeof(text));
+        if (wsd_filter_set_match_by(f, text) < 0) return -1;
+    }
+
+    // Types are compared by local name, the prefix is only kept for
+    // wsd_filter_format(), so any namespace the Probe declared will do
+    list = probe->types;
+    while (wsd_view_next_token(&list, &item)) {
+        const char *colon = memchr(item.ptr, ':', item.len);
+        struct wsd_view local = item;
+        if (colon) {
+            local.ptr = colon + 1;
+            local.len = item.len - (size_t)(local.ptr - item.ptr);
+        }
+        if (f->type_count == WSD_FILTER_MAX_TYPES || local.len + 5 > sizeof(f->types[0])) return -1;
+        snprintf(f->types[f->type_count++], sizeof(f->types[0]), "%s:%.*s",
+                 wsd_view_eq(local, "Device") ? "tds" : "dn", (int)local.len, local.ptr);
+    }
+
+    list = probe->scopes;
+    while (wsd_view_next_token(&list, &item)) {
+        wsd_view_decode(item, text, sizeof(text));
+        if (wsd_filter_add_scope(f, text) < 0) return -1;
+    }
+    return 0;
+}
+
+int wsd_filter_active(const struct wsd_filter *f) {
+    return f->type_count > 0 || f->scope_count > 0;
+}
+
+// Predicates that one scope token satisfies, in a single walk of the trie.
+// *past is set if the walk got beyond the authority, where case no
+// longer matters.
+static uint64_t match_scope(const struct wsd_filter *f, const char *s, size_t len, int *past) {
+    uint64_t hits = 0;
+    int32_t node = 0;
+    size_t i = 0;
+
+    *past = 0;
+    while (i < len) {
+        node = trie_child(f, node, s[i]);
+        if (node < 0) break;
+        const struct wsd_scope_node *n = &f->nodes[node];
+        if (n->label_len > len - i || memcmp(f->labels + n->label, s + i, n->label_len) != 0) break;
+        i += n->label_len;
+        *past = (int)n->past_authority;
+        if (!n->accept) continue;
+        // A predicate matches a whole token, or under RFC 3986 a prefix
+        // ending on a segment boundary past the authority
+        if (i == len || (f->match_by == WSD_MATCH_RFC3986 && s[i] == '/' && i >= authority_len(s, len))) {
+            hits |= n->accept;
+        }
+    }
+    return hits;
+}
+
+// Return 1 if one of the types has the local name of qname
+static int has_type(struct wsd_view types, const char *qname) {
+    const char *local = strchr(qname, ':') + 1;
+    struct wsd_view item;
+
+    while (wsd_view_next_token(&types, &item)) {
+        const char *colon = memchr(item.ptr, ':', item.len);
+        struct wsd_view name = item;
+        if (colon) {
+            name.ptr = colon + 1;
+            name.len = item.len - (size_t)(colon + 1 - item.ptr);
+        }
+        if (wsd_view_eq(name, local)) return 1;
+    }
+    return 0;
+}
+
+int wsd_filter_match(const struct wsd_filter *f, const struct wsd_match *m) {
+    for (int i = 0; i < f->type_count; i++) {
+        if (!has_type(m->types, f->types[i])) return 0;
+    }
+    if (f->scope_count == 0) return 1;
+
+    uint64_t want = f->scope_count == 64 ? ~0ULL : (1ULL << f->scope_count) - 1;
+    uint64_t have = 0;
+    struct wsd_view list = m->scopes;
+    struct wsd_view item;
+    while (have != want && wsd_view_next_token(&list, &item)) {
+        // Entities and upper case hosts are rare, so the token is walked
+        // as is first. Only a walk that stopped inside the authority of a
+        // token with capitals, or one with entities, is redone on a
+        // normalized copy.
+        int past;
+        have |= match_scope(f, item.ptr, item.len, &past);
+        int redo = memchr(item.ptr, '&', item.len) != NULL;
+        if (!past && !redo) {
+            size_t auth = authority_len(item.ptr, item.len);
+            for (size_t i = 0; i < auth; i++) redo |= isupper((unsigned char)item.ptr[i]);
+        }
+        if (redo) {
+            char norm[MAX_SCOPE_LEN];
+            size_t len = wsd_view_decode(item, norm, sizeof(norm));
+            size_t auth = authority_len(norm, len);
+            for (size_t i = 0; i < auth; i++) norm[i] = (char)tolower((unsigned char)norm[i]);
+            have |= match_scope(f, norm, len, &past);
+        }
+    }
+    return have == want;
+}
+
+size_t wsd_filter_format(const struct wsd_filter *f, char *buf, size_t size) {
+    size_t w = 0;
+    int n;
+
+    if (f->type_count > 0) {
+        n = snprintf(buf, size, "<d:Types>");
+        if (n < 0 || (size_t)n >= size) return 0;
+        w = (size_t)n;
+        for (int i = 0; i < f->type_count; i++) {
+            n = snprintf(buf + w, size - w, "%s%s", i ? " " : "", f->types[i]);
+            if (n < 0 || (size_t)n >= size - w) return 0;
+            w += (size_t)n;
+        }
+        n = snprintf(buf + w, size - w, "</d:Types>");
+    } else {
+        n = snprintf(buf, size, "<d:Types>dn:NetworkVideoTransmitter</d:Types>");
+    }
+    if (n < 0 || (size_t)n >= size - w) return 0;
+    w += (size_t)n;
+
+    if (f->scope_count > 0) {
+        // RFC 3986 is the default MatchBy, so it is left out
+        if (f->match_by == WSD_MATCH_STRCMP) {
+            n = snprintf(buf + w, size - w, "<d:Scopes MatchBy=\"" MATCH_BY_STRCMP "\">%s</d:Scopes>", f->scopes);
+        } else {
+            n = snprintf(buf + w, size - w, "<d:Scopes>%s</d:Scopes>", f->scopes);
+        }
+        if (n < 0 || (size_t)n >= size - w) return 0;
+        w += (size_t)n;
+    }
+    return w;
+}
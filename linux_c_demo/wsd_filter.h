@@ -0,0 +1,83 @@
+#ifndef WSD_FILTER_H
+#define WSD_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wsd_parser.h"
+
+// Probe Types/Scopes, pushed down into the Probe so devices filter at the
+// source, and checked again on every reply and Hello for the devices that
+// ignore them. Scope predicates are compiled into one radix trie (edges
+// carry whole label runs, so the shared "onvif://www.onvif.org/" is a
+// single memcmp): a scope token is matched against all of them in a
+// single walk, so the cost per device does not grow with the number of
+// predicates. Scheme and
+// authority are compared without case under both MatchBy rules.
+
+#define WSD_FILTER_MAX_TYPES 8
+#define WSD_FILTER_MAX_SCOPES 64      // one bit each in the match mask
+#define WSD_FILTER_SCOPES_SIZE 2048   // Scopes text of the Probe, escaped
+
+enum wsd_match_by {
+    WSD_MATCH_RFC3986 = 0,            // prefix by whole path segments (the default)
+    WSD_MATCH_STRCMP                  // exact string comparison
+};
+
+struct wsd_scope_node {
+    int32_t child;                    // first child, -1 for none
+    int32_t sibling;                  // next child of the same parent, -1 for none
+    uint32_t label;                   // edge from the parent: offset into labels
+    uint32_t label_len;
+    uint32_t past_authority;          // the path to here covers scheme://authority/
+    uint64_t accept;                  // predicates ending here
+};
+
+struct wsd_filter {
+    char types[WSD_FILTER_MAX_TYPES][64];  // QNames, dn: or tds: prefix
+    int type_count;
+    enum wsd_match_by match_by;
+    char scopes[WSD_FILTER_SCOPES_SIZE];
+    size_t scopes_len;
+    int scope_count;
+    struct wsd_scope_node *nodes;     // trie, node 0 is the root
+    size_t node_count;
+    size_t node_cap;
+    char *labels;                     // every edge label, appended as inserted
+    size_t labels_len;
+    size_t labels_cap;
+};
+
+void wsd_filter_init(struct wsd_filter *f);
+void wsd_filter_free(struct wsd_filter *f);
+
+// Add a type: NVT, NVD, NVS, NVA, Device, or a QName with the dn: or tds:
+// prefix. Returns 0 on success, -1 if it is unknown or there are too many.
+int wsd_filter_add_type(struct wsd_filter *f, const char *name);
+
+// Add a scope predicate. A URI without a scheme ("location/rack1") is
+// taken as relative to onvif://www.onvif.org/.
+// Returns 0 on success, -1 if it is invalid, too long or too many.
+int wsd_filter_add_scope(struct wsd_filter *f, const char *uri);
+
+// Set the MatchBy rule: "rfc3986", "strcmp" or the full URI of either.
+// Returns 0 on success, -1 for a rule that is not supported.
+int wsd_filter_set_match_by(struct wsd_filter *f, const char *name);
+
+// Replace the filter with the Types, Scopes and MatchBy of a parsed Probe.
+// Returns 0 on success, -1 for a MatchBy rule that is not supported or
+// more predicates than the filter holds (the Probe cannot be answered).
+int wsd_filter_compile_probe(struct wsd_filter *f, const struct wsd_match *probe);
+
+// Return 1 if the filter has anything to check
+int wsd_filter_active(const struct wsd_filter *f);
+
+// Return 1 if a ProbeMatch or Hello has every requested type and, for
+// each scope predicate, a scope matching it
+int wsd_filter_match(const struct wsd_filter *f, const struct wsd_match *m);
+
+// Write the Types and Scopes elements of a Probe.
+// Returns their length, or 0 if they did not fit.
+size_t wsd_filter_format(const struct wsd_filter *f, char *buf, size_t size);
+
+#endif
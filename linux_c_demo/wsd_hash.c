@@ -0,0 +1,27 @@
+#include "wsd_hash.h"
+
+uint64_t wsd_hash(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+size_t wsd_hash_slots(size_t expected) {
+    size_t n = 16;
+    // Keep the load factor under 1/2
+    while (n < expected * 2) n <<= 1;
+    return n;
+}
+
+size_t wsd_hash_start(uint64_t h, size_t mask) {
+    return (size_t)(h ^ (h >> 32)) & mask;
+}
+
+size_t wsd_hash_find(const uint64_t *set, size_t mask, uint64_t h) {
+    size_t i = wsd_hash_start(h, mask);
+    while (set[i] && set[i] != h) i = (i + 1) & mask;
+    return i;
+}
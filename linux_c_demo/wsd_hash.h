@@ -0,0 +1,24 @@
+#ifndef WSD_HASH_H
+#define WSD_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hashing shared by the open-addressing tables: the device index, the
+// MessageID dedup sets and the Probe correlator. Strings hash with 64-bit
+// FNV-1a. Tables are a power of two in size, kept under half full, and
+// probed linearly from the hash folded to the table size.
+
+// FNV-1a of s; never 0, so 0 can mark an empty slot
+uint64_t wsd_hash(const char *s, size_t len);
+
+// Slots for a table of about `expected` entries: a power of two, at least 16
+size_t wsd_hash_slots(size_t expected);
+
+// First slot to probe for h in a table of mask + 1 slots
+size_t wsd_hash_start(uint64_t h, size_t mask);
+
+// Slot of a set of hashes holding h, or the empty (0) slot where it would go
+size_t wsd_hash_find(const uint64_t *set, size_t mask, uint64_t h);
+
+#endif
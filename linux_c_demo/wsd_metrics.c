@@ -0,0 +1,140 @@
+#include "wsd_metrics.h"
+
+#include <string.h>
+
+#define US 1000ull
+#define MS 1000000ull
+
+static const uint64_t parse_bounds[] = {500, 1 * US, 2 * US, 5 * US, 10 * US, 20 * US, 50 * US, 100 * US,
+                                        250 * US, 1 * MS};
+static const uint64_t rtt_bounds[] = {1 * MS, 2 * MS, 5 * MS, 10 * MS, 25 * MS, 50 * MS, 100 * MS, 250 * MS,
+                                      500 * MS, 1000 * MS, 2500 * MS, 5000 * MS};
+static const uint64_t queue_bounds[] = {10 * US, 25 * US, 50 * US, 100 * US, 250 * US, 500 * US, 1 * MS,
+                                        2500 * US, 5 * MS, 10 * MS, 25 * MS, 50 * MS};
+
+void wsd_metrics_init(struct wsd_metrics *m) {
+    memset(m, 0, sizeof(*m));
+    m->parse_time.bounds = parse_bounds;
+    m->parse_time.bucket_count = sizeof(parse_bounds) / sizeof(parse_bounds[0]);
+    m->probe_rtt.bounds = rtt_bounds;
+    m->probe_rtt.bucket_count = sizeof(rtt_bounds) / sizeof(rtt_bounds[0]);
+    m->proxy_answer.bounds = parse_bounds;
+    m->proxy_answer.bucket_count = sizeof(parse_bounds) / sizeof(parse_bounds[0]);
+    m->pipeline_latency.bounds = queue_bounds;
+    m->pipeline_latency.bucket_count = sizeof(queue_bounds) / sizeof(queue_bounds[0]);
+}
+
+void wsd_histogram_observe(struct wsd_histogram *h, uint64_t value_ns) {
+    int i = 0;
+    while (i < h->bucket_count && value_ns > h->bounds[i]) i++;
+    h->buckets[i]++;
+    h->count++;
+    h->sum_ns += value_ns;
+}
+
+// --- Prometheus text format -------------------------------------------------
+
+static void prom_counter(FILE *out, const char *name, const char *help, uint64_t value) {
+    fprintf(out, "# HELP onvif_discover_%s %s\n# TYPE onvif_discover_%s counter\nonvif_discover_%s %llu\n",
+            name, help, name, name, (unsigned long long)value);
+}
+
+// Histograms are exported in seconds, buckets are cumulative
+static void prom_histogram(FILE *out, const char *name, const char *help, const struct wsd_histogram *h) {
+    uint64_t cumulative = 0;
+
+    fprintf(out, "# HELP onvif_discover_%s %s\n# TYPE onvif_discover_%s histogram\n", name, help, name);
+    for (int i = 0; i < h->bucket_count; i++) {
+        cumulative += h->buckets[i];
+        fprintf(out, "onvif_discover_%s_bucket{le=\"%g\"} %llu\n", name, (double)h->bounds[i] / 1e9,
+                (unsigned long long)cumulative);
+    }
+    fprintf(out, "onvif_discover_%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)h->count);
+    fprintf(out, "onvif_discover_%s_sum %.9f\n", name, (double)h->sum_ns / 1e9);
+    fprintf(out, "onvif_discover_%s_count %llu\n", name, (unsigned long long)h->count);
+}
+
+int wsd_metrics_write_prometheus(const struct wsd_metrics *m, FILE *out) {
+    prom_counter(out, "packets_received_total", "Datagrams received.", m->packets);
+    prom_counter(out, "bytes_received_total", "Bytes received.", m->bytes);
+    prom_counter(out, "packets_truncated_total", "Datagrams larger than the receive slot.", m->truncated);
+    prom_counter(out, "packets_repeated_total", "Retransmitted messages dropped by MessageID.", m->repeats);
+    prom_counter(out, "packets_ignored_total", "Datagrams that are not ProbeMatches, Hello or Bye.", m->ignored);
+    prom_counter(out, "packets_uncorrelated_total", "Replies to Probes sent by someone else.", m->uncorrelated);
+    prom_counter(out, "parse_errors_total", "Malformed or truncated datagrams.", m->parse_errors);
+    prom_counter(out, "duplicate_matches_total", "Matches for a known device with no change.", m->duplicates);
+    prom_counter(out, "filtered_matches_total", "Matches dropped by the Types/Scopes filter.", m->filtered);
+    prom_counter(out, "socket_queue_drops_total", "Datagrams dropped by the kernel receive queue.",
+                 m->queue_drops);
+    prom_counter(out, "probes_sent_total", "Probe datagrams sent.", m->probes_sent);
+    prom_counter(out, "devices_found_total", "New devices.", m->devices_found);
+    prom_counter(out, "devices_updated_total", "Devices whose MetadataVersion changed.", m->devices_updated);
+    prom_counter(out, "devices_left_total", "Devices that said Bye or went silent.", m->devices_left);
+    prom_counter(out, "device_address_changes_total", "Known devices seen at a new address or XAddr.",
+                 m->address_changes);
+    prom_counter(out, "device_scope_changes_total", "Types/Scopes changes without a MetadataVersion bump.",
+                 m->scope_changes);
+    fprintf(out, "# HELP onvif_discover_devices Devices in the inventory.\n"
+                 "# TYPE onvif_discover_devices gauge\nonvif_discover_devices %llu\n",
+            (unsigned long long)m->devices);
+    prom_counter(out, "proxy_requests_total", "Unicast Probe/Resolve answered by the Discovery Proxy.",
+                 m->proxy_requests);
+    prom_counter(out, "proxy_suppressed_total", "Multicast Probes answered with a suppression Hello.",
+                 m->proxy_suppressed);
+    prom_counter(out, "proxy_matches_total", "Matches sent by the Discovery Proxy.", m->proxy_matches);
+    prom_counter(out, "proxy_limited_total", "Discovery Proxy answers cut short by the per-source budget.",
+                 m->proxy_limited);
+    prom_counter(out, "pipeline_stalls_total", "Times the receive thread waited for a free buffer.",
+                 m->pipeline_stalls);
+    prom_counter(out, "pipeline_drops_total", "Datagrams dropped for want of buffer memory.", m->pipeline_drops);
+    prom_histogram(out, "parse_seconds", "Parse time per datagram.", &m->parse_time);
+    prom_histogram(out, "probe_rtt_seconds", "Time from Probe to the first reply of each device.", &m->probe_rtt);
+    prom_histogram(out, "proxy_answer_seconds", "Discovery Proxy time from request to answer.", &m->proxy_answer);
+    prom_histogram(out, "pipeline_latency_seconds", "Time from receive to handled with parser workers.",
+                   &m->pipeline_latency);
+    return ferror(out) ? -1 : 0;
+}
+
+// --- JSON snapshot ------------------------------------------------------------
+
+static void json_histogram(FILE *out, const char *name, const struct wsd_histogram *h) {
+    fprintf(out, "\"%s\":{\"count\":%llu,\"sum_ns\":%llu,\"buckets\":[", name, (unsigned long long)h->count,
+            (unsigned long long)h->sum_ns);
+    for (int i = 0; i < h->bucket_count; i++) {
+        fprintf(out, "{\"le_ns\":%llu,\"count\":%llu},", (unsigned long long)h->bounds[i],
+                (unsigned long long)h->buckets[i]);
+    }
+    fprintf(out, "{\"le_ns\":null,\"count\":%llu}]}", (unsigned long long)h->buckets[h->bucket_count]);
+}
+
+int wsd_metrics_write_json(const struct wsd_metrics *m, FILE *out) {
+    fprintf(out,
+            "{\"packets_received\":%llu,\"bytes_received\":%llu,\"packets_truncated\":%llu,"
+            "\"packets_repeated\":%llu,\"packets_ignored\":%llu,\"packets_uncorrelated\":%llu,\"parse_errors\":%llu,"
+            "\"duplicate_matches\":%llu,\"filtered_matches\":%llu,"
+            "\"socket_queue_drops\":%llu,\"probes_sent\":%llu,\"devices_found\":%llu,"
+            "\"devices_updated\":%llu,\"devices_left\":%llu,\"device_address_changes\":%llu,"
+            "\"device_scope_changes\":%llu,\"devices\":%llu,"
+            "\"proxy_requests\":%llu,\"proxy_suppressed\":%llu,\"proxy_matches\":%llu,\"proxy_limited\":%llu,"
+            "\"pipeline_stalls\":%llu,\"pipeline_drops\":%llu,",
+            (unsigned long long)m->packets, (unsigned long long)m->bytes, (unsigned long long)m->truncated,
+            (unsigned long long)m->repeats, (unsigned long long)m->ignored, (unsigned long long)m->uncorrelated,
+            (unsigned long long)m->parse_errors,
+            (unsigned long long)m->duplicates, (unsigned long long)m->filtered, (unsigned long long)m->queue_drops,
+            (unsigned long long)m->probes_sent, (unsigned long long)m->devices_found,
+            (unsigned long long)m->devices_updated, (unsigned long long)m->devices_left,
+            (unsigned long long)m->address_changes, (unsigned long long)m->scope_changes,
+            (unsigned long long)m->devices, (unsigned long long)m->proxy_requests,
+            (unsigned long long)m->proxy_suppressed, (unsigned long long)m->proxy_matches,
+            (unsigned long long)m->proxy_limited, (unsigned long long)m->pipeline_stalls,
+            (unsigned long long)m->pipeline_drops);
+    json_histogram(out, "parse_time", &m->parse_time);
+    fputc(',', out);
+    json_histogram(out, "probe_rtt", &m->probe_rtt);
+    fputc(',', out);
+    json_histogram(out, "proxy_answer", &m->proxy_answer);
+    fputc(',', out);
+    json_histogram(out, "pipeline_latency", &m->pipeline_latency);
+    fputs("}\n", out);
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,60 @@
+#ifndef WSD_METRICS_H
+#define WSD_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Counters and latency histograms for the receive and parse path.
+// Plain integers updated from the single event loop thread, exported as
+// Prometheus text exposition format or as a JSON snapshot.
+
+#define WSD_HIST_MAX_BUCKETS 16
+
+// Fixed-bucket histogram of nanosecond values
+struct wsd_histogram {
+    const uint64_t *bounds;           // upper bounds in ns, increasing
+    int bucket_count;                 // finite buckets; one more counts +Inf
+    uint64_t buckets[WSD_HIST_MAX_BUCKETS + 1];
+    uint64_t count;
+    uint64_t sum_ns;
+};
+
+struct wsd_metrics {
+    uint64_t packets;                 // datagrams received
+    uint64_t bytes;
+    uint64_t truncated;               // larger than the receive slot
+    uint64_t repeats;                 // repeated MessageID, dropped before parsing
+    uint64_t ignored;                 // not ProbeMatches/Hello/Bye
+    uint64_t uncorrelated;            // RelatesTo is not one of our Probes
+    uint64_t parse_errors;            // malformed or cut short
+    uint64_t duplicates;              // matches for an already known, unchanged device
+    uint64_t filtered;                // matches failing the Types/Scopes filter
+    uint64_t queue_drops;             // SO_RXQ_OVFL, filled in before export
+    uint64_t probes_sent;
+    uint64_t devices_found;
+    uint64_t devices_updated;
+    uint64_t devices_left;
+    uint64_t address_changes;         // monitor: known devices with a new address or XAddr
+    uint64_t scope_changes;           // monitor: Types/Scopes changed without a MetadataVersion bump
+    uint64_t devices;                 // gauge, filled in before export
+    uint64_t proxy_requests;          // Discovery Proxy: unicast Probe/Resolve answered
+    uint64_t proxy_suppressed;        // Discovery Proxy: multicast Probes redirected with a Hello
+    uint64_t proxy_matches;           // Discovery Proxy: ProbeMatch/ResolveMatch entries sent
+    uint64_t proxy_limited;           // Discovery Proxy: answers cut short, the source's budget spent
+    uint64_t pipeline_stalls;         // receive thread waited for a free item, filled in before export
+    uint64_t pipeline_drops;          // receive thread could not grow an item, filled in before export
+    struct wsd_histogram parse_time;  // per datagram
+    struct wsd_histogram probe_rtt;   // Probe to first reply, per device and Probe
+    struct wsd_histogram proxy_answer;  // Discovery Proxy: request received to answer sent
+    struct wsd_histogram pipeline_latency;  // receive thread to handled by the event loop
+};
+
+void wsd_metrics_init(struct wsd_metrics *m);
+
+void wsd_histogram_observe(struct wsd_histogram *h, uint64_t value_ns);
+
+// Write the metrics to out. Returns 0 on success, -1 on a write error.
+int wsd_metrics_write_prometheus(const struct wsd_metrics *m, FILE *out);
+int wsd_metrics_write_json(const struct wsd_metrics *m, FILE *out);
+
+#endif
@@ -0,0 +1,55 @@
+#include "wsd_monitor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+void wsd_monitor_init(struct wsd_monitor *m, int interval_ms, int max_missed) {
+    memset(m, 0, sizeof(*m));
+    m->interval_ms = interval_ms;
+    m->max_missed = max_missed;
+}
+
+int wsd_monitor_add_rule(struct wsd_monitor *m, const char *spec) {
+    char target[INET_ADDRSTRLEN + 4];
+    struct wsd_monitor_rule r;
+    char *end;
+
+    if (m->rule_count >= WSD_MONITOR_MAX_RULES) return -1;
+    const char *eq = strrchr(spec, '=');
+    if (!eq || eq == spec || (size_t)(eq - spec) >= sizeof(target)) return -1;
+    long ms = strtol(eq + 1, &end, 10);
+    if (*end != '\0' || end == eq + 1 || ms <= 0 || ms > 86400000) return -1;
+    memcpy(target, spec, (size_t)(eq - spec));
+    target[eq - spec] = '\0';
+
+    memset(&r, 0, sizeof(r));
+    r.interval_ms = (int)ms;
+    char *slash = strchr(target, '/');
+    if (slash) {
+        struct in_addr addr;
+        *slash = '\0';
+        long prefix = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || end == slash + 1 || prefix < 0 || prefix > 32) return -1;
+        if (inet_pton(AF_INET, target, &addr) != 1) return -1;
+        r.mask = prefix ? 0xFFFFFFFFu << (32 - prefix) : 0;
+        r.net = ntohl(addr.s_addr) & r.mask;
+    } else {
+        if (strlen(target) >= sizeof(r.ifname)) return -1;
+        strcpy(r.ifname, target);
+    }
+    m->rules[m->rule_count++] = r;
+    return 0;
+}
+
+int wsd_monitor_interval(const struct wsd_monitor *m, const char *ifname, const struct in_addr *addr) {
+    for (int i = 0; i < m->rule_count; i++) {
+        const struct wsd_monitor_rule *r = &m->rules[i];
+        if (r->ifname[0]) {
+            if (strcmp(r->ifname, ifname) == 0) return r->interval_ms;
+        } else if (addr && (ntohl(addr->s_addr) & r->mask) == r->net) {
+            return r->interval_ms;
+        }
+    }
+    return m->interval_ms;
+}
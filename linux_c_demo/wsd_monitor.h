@@ -0,0 +1,39 @@
+#ifndef WSD_MONITOR_H
+#define WSD_MONITOR_H
+
+#include <stdint.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+// Monitoring schedule. Each probe interface gets its own Probe interval:
+// the default, or that of the first rule naming the interface or an IPv4
+// subnet holding its address. A device that misses `max_missed` cycles of
+// the interface it answered on is aged out.
+
+#define WSD_MONITOR_MAX_RULES 64
+#define WSD_MONITOR_DEFAULT_MISSED 3
+
+struct wsd_monitor_rule {
+    char ifname[IF_NAMESIZE];         // empty for a subnet rule
+    uint32_t net;                     // subnet rule: host byte order
+    uint32_t mask;
+    int interval_ms;
+};
+
+struct wsd_monitor {
+    int interval_ms;                  // default Probe interval
+    int max_missed;                   // cycles without a reply before a device is lost
+    struct wsd_monitor_rule rules[WSD_MONITOR_MAX_RULES];
+    int rule_count;
+};
+
+void wsd_monitor_init(struct wsd_monitor *m, int interval_ms, int max_missed);
+
+// Parse "IFNAME=MS" or "a.b.c.d/len=MS" and append the rule.
+// Returns 0 on success, -1 if the spec is invalid or there are too many.
+int wsd_monitor_add_rule(struct wsd_monitor *m, const char *spec);
+
+// Probe interval of an interface; addr is its IPv4 address, or NULL
+int wsd_monitor_interval(const struct wsd_monitor *m, const char *ifname, const struct in_addr *addr);
+
+#endif
@@ -0,0 +1,261 @@
+#include "wsd_output.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BINARY_VERSION 1
+
+static const char *const event_names[] = {
+    "", "found", "updated", "left", "lost", "cached", "inventory", "info", "address", "scopes"
+};
+
+int wsd_output_init(struct wsd_output *o, int fd, enum wsd_output_format format, size_t cap) {
+    memset(o, 0, sizeof(*o));
+    o->fd = fd;
+    o->format = format;
+    o->cap = cap;
+    o->buf = malloc(cap);
+    return o->buf ? 0 : -1;
+}
+
+void wsd_output_free(struct wsd_output *o) {
+    if (o->buf) wsd_output_flush(o);
+    free(o->buf);
+    o->buf = NULL;
+}
+
+int wsd_output_flush(struct wsd_output *o) {
+    size_t done = 0;
+
+    while (done < o->len && !o->failed) {
+        ssize_t n = write(o->fd, o->buf + done, o->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("write");
+            o->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    o->len = 0;
+    return o->failed ? -1 : 0;
+}
+
+// Make room for n more bytes. A record is never split across writes (its
+// binary length is patched in at the end), so this grows the buffer
+// instead of flushing. Returns 0, or -1 on allocation failure.
+static int reserve(struct wsd_output *o, size_t n) {
+    if (o->len + n <= o->cap) return 0;
+    size_t cap = o->cap * 2;
+    while (cap < o->len + n) cap *= 2;
+    char *buf = realloc(o->buf, cap);
+    if (!buf) return -1;
+    o->buf = buf;
+    o->cap = cap;
+    return 0;
+}
+
+// --- NDJSON -------------------------------------------------------------------
+
+static void put(struct wsd_output *o, const char *s, size_t len) {
+    if (reserve(o, len) < 0) return;
+    memcpy(o->buf + o->len, s, len);
+    o->len += len;
+}
+
+static void put_str(struct wsd_output *o, const char *s) {
+    put(o, s, strlen(s));
+}
+
+// A JSON string; bytes >= 0x80 pass through, the input is UTF-8 already
+static void put_json_string(struct wsd_output *o, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    if (reserve(o, len * 6 + 2) < 0) return;
+    char *w = o->buf + o->len;
+    *w++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            *w++ = '\\';
+            *w++ = (char)c;
+        } else if (c < 0x20) {
+            memcpy(w, "\\u00", 4);
+            w[4] = hex[c >> 4];
+            w[5] = hex[c & 15];
+            w += 6;
+        } else {
+            *w++ = (char)c;
+        }
+    }
+    *w++ = '"';
+    o->len = (size_t)(w - o->buf);
+}
+
+static void put_json_field(struct wsd_output *o, const char *name, const char *value) {
+    put(o, ",\"", 2);
+    put_str(o, name);
+    put(o, "\":", 2);
+    put_json_string(o, value, strlen(value));
+}
+
+// A space separated list as a JSON array
+static void put_json_list(struct wsd_output *o, const char *name, const char *list) {
+    struct wsd_view rest = {list, strlen(list)};
+    struct wsd_view item;
+    int first = 1;
+
+    put(o, ",\"", 2);
+    put_str(o, name);
+    put(o, "\":[", 3);
+    while (wsd_view_next_token(&rest, &item)) {
+        if (!first) put(o, ",", 1);
+        put_json_string(o, item.ptr, item.len);
+        first = 0;
+    }
+    put(o, "]", 1);
+}
+
+static void put_number(struct wsd_output *o, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void put_number(struct wsd_output *o, const char *format, ...) {
+    va_list ap;
+
+    if (reserve(o, 64) < 0) return;
+    va_start(ap, format);
+    int n = vsnprintf(o->buf + o->len, 64, format, ap);
+    va_end(ap);
+    if (n > 0 && n < 64) o->len += (size_t)n;
+}
+
+static void write_ndjson(struct wsd_output *o, const struct wsd_output_record *r) {
+    const struct device *d = r->device;
+
+    put(o, "{\"event\":", 9);
+    put_json_string(o, event_names[r->event], strlen(event_names[r->event]));
+    put_number(o, ",\"ts_ms\":%lld", (long long)r->ts_ms);
+    put_json_field(o, "endpoint", d->key);
+    put(o, ",\"addrs\":[", 10);
+    for (int i = 0; i < r->addr_count; i++) {
+        if (i) put(o, ",", 1);
+        put_json_string(o, r->addrs[i], strlen(r->addrs[i]));
+    }
+    put(o, "]", 1);
+    if (r->ifname && r->ifname[0]) put_json_field(o, "interface", r->ifname);
+    if (r->event != WSD_EVENT_INFO) {
+        put_json_list(o, "xaddrs", d->xaddrs);
+        put_json_list(o, "types", d->types);
+        put_json_list(o, "scopes", d->scopes);
+        put_number(o, ",\"metadata_version\":%u", d->metadata_version);
+    }
+    if (r->rtt_ns >= 0) put_number(o, ",\"rtt_ms\":%.3f", (double)r->rtt_ns / 1e6);
+    if (r->error) put_json_field(o, "error", r->error);
+    if (d->info && !r->error) {
+        put(o, ",\"info\":{", 9);
+        put(o, "\"manufacturer\":", 15);
+        put_json_string(o, d->info->manufacturer, strlen(d->info->manufacturer));
+        put_json_field(o, "model", d->info->model);
+        put_json_field(o, "firmware", d->info->firmware);
+        put_json_field(o, "serial", d->info->serial);
+        if (d->info->hardware_id[0]) put_json_field(o, "hardware_id", d->info->hardware_id);
+        if (d->info->media_xaddr[0]) put_json_field(o, "media_xaddr", d->info->media_xaddr);
+        if (d->info->events_xaddr[0]) put_json_field(o, "events_xaddr", d->info->events_xaddr);
+        if (d->info->ptz_xaddr[0]) put_json_field(o, "ptz_xaddr", d->info->ptz_xaddr);
+        if (d->info->imaging_xaddr[0]) put_json_field(o, "imaging_xaddr", d->info->imaging_xaddr);
+        put(o, "}", 1);
+    }
+    put(o, "}\n", 2);
+}
+
+// --- Binary -------------------------------------------------------------------
+
+static void put_le(char *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (char)(v >> (8 * i));
+}
+
+static int put_field(struct wsd_output *o, int tag, const void *value, size_t len) {
+    if (len > 0xFFFF) len = 0xFFFF;
+    if (reserve(o, 3 + len) < 0) return 0;
+    o->buf[o->len] = (char)tag;
+    put_le(o->buf + o->len + 1, len, 2);
+    memcpy(o->buf + o->len + 3, value, len);
+    o->len += 3 + len;
+    return 1;
+}
+
+static int put_field_str(struct wsd_output *o, int tag, const char *s) {
+    return put_field(o, tag, s, strlen(s));
+}
+
+static int put_field_int(struct wsd_output *o, int tag, uint64_t v, int bytes) {
+    char le[8];
+    put_le(le, v, bytes);
+    return put_field(o, tag, le, (size_t)bytes);
+}
+
+static int put_field_list(struct wsd_output *o, int tag, const char *list) {
+    struct wsd_view rest = {list, strlen(list)};
+    struct wsd_view item;
+    int count = 0;
+
+    while (wsd_view_next_token(&rest, &item)) count += put_field(o, tag, item.ptr, item.len);
+    return count;
+}
+
+static void write_binary(struct wsd_output *o, const struct wsd_output_record *r) {
+    const struct device *d = r->device;
+    int fields = 0;
+
+    if (reserve(o, 8) < 0) return;
+    size_t start = o->len;
+    o->buf[start + 4] = BINARY_VERSION;
+    o->buf[start + 5] = (char)r->event;
+    o->len += 8;
+
+    fields += put_field_int(o, WSD_TAG_TS_MS, (uint64_t)r->ts_ms, 8);
+    fields += put_field_str(o, WSD_TAG_ENDPOINT, d->key);
+    for (int i = 0; i < r->addr_count; i++) fields += put_field_str(o, WSD_TAG_ADDR, r->addrs[i]);
+    if (r->ifname && r->ifname[0]) fields += put_field_str(o, WSD_TAG_INTERFACE, r->ifname);
+    if (r->event != WSD_EVENT_INFO) {
+        fields += put_field_list(o, WSD_TAG_XADDR, d->xaddrs);
+        fields += put_field_list(o, WSD_TAG_TYPE, d->types);
+        fields += put_field_list(o, WSD_TAG_SCOPE, d->scopes);
+        fields += put_field_int(o, WSD_TAG_METADATA_VERSION, d->metadata_version, 4);
+    }
+    if (r->rtt_ns >= 0) fields += put_field_int(o, WSD_TAG_RTT_NS, (uint64_t)r->rtt_ns, 8);
+    if (r->error) fields += put_field_str(o, WSD_TAG_ERROR, r->error);
+    if (d->info && !r->error) {
+        fields += put_field_str(o, WSD_TAG_MANUFACTURER, d->info->manufacturer);
+        fields += put_field_str(o, WSD_TAG_MODEL, d->info->model);
+        fields += put_field_str(o, WSD_TAG_FIRMWARE, d->info->firmware);
+        fields += put_field_str(o, WSD_TAG_SERIAL, d->info->serial);
+        if (d->info->hardware_id[0]) fields += put_field_str(o, WSD_TAG_HARDWARE_ID, d->info->hardware_id);
+        if (d->info->media_xaddr[0]) fields += put_field_str(o, WSD_TAG_MEDIA_XADDR, d->info->media_xaddr);
+        if (d->info->events_xaddr[0]) fields += put_field_str(o, WSD_TAG_EVENTS_XADDR, d->info->events_xaddr);
+        if (d->info->ptz_xaddr[0]) fields += put_field_str(o, WSD_TAG_PTZ_XADDR, d->info->ptz_xaddr);
+        if (d->info->imaging_xaddr[0]) fields += put_field_str(o, WSD_TAG_IMAGING_XADDR, d->info->imaging_xaddr);
+    }
+
+    // The buffer may have moved while growing; patch through the offset
+    put_le(o->buf + start, o->len - start - 4, 4);
+    put_le(o->buf + start + 6, (uint64_t)fields, 2);
+}
+
+void wsd_output_device(struct wsd_output *o, const struct wsd_output_record *r) {
+    if (o->failed) return;
+    if (o->format == WSD_OUTPUT_NDJSON) write_ndjson(o, r);
+    else if (o->format == WSD_OUTPUT_BINARY) write_binary(o, r);
+    // Past three quarters full, write out now rather than grow
+    if (o->len >= o->cap / 4 * 3) wsd_output_flush(o);
+}
+
+int wsd_output_parse_format(const char *name) {
+    if (strcmp(name, "text") == 0) return WSD_OUTPUT_TEXT;
+    if (strcmp(name, "ndjson") == 0) return WSD_OUTPUT_NDJSON;
+    if (strcmp(name, "binary") == 0) return WSD_OUTPUT_BINARY;
+    return -1;
+}
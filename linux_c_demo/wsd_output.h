@@ -0,0 +1,108 @@
+#ifndef WSD_OUTPUT_H
+#define WSD_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device_index.h"
+
+// Structured device events for other programs: NDJSON, one object per
+// line, or length-prefixed binary records. Events are encoded straight
+// into one output buffer, which goes out in a single write() when it
+// fills up or when the caller flushes (once per event loop wakeup), so
+// the cost per device stays flat however many devices answer at once.
+//
+// NDJSON: {"event":"found","ts_ms":...,"endpoint":"urn:uuid:...",
+//   "addrs":[...],"interface":"eth0","xaddrs":[...],"types":[...],
+//   "scopes":[...],"metadata_version":1,"rtt_ms":1.234,"info":{...}}
+// Missing fields are left out. An enrichment failure is an "info" event
+// with an "error" string.
+//
+// Binary: each record is a little-endian u32 length of what follows,
+// then u8 format version (1), u8 event code, u16 field count, and that
+// many fields as u8 tag, u16 length, value. Text fields are UTF-8 as
+// received, without terminator; repeated tags form lists. Unknown tags
+// can be skipped by their length.
+
+enum wsd_output_format {
+    WSD_OUTPUT_TEXT = 0,              // the human-readable lines, not handled here
+    WSD_OUTPUT_NDJSON,
+    WSD_OUTPUT_BINARY
+};
+
+// Event codes of the binary records, in order of the NDJSON names
+enum wsd_output_event {
+    WSD_EVENT_FOUND = 1,
+    WSD_EVENT_UPDATED,
+    WSD_EVENT_LEFT,                   // said Bye
+    WSD_EVENT_LOST,                   // missed a reconciling Probe
+    WSD_EVENT_CACHED,                 // loaded from the cache
+    WSD_EVENT_INVENTORY,              // inventory dump (SIGUSR1)
+    WSD_EVENT_INFO,                   // enrichment result
+    WSD_EVENT_ADDRESS,                // monitor: new sender address or XAddr
+    WSD_EVENT_SCOPES                  // monitor: Types/Scopes changed, MetadataVersion did not
+};
+
+// Binary field tags
+enum wsd_output_tag {
+    WSD_TAG_ENDPOINT = 1,
+    WSD_TAG_ADDR,                     // repeated
+    WSD_TAG_INTERFACE,
+    WSD_TAG_XADDR,                    // repeated
+    WSD_TAG_TYPE,                     // repeated
+    WSD_TAG_SCOPE,                    // repeated
+    WSD_TAG_METADATA_VERSION,         // u32
+    WSD_TAG_RTT_NS,                   // u64
+    WSD_TAG_TS_MS,                    // u64, Unix time
+    WSD_TAG_MANUFACTURER,
+    WSD_TAG_MODEL,
+    WSD_TAG_FIRMWARE,
+    WSD_TAG_SERIAL,
+    WSD_TAG_HARDWARE_ID,
+    WSD_TAG_ERROR,
+    WSD_TAG_MEDIA_XADDR,              // service XAddrs from GetCapabilities
+    WSD_TAG_EVENTS_XADDR,
+    WSD_TAG_PTZ_XADDR,
+    WSD_TAG_IMAGING_XADDR
+};
+
+#define WSD_OUTPUT_DEFAULT_BUFFER (256 * 1024)
+
+struct wsd_output {
+    int fd;
+    enum wsd_output_format format;
+    char *buf;
+    size_t len;
+    size_t cap;
+    int failed;                       // a write failed, further output is dropped
+};
+
+// One device event. addrs are already formatted; ifname may be NULL,
+// rtt_ns < 0 when unknown, error only for a failed enrichment.
+struct wsd_output_record {
+    enum wsd_output_event event;
+    const struct device *device;
+    const char *const *addrs;
+    int addr_count;
+    const char *ifname;
+    int64_t rtt_ns;
+    int64_t ts_ms;
+    const char *error;
+};
+
+// Returns 0 on success, -1 on allocation failure
+int wsd_output_init(struct wsd_output *o, int fd, enum wsd_output_format format, size_t cap);
+
+// Flush and release the buffer
+void wsd_output_free(struct wsd_output *o);
+
+// Encode one event into the buffer
+void wsd_output_device(struct wsd_output *o, const struct wsd_output_record *r);
+
+// Write out everything buffered. Returns 0 on success, -1 on error.
+int wsd_output_flush(struct wsd_output *o);
+
+// Parse "text", "ndjson" or "binary". Returns -1 if unknown.
+int wsd_output_parse_format(const char *name);
+
+#endif
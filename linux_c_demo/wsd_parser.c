@@ -0,0 +1,473 @@
+#include "wsd_parser.h"
+
+#include <string.h>
+
+#include "wsd_scan.h"
+
+static int is_xml_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Compare a tag's local name (the part after the ':') with s
+static int local_eq(const char *name, size_t len, const char *s) {
+    size_t slen = strlen(s);
+    return len == slen && memcmp(name, s, len) == 0;
+}
+
+static struct wsd_view make_trimmed_view(const char *start, const char *end) {
+    struct wsd_view v;
+    while (start < end && is_xml_space(*start)) start++;
+    while (end > start && is_xml_space(end[-1])) end--;
+    v.ptr = start;
+    v.len = (size_t)(end - start);
+    return v;
+}
+
+// Find the end of a "<?...?>", "<!--...-->" or "<![CDATA[...]]>" construct
+// starting at p (just after '<'). Returns the position after it or NULL.
+static const char *skip_special(const char *p, const char *end) {
+    const char *start = p;
+    const char *terminator = ">";
+    size_t tlen = 1;
+
+    if (*p == '?') {
+        terminator = "?>";
+        tlen = 2;
+    } else if (end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+        terminator = "-->";
+        tlen = 3;
+    } else if (end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0) {
+        terminator = "]]>";
+        tlen = 3;
+    }
+
+    while (p < end) {
+        const char *gt = memchr(p, '>', (size_t)(end - p));
+        if (!gt) return NULL;
+        if ((size_t)(gt + 1 - start) > tlen && memcmp(gt + 1 - tlen, terminator, tlen) == 0) return gt + 1;
+        p = gt + 1;
+    }
+    return NULL;
+}
+
+// Find the '>' closing a start tag, skipping quoted attribute values.
+// Jumps from quote to quote with a vector scan rather than walking every
+// byte, which matters for envelopes declaring dozens of namespaces.
+static const char *find_tag_end(const char *p, const char *end) {
+    while (p < end) {
+        const char *d = wsd_scan_tag_delim(p, end);
+        if (d == end) return NULL;
+        if (*d == '>') return d;
+        const char *close = memchr(d + 1, *d, (size_t)(end - d - 1));
+        if (!close) return NULL;
+        p = close + 1;
+    }
+    return NULL;
+}
+
+// Value of the attribute with local name `name` in the start tag between
+// p and gt, or an empty view
+static struct wsd_view find_attribute(const char *p, const char *gt, const char *name) {
+    struct wsd_view v = {p, 0};
+
+    while (p < gt) {
+        while (p < gt && is_xml_space(*p)) p++;
+        const char *aname = p;
+        while (p < gt && *p != '=' && !is_xml_space(*p)) p++;
+        const char *aname_end = p;
+        const char *q = memchr(p, '"', (size_t)(gt - p));
+        const char *sq = memchr(p, '\'', (size_t)((q ? q : gt) - p));
+        if (sq) q = sq;
+        if (!q) break;
+        const char *close = memchr(q + 1, *q, (size_t)(gt - q - 1));
+        if (!close) break;
+
+        const char *colon = memchr(aname, ':', (size_t)(aname_end - aname));
+        const char *lname = colon ? colon + 1 : aname;
+        if (local_eq(lname, (size_t)(aname_end - lname), name)) return make_trimmed_view(q + 1, close);
+        p = close + 1;
+    }
+    return v;
+}
+
+int wsd_parse(const char *buf, size_t len, struct wsd_message *msg) {
+    const char *p = buf;
+    const char *end = buf + len;
+    int depth = 0;
+    int container_depth = -1;         // depth of the open ProbeMatch/Hello/...
+    int epr_depth = -1;               // depth of its EndpointReference
+    int field_depth = -1;             // depth of the element being captured
+    const char *field_start = NULL;
+    struct wsd_view *field = NULL;
+    struct wsd_match *cur = NULL;
+
+    msg->type = WSD_MSG_UNKNOWN;
+    msg->message_id.ptr = msg->relates_to.ptr = msg->action.ptr = NULL;
+    msg->message_id.len = msg->relates_to.len = msg->action.len = 0;
+    msg->match_count = 0;
+    msg->dropped = 0;
+
+    while (p < end) {
+        const char *lt = memchr(p, '<', (size_t)(end - p));
+        if (!lt) break;
+        p = lt + 1;
+        if (p >= end) return -1;
+
+        // Processing instructions, comments, CDATA and doctype
+        if (*p == '?' || *p == '!') {
+            p = skip_special(p, end);
+            if (!p) return -1;
+            continue;
+        }
+
+        // End tag
+        if (*p == '/') {
+            const char *gt = memchr(p, '>', (size_t)(end - p));
+            if (!gt) return -1;
+            p = gt + 1;
+            depth--;
+
+            if (field && depth == field_depth) {
+                *field = make_trimmed_view(field_start, lt);
+                field = NULL;
+            } else if (!field && depth == epr_depth) {
+                epr_depth = -1;
+            } else if (!field && depth == container_depth) {
+                container_depth = -1;
+                if (cur) msg->match_count++;
+                cur = NULL;
+            }
+            continue;
+        }
+
+        // Start tag: split the qualified name into prefix and local part
+        const char *name = p;
+        p = wsd_scan_name_end(p, end);
+        const char *name_end = p;
+        const char *gt = find_tag_end(p, end);
+        if (!gt) return -1;
+        int self_closing = gt[-1] == '/';
+        p = gt + 1;
+
+        const char *colon = memchr(name, ':', (size_t)(name_end - name));
+        const char *lname = colon ? colon + 1 : name;
+        size_t llen = (size_t)(name_end - lname);
+        struct wsd_view *capture = NULL;
+
+        // Elements nested inside a captured field are just text for us
+        if (!field) {
+            if (container_depth < 0) {
+                if (msg->type == WSD_MSG_UNKNOWN) {
+                    if (local_eq(lname, llen, "ProbeMatches")) msg->type = WSD_MSG_PROBE_MATCHES;
+                    else if (local_eq(lname, llen, "ResolveMatches")) msg->type = WSD_MSG_RESOLVE_MATCHES;
+                    else if (local_eq(lname, llen, "Hello")) msg->type = WSD_MSG_HELLO;
+                    else if (local_eq(lname, llen, "Bye")) msg->type = WSD_MSG_BYE;
+                    else if (local_eq(lname, llen, "Probe")) msg->type = WSD_MSG_PROBE;
+                    else if (local_eq(lname, llen, "Resolve")) msg->type = WSD_MSG_RESOLVE;
+                }
+
+                if (local_eq(lname, llen, "ProbeMatch") || local_eq(lname, llen, "ResolveMatch") ||
+                    local_eq(lname, llen, "Hello") || local_eq(lname, llen, "Bye") ||
+                    local_eq(lname, llen, "Probe") || local_eq(lname, llen, "Resolve")) {
+                    if (msg->match_count < WSD_MAX_MATCHES) {
+                        cur = &msg->matches[msg->match_count];
+                        memset(cur, 0, sizeof(*cur));
+                    } else {
+                        msg->dropped++;
+                        cur = NULL;
+                    }
+                    if (self_closing) {
+                        if (cur) msg->match_count++;
+                        cur = NULL;
+                    } else {
+                        container_depth = depth;
+                    }
+                } else if (local_eq(lname, llen, "MessageID")) {
+                    capture = &msg->message_id;
+                } else if (local_eq(lname, llen, "RelatesTo")) {
+                    capture = &msg->relates_to;
+                } else if (local_eq(lname, llen, "Action")) {
+                    capture = &msg->action;
+                }
+            } else if (cur) {
+                if (local_eq(lname, llen, "EndpointReference")) {
+                    if (!self_closing) epr_depth = depth;
+                } else if (epr_depth >= 0 && local_eq(lname, llen, "Address")) {
+                    capture = &cur->address;
+                } else if (local_eq(lname, llen, "Types")) {
+                    capture = &cur->types;
+                } else if (local_eq(lname, llen, "Scopes")) {
+                    capture = &cur->scopes;
+                    if (msg->type == WSD_MSG_PROBE) cur->match_by = find_attribute(name_end, gt, "MatchBy");
+                } else if (local_eq(lname, llen, "XAddrs")) {
+                    capture = &cur->xaddrs;
+                } else if (local_eq(lname, llen, "MetadataVersion")) {
+                    capture = &cur->metadata_version;
+                }
+            }
+        }
+
+        if (self_closing) {
+            if (capture) {
+                capture->ptr = p;
+                capture->len = 0;
+            }
+            continue;
+        }
+
+        if (capture) {
+            field = capture;
+            field_start = p;
+            field_depth = depth;
+        }
+        depth++;
+    }
+
+    // Anything still open means the datagram was cut short
+    if (field || container_depth >= 0) return -1;
+    return msg->match_count;
+}
+
+int wsd_scan_header(const char *buf, size_t len, struct wsd_header *hdr) {
+    const char *p = buf;
+    const char *end = buf + len;
+
+    memset(hdr, 0, sizeof(*hdr));
+    while (p < end) {
+        const char *lt = memchr(p, '<', (size_t)(end - p));
+        if (!lt || lt + 1 >= end) return -1;
+        p = lt + 1;
+        if (*p == '?' || *p == '!') {
+            p = skip_special(p, end);
+            if (!p) return -1;
+            continue;
+        }
+        if (*p == '/') continue;
+
+        const char *name = p;
+        p = wsd_scan_name_end(p, end);
+        const char *name_end = p;
+        const char *gt = find_tag_end(p, end);
+        if (!gt) return -1;
+        p = gt + 1;
+
+        const char *colon = memchr(name, ':', (size_t)(name_end - name));
+        const char *lname = colon ? colon + 1 : name;
+        size_t llen = (size_t)(name_end - lname);
+        struct wsd_view *field = NULL;
+
+        if (local_eq(lname, llen, "Body")) return 0;
+        if (gt[-1] == '/') continue;
+        if (local_eq(lname, llen, "MessageID")) field = &hdr->message_id;
+        else if (local_eq(lname, llen, "RelatesTo")) field = &hdr->relates_to;
+        else if (local_eq(lname, llen, "Action")) field = &hdr->action;
+        if (field) {
+            const char *text_end = memchr(p, '<', (size_t)(end - p));
+            if (!text_end) return -1;
+            *field = make_trimmed_view(p, text_end);
+            p = text_end;
+        }
+    }
+    return -1;
+}
+
+int wsd_extract_leaves(const char *buf, size_t len, const char *const *names, int count, struct wsd_view *out) {
+    const char *p = buf;
+    const char *end = buf + len;
+    int found = 0;
+
+    for (int i = 0; i < count; i++) {
+        out[i].ptr = NULL;
+        out[i].len = 0;
+    }
+
+    while (p < end && found < count) {
+        const char *lt = memchr(p, '<', (size_t)(end - p));
+        if (!lt || lt + 1 >= end) break;
+        p = lt + 1;
+        if (*p == '/' || *p == '?' || *p == '!') continue;
+
+        const char *name = p;
+        p = wsd_scan_name_end(p, end);
+        const char *name_end = p;
+        const char *gt = find_tag_end(p, end);
+        if (!gt) break;
+        p = gt + 1;
+        if (gt[-1] == '/') continue;
+
+        const char *colon = memchr(name, ':', (size_t)(name_end - name));
+        const char *lname = colon ? colon + 1 : name;
+        size_t llen = (size_t)(name_end - lname);
+
+        for (int i = 0; i < count; i++) {
+            if (out[i].ptr || !local_eq(lname, llen, names[i])) continue;
+            // Leaf element: the text runs up to the next tag
+            const char *text_end = memchr(p, '<', (size_t)(end - p));
+            out[i] = make_trimmed_view(p, text_end ? text_end : end);
+            found++;
+            break;
+        }
+    }
+    return found;
+}
+
+int wsd_view_eq(struct wsd_view v, const char *s) {
+    size_t slen = strlen(s);
+    return v.len == slen && memcmp(v.ptr, s, slen) == 0;
+}
+
+int wsd_view_has_prefix(struct wsd_view v, const char *prefix) {
+    size_t plen = strlen(prefix);
+    return v.len >= plen && memcmp(v.ptr, prefix, plen) == 0;
+}
+
+int wsd_view_has_suffix(struct wsd_view v, const char *suffix) {
+    size_t slen = strlen(suffix);
+    return v.len >= slen && memcmp(v.ptr + v.len - slen, suffix, slen) == 0;
+}
+
+size_t wsd_view_copy(struct wsd_view v, char *dst, size_t size) {
+    if (size == 0) return 0;
+    size_t n = v.len < size - 1 ? v.len : size - 1;
+    if (n) memcpy(dst, v.ptr, n);
+    dst[n] = '\0';
+    return n;
+}
+
+// Store code point c as UTF-8 in out (4 bytes of room). Returns the length.
+static size_t put_utf8(unsigned c, char *out) {
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = (char)(0xC0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = (char)(0xE0 | (c >> 12));
+        out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (c >> 18));
+    out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
+// Decode one entity at s (pointing at '&') into out (4 bytes of room),
+// numeric references as UTF-8. Returns the number of input bytes consumed
+// and sets *out_len, or returns 0 if not an entity. The output is never
+// longer than the entity.
+static size_t decode_entity(const char *s, const char *end, char *out, size_t *out_len) {
+    static const struct { const char *name; size_t len; char ch; } named[] = {
+        {"&lt;", 4, '<'}, {"&gt;", 4, '>'}, {"&amp;", 5, '&'},
+        {"&quot;", 6, '"'}, {"&apos;", 6, '\''}
+    };
+    size_t avail = (size_t)(end - s);
+
+    for (size_t i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+        if (avail >= named[i].len && memcmp(s, named[i].name, named[i].len) == 0) {
+            *out = named[i].ch;
+            *out_len = 1;
+            return named[i].len;
+        }
+    }
+
+    // Numeric entities &#NN; and &#xNN;, any Unicode scalar value
+    if (avail >= 4 && s[1] == '#') {
+        const char *q = s + 2;
+        int hex = 0;
+        unsigned code = 0;
+        if (*q == 'x' || *q == 'X') {
+            hex = 1;
+            q++;
+        }
+        const char *digits = q;
+        for (; q < end && q - digits < 8; q++) {
+            char c = *q;
+            if (c >= '0' && c <= '9') code = code * (hex ? 16 : 10) + (unsigned)(c - '0');
+            else if (hex && c >= 'a' && c <= 'f') code = code * 16 + (unsigned)(c - 'a' + 10);
+            else if (hex && c >= 'A' && c <= 'F') code = code * 16 + (unsigned)(c - 'A' + 10);
+            else break;
+        }
+        if (q > digits && q < end && *q == ';' && code > 0 && code <= 0x10FFFF &&
+            (code < 0xD800 || code > 0xDFFF)) {
+            *out_len = put_utf8(code, out);
+            return (size_t)(q + 1 - s);
+        }
+    }
+    return 0;
+}
+
+size_t wsd_view_decode(struct wsd_view v, char *dst, size_t size) {
+    if (size == 0) return 0;
+    const char *p = v.ptr;
+    const char *end = v.ptr + v.len;
+    size_t w = 0;
+
+    while (p < end && w < size - 1) {
+        const char *amp = memchr(p, '&', (size_t)(end - p));
+        const char *run_end = amp ? amp : end;
+        size_t run = (size_t)(run_end - p);
+        if (run > size - 1 - w) run = size - 1 - w;
+        memcpy(dst + w, p, run);
+        w += run;
+        p += run;
+        if (p != amp || w >= size - 1) continue;
+
+        char ch[4];
+        size_t n = 1;
+        size_t used = decode_entity(p, end, ch, &n);
+        if (!used) ch[0] = *p;
+        // Truncate before a character, never inside its UTF-8 sequence
+        if (n > size - 1 - w) break;
+        memcpy(dst + w, ch, n);
+        w += n;
+        p += used ? used : 1;
+    }
+    dst[w] = '\0';
+    return w;
+}
+
+int wsd_xml_escape(const char *s, char *dst, size_t size) {
+    size_t w = 0;
+
+    if (size == 0) return -1;
+    for (; *s; s++) {
+        const char *e = NULL;
+        switch (*s) {
+        case '&': e = "&amp;"; break;
+        case '<': e = "&lt;"; break;
+        case '>': e = "&gt;"; break;
+        case '"': e = "&quot;"; break;
+        }
+        size_t n = e ? strlen(e) : 1;
+        if (w + n >= size) return -1;
+        memcpy(dst + w, e ? e : s, n);
+        w += n;
+    }
+    dst[w] = '\0';
+    return (int)w;
+}
+
+int wsd_view_next_token(struct wsd_view *list, struct wsd_view *tok) {
+    const char *p = list->ptr;
+    const char *end = list->ptr + list->len;
+
+    const char *start = wsd_scan_item(p, end, &p);
+    if (start == end) {
+        list->ptr = end;
+        list->len = 0;
+        return 0;
+    }
+
+    tok->ptr = start;
+    tok->len = (size_t)(p - start);
+    list->ptr = p;
+    list->len = (size_t)(end - p);
+    return 1;
+}
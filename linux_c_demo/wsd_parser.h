@@ -0,0 +1,98 @@
+#ifndef WSD_PARSER_H
+#define WSD_PARSER_H
+
+#include <stddef.h>
+
+// Single-pass WS-Discovery message parser.
+// All fields are views into the caller's buffer: nothing is copied or
+// decoded unless the caller asks for it with wsd_view_copy/wsd_view_decode.
+// Element names are matched on their local part, so any namespace prefix
+// (d:, wsdd:, dn:, none at all...) is accepted.
+
+#define WSD_MAX_MATCHES 64
+
+// A slice of the parsed buffer, not NUL-terminated
+struct wsd_view {
+    const char *ptr;
+    size_t len;
+};
+
+enum wsd_msg_type {
+    WSD_MSG_UNKNOWN = 0,
+    WSD_MSG_PROBE,
+    WSD_MSG_PROBE_MATCHES,
+    WSD_MSG_RESOLVE,
+    WSD_MSG_RESOLVE_MATCHES,
+    WSD_MSG_HELLO,
+    WSD_MSG_BYE
+};
+
+// One ProbeMatch/ResolveMatch, or the body of a Hello/Bye/Probe/Resolve
+struct wsd_match {
+    struct wsd_view address;          // EndpointReference/Address
+    struct wsd_view types;
+    struct wsd_view scopes;
+    struct wsd_view xaddrs;
+    struct wsd_view metadata_version;
+    struct wsd_view match_by;         // Probe: the MatchBy of its Scopes, if given
+};
+
+struct wsd_message {
+    enum wsd_msg_type type;
+    struct wsd_view message_id;
+    struct wsd_view relates_to;
+    struct wsd_view action;
+    int match_count;                  // completed entries in matches[]
+    int dropped;                      // entries beyond WSD_MAX_MATCHES
+    struct wsd_match matches[WSD_MAX_MATCHES];
+};
+
+// WS-Addressing header fields, read without walking the Body
+struct wsd_header {
+    struct wsd_view message_id;
+    struct wsd_view relates_to;
+    struct wsd_view action;
+};
+
+// Walk buf once and fill msg. buf does not need to be NUL-terminated.
+// Returns the number of matches, or -1 if the datagram is malformed or
+// truncated; matches completed before the error are still in msg.
+int wsd_parse(const char *buf, size_t len, struct wsd_message *msg);
+
+// Read MessageID, RelatesTo and Action from the SOAP Header and stop at
+// the start of the Body, so a datagram can be rejected for the price of
+// its header. Missing fields are empty views.
+// Returns 0, or -1 if no Body start was found.
+int wsd_scan_header(const char *buf, size_t len, struct wsd_header *hdr);
+
+// Find the first leaf element with each of the given local names in one
+// pass over any XML document (e.g. a SOAP response). out[i] receives the
+// trimmed text of names[i], or an empty view if it is missing.
+// Returns the number of names found.
+int wsd_extract_leaves(const char *buf, size_t len, const char *const *names, int count, struct wsd_view *out);
+
+// Return 1 if v equals the C string s
+int wsd_view_eq(struct wsd_view v, const char *s);
+
+// Return 1 if v starts with prefix
+int wsd_view_has_prefix(struct wsd_view v, const char *prefix);
+
+// Return 1 if v ends with suffix
+int wsd_view_has_suffix(struct wsd_view v, const char *suffix);
+
+// Copy v into dst as a C string, truncating to size - 1. Returns the length.
+size_t wsd_view_copy(struct wsd_view v, char *dst, size_t size);
+
+// Same as wsd_view_copy but decodes XML entities (&lt; &amp; &#NN; ...)
+size_t wsd_view_decode(struct wsd_view v, char *dst, size_t size);
+
+// The reverse: copy s into dst with & < > " escaped, as a C string.
+// Returns the length, or -1 if it does not fit in size.
+int wsd_xml_escape(const char *s, char *dst, size_t size);
+
+// Split a whitespace separated list (Types, Scopes, XAddrs) in place:
+// stores the next item in tok and advances list past it.
+// Returns 1 if an item was found, 0 at the end of the list.
+int wsd_view_next_token(struct wsd_view *list, struct wsd_view *tok);
+
+#endif
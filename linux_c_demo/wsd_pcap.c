@@ -0,0 +1,525 @@
+#include "wsd_pcap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PCAP_MAGIC_US 0xA1B2C3D4u
+#define PCAP_MAGIC_NS 0xA1B23C4Du
+#define PCAPNG_SHB 0x0A0D0D0Au
+#define PCAPNG_BOM 0x1A2B3C4Du
+
+#define PCAPNG_IDB 1
+#define PCAPNG_PB 2                   // obsolete Packet Block
+#define PCAPNG_SPB 3
+#define PCAPNG_EPB 6
+
+// Link types (tcpdump.org/linktypes.html)
+#define LINK_NULL 0
+#define LINK_ETHERNET 1
+#define LINK_RAW_BSD 12
+#define LINK_RAW_OPENBSD 14
+#define LINK_RAW 101
+#define LINK_LOOP 108
+#define LINK_SLL 113
+#define LINK_IPV4 228
+#define LINK_IPV6 229
+#define LINK_SLL2 276
+
+#define READ_CHUNK (256 * 1024)
+#define MAX_RECORD (16 * 1024 * 1024) // larger blocks mean a corrupt file
+#define MAX_DATAGRAM 65536
+
+struct wsd_pcap_fragment {
+    int used;
+    int family;
+    unsigned char src[16];
+    unsigned char dst[16];
+    uint32_t id;
+    uint64_t age;
+    size_t total;                     // payload length, 0 until the last fragment
+    size_t units;                     // 8-byte units received
+    unsigned char *data;              // MAX_DATAGRAM bytes, kept across uses
+    uint8_t seen[MAX_DATAGRAM / 8 / 8];  // one bit per 8-byte unit
+};
+
+static uint16_t be16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+// Integers in the byte order of the file
+static uint32_t rd32(const struct wsd_pcap *p, const unsigned char *b) {
+    return p->swap ? be32(b) : le32(b);
+}
+
+static uint16_t rd16(const struct wsd_pcap *p, const unsigned char *b) {
+    return p->swap ? be16(b) : (uint16_t)(b[1] << 8 | b[0]);
+}
+
+// Make n unread bytes available. Returns 1, or 0 at the end of the file.
+static int fill(struct wsd_pcap *p, size_t n) {
+    if (p->map) return p->map_size - p->pos >= n;
+    if (p->buf_len - p->pos >= n) return 1;
+
+    // Move the unread tail to the front, grow, and read up to n
+    memmove(p->buf, p->buf + p->pos, p->buf_len - p->pos);
+    p->buf_len -= p->pos;
+    p->pos = 0;
+    if (n > p->buf_cap) {
+        unsigned char *buf = realloc(p->buf, n);
+        if (!buf) return 0;
+        p->buf = buf;
+        p->buf_cap = n;
+    }
+    while (p->buf_len < n && !p->eof) {
+        ssize_t r = read(p->fd, p->buf + p->buf_len, p->buf_cap - p->buf_len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            p->eof = 1;
+            break;
+        }
+        p->buf_len += (size_t)r;
+    }
+    return p->buf_len >= n;
+}
+
+// Consume n bytes. Returns a pointer to them, or NULL at the end of the file.
+static const unsigned char *take(struct wsd_pcap *p, size_t n) {
+    if (!fill(p, n)) return NULL;
+    p->pos += n;
+    return (p->map ? p->map : p->buf) + p->pos - n;
+}
+
+static int at_end(struct wsd_pcap *p) {
+    return !fill(p, 1);
+}
+
+static int64_t ticks_to_ns(uint64_t ticks, uint64_t per_sec) {
+    return (int64_t)(ticks / per_sec * 1000000000 + ticks % per_sec * 1000000000 / per_sec);
+}
+
+// --- IP and UDP ---------------------------------------------------------------
+
+static void set_from(struct sockaddr_storage *from, int family, const unsigned char *addr, uint16_t port) {
+    memset(from, 0, sizeof(*from));
+    if (family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)from;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        memcpy(&sin->sin_addr, addr, 4);
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)from;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        memcpy(&sin6->sin6_addr, addr, 16);
+    }
+}
+
+// A UDP header and what follows of it. Returns 1 for a WS-Discovery datagram.
+static int decode_udp(const unsigned char *u, size_t len, int family, const unsigned char *src,
+                      struct wsd_pcap_packet *pkt) {
+    if (len < 8) return 0;
+    uint16_t sport = be16(u);
+    uint16_t dport = be16(u + 2);
+    size_t udp_len = be16(u + 4);
+    if (sport != WSD_PCAP_PORT && dport != WSD_PCAP_PORT) return 0;
+    if (udp_len < 8) return 0;
+
+    pkt->data = (const char *)u + 8;
+    pkt->len = udp_len - 8;
+    if (udp_len > len) {
+        pkt->len = len - 8;
+        pkt->truncated = 1;
+    }
+    set_from(&pkt->from, family, src, sport);
+    return 1;
+}
+
+static struct wsd_pcap_fragment *find_fragment(struct wsd_pcap *p, int family, const unsigned char *src,
+                                              const unsigned char *dst, uint32_t id) {
+    size_t alen = family == AF_INET ? 4 : 16;
+    struct wsd_pcap_fragment *slot = NULL;
+
+    for (int i = 0; i < WSD_PCAP_REASSEMBLY; i++) {
+        struct wsd_pcap_fragment *f = &p->frags[i];
+        if (f->used && f->family == family && f->id == id && memcmp(f->src, src, alen) == 0 &&
+            memcmp(f->dst, dst, alen) == 0) {
+            return f;
+        }
+        if (!slot || (slot->used && (!f->used || f->age < slot->age))) slot = f;
+    }
+
+    // A free slot, or the oldest reassembly, which is given up
+    if (slot->used) p->incomplete++;
+    if (!slot->data) {
+        slot->data = malloc(MAX_DATAGRAM);
+        if (!slot->data) return NULL;
+    }
+    slot->used = 1;
+    slot->family = family;
+    memcpy(slot->src, src, alen);
+    memcpy(slot->dst, dst, alen);
+    slot->id = id;
+    slot->total = 0;
+    slot->units = 0;
+    memset(slot->seen, 0, sizeof(slot->seen));
+    return slot;
+}
+
+// Add one fragment of a UDP datagram at byte offset off. Returns 1 when
+// the datagram is complete, with *pkt pointing into the slot.
+static int add_fragment(struct wsd_pcap *p, int family, const unsigned char *src, const unsigned char *dst,
+                        uint32_t id, size_t off, int more, const unsigned char *data, size_t len,
+                        struct wsd_pcap_packet *pkt) {
+    p->fragments++;
+    if (off + len > MAX_DATAGRAM || (more && len % 8 != 0)) return 0;
+    struct wsd_pcap_fragment *f = find_fragment(p, family, src, dst, id);
+    if (!f) return 0;
+
+    f->age = ++p->frag_clock;
+    memcpy(f->data + off, data, len);
+    for (size_t u = off / 8; u < (off + len + 7) / 8; u++) {
+        if (f->seen[u / 8] & (1u << (u % 8))) continue;
+        f->seen[u / 8] |= (uint8_t)(1u << (u % 8));
+        f->units++;
+    }
+    if (!more) f->total = off + len;
+    if (f->total == 0 || f->units < (f->total + 7) / 8) return 0;
+
+    f->used = 0;
+    return decode_udp(f->data, f->total, family, f->src, pkt);
+}
+
+static int decode_ipv4(struct wsd_pcap *p, const unsigned char *d, size_t len, struct wsd_pcap_packet *pkt) {
+    if (len < 20 || d[0] >> 4 != 4) return 0;
+    size_t hlen = (size_t)(d[0] & 15) * 4;
+    size_t total = be16(d + 2);
+    if (hlen < 20 || total < hlen || len < hlen) return 0;
+    if (d[9] != IPPROTO_UDP) return 0;
+    // Ethernet pads short frames; the snap length cuts long ones
+    if (total <= len) len = total;
+    else pkt->truncated = 1;
+
+    uint16_t frag = be16(d + 6);
+    size_t off = (size_t)(frag & 0x1FFF) * 8;
+    int more = (frag & 0x2000) != 0;
+    if (off || more) {
+        if (pkt->truncated) return 0;
+        return add_fragment(p, AF_INET, d + 12, d + 16, be16(d + 4), off, more, d + hlen, len - hlen, pkt);
+    }
+    return decode_udp(d + hlen, len - hlen, AF_INET, d + 12, pkt);
+}
+
+static int decode_ipv6(struct wsd_pcap *p, const unsigned char *d, size_t len, struct wsd_pcap_packet *pkt) {
+    if (len < 40 || d[0] >> 4 != 6) return 0;
+    size_t total = 40 + (size_t)be16(d + 4);
+    if (total <= len) len = total;
+    else pkt->truncated = 1;
+
+    // Walk the extension headers up to UDP
+    int next = d[6];
+    size_t off = 40;
+    for (;;) {
+        if (next == IPPROTO_UDP) return decode_udp(d + off, len - off, AF_INET6, d + 8, pkt);
+        if (len - off < 8) return 0;
+        const unsigned char *h = d + off;
+        if (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS) {
+            next = h[0];
+            off += ((size_t)h[1] + 1) * 8;
+        } else if (next == IPPROTO_AH) {
+            next = h[0];
+            off += ((size_t)h[1] + 2) * 4;
+        } else if (next == IPPROTO_FRAGMENT) {
+            uint16_t frag = be16(h + 2);
+            if (h[0] != IPPROTO_UDP || pkt->truncated) return 0;
+            return add_fragment(p, AF_INET6, d + 8, d + 24, be32(h + 4), frag & 0xFFF8, frag & 1, h + 8,
+                                len - off - 8, pkt);
+        } else {
+            return 0;
+        }
+        if (off > len) return 0;
+    }
+}
+
+static int decode_ip(struct wsd_pcap *p, const unsigned char *d, size_t len, struct wsd_pcap_packet *pkt) {
+    if (len < 1) return 0;
+    if (d[0] >> 4 == 4) return decode_ipv4(p, d, len, pkt);
+    if (d[0] >> 4 == 6) return decode_ipv6(p, d, len, pkt);
+    return 0;
+}
+
+// One captured frame. Returns 1 for a WS-Discovery datagram.
+static int decode_frame(struct wsd_pcap *p, uint32_t linktype, const unsigned char *d, size_t len, int cut,
+                        struct wsd_pcap_packet *pkt) {
+    size_t off;
+    uint32_t type;
+
+    switch (linktype) {
+    case LINK_ETHERNET:
+        if (len < 14) return 0;
+        type = be16(d + 12);
+        off = 14;
+        // 802.1Q, 802.1ad and the old QinQ tag
+        while ((type == 0x8100 || type == 0x88A8 || type == 0x9100) && len >= off + 4) {
+            type = be16(d + off + 2);
+            off += 4;
+        }
+        break;
+    case LINK_SLL:
+        if (len < 16) return 0;
+        type = be16(d + 14);
+        off = 16;
+        break;
+    case LINK_SLL2:
+        if (len < 20) return 0;
+        type = be16(d);
+        off = 20;
+        break;
+    case LINK_NULL:
+    case LINK_LOOP:
+        // The address family, in the capturing host's byte order for NULL
+        if (len < 4) return 0;
+        type = linktype == LINK_LOOP ? be32(d) : rd32(p, d);
+        type = type == 2 ? 0x0800 : (type == 24 || type == 28 || type == 30) ? 0x86DD : 0;
+        off = 4;
+        break;
+    case LINK_RAW:
+    case LINK_RAW_BSD:
+    case LINK_RAW_OPENBSD:
+    case LINK_IPV4:
+    case LINK_IPV6:
+        pkt->truncated = cut;
+        return decode_ip(p, d, len, pkt);
+    default:
+        return 0;
+    }
+    if (type != 0x0800 && type != 0x86DD) return 0;
+    pkt->truncated = cut;
+    return type == 0x0800 ? decode_ipv4(p, d + off, len - off, pkt) : decode_ipv6(p, d + off, len - off, pkt);
+}
+
+// --- File formats -------------------------------------------------------------
+
+static int next_classic(struct wsd_pcap *p, struct wsd_pcap_packet *pkt) {
+    for (;;) {
+        if (at_end(p)) return 0;
+        const unsigned char *h = take(p, 16);
+        if (!h) return -1;
+        uint32_t caplen = rd32(p, h + 8);
+        uint32_t origlen = rd32(p, h + 12);
+        if (caplen > MAX_RECORD) return -1;
+        const unsigned char *d = take(p, caplen);
+        if (!d) return -1;
+
+        p->records++;
+        memset(pkt, 0, sizeof(*pkt));
+        pkt->ifname = "";
+        pkt->ts_ns = ticks_to_ns((uint64_t)rd32(p, h) * p->ticks_per_sec + rd32(p, h + 4), p->ticks_per_sec);
+        uint64_t fragments = p->fragments;
+        if (decode_frame(p, p->linktype, d, caplen, caplen < origlen, pkt)) return 1;
+        if (p->fragments == fragments) p->skipped++;
+    }
+}
+
+// Interface Description Block: link type, if_name and if_tsresol
+static void add_interface(struct wsd_pcap *p, const unsigned char *body, size_t len) {
+    if (len < 8 || p->if_count >= WSD_PCAP_MAX_IFACES) return;
+    int i = p->if_count++;
+    p->if_linktype[i] = rd16(p, body);
+    p->if_ticks_per_sec[i] = 1000000;
+    p->if_name[i][0] = '\0';
+
+    for (size_t off = 8; off + 4 <= len;) {
+        uint16_t code = rd16(p, body + off);
+        size_t olen = rd16(p, body + off + 2);
+        const unsigned char *v = body + off + 4;
+        if (code == 0 || off + 4 + olen > len) break;
+        if (code == 2) {
+            size_t n = olen < sizeof(p->if_name[i]) ? olen : sizeof(p->if_name[i]) - 1;
+            memcpy(p->if_name[i], v, n);
+            p->if_name[i][n] = '\0';
+        } else if (code == 9 && olen >= 1) {
+            // 10^-n or, with the top bit set, 2^-n seconds per tick
+            int n = v[0] & 0x7F;
+            uint64_t per_sec = 1;
+            if (v[0] & 0x80) per_sec = n < 64 ? (uint64_t)1 << n : 0;
+            else for (int k = 0; k < n && k < 19; k++) per_sec *= 10;
+            if (per_sec) p->if_ticks_per_sec[i] = per_sec;
+        }
+        off += 4 + ((olen + 3) & ~(size_t)3);
+    }
+}
+
+static int next_ng(struct wsd_pcap *p, struct wsd_pcap_packet *pkt) {
+    for (;;) {
+        if (at_end(p)) return 0;
+        const unsigned char *h = take(p, 8);
+        if (!h) return -1;
+        uint32_t type = rd32(p, h);
+
+        // A new section may switch byte order; its interfaces start over
+        if (type == PCAPNG_SHB) {
+            const unsigned char *bom = take(p, 4);
+            if (!bom) return -1;
+            if (le32(bom) == PCAPNG_BOM) p->swap = 0;
+            else if (be32(bom) == PCAPNG_BOM) p->swap = 1;
+            else return -1;
+            p->if_count = 0;
+            uint32_t total = rd32(p, h + 4);
+            if (total < 28 || total % 4 || total > MAX_RECORD || !take(p, total - 12)) return -1;
+            continue;
+        }
+
+        uint32_t total = rd32(p, h + 4);
+        if (total < 12 || total % 4 || total > MAX_RECORD) return -1;
+        const unsigned char *body = take(p, total - 8);
+        if (!body) return -1;
+        size_t len = total - 12;
+
+        if (type == PCAPNG_IDB) {
+            add_interface(p, body, len);
+            continue;
+        }
+
+        uint32_t ifid, caplen, origlen;
+        uint64_t ticks = 0;
+        const unsigned char *d;
+        if (type == PCAPNG_EPB && len >= 20) {
+            ifid = rd32(p, body);
+            ticks = (uint64_t)rd32(p, body + 4) << 32 | rd32(p, body + 8);
+            caplen = rd32(p, body + 12);
+            origlen = rd32(p, body + 16);
+            d = body + 20;
+            if (caplen > len - 20) return -1;
+        } else if (type == PCAPNG_PB && len >= 20) {
+            ifid = rd16(p, body);
+            ticks = (uint64_t)rd32(p, body + 4) << 32 | rd32(p, body + 8);
+            caplen = rd32(p, body + 12);
+            origlen = rd32(p, body + 16);
+            d = body + 20;
+            if (caplen > len - 20) return -1;
+        } else if (type == PCAPNG_SPB && len >= 4) {
+            // No capture length: the snap length cut it if it fills the block
+            ifid = 0;
+            origlen = rd32(p, body);
+            caplen = origlen < len - 4 ? origlen : (uint32_t)(len - 4);
+            d = body + 4;
+        } else {
+            continue;                 // statistics, name resolution, custom blocks
+        }
+
+        p->records++;
+        if (ifid >= (uint32_t)p->if_count) {
+            p->skipped++;
+            continue;
+        }
+        memset(pkt, 0, sizeof(*pkt));
+        pkt->ifname = p->if_name[ifid];
+        if (type != PCAPNG_SPB) pkt->ts_ns = ticks_to_ns(ticks, p->if_ticks_per_sec[ifid]);
+        uint64_t fragments = p->fragments;
+        if (decode_frame(p, p->if_linktype[ifid], d, caplen, caplen < origlen, pkt)) return 1;
+        if (p->fragments == fragments) p->skipped++;
+    }
+}
+
+static int next_raw(struct wsd_pcap *p, struct wsd_pcap_packet *pkt) {
+    if (at_end(p)) return 0;
+    const unsigned char *h = take(p, 4);
+    if (!h) return -1;
+    uint32_t len = le32(h);
+    if (len > MAX_RECORD) return -1;
+    const unsigned char *d = take(p, len);
+    if (!d) return -1;
+
+    p->records++;
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->ifname = "";
+    pkt->data = (const char *)d;
+    pkt->len = len;
+    pkt->from.ss_family = AF_UNSPEC;
+    return 1;
+}
+
+int wsd_pcap_next(struct wsd_pcap *p, struct wsd_pcap_packet *pkt) {
+    if (p->format == WSD_PCAP_CLASSIC) return next_classic(p, pkt);
+    if (p->format == WSD_PCAP_NG) return next_ng(p, pkt);
+    return next_raw(p, pkt);
+}
+
+int wsd_pcap_open(struct wsd_pcap *p, const char *path) {
+    struct stat st;
+
+    memset(p, 0, sizeof(*p));
+    p->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (p->fd < 0) return -1;
+
+    if (fstat(p->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, p->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            p->map = map;
+            p->map_size = (size_t)st.st_size;
+        }
+    }
+    if (!p->map) {
+        p->buf_cap = READ_CHUNK;
+        p->buf = malloc(p->buf_cap);
+    }
+    p->frags = calloc(WSD_PCAP_REASSEMBLY, sizeof(*p->frags));
+    if ((!p->map && !p->buf) || !p->frags) {
+        wsd_pcap_close(p);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Sniff the magic; no recognised header means a raw payload stream
+    const unsigned char *magic = take(p, 4);
+    p->format = WSD_PCAP_RAW;
+    if (!magic) return 0;
+    uint32_t m = le32(magic);
+    if (m == PCAPNG_SHB) {
+        p->format = WSD_PCAP_NG;
+        p->pos -= 4;
+        return 0;
+    }
+    if (m == PCAP_MAGIC_US || m == PCAP_MAGIC_NS || be32(magic) == PCAP_MAGIC_US || be32(magic) == PCAP_MAGIC_NS) {
+        p->swap = be32(magic) == PCAP_MAGIC_US || be32(magic) == PCAP_MAGIC_NS;
+        const unsigned char *h = take(p, 20);
+        if (!h) {
+            wsd_pcap_close(p);
+            errno = EINVAL;
+            return -1;
+        }
+        p->format = WSD_PCAP_CLASSIC;
+        p->ticks_per_sec = rd32(p, magic) == PCAP_MAGIC_NS ? 1000000000 : 1000000;
+        p->linktype = rd32(p, h + 16) & 0xFFFF;
+        return 0;
+    }
+    p->pos -= 4;
+    return 0;
+}
+
+void wsd_pcap_close(struct wsd_pcap *p) {
+    if (p->map) munmap((void *)p->map, p->map_size);
+    if (p->fd > STDIN_FILENO) close(p->fd);
+    free(p->buf);
+    if (p->frags) {
+        for (int i = 0; i < WSD_PCAP_REASSEMBLY; i++) free(p->frags[i].data);
+    }
+    free(p->frags);
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+}
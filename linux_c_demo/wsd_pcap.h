@@ -0,0 +1,80 @@
+#ifndef WSD_PCAP_H
+#define WSD_PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Capture file reader for offline replay, without libpcap. Reads pcap
+// (either byte order, micro- or nanosecond timestamps) and pcapng, and
+// yields the payload of every UDP datagram to or from port 3702 with its
+// sender address. Link types: Ethernet (with 802.1Q/802.1ad tags), Linux
+// cooked v1/v2, BSD loopback and raw IPv4/IPv6. Fragmented datagrams are
+// reassembled, so large ProbeMatches from NVRs come out whole.
+//
+// Anything else is read as a raw stream of payloads, each preceded by its
+// length as a little-endian u32, with no sender address.
+//
+// Regular files are mapped; pipes go through a read buffer. Packets point
+// into the file or the buffer and stay valid until the next call.
+
+#define WSD_PCAP_PORT 3702
+#define WSD_PCAP_MAX_IFACES 32        // pcapng interfaces with a known link type
+#define WSD_PCAP_REASSEMBLY 16        // datagrams being reassembled at once
+
+enum wsd_pcap_format {
+    WSD_PCAP_CLASSIC = 0,
+    WSD_PCAP_NG,
+    WSD_PCAP_RAW
+};
+
+struct wsd_pcap_packet {
+    const char *data;
+    size_t len;
+    int truncated;                    // cut short by the capture snap length
+    int64_t ts_ns;                    // capture time, Unix ns (0 for raw streams)
+    const char *ifname;               // pcapng if_name, or ""
+    struct sockaddr_storage from;     // AF_UNSPEC for raw streams
+};
+
+struct wsd_pcap_fragment;
+
+struct wsd_pcap {
+    int fd;
+    enum wsd_pcap_format format;
+    const unsigned char *map;         // the whole file when mapped, else NULL
+    size_t map_size;
+    unsigned char *buf;               // read buffer for pipes
+    size_t buf_cap;
+    size_t buf_len;
+    size_t pos;                       // next unread byte of map or buf
+    int swap;                         // file written in the other byte order
+    int eof;
+    // Classic pcap: one link type and timestamp resolution for the file
+    uint32_t linktype;
+    uint64_t ticks_per_sec;
+    // pcapng: per interface of the current section
+    uint32_t if_linktype[WSD_PCAP_MAX_IFACES];
+    uint64_t if_ticks_per_sec[WSD_PCAP_MAX_IFACES];
+    char if_name[WSD_PCAP_MAX_IFACES][32];
+    int if_count;
+    struct wsd_pcap_fragment *frags;  // WSD_PCAP_REASSEMBLY slots
+    uint64_t frag_clock;              // age of the slots, for eviction
+    // Counters for the summary
+    uint64_t records;                 // packets in the file
+    uint64_t skipped;                 // not UDP port 3702, or an unsupported link type
+    uint64_t fragments;               // IP fragments taken in for reassembly
+    uint64_t incomplete;              // reassemblies given up
+};
+
+// Open a capture file, "-" for stdin, and detect its format.
+// Returns 0 on success, -1 with errno set on error.
+int wsd_pcap_open(struct wsd_pcap *p, const char *path);
+void wsd_pcap_close(struct wsd_pcap *p);
+
+// Read up to the next WS-Discovery datagram.
+// Returns 1 with *pkt filled, 0 at the end of the file, or -1 if the file
+// is malformed or cut short (the packets read so far are still good).
+int wsd_pcap_next(struct wsd_pcap *p, struct wsd_pcap_packet *pkt);
+
+#endif
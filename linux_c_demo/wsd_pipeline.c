@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include "wsd_pipeline.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define STOP_TAG UINT32_MAX           // epoll tag of stop_fd
+
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void wait_sem(sem_t *s) {
+    while (sem_wait(s) < 0 && errno == EINTR) {
+    }
+}
+
+int wsd_pipeline_init(struct wsd_pipeline *pl, int workers, int depth, int batch) {
+    memset(pl, 0, sizeof(*pl));
+    pl->epfd = pl->stop_fd = pl->event_fd = -1;
+    if (workers < 1 || workers > WSD_PIPELINE_MAX_WORKERS || depth < 1) return -1;
+
+    pl->depth = depth;
+    pthread_rwlock_init(&pl->outstanding_lock, NULL);
+    if (wsd_rx_init(&pl->rx, batch) < 0) goto fail;
+    pl->items = calloc((size_t)depth, sizeof(*pl->items));
+    pl->workers = calloc((size_t)workers, sizeof(*pl->workers));
+    if (!pl->items || !pl->workers || wsd_ring_init(&pl->free_items, (size_t)depth) < 0) goto fail;
+    sem_init(&pl->free_count, 0, (unsigned int)depth);
+    for (int i = 0; i < depth; i++) {
+        struct wsd_pipeline_item *item = &pl->items[i];
+        item->buf = malloc(WSD_PIPELINE_ITEM_BUFFER);
+        if (!item->buf) goto fail;
+        item->cap = WSD_PIPELINE_ITEM_BUFFER;
+        wsd_ring_push(&pl->free_items, item);
+    }
+
+    // Every ring holds the whole pool, so pushes never fail. Senders are
+    // spread over the workers, and so are the MessageIDs to remember.
+    size_t seen_capacity = WSD_DEDUP_DEFAULT_CAPACITY / (size_t)workers;
+    if (seen_capacity < 1024) seen_capacity = 1024;
+    for (int i = 0; i < workers; i++) {
+        struct wsd_pipeline_worker *w = &pl->workers[i];
+        w->pl = pl;
+        if (wsd_ring_init(&w->in, (size_t)depth) < 0 || wsd_ring_init(&w->out, (size_t)depth) < 0 ||
+            wsd_dedup_init(&w->seen, seen_capacity) < 0) {
+            wsd_ring_free(&w->in);
+            wsd_ring_free(&w->out);
+            goto fail;
+        }
+        sem_init(&w->ready, 0, 0);
+        pl->worker_count++;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = STOP_TAG;
+    pl->epfd = epoll_create1(EPOLL_CLOEXEC);
+    pl->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pl->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pl->epfd < 0 || pl->stop_fd < 0 || pl->event_fd < 0 ||
+        epoll_ctl(pl->epfd, EPOLL_CTL_ADD, pl->stop_fd, &ev) < 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    wsd_pipeline_free(pl);
+    return -1;
+}
+
+int wsd_pipeline_add_socket(struct wsd_pipeline *pl, int sock, uint32_t tag) {
+    struct epoll_event ev;
+
+    if (pl->sock_count == WSD_PIPELINE_MAX_SOCKETS) return -1;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)pl->sock_count;
+    if (epoll_ctl(pl->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) return -1;
+    pl->socks[pl->sock_count] = sock;
+    pl->tags[pl->sock_count] = tag;
+    pl->sock_count++;
+    return 0;
+}
+
+// A free item for the receive thread, waiting for one if all are in
+// flight. NULL once the pipeline is stopping.
+static struct wsd_pipeline_item *take_item(struct wsd_pipeline *pl) {
+    if (sem_trywait(&pl->free_count) < 0) {
+        atomic_fetch_add_explicit(&pl->stalls, 1, memory_order_relaxed);
+        wait_sem(&pl->free_count);
+    }
+    if (atomic_load(&pl->stopping)) return NULL;
+    return wsd_ring_pop(&pl->free_items);
+}
+
+// The same sender always lands on the same worker
+static struct wsd_pipeline_worker *pick_worker(struct wsd_pipeline *pl, const struct sockaddr_storage *from) {
+    uint32_t h = 0;
+
+    if (from->ss_family == AF_INET) {
+        h = ((const struct sockaddr_in *)from)->sin_addr.s_addr;
+    } else if (from->ss_family == AF_INET6) {
+        memcpy(&h, &((const struct sockaddr_in6 *)from)->sin6_addr.s6_addr[12], sizeof(h));
+    }
+    h *= 0x9E3779B1u;
+    return &pl->workers[(h >> 16) % (uint32_t)pl->worker_count];
+}
+
+static void drain(struct wsd_pipeline *pl, int idx) {
+    for (;;) {
+        int n = wsd_rx_recv(&pl->rx, pl->socks[idx], &pl->drops[idx]);
+        if (n < 0) perror("recvmmsg");
+        if (n <= 0) return;
+
+        int64_t now = monotonic_ns();
+        for (int k = 0; k < n; k++) {
+            const struct wsd_rx_packet *pkt = &pl->rx.packets[k];
+            // Only the event loop pushes to free_items: an item that could
+            // not take a datagram stays here for the next one
+            struct wsd_pipeline_item *item = pl->spare;
+            pl->spare = NULL;
+            if (!item) item = take_item(pl);
+            if (!item) return;
+
+            if (pkt->len > item->cap) {
+                char *grown = realloc(item->buf, pkt->len);
+                if (!grown) {
+                    pl->spare = item;
+                    atomic_fetch_add_explicit(&pl->dropped, 1, memory_order_relaxed);
+                    continue;
+                }
+                item->buf = grown;
+                item->cap = pkt->len;
+            }
+            memcpy(item->buf, pkt->data, pkt->len);
+            item->pkt = *pkt;
+            item->pkt.data = item->buf;
+            item->tag = pl->tags[idx];
+            item->drops = pl->drops[idx];
+            item->rx_ns = now;
+
+            struct wsd_pipeline_worker *w = pick_worker(pl, &pkt->from);
+            wsd_ring_push(&w->in, item);
+            sem_post(&w->ready);
+        }
+        if (n < pl->rx.slots) return;
+    }
+}
+
+static void *rx_main(void *arg) {
+    struct wsd_pipeline *pl = arg;
+    struct epoll_event events[WSD_PIPELINE_MAX_SOCKETS + 1];
+
+    while (!atomic_load(&pl->stopping)) {
+        int n = epoll_wait(pl->epfd, events, WSD_PIPELINE_MAX_SOCKETS + 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.u32 == STOP_TAG) return NULL;
+            drain(pl, (int)events[e].data.u32);
+        }
+    }
+    return NULL;
+}
+
+// Return 0 if a reply relates to none of the outstanding Probes
+static int correlated(struct wsd_pipeline *pl, const struct wsd_header *hdr, int64_t now_ms) {
+    if (!pl->outstanding || hdr->relates_to.len == 0) return 1;
+    pthread_rwlock_rdlock(&pl->outstanding_lock);
+    int ours = wsd_correlator_match(pl->outstanding, hdr->relates_to.ptr, hdr->relates_to.len, now_ms);
+    pthread_rwlock_unlock(&pl->outstanding_lock);
+    return ours;
+}
+
+static void *worker_main(void *arg) {
+    struct wsd_pipeline_worker *w = arg;
+    struct wsd_pipeline *pl = w->pl;
+
+    for (;;) {
+        wait_sem(&w->ready);
+        struct wsd_pipeline_item *item = wsd_ring_pop(&w->in);
+        if (!item) break;
+
+        // Requests are the event loop's to answer or ignore; what it would
+        // reject on the header alone is not worth a parse
+        int64_t start = monotonic_ns();
+        item->header_ok = wsd_scan_header(item->pkt.data, item->pkt.len, &item->hdr) == 0;
+        item->msg.type = WSD_MSG_UNKNOWN;
+        item->msg.match_count = 0;
+        if (!item->header_ok) {
+            item->parsed = wsd_parse(item->pkt.data, item->pkt.len, &item->msg);
+        } else if (wsd_view_has_suffix(item->hdr.action, "/Probe") ||
+                   wsd_view_has_suffix(item->hdr.action, "/Resolve")) {
+            item->parsed = WSD_PIPELINE_NOT_PARSED;
+        } else if (!correlated(pl, &item->hdr, item->rx_ns / 1000000)) {
+            item->parsed = WSD_PIPELINE_UNCORRELATED;
+        } else if (item->hdr.message_id.len > 0 &&
+                   wsd_dedup_check(&w->seen, item->hdr.message_id.ptr, item->hdr.message_id.len)) {
+            item->parsed = WSD_PIPELINE_REPEAT;
+        } else {
+            item->parsed = wsd_parse(item->pkt.data, item->pkt.len, &item->msg);
+        }
+        item->parse_ns = monotonic_ns() - start;
+
+        wsd_ring_push(&w->out, item);
+        if (!atomic_exchange(&pl->notified, 1)) {
+            uint64_t one = 1;
+            if (write(pl->event_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        }
+    }
+    return NULL;
+}
+
+void wsd_pipeline_set_correlator(struct wsd_pipeline *pl, const struct wsd_correlator *c) {
+    pl->outstanding = c;
+}
+
+void wsd_pipeline_lock(struct wsd_pipeline *pl) {
+    pthread_rwlock_wrlock(&pl->outstanding_lock);
+}
+
+void wsd_pipeline_unlock(struct wsd_pipeline *pl) {
+    pthread_rwlock_unlock(&pl->outstanding_lock);
+}
+
+int wsd_pipeline_start(struct wsd_pipeline *pl) {
+    sigset_t all, old;
+    int running = 0;
+
+    // Signals stay with the event loop, whose epoll_wait() they interrupt
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    while (running < pl->worker_count &&
+           pthread_create(&pl->workers[running].thread, NULL, worker_main, &pl->workers[running]) == 0) {
+        running++;
+    }
+    if (running == pl->worker_count && pthread_create(&pl->rx_thread, NULL, rx_main, pl) == 0) pl->started = 1;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (pl->started) return 0;
+
+    // Let the workers that did start exit
+    for (int i = 0; i < running; i++) {
+        sem_post(&pl->workers[i].ready);
+        pthread_join(pl->workers[i].thread, NULL);
+    }
+    return -1;
+}
+
+void wsd_pipeline_free(struct wsd_pipeline *pl) {
+    if (pl->started) {
+        uint64_t one = 1;
+        atomic_store(&pl->stopping, 1);
+        if (write(pl->stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        sem_post(&pl->free_count);
+        pthread_join(pl->rx_thread, NULL);
+        // Workers finish what they hold, then pop the NULL of the extra post
+        for (int i = 0; i < pl->worker_count; i++) sem_post(&pl->workers[i].ready);
+        for (int i = 0; i < pl->worker_count; i++) pthread_join(pl->workers[i].thread, NULL);
+        pl->started = 0;
+    }
+    for (int i = 0; i < pl->worker_count; i++) {
+        sem_destroy(&pl->workers[i].ready);
+        wsd_ring_free(&pl->workers[i].in);
+        wsd_ring_free(&pl->workers[i].out);
+        wsd_dedup_free(&pl->workers[i].seen);
+    }
+    if (pl->free_items.slots) sem_destroy(&pl->free_count);
+    for (int i = 0; pl->items && i < pl->depth; i++) free(pl->items[i].buf);
+    if (pl->epfd >= 0) close(pl->epfd);
+    if (pl->stop_fd >= 0) close(pl->stop_fd);
+    if (pl->event_fd >= 0) close(pl->event_fd);
+    wsd_ring_free(&pl->free_items);
+    wsd_rx_free(&pl->rx);
+    free(pl->items);
+    free(pl->workers);
+    if (pl->depth) pthread_rwlock_destroy(&pl->outstanding_lock);
+    memset(pl, 0, sizeof(*pl));
+    pl->epfd = pl->stop_fd = pl->event_fd = -1;
+}
+
+int wsd_pipeline_fd(const struct wsd_pipeline *pl) {
+    return pl->event_fd;
+}
+
+// Clear the eventfd before draining: a worker finishing after this point
+// writes it again, so nothing is left behind until the next wake-up
+void wsd_pipeline_wakeup(struct wsd_pipeline *pl) {
+    uint64_t count;
+    if (read(pl->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+    atomic_store(&pl->notified, 0);
+}
+
+struct wsd_pipeline_item *wsd_pipeline_next(struct wsd_pipeline *pl) {
+    for (int k = 0; k < pl->worker_count; k++) {
+        int i = (pl->next_worker + k) % pl->worker_count;
+        struct wsd_pipeline_item *item = wsd_ring_pop(&pl->workers[i].out);
+        if (item) {
+            pl->next_worker = (i + 1) % pl->worker_count;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+void wsd_pipeline_release(struct wsd_pipeline *pl, struct wsd_pipeline_item *item) {
+    wsd_ring_push(&pl->free_items, item);
+    sem_post(&pl->free_count);
+}
@@ -0,0 +1,123 @@
+#ifndef WSD_PIPELINE_H
+#define WSD_PIPELINE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "wsd_correlate.h"
+#include "wsd_dedup.h"
+#include "wsd_parser.h"
+#include "wsd_ring.h"
+#include "wsd_rx.h"
+
+// Threaded receive and parse pipeline. A receive thread does nothing but
+// drain the sockets with recvmmsg() and copy each datagram into a pooled
+// item, so the kernel queues are emptied at a steady pace however long a
+// datagram takes to parse. Items go to a pool of parser workers, which
+// scan the header and parse the body, and come back to the event loop
+// for the stateful part: correlation, dedup, the index and the output.
+//
+// Every hop is a lock-free SPSC ring: one from the receive thread to each
+// worker, one from each worker back to the event loop, and the free list.
+// A sender's datagrams always go to the same worker, so its Hello and Bye
+// come out in the order they were received, and each worker can drop that
+// sender's repeated MessageIDs before parsing them. Replies to Probes that
+// are not ours are dropped there as well, against the event loop's
+// correlator under a read lock. Workers sleep on a semaphore
+// and the event loop on an eventfd, woken only when it is not already
+// awake. When every item is in flight the receive thread waits for one
+// to be released, and the kernel queue takes up the slack.
+
+#define WSD_PIPELINE_MAX_WORKERS 64
+#define WSD_PIPELINE_MAX_SOCKETS 80
+#define WSD_PIPELINE_DEFAULT_DEPTH 1024   // items in flight
+#define WSD_PIPELINE_ITEM_BUFFER 4096     // initial buffer per item, grown as needed
+#define WSD_PIPELINE_NOT_PARSED (-2)      // parsed: a Probe/Resolve, left to the event loop
+#define WSD_PIPELINE_REPEAT (-3)          // parsed: MessageID already seen by this worker
+#define WSD_PIPELINE_UNCORRELATED (-4)    // parsed: RelatesTo is none of our Probes
+
+struct wsd_pipeline_item {
+    struct wsd_rx_packet pkt;         // data points to buf
+    uint32_t tag;                     // of the socket, from wsd_pipeline_add_socket()
+    uint32_t drops;                   // the socket's kernel drop counter at the time
+    int64_t rx_ns;                    // monotonic receive time
+    int header_ok;                    // wsd_scan_header() found the Body
+    struct wsd_header hdr;
+    int parsed;                       // wsd_parse() result, or one of WSD_PIPELINE_*
+    int64_t parse_ns;                 // header scan and parse time
+    struct wsd_message msg;
+    char *buf;
+    size_t cap;
+};
+
+struct wsd_pipeline_worker {
+    struct wsd_pipeline *pl;
+    pthread_t thread;
+    sem_t ready;                      // one post per item in `in`, one more to stop
+    struct wsd_ring in;               // from the receive thread
+    struct wsd_ring out;              // to the event loop
+    struct wsd_dedup seen;            // MessageIDs of this worker's senders
+};
+
+struct wsd_pipeline {
+    int socks[WSD_PIPELINE_MAX_SOCKETS];
+    uint32_t tags[WSD_PIPELINE_MAX_SOCKETS];
+    uint32_t drops[WSD_PIPELINE_MAX_SOCKETS];  // written by the receive thread only
+    int sock_count;
+    int epfd;                         // the receive thread's sockets and stop_fd
+    int stop_fd;                      // eventfd: stop the receive thread
+    int event_fd;                     // eventfd: items are ready for the event loop
+    atomic_int notified;              // event_fd has been written and not yet read
+    atomic_int stopping;
+    struct wsd_rx rx;
+    pthread_t rx_thread;
+    int started;
+    struct wsd_pipeline_item *items;
+    int depth;
+    struct wsd_ring free_items;       // released by the event loop, taken by the receive thread
+    sem_t free_count;
+    struct wsd_pipeline_worker *workers;
+    int worker_count;
+    int next_worker;                  // where the event loop looks first
+    atomic_ullong stalls;             // times the receive thread waited for an item
+    atomic_ullong dropped;            // datagrams lost to a failed buffer allocation
+    struct wsd_pipeline_item *spare;  // receive thread: taken but not handed on
+    const struct wsd_correlator *outstanding;  // NULL: RelatesTo is left to the event loop
+    pthread_rwlock_t outstanding_lock;
+};
+
+// Allocate a pipeline with `workers` parser threads, `depth` items and a
+// receive batch of `batch` datagrams. Returns 0 or -1 on failure.
+int wsd_pipeline_init(struct wsd_pipeline *pl, int workers, int depth, int batch);
+
+// Hand a non-blocking socket to the receive thread; before wsd_pipeline_start().
+// Returns 0 or -1 if there are too many.
+int wsd_pipeline_add_socket(struct wsd_pipeline *pl, int sock, uint32_t tag);
+
+// Let the workers drop replies whose RelatesTo is not in c; before
+// wsd_pipeline_start(). The event loop changes c only between
+// wsd_pipeline_lock() and wsd_pipeline_unlock().
+void wsd_pipeline_set_correlator(struct wsd_pipeline *pl, const struct wsd_correlator *c);
+void wsd_pipeline_lock(struct wsd_pipeline *pl);
+void wsd_pipeline_unlock(struct wsd_pipeline *pl);
+
+// Start the threads. Returns 0 or -1 on failure.
+int wsd_pipeline_start(struct wsd_pipeline *pl);
+
+// Stop and join the threads, then free everything. Items not yet
+// handed to the event loop are dropped.
+void wsd_pipeline_free(struct wsd_pipeline *pl);
+
+// Readable when items are waiting: watch it in the event loop and call
+// wsd_pipeline_wakeup() before draining with wsd_pipeline_next().
+int wsd_pipeline_fd(const struct wsd_pipeline *pl);
+void wsd_pipeline_wakeup(struct wsd_pipeline *pl);
+
+// Event loop side: the next parsed item, or NULL when there is none.
+// Every item must be released once handled.
+struct wsd_pipeline_item *wsd_pipeline_next(struct wsd_pipeline *pl);
+void wsd_pipeline_release(struct wsd_pipeline *pl, struct wsd_pipeline_item *item);
+
+#endif
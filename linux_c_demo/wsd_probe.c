@@ -0,0 +1,66 @@
+#include "wsd_probe.h"
+
+#include <stdio.h>
+
+#include "wsd_socket.h"
+
+int wsd_generate_uuid(char *buffer, size_t size) {
+    unsigned char b[16];
+
+    if (wsd_random_bytes(b, sizeof(b)) < 0) return -1;
+    b[6] = (unsigned char)((b[6] & 0x0F) | 0x40);   // version 4
+    b[8] = (unsigned char)((b[8] & 0x3F) | 0x80);   // RFC 4122 variant
+    snprintf(buffer, size,
+             "urn:uuid:%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+    return 0;
+}
+
+size_t wsd_build_probe(char *buf, size_t size, const char *message_id, const struct wsd_filter *filter) {
+    const char *probe_template =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<e:Envelope xmlns:e=\"http://www.w3.org/2003/05/soap-envelope\" "
+        "xmlns:w=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+        "xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "
+        "xmlns:dn=\"http://www.onvif.org/ver10/network/wsdl\" "
+        "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\">"
+        "<e:Header>"
+        "<w:MessageID>%s</w:MessageID>"
+        "<w:To>urn:schemas-xmlsoap-org:ws:2005:04:discovery</w:To>"
+        "<w:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/Probe</w:Action>"
+        "</e:Header>"
+        "<e:Body>"
+        "<d:Probe>%s</d:Probe>"
+        "</e:Body>"
+        "</e:Envelope>";
+    char body[WSD_FILTER_SCOPES_SIZE + 1024];
+    struct wsd_filter none;
+
+    if (!filter) {
+        wsd_filter_init(&none);
+        filter = &none;
+    }
+    if (wsd_filter_format(filter, body, sizeof(body)) == 0) return 0;
+    int n = snprintf(buf, size, probe_template, message_id, body);
+    if (n < 0 || (size_t)n >= size) return 0;
+    return (size_t)n;
+}
+
+void wsd_repeat_start(struct wsd_repeat *r, int repeats, int64_t now_ms) {
+    uint32_t jitter = 0;
+
+    wsd_random_bytes(&jitter, sizeof(jitter));
+    r->left = repeats;
+    r->delay_ms = WSD_UDP_MIN_DELAY_MS + (int)(jitter % (WSD_UDP_MAX_DELAY_MS - WSD_UDP_MIN_DELAY_MS + 1));
+    r->due = repeats > 0 ? now_ms + r->delay_ms : -1;
+}
+
+int wsd_repeat_due(struct wsd_repeat *r, int64_t now_ms) {
+    if (r->due < 0 || now_ms < r->due) return 0;
+
+    r->left--;
+    r->delay_ms *= 2;
+    if (r->delay_ms > WSD_UDP_UPPER_DELAY_MS) r->delay_ms = WSD_UDP_UPPER_DELAY_MS;
+    r->due = r->left > 0 ? now_ms + r->delay_ms : -1;
+    return 1;
+}
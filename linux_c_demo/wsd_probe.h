@@ -0,0 +1,45 @@
+#ifndef WSD_PROBE_H
+#define WSD_PROBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wsd_filter.h"
+
+// Outgoing WS-Discovery messages
+
+#define WSD_MESSAGE_ID_SIZE 64
+
+// SOAP-over-UDP retransmission parameters (WS-Discovery 2005/04, Appendix I).
+// A multicast message is sent once and then repeated MULTICAST_UDP_REPEAT
+// times, unchanged. The first repeat waits a random time between
+// UDP_MIN_DELAY and UDP_MAX_DELAY, each further wait doubles, capped at
+// UDP_UPPER_DELAY.
+#define WSD_MULTICAST_UDP_REPEAT 2
+#define WSD_UDP_MIN_DELAY_MS 50
+#define WSD_UDP_MAX_DELAY_MS 250
+#define WSD_UDP_UPPER_DELAY_MS 500
+
+struct wsd_repeat {
+    int left;                         // repeats still to send
+    int delay_ms;                     // wait before the next one
+    int64_t due;                      // monotonic ms of the next one, -1 when done
+};
+
+// Generate a random (version 4) UUID as "urn:uuid:...", from the system
+// CSPRNG so concurrent instances never share MessageIDs.
+// Returns 0 on success, -1 if no randomness was available.
+int wsd_generate_uuid(char *buffer, size_t size);
+
+// Build a Probe with the given MessageID for the filter's Types and
+// Scopes, or for NetworkVideoTransmitter devices if filter is NULL.
+// Returns the message length (0 if it did not fit).
+size_t wsd_build_probe(char *buf, size_t size, const char *message_id, const struct wsd_filter *filter);
+
+// Schedule `repeats` retransmissions of a message sent at now_ms
+void wsd_repeat_start(struct wsd_repeat *r, int repeats, int64_t now_ms);
+
+// Return 1 if a retransmission is due at now_ms, and schedule the next one
+int wsd_repeat_due(struct wsd_repeat *r, int64_t now_ms);
+
+#endif
@@ -0,0 +1,263 @@
+#include "wsd_proxy.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#define ENVELOPE_OPEN \
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" \
+    "<e:Envelope xmlns:e=\"http://www.w3.org/2003/05/soap-envelope\" " \
+    "xmlns:w=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" " \
+    "xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" " \
+    "xmlns:dn=\"http://www.onvif.org/ver10/network/wsdl\" " \
+    "xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\">"
+#define ENVELOPE_CLOSE "</e:Body></e:Envelope>"
+#define ACTION_PREFIX "http://schemas.xmlsoap.org/ws/2005/04/discovery/"
+#define TO_ANONYMOUS "http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous"
+#define TO_DISCOVERY "urn:schemas-xmlsoap-org:ws:2005:04:discovery"
+
+// Appends to a fixed buffer; once something does not fit, everything
+// after it is dropped and the message is abandoned
+struct writer {
+    char *buf;
+    size_t size;
+    size_t len;
+    int full;
+};
+
+static void put(struct writer *w, const char *s, size_t len) {
+    if (w->full || len >= w->size - w->len) {
+        w->full = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+    w->buf[w->len] = '\0';
+}
+
+static void put_str(struct writer *w, const char *s) {
+    put(w, s, strlen(s));
+}
+
+// Index strings are stored decoded, so they are escaped again on the way out
+static void put_escaped(struct writer *w, const char *s, size_t len) {
+    size_t run = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        const char *entity;
+        switch (s[i]) {
+        case '&': entity = "&amp;"; break;
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '"': entity = "&quot;"; break;
+        default: continue;
+        }
+        put(w, s + run, i - run);
+        put_str(w, entity);
+        run = i + 1;
+    }
+    put(w, s + run, len - run);
+}
+
+static void put_u32(struct writer *w, uint32_t v) {
+    char num[16];
+    int n = snprintf(num, sizeof(num), "%u", v);
+    put(w, num, (size_t)n);
+}
+
+static void put_header(struct wsd_proxy *p, struct writer *w, const char *action, const char *to,
+                       struct wsd_view relates_to, const char *relationship) {
+    if (wsd_generate_uuid(p->message_id, sizeof(p->message_id)) < 0) {
+        w->full = 1;
+        return;
+    }
+    put_str(w, ENVELOPE_OPEN "<e:Header><w:MessageID>");
+    put_str(w, p->message_id);
+    put_str(w, "</w:MessageID>");
+    if (relates_to.len > 0) {
+        // Already escaped: it is a view into the request
+        put_str(w, relationship ? "<w:RelatesTo RelationshipType=\"" : "<w:RelatesTo>");
+        if (relationship) {
+            put_str(w, relationship);
+            put_str(w, "\">");
+        }
+        put(w, relates_to.ptr, relates_to.len);
+        put_str(w, "</w:RelatesTo>");
+    }
+    put_str(w, "<w:To>");
+    put_str(w, to);
+    put_str(w, "</w:To><w:Action>" ACTION_PREFIX);
+    put_str(w, action);
+    put_str(w, "</w:Action><d:AppSequence InstanceId=\"");
+    put_u32(w, p->instance_id);
+    put_str(w, "\" MessageNumber=\"");
+    put_u32(w, ++p->message_number);
+    put_str(w, "\"/></e:Header><e:Body>");
+}
+
+static void put_address(struct writer *w, const char *address) {
+    put_str(w, "<w:EndpointReference><w:Address>");
+    put_escaped(w, address, strlen(address));
+    put_str(w, "</w:Address></w:EndpointReference>");
+}
+
+// Types are kept as the device sent them, with its own prefixes. They are
+// written back with the prefixes this envelope declares, the same mapping
+// a Probe's Types get in wsd_filter_compile_probe().
+static void put_types(struct writer *w, const char *types) {
+    struct wsd_view list = {types, strlen(types)}, item;
+    int first = 1;
+
+    put_str(w, "<d:Types>");
+    while (wsd_view_next_token(&list, &item)) {
+        const char *colon = memchr(item.ptr, ':', item.len);
+        struct wsd_view local = item;
+        if (colon) {
+            local.ptr = colon + 1;
+            local.len = item.len - (size_t)(local.ptr - item.ptr);
+        }
+        if (!first) put_str(w, " ");
+        put_str(w, wsd_view_eq(local, "Device") ? "tds:" : "dn:");
+        put(w, local.ptr, local.len);
+        first = 0;
+    }
+    put_str(w, "</d:Types>");
+}
+
+static void put_device(struct writer *w, const char *element, const struct device *d) {
+    put_str(w, "<d:");
+    put_str(w, element);
+    put_str(w, ">");
+    put_address(w, d->address);
+    put_types(w, d->types);
+    if (d->scopes[0]) {
+        put_str(w, "<d:Scopes>");
+        put_escaped(w, d->scopes, strlen(d->scopes));
+        put_str(w, "</d:Scopes>");
+    }
+    if (d->xaddrs[0]) {
+        put_str(w, "<d:XAddrs>");
+        put_escaped(w, d->xaddrs, strlen(d->xaddrs));
+        put_str(w, "</d:XAddrs>");
+    }
+    put_str(w, "<d:MetadataVersion>");
+    put_u32(w, d->metadata_version);
+    put_str(w, "</d:MetadataVersion></d:");
+    put_str(w, element);
+    put_str(w, ">");
+}
+
+int wsd_proxy_init(struct wsd_proxy *p) {
+    memset(p, 0, sizeof(*p));
+    wsd_filter_init(&p->filter);
+    if (wsd_generate_uuid(p->endpoint, sizeof(p->endpoint)) < 0) return -1;
+    p->instance_id = (uint32_t)time(NULL);
+    return 0;
+}
+
+void wsd_proxy_free(struct wsd_proxy *p) {
+    wsd_filter_free(&p->filter);
+}
+
+int wsd_proxy_admit(struct wsd_proxy *p, const struct sockaddr *from, int64_t now_ms) {
+    uint32_t h = 0;
+
+    if (from->sa_family == AF_INET) {
+        h = ((const struct sockaddr_in *)from)->sin_addr.s_addr;
+    } else if (from->sa_family == AF_INET6) {
+        const unsigned char *a = ((const struct sockaddr_in6 *)from)->sin6_addr.s6_addr;
+        for (int i = 0; i < 16; i += 4) h ^= (uint32_t)a[i] << 24 | (uint32_t)a[i + 1] << 16 | a[i + 2] << 8 | a[i + 3];
+    }
+    h *= 0x9E3779B1u;
+    struct wsd_proxy_budget *b = &p->budgets[(h >> 16) % WSD_PROXY_BUDGETS];
+
+    if (b->refilled_ms == 0) {
+        b->tokens = WSD_PROXY_MAX_DATAGRAMS;
+    } else {
+        b->tokens += (double)(now_ms - b->refilled_ms) * WSD_PROXY_RATE / 1000.0;
+        if (b->tokens > WSD_PROXY_MAX_DATAGRAMS) b->tokens = WSD_PROXY_MAX_DATAGRAMS;
+    }
+    b->refilled_ms = now_ms;
+    if (b->tokens < 1) return 0;
+    b->tokens -= 1;
+    return 1;
+}
+
+size_t wsd_proxy_hello(struct wsd_proxy *p, char *buf, size_t size, const char *xaddr, struct wsd_view probe_id) {
+    struct writer w = {buf, size, 0, 0};
+
+    // The suppression Hello goes back to the client, the announcement to the group
+    put_header(p, &w, "Hello", probe_id.len > 0 ? TO_ANONYMOUS : TO_DISCOVERY, probe_id, "d:Suppression");
+    put_str(&w, "<d:Hello><w:EndpointReference><w:Address>");
+    put_str(&w, p->endpoint);
+    put_str(&w, "</w:Address></w:EndpointReference><d:Types>d:DiscoveryProxy</d:Types><d:XAddrs>");
+    put_escaped(&w, xaddr, strlen(xaddr));
+    put_str(&w, "</d:XAddrs><d:MetadataVersion>1</d:MetadataVersion></d:Hello>" ENVELOPE_CLOSE);
+    return w.full ? 0 : w.len;
+}
+
+size_t wsd_proxy_bye(struct wsd_proxy *p, char *buf, size_t size) {
+    struct writer w = {buf, size, 0, 0};
+    struct wsd_view none = {NULL, 0};
+
+    put_header(p, &w, "Bye", TO_DISCOVERY, none, NULL);
+    put_str(&w, "<d:Bye><w:EndpointReference><w:Address>");
+    put_str(&w, p->endpoint);
+    put_str(&w, "</w:Address></w:EndpointReference></d:Bye>" ENVELOPE_CLOSE);
+    return w.full ? 0 : w.len;
+}
+
+int wsd_proxy_begin_probe(struct wsd_proxy *p, const struct wsd_match *probe) {
+    return wsd_filter_compile_probe(&p->filter, probe);
+}
+
+size_t wsd_proxy_probe_matches(struct wsd_proxy *p, char *buf, size_t size, struct wsd_view probe_id,
+                               const struct device_index *idx, size_t *next, int *matches) {
+    static const char close[] = "</d:ProbeMatches>" ENVELOPE_CLOSE;
+    struct writer w = {buf, size, 0, 0};
+    size_t i = *next;
+
+    *matches = 0;
+    put_header(p, &w, "ProbeMatches", TO_ANONYMOUS, probe_id, NULL);
+    put_str(&w, "<d:ProbeMatches>");
+    if (w.full) return 0;
+
+    // Keep room for the closing tags: a device that does not fit ends the
+    // datagram and starts the next one
+    w.size -= sizeof(close) - 1;
+    for (; i < idx->count; i++) {
+        const struct device *d = &idx->records[i];
+        struct wsd_match m = {
+            .types = {d->types, strlen(d->types)},
+            .scopes = {d->scopes, strlen(d->scopes)},
+        };
+        if (!wsd_filter_match(&p->filter, &m)) continue;
+
+        size_t mark = w.len;
+        put_device(&w, "ProbeMatch", d);
+        if (w.full) {
+            w.len = mark;
+            // A device too big for a datagram of its own is left out
+            if (*matches == 0) i++;
+            break;
+        }
+        (*matches)++;
+    }
+    *next = i;
+    w.full = 0;
+    w.size += sizeof(close) - 1;
+    put_str(&w, close);
+    return w.full ? 0 : w.len;
+}
+
+size_t wsd_proxy_resolve_matches(struct wsd_proxy *p, char *buf, size_t size, struct wsd_view resolve_id,
+                                 const struct device *d) {
+    struct writer w = {buf, size, 0, 0};
+
+    put_header(p, &w, "ResolveMatches", TO_ANONYMOUS, resolve_id, NULL);
+    put_str(&w, "<d:ResolveMatches>");
+    put_device(&w, "ResolveMatch", d);
+    put_str(&w, "</d:ResolveMatches>" ENVELOPE_CLOSE);
+    return w.full ? 0 : w.len;
+}
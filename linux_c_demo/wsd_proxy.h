@@ -0,0 +1,77 @@
+#ifndef WSD_PROXY_H
+#define WSD_PROXY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device_index.h"
+#include "wsd_filter.h"
+#include "wsd_probe.h"
+
+// Discovery Proxy (WS-Discovery 2005/04, managed mode). The proxy keeps
+// the device index fresh from Hello/Bye and its own reconciling Probes,
+// and answers unicast Probe and Resolve from memory, so each client costs
+// the devices nothing. It announces itself with a Hello of type
+// d:DiscoveryProxy, and answers a multicast Probe with a unicast Hello
+// related to it as "d:Suppression": the client then sends its Probes to
+// the proxy's XAddr instead of multicasting them.
+//
+// This module only builds the messages; sockets stay with the caller.
+
+#define WSD_PROXY_DATAGRAM_SIZE 8192  // ProbeMatches are split to stay under this
+#define WSD_PROXY_XADDR_SIZE 96
+#define WSD_PROXY_MAX_DATAGRAMS 32    // most datagrams one request is answered with
+#define WSD_PROXY_RATE 16             // datagrams per second a source's budget refills by
+#define WSD_PROXY_BUDGETS 256         // sources hashing to the same budget share it
+
+// Datagrams a source may still be sent
+struct wsd_proxy_budget {
+    double tokens;
+    int64_t refilled_ms;              // 0 while unused
+};
+
+struct wsd_proxy {
+    char endpoint[WSD_MESSAGE_ID_SIZE];  // urn:uuid of the proxy, new on every start
+    uint32_t instance_id;             // AppSequence InstanceId: the start time
+    uint32_t message_number;          // AppSequence MessageNumber of the last message
+    char message_id[WSD_MESSAGE_ID_SIZE];  // MessageID of the last message, to spot it looping back
+    struct wsd_filter filter;         // Types/Scopes of the Probe being answered
+    struct wsd_proxy_budget budgets[WSD_PROXY_BUDGETS];
+};
+
+// Returns 0 on success, -1 if no randomness was available for the endpoint
+int wsd_proxy_init(struct wsd_proxy *p);
+void wsd_proxy_free(struct wsd_proxy *p);
+
+// Answers go to whatever address a request claims to come from, and one
+// small Probe can be worth many ProbeMatches. Each source has a budget of
+// WSD_PROXY_MAX_DATAGRAMS, refilled at WSD_PROXY_RATE per second.
+// Returns 1 and charges the budget if a datagram may be sent to from now,
+// 0 if it is spent.
+int wsd_proxy_admit(struct wsd_proxy *p, const struct sockaddr *from, int64_t now_ms);
+
+// Hello announcing the proxy at xaddr ("soap.udp://host:3702"). With a
+// non-empty probe_id it is the suppression answer to that Probe.
+// Returns the message length (0 if it did not fit).
+size_t wsd_proxy_hello(struct wsd_proxy *p, char *buf, size_t size, const char *xaddr, struct wsd_view probe_id);
+
+// Bye withdrawing the proxy. Returns the message length (0 if it did not fit).
+size_t wsd_proxy_bye(struct wsd_proxy *p, char *buf, size_t size);
+
+// Start answering a parsed Probe: compile its Types, Scopes and MatchBy.
+// Returns 0, or -1 if the Probe asks for something the filter cannot do.
+int wsd_proxy_begin_probe(struct wsd_proxy *p, const struct wsd_match *probe);
+
+// Build the next ProbeMatches datagram for the Probe begun last, with the
+// matching devices from records[*next] on, and advance *next past those
+// considered. The first call always yields a datagram, empty if nothing
+// matches; call again while *next < idx->count.
+// Returns the message length; *matches gets the number of entries.
+size_t wsd_proxy_probe_matches(struct wsd_proxy *p, char *buf, size_t size, struct wsd_view probe_id,
+                               const struct device_index *idx, size_t *next, int *matches);
+
+// ResolveMatches for one device. Returns the message length (0 if it did not fit).
+size_t wsd_proxy_resolve_matches(struct wsd_proxy *p, char *buf, size_t size, struct wsd_view resolve_id,
+                                 const struct device *d);
+
+#endif
@@ -0,0 +1,47 @@
+#include "wsd_ring.h"
+
+#include <stdlib.h>
+
+int wsd_ring_init(struct wsd_ring *r, size_t capacity) {
+    size_t size = 2;
+
+    while (size < capacity) size *= 2;
+    r->slots = calloc(size, sizeof(*r->slots));
+    if (!r->slots) return -1;
+    r->mask = size - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->tail_cache = 0;
+    r->head_cache = 0;
+    return 0;
+}
+
+void wsd_ring_free(struct wsd_ring *r) {
+    free(r->slots);
+    r->slots = NULL;
+}
+
+// Indexes only grow; the slot is the index modulo the capacity
+int wsd_ring_push(struct wsd_ring *r, void *item) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail - r->head_cache > r->mask) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail - r->head_cache > r->mask) return -1;
+    }
+    r->slots[tail & r->mask] = item;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+void *wsd_ring_pop(struct wsd_ring *r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (head == r->tail_cache) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head == r->tail_cache) return NULL;
+    }
+    void *item = r->slots[head & r->mask];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return item;
+}
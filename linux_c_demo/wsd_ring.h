@@ -0,0 +1,35 @@
+#ifndef WSD_RING_H
+#define WSD_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Bounded lock-free single-producer/single-consumer ring of pointers.
+// One thread pushes, one thread pops, neither ever blocks or takes a
+// lock. Head and tail live on their own cache lines, and each side keeps
+// a private copy of the other's index so the shared one is only read
+// when the ring looks full or empty.
+
+#define WSD_RING_CACHE_LINE 64
+
+struct wsd_ring {
+    _Alignas(WSD_RING_CACHE_LINE) atomic_size_t head;  // next slot to pop, written by the consumer
+    size_t tail_cache;                // consumer's last view of tail
+    _Alignas(WSD_RING_CACHE_LINE) atomic_size_t tail;  // next slot to push, written by the producer
+    size_t head_cache;                // producer's last view of head
+    _Alignas(WSD_RING_CACHE_LINE) void **slots;
+    size_t mask;                      // capacity - 1, a power of two
+};
+
+// Make room for at least `capacity` pointers.
+// Returns 0 on success, -1 on allocation failure.
+int wsd_ring_init(struct wsd_ring *r, size_t capacity);
+void wsd_ring_free(struct wsd_ring *r);
+
+// Producer side. Returns 0, or -1 if the ring is full.
+int wsd_ring_push(struct wsd_ring *r, void *item);
+
+// Consumer side. Returns the oldest item, or NULL if the ring is empty.
+void *wsd_ring_pop(struct wsd_ring *r);
+
+#endif
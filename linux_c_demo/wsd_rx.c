@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include "wsd_rx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#define WSD_RX_CONTROL_SIZE (CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct in6_pktinfo)))
+
+int wsd_rx_init(struct wsd_rx *rx, int slots) {
+    memset(rx, 0, sizeof(*rx));
+    if (slots <= 0) slots = WSD_RX_DEFAULT_SLOTS;
+
+    rx->slots = slots;
+    rx->buffers = malloc((size_t)slots * WSD_RX_SLOT_SIZE);
+    rx->msgs = calloc((size_t)slots, sizeof(struct mmsghdr));
+    rx->iov = calloc((size_t)slots, sizeof(struct iovec));
+    rx->control = calloc((size_t)slots, WSD_RX_CONTROL_SIZE);
+    rx->packets = calloc((size_t)slots, sizeof(struct wsd_rx_packet));
+    if (!rx->buffers || !rx->msgs || !rx->iov || !rx->control || !rx->packets) {
+        wsd_rx_free(rx);
+        return -1;
+    }
+
+    struct iovec *iov = rx->iov;
+    for (int i = 0; i < slots; i++) {
+        iov[i].iov_base = rx->buffers + (size_t)i * WSD_RX_SLOT_SIZE;
+        iov[i].iov_len = WSD_RX_SLOT_SIZE;
+        rx->packets[i].data = iov[i].iov_base;
+    }
+    return 0;
+}
+
+void wsd_rx_free(struct wsd_rx *rx) {
+    free(rx->buffers);
+    free(rx->msgs);
+    free(rx->iov);
+    free(rx->control);
+    free(rx->packets);
+    memset(rx, 0, sizeof(*rx));
+}
+
+int wsd_rx_setup_socket(int sock, int rcvbuf) {
+    int on = 1;
+    int granted = 0;
+    socklen_t len = sizeof(granted);
+
+    // SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0 &&
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        perror("setsockopt(SO_RCVBUF)");
+    }
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_RXQ_OVFL)");
+    }
+
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &granted, &len) < 0) return -1;
+    return granted;
+}
+
+int wsd_rx_want_destination(int sock, int family) {
+    int on = 1;
+
+    if (family == AF_INET6) return setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+    return setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+}
+
+// Fill in the destination from an IP_PKTINFO or IPV6_PKTINFO message
+static void read_pktinfo(const struct cmsghdr *c, struct wsd_rx_packet *pkt) {
+    if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO) {
+        struct in_pktinfo info;
+        struct sockaddr_in *to = (struct sockaddr_in *)&pkt->to;
+        memcpy(&info, CMSG_DATA(c), sizeof(info));
+        to->sin_family = AF_INET;
+        to->sin_addr = info.ipi_addr;
+        pkt->ifindex = (unsigned int)info.ipi_ifindex;
+    } else if (c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_PKTINFO) {
+        struct in6_pktinfo info;
+        struct sockaddr_in6 *to = (struct sockaddr_in6 *)&pkt->to;
+        memcpy(&info, CMSG_DATA(c), sizeof(info));
+        to->sin6_family = AF_INET6;
+        to->sin6_addr = info.ipi6_addr;
+        to->sin6_scope_id = info.ipi6_ifindex;
+        pkt->ifindex = info.ipi6_ifindex;
+    }
+}
+
+int wsd_rx_recv(struct wsd_rx *rx, int sock, uint32_t *drops) {
+    struct mmsghdr *msgs = rx->msgs;
+    struct iovec *iov = rx->iov;
+
+    // recvmmsg() overwrites the lengths, so reset every header per batch
+    for (int i = 0; i < rx->slots; i++) {
+        struct msghdr *h = &msgs[i].msg_hdr;
+        h->msg_name = &rx->packets[i].from;
+        h->msg_namelen = sizeof(rx->packets[i].from);
+        h->msg_iov = &iov[i];
+        h->msg_iovlen = 1;
+        h->msg_control = rx->control + (size_t)i * WSD_RX_CONTROL_SIZE;
+        h->msg_controllen = WSD_RX_CONTROL_SIZE;
+        h->msg_flags = 0;
+    }
+
+    int n = recvmmsg(sock, msgs, (unsigned int)rx->slots, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct msghdr *h = &msgs[i].msg_hdr;
+        struct wsd_rx_packet *pkt = &rx->packets[i];
+
+        pkt->len = msgs[i].msg_len;
+        pkt->truncated = (h->msg_flags & MSG_TRUNC) != 0;
+        if (pkt->len > WSD_RX_SLOT_SIZE) pkt->len = WSD_RX_SLOT_SIZE;
+        pkt->to.ss_family = AF_UNSPEC;
+        pkt->ifindex = 0;
+
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL && drops) {
+                memcpy(drops, CMSG_DATA(c), sizeof(*drops));
+            } else {
+                read_pktinfo(c, pkt);
+            }
+        }
+    }
+    return n;
+}
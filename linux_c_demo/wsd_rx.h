@@ -0,0 +1,58 @@
+#ifndef WSD_RX_H
+#define WSD_RX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Batched datagram receive engine.
+// Drains up to `slots` datagrams per recvmmsg() call into preallocated
+// 64 KB slots that are reused for every batch, so no reply is ever cut at
+// a fixed buffer size and the syscall cost is shared by the whole batch.
+
+#define WSD_RX_SLOT_SIZE 65536
+#define WSD_RX_DEFAULT_SLOTS 64
+#define WSD_RX_DEFAULT_RCVBUF (4 * 1024 * 1024)
+
+struct wsd_rx_packet {
+    const char *data;
+    size_t len;
+    int truncated;                    // larger than a slot (MSG_TRUNC)
+    struct sockaddr_storage from;
+    // With wsd_rx_want_destination(): where it was sent and the interface
+    // it came in on; AF_UNSPEC and 0 otherwise
+    struct sockaddr_storage to;
+    unsigned int ifindex;
+};
+
+struct wsd_rx {
+    int slots;
+    char *buffers;                    // slots * WSD_RX_SLOT_SIZE bytes
+    void *msgs;                       // struct mmsghdr[slots]
+    void *iov;                        // struct iovec[slots]
+    char *control;                    // per-slot cmsg space for SO_RXQ_OVFL
+    struct wsd_rx_packet *packets;    // results of the last wsd_rx_recv()
+};
+
+// Allocate an engine with the given number of slots (batch size).
+// Returns 0 on success, -1 on allocation failure.
+int wsd_rx_init(struct wsd_rx *rx, int slots);
+void wsd_rx_free(struct wsd_rx *rx);
+
+// Grow the socket receive queue to rcvbuf bytes (SO_RCVBUFFORCE when
+// permitted, SO_RCVBUF otherwise) and enable SO_RXQ_OVFL drop reporting.
+// Returns the receive buffer size the kernel actually granted.
+int wsd_rx_setup_socket(int sock, int rcvbuf);
+
+// Report the destination address and interface of every datagram
+// (IP_PKTINFO / IPV6_RECVPKTINFO), e.g. to tell multicast from unicast.
+// Returns 0 on success, -1 on error.
+int wsd_rx_want_destination(int sock, int family);
+
+// Receive one batch from a non-blocking socket into rx->packets.
+// *drops is updated with the kernel's cumulative drop counter for the
+// socket when it reports one. Returns the number of datagrams (0 when the
+// socket is drained) or -1 on error.
+int wsd_rx_recv(struct wsd_rx *rx, int sock, uint32_t *drops);
+
+#endif
@@ -0,0 +1,203 @@
+#include "wsd_scan.h"
+
+#include <stdint.h>
+
+// SSE2 is part of x86-64, AVX2 is compiled per function and only called
+// after the CPU said it has it. Other targets get the scalar loops.
+#if defined(__GNUC__) && defined(__SSE2__)
+#define HAVE_SSE2 1
+#include <immintrin.h>
+#endif
+
+struct scan_ops {
+    const char *(*space)(const char *p, const char *end);
+    const char *(*nonspace)(const char *p, const char *end);
+    const char *(*item)(const char *p, const char *end, const char **item_end);
+    const char *(*name_end)(const char *p, const char *end);
+    const char *(*tag_delim)(const char *p, const char *end);
+};
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static const char *scalar_space(const char *p, const char *end) {
+    while (p < end && !is_space(*p)) p++;
+    return p;
+}
+
+static const char *scalar_nonspace(const char *p, const char *end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+static const char *scalar_item(const char *p, const char *end, const char **item_end) {
+    p = scalar_nonspace(p, end);
+    *item_end = scalar_space(p, end);
+    return p;
+}
+
+static const char *scalar_name_end(const char *p, const char *end) {
+    while (p < end && !is_space(*p) && *p != '>' && *p != '/') p++;
+    return p;
+}
+
+static const char *scalar_tag_delim(const char *p, const char *end) {
+    while (p < end && *p != '>' && *p != '"' && *p != '\'') p++;
+    return p;
+}
+
+static const struct scan_ops scalar_ops = {scalar_space, scalar_nonspace, scalar_item, scalar_name_end,
+                                          scalar_tag_delim};
+
+#ifdef HAVE_SSE2
+
+// Byte masks of one vector, 0xFF where the class matches
+#define EQ128(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+#define SPACE128(v) _mm_or_si128(_mm_or_si128(EQ128(v, ' '), EQ128(v, '\t')), \
+                                 _mm_or_si128(EQ128(v, '\r'), EQ128(v, '\n')))
+#define NAME_END128(v) _mm_or_si128(SPACE128(v), _mm_or_si128(EQ128(v, '>'), EQ128(v, '/')))
+#define TAG_DELIM128(v) _mm_or_si128(EQ128(v, '>'), _mm_or_si128(EQ128(v, '"'), EQ128(v, '\'')))
+
+#define EQ256(v, c) _mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+#define SPACE256(v) _mm256_or_si256(_mm256_or_si256(EQ256(v, ' '), EQ256(v, '\t')), \
+                                    _mm256_or_si256(EQ256(v, '\r'), EQ256(v, '\n')))
+#define NAME_END256(v) _mm256_or_si256(SPACE256(v), _mm256_or_si256(EQ256(v, '>'), EQ256(v, '/')))
+#define TAG_DELIM256(v) _mm256_or_si256(EQ256(v, '>'), _mm256_or_si256(EQ256(v, '"'), EQ256(v, '\'')))
+
+// One scanner per class and width. `flip` inverts the class (nonspace).
+// What is left after the last full vector goes to the next narrower one.
+#define SSE2_SCANNER(name, MASK, flip)                                          \
+    static const char *sse2_##name(const char *p, const char *end) {            \
+        while (end - p >= 16) {                                                 \
+            __m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);      \
+            uint32_t m = ((uint32_t)_mm_movemask_epi8(MASK(v)) ^ (flip)) & 0xFFFFu; \
+            if (m) return p + __builtin_ctz(m);                                 \
+            p += 16;                                                            \
+        }                                                                       \
+        return scalar_##name(p, end);                                           \
+    }
+
+#define AVX2_SCANNER(name, MASK, flip)                                          \
+    __attribute__((target("avx2")))                                             \
+    static const char *avx2_##name(const char *p, const char *end) {            \
+        while (end - p >= 32) {                                                 \
+            __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);   \
+            uint32_t m = (uint32_t)_mm256_movemask_epi8(MASK(v)) ^ (flip);      \
+            if (m) return p + __builtin_ctz(m);                                 \
+            p += 32;                                                            \
+        }                                                                       \
+        return sse2_##name(p, end);                                             \
+    }
+
+// An item usually starts and ends within the vector that holds the
+// whitespace before it, so one mask gives both ends
+#define ITEM_SCANNER(prefix, width, LOAD, MOVEMASK, SPACE)                      \
+    static const char *prefix##_item(const char *p, const char *end, const char **item_end) { \
+        while (end - p >= (width)) {                                            \
+            uint64_t space = (uint32_t)MOVEMASK(SPACE(LOAD(p)));                \
+            uint64_t text = ~space & ((1ull << (width)) - 1);                   \
+            if (!text) {                                                        \
+                p += (width);                                                   \
+                continue;                                                       \
+            }                                                                   \
+            int start = __builtin_ctzll(text);                                  \
+            space &= ~0ull << start;                                            \
+            *item_end = space ? p + __builtin_ctzll(space) : prefix##_space(p + (width), end); \
+            return p + start;                                                   \
+        }                                                                       \
+        return sse2_item_tail(p, end, item_end);                                \
+    }
+
+#define LOAD128(p) _mm_loadu_si128((const __m128i *)(const void *)(p))
+#define LOAD256(p) _mm256_loadu_si256((const __m256i *)(const void *)(p))
+
+SSE2_SCANNER(space, SPACE128, 0u)
+SSE2_SCANNER(nonspace, SPACE128, 0xFFFFFFFFu)
+SSE2_SCANNER(name_end, NAME_END128, 0u)
+SSE2_SCANNER(tag_delim, TAG_DELIM128, 0u)
+
+static const char *sse2_item_tail(const char *p, const char *end, const char **item_end) {
+    p = sse2_nonspace(p, end);
+    *item_end = sse2_space(p, end);
+    return p;
+}
+
+ITEM_SCANNER(sse2, 16, LOAD128, _mm_movemask_epi8, SPACE128)
+
+AVX2_SCANNER(space, SPACE256, 0u)
+AVX2_SCANNER(nonspace, SPACE256, 0xFFFFFFFFu)
+AVX2_SCANNER(name_end, NAME_END256, 0u)
+AVX2_SCANNER(tag_delim, TAG_DELIM256, 0u)
+
+__attribute__((target("avx2")))
+ITEM_SCANNER(avx2, 32, LOAD256, _mm256_movemask_epi8, SPACE256)
+
+static const struct scan_ops sse2_ops = {sse2_space, sse2_nonspace, sse2_item, sse2_name_end, sse2_tag_delim};
+static const struct scan_ops avx2_ops = {avx2_space, avx2_nonspace, avx2_item, avx2_name_end, avx2_tag_delim};
+
+static const struct scan_ops *ops = &sse2_ops;
+static enum wsd_simd level = WSD_SIMD_SSE2;
+
+// Pick the kernels before main(), so threads never see them change
+__attribute__((constructor)) static void scan_init(void) {
+    __builtin_cpu_init();
+    wsd_simd_select(WSD_SIMD_AVX2);
+}
+
+#else
+
+static const struct scan_ops *ops = &scalar_ops;
+static enum wsd_simd level = WSD_SIMD_SCALAR;
+
+#endif
+
+const char *wsd_scan_space(const char *p, const char *end) {
+    return ops->space(p, end);
+}
+
+const char *wsd_scan_nonspace(const char *p, const char *end) {
+    return ops->nonspace(p, end);
+}
+
+const char *wsd_scan_item(const char *p, const char *end, const char **item_end) {
+    return ops->item(p, end, item_end);
+}
+
+const char *wsd_scan_name_end(const char *p, const char *end) {
+    return ops->name_end(p, end);
+}
+
+const char *wsd_scan_tag_delim(const char *p, const char *end) {
+    return ops->tag_delim(p, end);
+}
+
+enum wsd_simd wsd_simd_level(void) {
+    return level;
+}
+
+enum wsd_simd wsd_simd_select(enum wsd_simd want) {
+#ifdef HAVE_SSE2
+    if (want >= WSD_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+        ops = &avx2_ops;
+        level = WSD_SIMD_AVX2;
+    } else if (want >= WSD_SIMD_SSE2) {
+        ops = &sse2_ops;
+        level = WSD_SIMD_SSE2;
+    } else {
+        ops = &scalar_ops;
+        level = WSD_SIMD_SCALAR;
+    }
+#else
+    (void)want;
+#endif
+    return level;
+}
+
+const char *wsd_simd_name(enum wsd_simd l) {
+    switch (l) {
+    case WSD_SIMD_AVX2: return "avx2";
+    case WSD_SIMD_SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
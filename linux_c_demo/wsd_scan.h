@@ -0,0 +1,45 @@
+#ifndef WSD_SCAN_H
+#define WSD_SCAN_H
+
+#include <stddef.h>
+
+// Byte-class scanners for the parser's inner loops: the end of a tag name,
+// the quote or '>' ending a start tag, and the whitespace around list
+// items. Each looks at 16 (SSE2) or 32 (AVX2) bytes per step, with a
+// scalar loop for the tail and for other CPUs or compilers. The widest
+// kernel the CPU supports is picked when the program starts.
+//
+// Every scanner returns the first matching byte in [p, end), or end.
+
+enum wsd_simd {
+    WSD_SIMD_SCALAR = 0,
+    WSD_SIMD_SSE2,
+    WSD_SIMD_AVX2
+};
+
+// First XML whitespace (space, tab, CR, LF)
+const char *wsd_scan_space(const char *p, const char *end);
+
+// First byte that is not XML whitespace
+const char *wsd_scan_nonspace(const char *p, const char *end);
+
+// Next whitespace-separated item: returns its start (end if there is
+// none) and sets *item_end, finding both from the same whitespace masks
+const char *wsd_scan_item(const char *p, const char *end, const char **item_end);
+
+// First whitespace, '>' or '/': the end of a tag name
+const char *wsd_scan_name_end(const char *p, const char *end);
+
+// First '>', '"' or '\'': inside a start tag, the end or an attribute value
+const char *wsd_scan_tag_delim(const char *p, const char *end);
+
+// The kernels in use
+enum wsd_simd wsd_simd_level(void);
+
+// Use the given kernels, or the widest the CPU supports below them (for
+// benchmarks and comparisons). Returns the level now in use.
+enum wsd_simd wsd_simd_select(enum wsd_simd want);
+
+const char *wsd_simd_name(enum wsd_simd level);
+
+#endif
@@ -0,0 +1,152 @@
+#ifdef _WIN32
+#define _CRT_RAND_S                   // rand_s(), before any CRT header
+#endif
+
+#include "wsd_socket.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+
+#include <stdlib.h>
+
+int wsd_socket_startup(void) {
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0 ? 0 : -1;
+}
+
+void wsd_socket_cleanup(void) {
+    WSACleanup();
+}
+
+void wsd_socket_close(wsd_socket_t sock) {
+    closesocket(sock);
+}
+
+int wsd_socket_set_nonblocking(wsd_socket_t sock) {
+    u_long on = 1;
+    return ioctlsocket(sock, FIONBIO, &on) == 0 ? 0 : -1;
+}
+
+int wsd_socket_error(void) {
+    return WSAGetLastError();
+}
+
+int wsd_socket_would_block(void) {
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+int64_t wsd_monotonic_ms(void) {
+    return (int64_t)GetTickCount64();
+}
+
+int wsd_random_bytes(void *buf, size_t len) {
+    unsigned char *p = buf;
+    while (len > 0) {
+        unsigned int r;
+        if (rand_s(&r) != 0) return -1;
+        size_t n = len < sizeof(r) ? len : sizeof(r);
+        memcpy(p, &r, n);
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/select.h>
+
+int wsd_socket_startup(void) {
+    return 0;
+}
+
+void wsd_socket_cleanup(void) {
+}
+
+void wsd_socket_close(wsd_socket_t sock) {
+    close(sock);
+}
+
+int wsd_socket_set_nonblocking(wsd_socket_t sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    return 0;
+}
+
+int wsd_socket_error(void) {
+    return errno;
+}
+
+int wsd_socket_would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+int64_t wsd_monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int wsd_random_bytes(void *buf, size_t len) {
+    unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t n = getrandom(p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+#endif
+
+int wsd_socket_wait_readable(wsd_socket_t sock, int timeout_ms) {
+    fd_set fds;
+    struct timeval tv;
+
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    // The first argument is ignored by Winsock
+    int ret = select((int)sock + 1, &fds, NULL, NULL, &tv);
+    if (ret < 0) {
+#ifndef _WIN32
+        if (errno == EINTR) return 0;
+#endif
+        return -1;
+    }
+    return ret > 0;
+}
+
+wsd_socket_t wsd_socket_open_udp4(const struct in_addr *if_addr) {
+    struct sockaddr_in local_addr;
+    int reuse = 1;
+
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (if_addr) local_addr.sin_addr = *if_addr;
+    local_addr.sin_port = htons(0);
+
+    wsd_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == WSD_INVALID_SOCKET) return WSD_INVALID_SOCKET;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse)) < 0 ||
+        bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0 ||
+        (if_addr && setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (const char *)if_addr, sizeof(*if_addr)) < 0) ||
+        wsd_socket_set_nonblocking(sock) < 0) {
+        wsd_socket_close(sock);
+        return WSD_INVALID_SOCKET;
+    }
+    return sock;
+}
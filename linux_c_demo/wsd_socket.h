@@ -0,0 +1,59 @@
+#ifndef WSD_SOCKET_H
+#define WSD_SOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin socket portability layer: Winsock on Windows, BSD sockets elsewhere.
+// Only what the portable discovery code needs; the Linux tool keeps using
+// epoll, recvmmsg() and friends directly.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+typedef SOCKET wsd_socket_t;
+#define WSD_INVALID_SOCKET INVALID_SOCKET
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef int wsd_socket_t;
+#define WSD_INVALID_SOCKET (-1)
+#endif
+
+// WSAStartup()/WSACleanup() on Windows, nothing elsewhere.
+// Returns 0 on success, -1 on error.
+int wsd_socket_startup(void);
+void wsd_socket_cleanup(void);
+
+void wsd_socket_close(wsd_socket_t sock);
+
+// Returns 0 on success, -1 on error
+int wsd_socket_set_nonblocking(wsd_socket_t sock);
+
+// Open a non-blocking UDP socket on an ephemeral port. With if_addr it is
+// bound to that address, so unicast replies come back on it, and multicast
+// leaves through that interface; NULL binds INADDR_ANY and follows the
+// default route. Returns WSD_INVALID_SOCKET on error.
+wsd_socket_t wsd_socket_open_udp4(const struct in_addr *if_addr);
+
+// Error code of the last failed socket call (errno or WSAGetLastError())
+int wsd_socket_error(void);
+
+// Return 1 if the last failed call would have blocked
+int wsd_socket_would_block(void);
+
+// Wait until sock is readable or timeout_ms passes.
+// Returns 1 if readable, 0 on timeout, -1 on error.
+int wsd_socket_wait_readable(wsd_socket_t sock, int timeout_ms);
+
+// Milliseconds on a monotonic clock
+int64_t wsd_monotonic_ms(void);
+
+// Fill buf from the system CSPRNG (getrandom() or rand_s()).
+// Returns 0 on success, -1 on error.
+int wsd_random_bytes(void *buf, size_t len);
+
+#endif
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include "wsd_sweep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "wsd_probe.h"
+
+#define SWEEP_BATCH 64                // probes per sendmmsg()
+#define ORDINAL_DIGITS 12             // hex digits of the ordinal in the MessageID
+
+int wsd_sweep_add_cidr(struct wsd_sweep *sw, const char *spec) {
+    char addr_str[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    int prefix = 32;
+
+    if (sw->range_count >= WSD_SWEEP_MAX_RANGES) return -1;
+
+    const char *slash = strchr(spec, '/');
+    size_t len = slash ? (size_t)(slash - spec) : strlen(spec);
+    if (len == 0 || len >= sizeof(addr_str)) return -1;
+    memcpy(addr_str, spec, len);
+    addr_str[len] = '\0';
+    if (inet_pton(AF_INET, addr_str, &addr) != 1) return -1;
+
+    if (slash) {
+        char *end;
+        long n = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || end == slash + 1 || n < 0 || n > 32) return -1;
+        prefix = (int)n;
+    }
+
+    uint32_t mask = prefix ? 0xFFFFFFFFu << (32 - prefix) : 0;
+    uint32_t first = ntohl(addr.s_addr) & mask;
+    uint32_t last = first | ~mask;
+    if (prefix < 31) {
+        first++;
+        last--;
+    }
+
+    sw->ranges[sw->range_count].first = first;
+    sw->ranges[sw->range_count].last = last;
+    sw->range_count++;
+    return 0;
+}
+
+int wsd_sweep_start(struct wsd_sweep *sw, double rate, int max_inflight, int retries, int wait_ms,
+                    int64_t now_ms) {
+    char message_id[WSD_MESSAGE_ID_SIZE];
+
+    sw->total = 0;
+    for (int i = 0; i < sw->range_count; i++) {
+        sw->total += (uint64_t)(sw->ranges[i].last - sw->ranges[i].first) + 1;
+    }
+    if (sw->total == 0) return -1;
+
+    sw->next = 0;
+    sw->rate = rate;
+    sw->burst = rate / 50 > 1 ? rate / 50 : 1;  // about 20 ms worth of probes
+    sw->max_inflight = max_inflight;
+    sw->max_attempts = retries + 1;
+    sw->wait_ms = wait_ms;
+    sw->tokens = sw->burst;
+    sw->refilled_at = now_ms;
+    sw->inflight = 0;
+    sw->sent = sw->retried = sw->replies = sw->given_up = 0;
+
+    sw->queue_cap = (size_t)max_inflight * 2;
+    sw->queue_head = 0;
+    sw->queue_len = 0;
+    sw->queue = malloc(sw->queue_cap * sizeof(*sw->queue));
+    sw->closed = calloc((size_t)(sw->total + 7) / 8, 1);
+    if (!sw->queue || !sw->closed) {
+        wsd_sweep_free(sw);
+        return -1;
+    }
+
+    // All probes share one random MessageID prefix, the ordinal goes last
+    if (wsd_generate_uuid(message_id, sizeof(message_id)) < 0) {
+        wsd_sweep_free(sw);
+        return -1;
+    }
+    char *dash = strrchr(message_id, '-');
+    sw->id_prefix_len = (size_t)(dash + 1 - message_id);
+    memcpy(sw->id_prefix, message_id, sw->id_prefix_len);
+    sw->id_prefix[sw->id_prefix_len] = '\0';
+    snprintf(message_id, sizeof(message_id), "%s%0*d", sw->id_prefix, ORDINAL_DIGITS, 0);
+
+    sw->probe_len = wsd_build_probe(sw->probe, sizeof(sw->probe), message_id, sw->filter);
+    char *id = strstr(sw->probe, message_id);
+    if (sw->probe_len == 0 || !id) {
+        wsd_sweep_free(sw);
+        return -1;
+    }
+    sw->ordinal_offset = (size_t)(id - sw->probe) + sw->id_prefix_len;
+    return 0;
+}
+
+void wsd_sweep_free(struct wsd_sweep *sw) {
+    free(sw->queue);
+    free(sw->closed);
+    sw->queue = NULL;
+    sw->closed = NULL;
+}
+
+static int is_closed(const struct wsd_sweep *sw, uint64_t ordinal) {
+    return (sw->closed[ordinal / 8] >> (ordinal % 8)) & 1;
+}
+
+static void set_closed(struct wsd_sweep *sw, uint64_t ordinal) {
+    sw->closed[ordinal / 8] |= (uint8_t)(1u << (ordinal % 8));
+}
+
+static uint32_t target_addr(const struct wsd_sweep *sw, uint64_t ordinal) {
+    for (int i = 0; i < sw->range_count; i++) {
+        uint64_t size = (uint64_t)(sw->ranges[i].last - sw->ranges[i].first) + 1;
+        if (ordinal < size) return sw->ranges[i].first + (uint32_t)ordinal;
+        ordinal -= size;
+    }
+    return 0;
+}
+
+static int queue_push(struct wsd_sweep *sw, uint64_t ordinal, int64_t deadline, int attempt) {
+    if (sw->queue_len == sw->queue_cap) {
+        size_t cap = sw->queue_cap * 2;
+        struct wsd_sweep_pending *q = malloc(cap * sizeof(*q));
+        if (!q) return -1;
+        for (size_t i = 0; i < sw->queue_len; i++) q[i] = sw->queue[(sw->queue_head + i) % sw->queue_cap];
+        free(sw->queue);
+        sw->queue = q;
+        sw->queue_cap = cap;
+        sw->queue_head = 0;
+    }
+    struct wsd_sweep_pending *p = &sw->queue[(sw->queue_head + sw->queue_len) % sw->queue_cap];
+    p->ordinal = ordinal;
+    p->deadline = deadline;
+    p->attempt = attempt;
+    sw->queue_len++;
+    return 0;
+}
+
+static void queue_pop(struct wsd_sweep *sw) {
+    sw->queue_head = (sw->queue_head + 1) % sw->queue_cap;
+    sw->queue_len--;
+}
+
+static void refill(struct wsd_sweep *sw, int64_t now_ms) {
+    if (now_ms <= sw->refilled_at) return;
+    sw->tokens += (double)(now_ms - sw->refilled_at) * sw->rate / 1000.0;
+    if (sw->tokens > sw->burst) sw->tokens = sw->burst;
+    sw->refilled_at = now_ms;
+}
+
+// One sendmmsg() batch: template head, ordinal digits, template tail
+struct sweep_batch {
+    struct mmsghdr msgs[SWEEP_BATCH];
+    struct iovec iov[SWEEP_BATCH][3];
+    struct sockaddr_in dst[SWEEP_BATCH];
+    char digits[SWEEP_BATCH][ORDINAL_DIGITS + 1];
+    int count;
+};
+
+static void batch_add(struct wsd_sweep *sw, struct sweep_batch *b, uint64_t ordinal) {
+    int i = b->count++;
+
+    snprintf(b->digits[i], sizeof(b->digits[i]), "%0*llx", ORDINAL_DIGITS, (unsigned long long)ordinal);
+    b->iov[i][0].iov_base = sw->probe;
+    b->iov[i][0].iov_len = sw->ordinal_offset;
+    b->iov[i][1].iov_base = b->digits[i];
+    b->iov[i][1].iov_len = ORDINAL_DIGITS;
+    b->iov[i][2].iov_base = sw->probe + sw->ordinal_offset + ORDINAL_DIGITS;
+    b->iov[i][2].iov_len = sw->probe_len - sw->ordinal_offset - ORDINAL_DIGITS;
+
+    memset(&b->dst[i], 0, sizeof(b->dst[i]));
+    b->dst[i].sin_family = AF_INET;
+    b->dst[i].sin_addr.s_addr = htonl(target_addr(sw, ordinal));
+    b->dst[i].sin_port = htons(3702);
+
+    memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+    b->msgs[i].msg_hdr.msg_name = &b->dst[i];
+    b->msgs[i].msg_hdr.msg_namelen = sizeof(b->dst[i]);
+    b->msgs[i].msg_hdr.msg_iov = b->iov[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 3;
+}
+
+static void batch_send(struct wsd_sweep *sw, struct sweep_batch *b, int sock) {
+    int done = 0;
+
+    while (done < b->count) {
+        int n = sendmmsg(sock, b->msgs + done, (unsigned int)(b->count - done), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Unreachable hosts or a full send queue: the retry logic covers it
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("sendmmsg");
+            done++;
+            continue;
+        }
+        done += n;
+        sw->sent += (uint64_t)n;
+    }
+    b->count = 0;
+}
+
+int64_t wsd_sweep_tick(struct wsd_sweep *sw, int sock, int64_t now_ms) {
+    struct sweep_batch b;
+    int waiting_for_tokens = 0;
+
+    b.count = 0;
+    refill(sw, now_ms);
+
+    for (;;) {
+        // Expired probes first: retry them or give up
+        while (sw->queue_len && b.count < SWEEP_BATCH) {
+            struct wsd_sweep_pending p = sw->queue[sw->queue_head];
+            if (p.deadline > now_ms) break;
+            if (is_closed(sw, p.ordinal)) {
+                queue_pop(sw);
+                continue;
+            }
+            if (p.attempt >= sw->max_attempts) {
+                queue_pop(sw);
+                set_closed(sw, p.ordinal);
+                sw->inflight--;
+                sw->given_up++;
+                continue;
+            }
+            if (sw->tokens < 1) {
+                waiting_for_tokens = 1;
+                break;
+            }
+            queue_pop(sw);
+            if (queue_push(sw, p.ordinal, now_ms + sw->wait_ms, p.attempt + 1) < 0) {
+                set_closed(sw, p.ordinal);
+                sw->inflight--;
+                sw->given_up++;
+                continue;
+            }
+            sw->tokens -= 1;
+            sw->retried++;
+            batch_add(sw, &b, p.ordinal);
+        }
+
+        // Then new targets, within the in-flight limit
+        while (sw->next < sw->total && sw->inflight < sw->max_inflight && b.count < SWEEP_BATCH) {
+            if (sw->tokens < 1) {
+                waiting_for_tokens = 1;
+                break;
+            }
+            if (queue_push(sw, sw->next, now_ms + sw->wait_ms, 1) < 0) break;
+            sw->tokens -= 1;
+            sw->inflight++;
+            batch_add(sw, &b, sw->next);
+            sw->next++;
+        }
+
+        if (b.count < SWEEP_BATCH) break;
+        batch_send(sw, &b, sock);
+    }
+    if (b.count) batch_send(sw, &b, sock);
+
+    if (sw->next >= sw->total && sw->inflight == 0) return -1;
+
+    // Wake up for the next deadline, or when the next token is available
+    int64_t wake = INT64_MAX;
+    if (sw->queue_len) wake = sw->queue[sw->queue_head].deadline;
+    if (waiting_for_tokens || (sw->next < sw->total && sw->inflight < sw->max_inflight)) {
+        int64_t token_ms = now_ms + 1 + (int64_t)((1 - sw->tokens) * 1000.0 / sw->rate);
+        if (token_ms < wake) wake = token_ms;
+    }
+    return wake;
+}
+
+// Ordinal of the target a RelatesTo points to, or -1 if it is not ours
+static int64_t parse_ordinal(const struct wsd_sweep *sw, struct wsd_view relates_to) {
+    uint64_t ordinal = 0;
+
+    if (relates_to.len != sw->id_prefix_len + ORDINAL_DIGITS) return -1;
+    if (memcmp(relates_to.ptr, sw->id_prefix, sw->id_prefix_len) != 0) return -1;
+
+    for (size_t i = sw->id_prefix_len; i < relates_to.len; i++) {
+        char c = relates_to.ptr[i];
+        int v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return -1;
+        ordinal = ordinal * 16 + (uint64_t)v;
+    }
+    return ordinal < sw->next ? (int64_t)ordinal : -1;
+}
+
+int wsd_sweep_owns(const struct wsd_sweep *sw, struct wsd_view relates_to) {
+    return parse_ordinal(sw, relates_to) >= 0;
+}
+
+int64_t wsd_sweep_on_reply(struct wsd_sweep *sw, struct wsd_view relates_to) {
+    int64_t found = parse_ordinal(sw, relates_to);
+    if (found < 0) return -1;
+
+    uint64_t ordinal = (uint64_t)found;
+    if (is_closed(sw, ordinal)) return -1;
+
+    set_closed(sw, ordinal);
+    sw->replies++;
+    sw->inflight--;
+    return (int64_t)ordinal;
+}
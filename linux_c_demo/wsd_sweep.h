@@ -0,0 +1,97 @@
+#ifndef WSD_SWEEP_H
+#define WSD_SWEEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wsd_filter.h"
+#include "wsd_parser.h"
+
+// Unicast directed-probe sweep over IPv4 ranges.
+// Multicast does not cross routers, so every host of the given CIDR ranges
+// gets its own Probe on UDP 3702. Sending is paced by a token bucket and
+// bounded by a maximum number of targets awaiting a reply; unanswered
+// targets are retried. Each target gets a distinct MessageID whose last
+// 48 bits are its ordinal, so a reply's RelatesTo maps straight back to
+// the target without any lookup structure.
+
+#define WSD_SWEEP_MAX_RANGES 64
+
+struct wsd_sweep_range {
+    uint32_t first;                   // host byte order, inclusive
+    uint32_t last;
+};
+
+// A probe waiting for a reply, queued in deadline order
+struct wsd_sweep_pending {
+    uint64_t ordinal;
+    int64_t deadline;
+    int attempt;
+};
+
+struct wsd_sweep {
+    struct wsd_sweep_range ranges[WSD_SWEEP_MAX_RANGES];
+    int range_count;
+    uint64_t total;                   // number of target hosts
+    uint64_t next;                    // next ordinal never probed
+
+    // Settings
+    double rate;                      // probes per second
+    double burst;                     // token bucket depth
+    int max_inflight;
+    int max_attempts;                 // 1 + retries
+    int wait_ms;                      // reply wait per attempt
+
+    // Token bucket
+    double tokens;
+    int64_t refilled_at;
+
+    // Pending probes: FIFO ring, deadlines are increasing
+    struct wsd_sweep_pending *queue;
+    size_t queue_cap;
+    size_t queue_head;
+    size_t queue_len;
+    int inflight;                     // pending and not closed yet
+
+    uint8_t *closed;                  // bitmap: answered or given up
+    char id_prefix[48];               // MessageID up to the ordinal
+    size_t id_prefix_len;
+
+    // Probe template; each send patches the ordinal in through its own iovec
+    const struct wsd_filter *filter;  // Types/Scopes to ask for, NULL for the default
+    char probe[4096];
+    size_t probe_len;
+    size_t ordinal_offset;
+
+    // Statistics
+    uint64_t sent;
+    uint64_t retried;
+    uint64_t replies;
+    uint64_t given_up;
+};
+
+// Parse "a.b.c.d/len" or a single address and append it to the sweep.
+// Network and broadcast addresses are skipped for prefixes shorter than /31.
+// Returns 0 on success, -1 if the spec is invalid or there are too many.
+int wsd_sweep_add_cidr(struct wsd_sweep *sw, const char *spec);
+
+// Prepare a sweep over the ranges added so far.
+// Returns 0 on success, -1 on allocation failure or an empty range list.
+int wsd_sweep_start(struct wsd_sweep *sw, double rate, int max_inflight, int retries, int wait_ms,
+                    int64_t now_ms);
+void wsd_sweep_free(struct wsd_sweep *sw);
+
+// Send what the pacer and the in-flight limit allow, retry or give up on
+// expired probes. Returns the monotonic time at which it wants to run
+// again, or -1 when the sweep is complete.
+int64_t wsd_sweep_tick(struct wsd_sweep *sw, int sock, int64_t now_ms);
+
+// Return 1 if relates_to is the MessageID of a Probe this sweep sent.
+// Unlike wsd_sweep_on_reply() it changes nothing.
+int wsd_sweep_owns(const struct wsd_sweep *sw, struct wsd_view relates_to);
+
+// Account for a ProbeMatches with the given RelatesTo.
+// Returns the target ordinal, or -1 if the reply is not ours or a repeat.
+int64_t wsd_sweep_on_reply(struct wsd_sweep *sw, struct wsd_view relates_to);
+
+#endif